@@ -0,0 +1,60 @@
+/*
+	A simple bump-pointer arena. Memory is carved out of large
+	blocks, and nothing is freed until the whole arena is released.
+
+	@author Noor Aftab
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+//Every allocation is rounded up so pointers/ints inside stay aligned
+#define ARENA_ALIGN (sizeof(void *))
+
+static ArenaBlock *new_arena_block(size_t size);
+
+void init_arena(Arena *arena) {
+	arena->head = NULL;
+}
+
+//Hands out size bytes from the current block, starting a new block if full
+void *arena_alloc(Arena *arena, size_t size) {
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if (arena->head == NULL || arena->head->used + size > arena->head->size) {
+		size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+		ArenaBlock *block = new_arena_block(blockSize);
+		block->next = arena->head;
+		arena->head = block;
+	}
+
+	void *mem = arena->head->data + arena->head->used;
+	arena->head->used += size;
+	return mem;
+}
+
+char *arena_strdup(Arena *arena, const char *str) {
+	size_t len = strlen(str) + 1;
+	char *copy = arena_alloc(arena, len);
+	memcpy(copy, str, len);
+	return copy;
+}
+
+void release_arena(Arena *arena) {
+	ArenaBlock *block = arena->head;
+	while (block != NULL) {
+		ArenaBlock *next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->head = NULL;
+}
+
+static ArenaBlock *new_arena_block(size_t size) {
+	ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+	block->next = NULL;
+	block->used = 0;
+	block->size = size;
+	return block;
+}
@@ -0,0 +1,150 @@
+/*
+	Writes instructions out as MIPS assembly. Each line looks like
+
+		command op1, op2, op3
+
+	(with a space after the command even when there are no operands,
+	since that's what the output has always looked like).
+
+	@author Noor Aftab
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "asmwriter.h"
+#include "traversaltotable.h"
+
+//Longest thing put down in one go that isn't a string: "-2147483648($zero)"
+#define MAX_NUM_LEN 11
+#define MAX_MEM_LEN (MAX_NUM_LEN + 2 + MAX_REG_NAME_LEN)
+
+typedef struct {
+	FILE *out;
+	char *buf;
+	size_t used;
+	size_t totalWritten;
+} AsmWriter;
+
+static void flush_writer(AsmWriter *w) {
+	if (w->used > 0) {
+		fwrite(w->buf, 1, w->used, w->out);
+		w->totalWritten += w->used;
+		w->used = 0;
+	}
+}
+
+//Makes sure at least len bytes are free at the end of the buffer
+static inline void reserve(AsmWriter *w, size_t len) {
+	if (w->used + len > ASM_BUFFER_SIZE) {
+		flush_writer(w);
+	}
+}
+
+static void put_str(AsmWriter *w, const char *str) {
+	size_t len = strlen(str);
+
+	//Too big to ever fit: skip the buffer entirely
+	if (len > ASM_BUFFER_SIZE) {
+		flush_writer(w);
+		fwrite(str, 1, len, w->out);
+		w->totalWritten += len;
+		return;
+	}
+
+	reserve(w, len);
+	memcpy(w->buf + w->used, str, len);
+	w->used += len;
+}
+
+//Caller must have reserved MAX_NUM_LEN bytes
+static inline void put_int(AsmWriter *w, int num) {
+	char digits[MAX_NUM_LEN];
+	int numDigits = 0;
+	//Work with unsigned so negating INT_MIN is fine
+	unsigned int mag = num < 0 ? 0u - (unsigned int)num : (unsigned int)num;
+
+	do {
+		digits[numDigits++] = '0' + mag % 10;
+		mag /= 10;
+	} while (mag != 0);
+
+	char *p = w->buf + w->used;
+	if (num < 0) {
+		*p++ = '-';
+	}
+	while (numDigits > 0) {
+		*p++ = digits[--numDigits];
+	}
+	w->used = p - w->buf;
+}
+
+//Caller must have reserved MAX_REG_NAME_LEN bytes
+static inline void put_reg(AsmWriter *w, int reg) {
+	const char *name = getRegStr(reg);
+	size_t len = strlen(name);
+	memcpy(w->buf + w->used, name, len);
+	w->used += len;
+}
+
+static void put_operand(AsmWriter *w, Operand *opnd) {
+	switch (opnd->kind) {
+		case OPND_REG:
+			reserve(w, MAX_REG_NAME_LEN);
+			put_reg(w, opnd->reg);
+			break;
+		case OPND_IMM:
+			reserve(w, MAX_NUM_LEN);
+			put_int(w, opnd->val.immed);
+			break;
+		case OPND_MEM:
+			reserve(w, MAX_MEM_LEN);
+			put_int(w, opnd->val.immed);
+			w->buf[w->used++] = '(';
+			put_reg(w, opnd->reg);
+			w->buf[w->used++] = ')';
+			break;
+		case OPND_SYM:
+			put_str(w, opnd->val.sym);
+			break;
+		case OPND_NONE:
+			break;
+	}
+}
+
+static void put_separator(AsmWriter *w) {
+	reserve(w, 2);
+	w->buf[w->used++] = ',';
+	w->buf[w->used++] = ' ';
+}
+
+size_t write_instructions(FILE *out, Instruction *instrs, int num) {
+	AsmWriter w = { out, malloc(ASM_BUFFER_SIZE), 0, 0 };
+
+	for (int i=0; i < num; i++) {
+		Instruction *instr = &instrs[i];
+
+		if (instr->command != NULL) {
+			put_str(&w, instr->command);
+			reserve(&w, 1);
+			w.buf[w.used++] = ' ';
+		}
+
+		put_operand(&w, &instr->op1);
+		if (instr->op2.kind != OPND_NONE) {
+			put_separator(&w);
+			put_operand(&w, &instr->op2);
+		}
+		if (instr->op3.kind != OPND_NONE) {
+			put_separator(&w);
+			put_operand(&w, &instr->op3);
+		}
+
+		reserve(&w, 1);
+		w.buf[w.used++] = '\n';
+	}
+
+	flush_writer(&w);
+	free(w.buf);
+	return w.totalWritten;
+}
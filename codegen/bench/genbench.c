@@ -0,0 +1,59 @@
+/*
+	Generates a big C-- program for benchmarking mycc. Every function
+	is a long run of straight-line arithmetic and conditionals, so the
+	program turns into millions of MIPS instructions without needing 
+	any huge blocks (which the parser is slow with).
+
+	usage: genbench [numFunctions] [statementsPerFunction] > big.c--
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char *argv[]) {
+	int numFunctions = argc > 1 ? atoi(argv[1]) : 400;
+	int numStatements = argc > 2 ? atoi(argv[2]) : 500;
+
+	printf("int g;\nint garr[16];\n\n");
+
+	for (int f=0; f < numFunctions; f++) {
+		printf("int f%d(int a, int b, int arr[]) {\n", f);
+		printf("\tint x;\n\tint y;\n\tchar c;\n");
+		printf("\tx = a;\n\ty = b;\n\tc = 'c';\n");
+
+		//Cycle through a handful of statement shapes
+		for (int s=0; s < numStatements; s++) {
+			switch (s%6) {
+				case 0:
+					printf("\tx = x + y * 3 - a;\n");
+					break;
+				case 1:
+					printf("\ty = (x - y) / 2 + b;\n");
+					break;
+				case 2:
+					printf("\tif (x < y) x = x + 1; else y = y - 1;\n");
+					break;
+				case 3:
+					printf("\tarr[%d] = x + arr[%d];\n", s%16, (s+1)%16);
+					break;
+				case 4:
+					printf("\tg = x + c * 2 - (x == y);\n");
+					break;
+				case 5:
+					printf("\tc = c + 1;\n");
+					break;
+			}
+		}
+		printf("\treturn x + y;\n}\n\n");
+	}
+
+	printf("int main() {\n\tint i;\n\ti = 0;\n\tg = 0;\n");
+	printf("\twhile (i < 16) {\n\t\tgarr[i] = i;\n\t\ti = i + 1;\n\t}\n");
+	for (int f=0; f < numFunctions; f++) {
+		printf("\tg = f%d(g, %d, garr);\n", f, f);
+	}
+	printf("\twrite g;\n\twriteln;\n}\n");
+	return 0;
+}
@@ -0,0 +1,87 @@
+/*
+	callconv: lets calls between the program's own functions use
+	more than the fixed protocol tells them. Everything in C-- but
+	main is only ever called from inside the program, so whatever a
+	callee really does is known when its callers are lowered:
+	- the functions are put in an order where (outside of recursion)
+	  every function comes after the ones it calls, so they're
+	  lowered first, and irtotable.c knows exactly which $t registers
+	  each one (or anything it calls) writes. A call then only saves
+	  the live ones it clobbers, rather than every live one. A call
+	  into a cycle that's still being lowered saves them all
+	- regalloc.c takes array params as candidates too, so the address
+	  passed in stays in an $s register instead of being stored to
+	  the frame in the prologue and loaded back at every use
+
+	Args still arrive in $a0-$a3 and results in $v0: params are
+	copied out of the $a registers first thing anyway.
+
+	This pass only reorders prog->functions (which is also the
+	order they're written out in).
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "passmanager.h"
+
+//Where the next function goes, in the new order
+static IrFunction **order;
+static int numOrdered;
+
+//For -stats
+static int numRecursive; //Calls to a function that isn't lowered by then
+
+static void visit(IrFunction *f);
+
+void choose_calling_conventions(IrProgram *prog) {
+	numRecursive = 0;
+	int numFunctions = 0;
+	for (IrFunction *f = prog->functions; f != NULL; f = f->next) {
+		f->mark = 0;
+		numFunctions++;
+	}
+	if (numFunctions == 0) {
+		return;
+	}
+
+	order = malloc(numFunctions * sizeof(IrFunction *));
+	numOrdered = 0;
+	for (IrFunction *f = prog->functions; f != NULL; f = f->next) {
+		visit(f);
+	}
+
+	prog->functions = order[0];
+	for (int i=0; i < numFunctions; i++) {
+		order[i]->mark = 0;
+		order[i]->next = i+1 < numFunctions ? order[i+1] : NULL;
+	}
+	prog->lastFunction = order[numFunctions-1];
+	free(order);
+
+	if (printStats) {
+		fprintf(stderr, "callconv: %d functions ordered callees first, %d calls into "
+			"recursion save every live register\n", numFunctions, numRecursive);
+	}
+}
+
+//Depth first down the call graph: a function goes in once everything it calls has (mark 1: on the way)
+static void visit(IrFunction *f) {
+	if (f->mark) {
+		return;
+	}
+	f->mark = 1;
+	for (IrBlock *block = f->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			if (instr->op != IR_CALL) {
+				continue;
+			}
+			numRecursive += instr->callee->mark == 1;
+			visit(instr->callee);
+		}
+	}
+	f->mark = 2;
+	order[numOrdered++] = f;
+}
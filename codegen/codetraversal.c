@@ -1,6 +1,8 @@
 /*
-	This file traverses a C-- AST and tells the Code Table
-	what MIPS code to spit out in the .s file
+	This file traverses a C-- AST and builds the IR for it (see
+	ir.h): one IrFunction per function, whose statements are
+	broken up into basic blocks. The passes in passmanager.c then
+	get a go at it before irtotable.c turns it into MIPS.
 
 	@author Noor Aftab :)
 	@date Tuesday, 5th May 2020
@@ -14,33 +16,35 @@
 #include "traversaltotable.h"
 #include "traversalmechanics.h"
 
-//Stack of offsets within a function (for nested blocks)
-OffsetStack *offsetStack;
+//The IR being built (and everything in it)
+IrProgram *irProgram = NULL;
+//Function we're in, and the block statements are currently added to
+IrFunction *currFunc = NULL;
+IrBlock *currBlock = NULL;
 
-//If encountered a break while traversing
-int breakOccured = 0;
-//If encounted a return while traversing
-int returnOccured = 0;
+//Block a 'break;' jumps to (NULL outside of while loops)
+IrBlock *breakTarget = NULL;
 
-/*
-	Offset within a function. I realized quite late that I 
-	basically treat funcOffset the same as stackCurrOffset, so
-	it's actually a little pointless. Given more time, 
-*/
-int funcOffset = 0;
 //A measure of how mnay globals we have
 int globalOffset = 0;
 int currScope = 0;
-
-//Tracks $sp throughout program
-int stackCurrOffset = 0;
-
-//Kickstarts code generation
-void traverse_and_generate_code() {
-	//Print .s file beginning, 
-	setup_mips_code();
+//Id of the block we're declaring locals in (see IrVar.scope)
+int currBlockScope = 0;
+
+static IrOperand handle_binary_op(ast_node *opNode, IrOpcode op);
+static void handle_operands(ast_node *opNode, IrOperand *left, IrOperand *right);
+static void branch_on_condition(ast_node *condNode, IrBlock *ifTrue, IrBlock *ifFalse);
+static IrOperand handle_short_circuit(ast_node *opNode, IrOpcode op);
+static int can_always_evaluate(ast_node *exprNode);
+static int register_need(ast_node *exprNode);
+static void start_unreachable_block();
+
+//Kickstarts IR generation
+IrProgram *traverse_and_generate_ir() {
+	irProgram = create_ir_program();
 	//Start traversing AST!
 	handle_program(ast_tree.root);
+	return irProgram;
 }
 
 /*
@@ -50,11 +54,10 @@ void traverse_and_generate_code() {
 	@param program: AST root
 */
 void handle_program(ast_node *program) {
- 	init_offset_stack();
 	int i = 0;
 
 	//Go through global variables
-	while (i < program->num_children && 
+	while (i < program->num_children &&
 		program->childlist[i]->symbol->grammar_symbol == VAR_DECL) {
 		handle_variable_declaration(program->childlist[i]);
 		i++;
@@ -65,50 +68,43 @@ void handle_program(ast_node *program) {
 		handle_function(program->childlist[i]);
 		i++;
 	}
-
-	destroy_offset_stack();
 }
 
 
 void handle_variable_declaration(ast_node *varDecl) {
-	//Initialize values in its symbol table entry 
-	int type = varDecl->childlist[0]->symbol->token; 
+	//Initialize values in its symbol table entry
+	int type = varDecl->childlist[0]->symbol->token;
 	char *name = varDecl->childlist[1]->symbol->lexeme;
 	int dimension = -1; //Assume non-array
 	int isInit = 0;
-	int offset; //From $gp or $fp (for arrays - it's actually size!)
+	int offset = 0; //From $gp for globals (locals get theirs when lowering)
+	IrVar *var;
 
 	//Meaning, its an array
-	if (varDecl->num_children > 2) { 
+	if (varDecl->num_children > 2) {
 		dimension = varDecl->childlist[3]->symbol->value;
 		//Treat it as already initialized - let user be in charge
-		isInit = 1; 
+		isInit = 1;
 	}
-	int arrayOffset = 0;
-	
+
 	//Global
-	if (currScope == 0) { 
+	if (currScope == 0) {
 		offset = handle_global_allocation(type, dimension);
 
 		if (dimension != -1) { //Array
 			globalOffset += offset;
 			//$gp grows towards bottom, so this is how we get offset from $gp
-			offset = globalOffset - offset; 
+			offset = globalOffset - offset;
 		}
-
+		var = ir_add_global(irProgram, name, type, dimension, offset);
 	} else {
-		//Allocates in terms of calculated offsets
-		offset = handle_local_allocation(type, dimension);
-		if (dimension != -1) {
-			arrayOffset = offset;
-			funcOffset -= arrayOffset;
-			//Top of array is at top of stack. since $sp grows negatively
-			offset = funcOffset; 
-		}
-		//Actually make space in the stack. changeInOffset only needed for arrays
-		allocate_space_for_locals(type, dimension, arrayOffset);
+		var = ir_add_local(currFunc, name, type, dimension);
+		var->scope = currBlockScope;
 	}
-	insert_var_symtab_entry(name, currScope, type, dimension, offset, isInit);
+
+	SymTabEntry *entry = insert_var_symtab_entry(name, currScope, type, dimension,
+		offset, isInit);
+	entry->var = var;
 }
 
 
@@ -120,17 +116,20 @@ void handle_parameter(ast_node *paramDecl, int numParam) {
 	int isInit = 1; //Parameter, so assume already initialized
 
 	//Case of an array!
-	if (paramDecl->num_children > 2) { 
-		/* 
-			Don't need an actual size, but set to 0 to 
+	if (paramDecl->num_children > 2) {
+		/*
+			Don't need an actual size, but set to 0 to
 			signal its an array and make space for a pointer.
 		*/
-		dimension = 0; 
+		dimension = 0;
+	}
+
+	if (numParam >= IR_MAX_ARGS) {
+		codegen_error("Compiler only supports 4 or fewer arguments/parameters", inFile, outFile);
 	}
 
-	int offset = handle_param_allocation(type, dimension);
-	allocate_space_for_params(type, getParamRegister(numParam), offset, dimension); 
-	insert_var_symtab_entry(name, currScope, type, dimension, offset, isInit);
+	SymTabEntry *entry = insert_var_symtab_entry(name, currScope, type, dimension, 0, isInit);
+	entry->var = ir_add_param(currFunc, name, type, dimension);
 }
 
 /*
@@ -140,45 +139,39 @@ void handle_parameter(ast_node *paramDecl, int numParam) {
 	@param funcDecl: FUNC_DECL tree node
 */
 void handle_function(ast_node *funcDecl) {
-	freeAllTempRegisters();
-	freeAllLocalRegisters();
-
 	//Get function name
 	char *funcName = funcDecl->childlist[1]->symbol->lexeme;
+	int returnType = funcDecl->childlist[0]->symbol->token;
 	//Create entry for function in ST - 1st param is name, 2nd is type
-	SymTabEntry *funcEntry = insert_func_symtab_entry(funcName, 
-		funcDecl->childlist[0]->symbol->token);
-	generate_function_label(funcName); //Make a label
+	SymTabEntry *funcEntry = insert_func_symtab_entry(funcName, returnType);
+	currFunc = ir_add_function(irProgram, funcName, returnType);
+	funcEntry->func = currFunc;
 
-	push_scope(); //Also updates funcOffset
+	push_scope();
 
 	/** Parameters handling **/
 	int i;
-	for (i=2; i < funcDecl->num_children && 
+	for (i=2; i < funcDecl->num_children &&
 		funcDecl->childlist[i]->symbol->grammar_symbol == PDL; i++) {
 		handle_parameter(funcDecl->childlist[i], i-2);
 	}
-	pad_params();
-
-	//Some error-checking here
-	if ((i-2) <= 4) {
-		funcEntry->numParams = i-2; //i-2 is the number of parameters
-	} else {
-		codegen_error("Compiler only supports 4 or fewer arguments/parameters", inFile, outFile);
-	}
+	funcEntry->numParams = i-2; //i-2 is the number of parameters
 
 	/** Body handling **/
-	generate_function_prologue();
+	currBlock = ir_new_block(currFunc);
 	handle_block(funcDecl->childlist[i]); //Traverse block of code
-	generate_function_epilogue();
+
+	//Falling off the end returns (with whatever's in $v0, like always)
+	ir_emit_ret(currBlock, ir_none());
+	ir_rebuild_cfg(currFunc);
 
 	pop_scope();
-	freeAllTempRegisters();
-	freeAllLocalRegisters();
+	currFunc = NULL;
+	currBlock = NULL;
 }
 
 /*
-	Traverses block of code. Direct children could be 
+	Traverses block of code. Direct children could be
 	VAR_DECL (if any), followed by a bunch of statements
 
 	@param block: BLOCK tree node
@@ -186,35 +179,32 @@ void handle_function(ast_node *funcDecl) {
 void handle_block(ast_node *block) {
 	int i = 0;
 	push_scope();
-	push_offset();
+	int outerBlockScope = currBlockScope;
+	currBlockScope = ++currFunc->numScopes;
 
-	while (i < block->num_children && 
+	while (i < block->num_children &&
 	 	block->childlist[i]->symbol->grammar_symbol == VAR_DECL) {
 		handle_variable_declaration(block->childlist[i]);
 		i++;
 	}
-	pad_locals(); //Ensure 4-byte alignment
 
-	/*
-		Statements! If a break occurs, we want to exit the body
-		traversal since there's no point. 
-	*/
-	while (i < block->num_children && breakOccured == 0) {
+	//Statements!
+	while (i < block->num_children) {
 		handle_stmt(block->childlist[i]);
 		i++;
-	} 
-
-	funcOffset = pop_offset();
-	pop_scope();
-	
-	if (breakOccured==1) {
-		add_break_instr();
-		breakOccured = 0;
 	}
 
+	//This block's locals are dead once it's over, so later blocks can reuse their slots
+	for (IrVar *var = currFunc->locals; var != NULL; var = var->next) {
+		if (var->scope == currBlockScope) {
+			var->scopeEnd = currFunc->numScopes;
+		}
+	}
+	currBlockScope = outerBlockScope;
+	pop_scope();
 }
 
-//Checks through different code statements 
+//Checks through different code statements
 void handle_stmt(ast_node *stmt) {
 	switch (stmt->symbol->token) {
 		case RETURN:
@@ -228,7 +218,7 @@ void handle_stmt(ast_node *stmt) {
 			break;
 		case WRITELN:
 			handle_writeln();
-			break;	
+			break;
 		case BREAK:
 			handle_break();
 			break;
@@ -242,121 +232,172 @@ void handle_stmt(ast_node *stmt) {
 			handle_block(stmt);
 			break;
 		//Otherwise, be optimistic and assume we're looking at expression
-		default: 
+		default:
 			handle_expr(stmt);
 	}
 }
 
+/*
+	Anything after a return/break can't be reached, but it still
+	has to go somewhere - simplifycfg gets rid of it later.
+*/
+static void start_unreachable_block() {
+	currBlock = ir_new_block(currFunc);
+}
+
 //return Expr;
 void handle_return(ast_node *returnNode) {
-	int finalReg = handle_expr(returnNode->childlist[0]);
-
-	//Put return value in V0
-	move_registers(V0, finalReg);
-	freeTempRegister(finalReg);
-
-	/*
-		Since pop_offset changes stackCurroffset, restore it and 
-		push offset back in.
-		This is good to do since we won't necessarily always 
-		return when we see a return e.g. in conditionals
-	*/
-	int startOfBlockOffset = offsetStack->stack[0];
-	add_immed_instr(SP, SP, stackCurrOffset+startOfBlockOffset);
-
-	execute_return();
-	returnOccured = 1; //Signal that we came across a return
-
+	IrOperand result = handle_expr(returnNode->childlist[0]);
+	ir_emit_ret(currBlock, result);
+	start_unreachable_block();
 }
 
 //read id;
 void handle_read(ast_node *readNode) {
-	//Finds the id we're using 
+	//Finds the id we're using
 	SymTabEntry *idInfo = symtab_lookup(readNode->childlist[0]->symbol->lexeme);
-	tempRegister placeHolder = findAvailableTempRegister();
-	add_read_instr(placeHolder);
-
-	//Assign the value in placeholder to the id
-	if (idInfo->scope == 0) {
-		assign_global(placeHolder, idInfo->type, idInfo->offset);
-	} else {
-		assign_local(placeHolder, idInfo->type, idInfo->offset);
+	if (idInfo->isFunction == 1 || idInfo->dimension != -1) {
+		codegen_error("Can only read into a (non-array) variable!", inFile, outFile);
 	}
+
+	int value = ir_emit_read(currBlock);
+	ir_emit_stvar(currBlock, idInfo->var, ir_vreg(value));
 	idInfo->isInit = 1; //Flag that the id has been initialized
 }
 
 //writeln;
 void handle_writeln() {
-	add_newline_instr();
+	ir_emit_writeln(currBlock);
 }
 
-//write Expr; 
+//write Expr;
 void handle_write(ast_node *writeNode) {
-	tempRegister expr = handle_expr(writeNode->childlist[0]);
-	add_write_instr(expr);
+	ir_emit_write(currBlock, handle_expr(writeNode->childlist[0]));
 }
 
 //break;
 void handle_break() {
-	//Flag it! MIPS code is added later, so we can also pop off block
-	breakOccured = 1; 
+	if (breakTarget == NULL) {
+		codegen_error("'break;' can only be used within while loops!", inFile, outFile);
+	}
+	ir_emit_jump(currBlock, breakTarget);
+	start_unreachable_block();
 }
 
-//if (Expr) Stmt...
+/*
+	if (Expr) Stmt...
+	The condition's block branches to a then-block and an else-block,
+	which both jump to a block for whatever comes after the if.
+*/
 void handle_if(ast_node *ifNode) {
-	//Evaluate condition expression
-	tempRegister condResult = handle_expr(ifNode->childlist[0]);
-
-	//Inserts branching code depending on value of condResult
-	add_instr_for_if(condResult); 
-	freeTempRegister(condResult);
+	IrBlock *thenBlock = ir_new_block(currFunc);
+	IrBlock *elseBlock = ir_new_block(currFunc);
+	branch_on_condition(ifNode->childlist[0], thenBlock, elseBlock);
 
+	//Then-block (moved so it's laid out after any blocks the condition needed)
+	ir_move_block_after(thenBlock, currFunc->lastBlock);
+	currBlock = thenBlock;
 	//Conditional is here in case of empty statement
-	if (ifNode->num_children == 3) handle_stmt(ifNode->childlist[1]); 
+	if (ifNode->num_children == 3) handle_stmt(ifNode->childlist[1]);
+	IrBlock *thenEnd = currBlock;
 
 	//Handles the else code
+	ir_move_block_after(elseBlock, currFunc->lastBlock);
+	currBlock = elseBlock;
 	handle_else(ifNode->childlist[ifNode->num_children-1]);
+
+	//Both sides meet up after the if
+	IrBlock *join = ir_new_block(currFunc);
+	ir_emit_jump(thenEnd, join);
+	ir_emit_jump(currBlock, join);
+	currBlock = join;
 }
 
 //... else Stmt
 void handle_else(ast_node *elseNode) {
-	//Inserts else label
-	add_instr_for_else();
-
 	//Conditional is here case of empty statement
 	if (elseNode->num_children ==1) handle_stmt(elseNode->childlist[0]);
-
-	//Adds label for subsqeuent code to go under
-	add_instr_for_cond_finish();
 }
 
-//while (Expr) Stmt
+/*
+	while (Expr) Stmt
+	A header block checks the condition, and the body jumps back
+	up to it. break; jumps to the block after the loop.
+*/
 void handle_while(ast_node *whileNode) {
-	//Generates label
-	add_instr_for_while();
-	tempRegister condResult = handle_expr(whileNode->childlist[0]);
-	//Checks condResult 
-	add_instr_for_while_middle(condResult);
-	freeTempRegister(condResult);
-
+	IrBlock *header = ir_new_block(currFunc);
+	ir_emit_jump(currBlock, header);
+	currBlock = header;
+
+	//The exit is made now (for break;), but laid out after the body
+	IrBlock *body = ir_new_block(currFunc);
+	IrBlock *exit = ir_new_block(currFunc);
+	branch_on_condition(whileNode->childlist[0], body, exit);
+	IrBlock *outerBreakTarget = breakTarget;
+	breakTarget = exit;
+
+	ir_move_block_after(body, currFunc->lastBlock);
+	currBlock = body;
 	//Conditional is here case of empty statement
 	if (whileNode->num_children == 2) handle_stmt(whileNode->childlist[1]);
 
-	//If our while Stmt is not a block, just the break statement
-	if (breakOccured==1) {
-		add_break_instr();
-		breakOccured=0;
+	//Branches up to beginning of while-loop (where condition is rechecked)
+	ir_emit_jump(currBlock, header);
+	breakTarget = outerBreakTarget;
+
+	ir_move_block_after(exit, currFunc->lastBlock);
+	currBlock = exit;
+}
+
+/*
+	Ends currBlock with a branch to ifTrue if condNode holds, and to
+	ifFalse if it doesn't. Comparisons become the branch itself and !
+	just swaps the targets, so no 0/1 value gets built for a condition
+	unless it's used as a value.
+*/
+static void branch_on_condition(ast_node *condNode, IrBlock *ifTrue, IrBlock *ifFalse) {
+	IrOpcode cond;
+	switch (condNode->symbol->token) {
+		case EQ: cond = IR_SEQ; break;
+		case NEQ: cond = IR_SNE; break;
+		case LESS: cond = IR_SLT; break;
+		case LEQ: cond = IR_SLE; break;
+		case GREAT: cond = IR_SGT; break;
+		case GEQ: cond = IR_SGE; break;
+
+		case NEG:
+			branch_on_condition(condNode->childlist[0], ifFalse, ifTrue);
+			return;
+
+		//The right side only runs if the left one doesn't decide it
+		case AND:
+		case OR: {
+			IrBlock *right = ir_new_block(currFunc);
+			if (condNode->symbol->token == AND) {
+				branch_on_condition(condNode->childlist[0], right, ifFalse);
+			} else {
+				branch_on_condition(condNode->childlist[0], ifTrue, right);
+			}
+			currBlock = right;
+			branch_on_condition(condNode->childlist[1], ifTrue, ifFalse);
+			return;
+		}
+
+		default:
+			ir_emit_cbr(currBlock, IR_SNE, handle_expr(condNode), ir_imm(0), ifTrue, ifFalse);
+			return;
 	}
 
-	//Branches up to beginning of while-loop (where condition is rechecked)
-	add_instr_for_while_end();
+	IrOperand left, right;
+	handle_operands(condNode, &left, &right);
+	ir_emit_cbr(currBlock, cond, left, right, ifTrue, ifFalse);
 }
 
 /*
-	Goes through different forms of an expression, returning 
-	register containing the final output 
+	Goes through different forms of an expression, returning
+	the operand (vreg or constant) holding its value
 */
-int handle_expr(ast_node *exprNode) {
+IrOperand handle_expr(ast_node *exprNode) {
 	switch(exprNode->symbol->token) {
 		case ASSIGN:
 			return handle_assign(exprNode);
@@ -392,233 +433,284 @@ int handle_expr(ast_node *exprNode) {
 			return handle_id(exprNode);
 		default:
 			codegen_error("Bad expression in AST", inFile, outFile);
-			return -1;
+			return ir_none();
 	}
 }
 
-// id = Expr
-int handle_assign(ast_node *assignNode) {
+// id = Expr (the value of the whole thing is the right-hand side)
+IrOperand handle_assign(ast_node *assignNode) {
 	//Get left node and find its symbol table entry
 	ast_node *lhsNode = assignNode->childlist[0];
+	if (lhsNode->symbol->token != ID) {
+		codegen_error("Can only assign to a variable or array index.", inFile, outFile);
+	}
 	SymTabEntry *idInfo = symtab_lookup(lhsNode->symbol->lexeme);
 
 	//Just a little bit of error checking
 	if (idInfo->isFunction == 1) {
 		codegen_error("Cannot assign functions a value.", inFile, outFile);
 	}
-	
+	if (idInfo->dimension != -1 && lhsNode->num_children == 0) {
+		codegen_error("Cannot assign a whole array a value.", inFile, outFile);
+	}
+	if (idInfo->dimension == -1 && lhsNode->num_children > 0) {
+		codegen_error("Can't index into something that isn't an array!", inFile, outFile);
+	}
+
 	//Evaluate expression on right
-	tempRegister right = handle_expr(assignNode->childlist[1]);
-
-	if (idInfo->scope == 0) { //Global scope
-		if (idInfo->dimension == -1) { //Normal variable
-			assign_global(right, idInfo->type, idInfo->offset);
-			idInfo->isInit = 1;
-			freeTempRegister(right);
-		} else { //Assigning an array index
-			store_array_index(lhsNode, idInfo, GP, right);
+	IrOperand right = handle_expr(assignNode->childlist[1]);
+
+	if (idInfo->dimension == -1) { //Normal variable
+		ir_emit_stvar(currBlock, idInfo->var, right);
+		idInfo->isInit = 1;
+	} else { //Assigning an array index
+		store_array_index(lhsNode, idInfo, right);
+	}
+	return right;
+}
+
+/*
+	Puts op of the two sides in a new vreg. The side that needs more
+	registers is evaluated first (Sethi-Ullman), so fewer temps are
+	held while the other side is worked out. If either side has side
+	effects the order could show, so then it's always left to right.
+*/
+static IrOperand handle_binary_op(ast_node *opNode, IrOpcode op) {
+	IrOperand left, right;
+	handle_operands(opNode, &left, &right);
+	return ir_vreg(ir_emit_binary(currBlock, op, left, right));
+}
+
+//Evaluates both sides of a binary operator, in the order described above
+static void handle_operands(ast_node *opNode, IrOperand *left, IrOperand *right) {
+	ast_node *leftNode = opNode->childlist[0];
+	ast_node *rightNode = opNode->childlist[1];
+	int leftNeed = register_need(leftNode);
+	int rightNeed = register_need(rightNode);
+
+	if (leftNeed != -1 && rightNeed != -1 && rightNeed > leftNeed) {
+		*right = handle_expr(rightNode);
+		*left = handle_expr(leftNode);
+	} else {
+		*left = handle_expr(leftNode);
+		*right = handle_expr(rightNode);
+	}
+}
+
+/*
+	Sethi-Ullman number: registers needed to evaluate exprNode without
+	spilling. Numbers are immediates, so they need none.
+	@return -1 if it has side effects (a call or an assignment)
+*/
+static int register_need(ast_node *exprNode) {
+	int token = exprNode->symbol->token;
+	if (token == NUM) {
+		return 0;
+	}
+	if (token == ASSIGN) {
+		return -1;
+	}
+	if (token == ID) {
+		if (exprNode->num_children == 0) {
+			return 1;
+		}
+		ast_node *child = exprNode->childlist[0];
+		if (child->symbol->token == NONTERMINAL && child->symbol->grammar_symbol == EXPR_LIST) {
+			return -1;
 		}
-	} else { //Function scope
-		if (idInfo->dimension == -1) { //Normal variable
-			/* 
-				Use local variables - not actually needed! Just
-				wanted to use the s_i registers.
-			*/
-			localRegister local = findAvailableLocalRegister();
-			move_registers(local, right);
-
-			assign_local(local, idInfo->type, idInfo->offset);
-			idInfo->isInit=1;
-			freeTempRegister(right);
-			freeLocalRegister(local);
-		} else { //Assigning an array index
-			store_array_index(lhsNode, idInfo, FP, right);
-		}	
-	}
-
-	//For assignment statements, no need to return anything
-	return -1;
-}
-
-// ||
-int handle_or(ast_node *orNode) {
-	tempRegister left = handle_expr(orNode->childlist[0]);
-	tempRegister right = handle_expr(orNode->childlist[1]);
-	add_instr_for_or(left, left, right);
-	freeTempRegister(right); //Can just free the right - only need left
-	return left;
-}
-
-// &&
-int handle_and(ast_node *andNode) {
-	tempRegister left = handle_expr(andNode->childlist[0]);
-	tempRegister right = handle_expr(andNode->childlist[1]);
-	add_instr_for_and(left, left, right);
-	freeTempRegister(right);
-	return left;
+		//Array index: base address and index are both held for the add
+		int indexNeed = register_need(child);
+		return indexNeed == -1 ? -1 : indexNeed > 1 ? indexNeed : 2;
+	}
+
+	int need = 0;
+	for (int i=0; i < exprNode->num_children; i++) {
+		int childNeed = register_need(exprNode->childlist[i]);
+		if (childNeed == -1) {
+			return -1;
+		}
+		if (childNeed > need) {
+			need = childNeed;
+		} else if (childNeed == need && need > 0) {
+			need++; //Both sides need all of them, one has to be held meanwhile
+		}
+	}
+	return need > 0 ? need : 1;
+}
+
+// || (the right side is only evaluated if the left side is 0)
+IrOperand handle_or(ast_node *orNode) {
+	return handle_short_circuit(orNode, IR_LOR);
+}
+
+// && (the right side is only evaluated if the left side isn't 0)
+IrOperand handle_and(ast_node *andNode) {
+	return handle_short_circuit(andNode, IR_LAND);
+}
+
+/*
+	&& or || used as a value. If evaluating the right side anyway
+	can't be noticed, both sides are just combined with op (no
+	branches). Otherwise the 0/1 result is set on each path out of
+	branch_on_condition(), in a temporary variable so it can be in a
+	register across the blocks.
+*/
+static IrOperand handle_short_circuit(ast_node *opNode, IrOpcode op) {
+	if (can_always_evaluate(opNode->childlist[1])) {
+		return handle_binary_op(opNode, op);
+	}
+
+	IrVar *result = ir_add_local(currFunc, op == IR_LAND ? "&&" : "||", INTTOK, -1);
+	result->scope = currBlockScope;
+	IrBlock *isTrue = ir_new_block(currFunc);
+	IrBlock *isFalse = ir_new_block(currFunc);
+	branch_on_condition(opNode, isTrue, isFalse);
+
+	IrBlock *join = ir_new_block(currFunc);
+	ir_move_block_after(isTrue, currFunc->lastBlock);
+	ir_emit_stvar(isTrue, result, ir_imm(1));
+	ir_emit_jump(isTrue, join);
+	ir_move_block_after(isFalse, currFunc->lastBlock);
+	ir_emit_stvar(isFalse, result, ir_imm(0));
+	ir_emit_jump(isFalse, join);
+	ir_move_block_after(join, currFunc->lastBlock);
+
+	currBlock = join;
+	return ir_vreg(ir_emit_ldvar(currBlock, result));
+}
+
+/*
+	Whether evaluating exprNode can't be told apart from not: no side
+	effects, and nothing that can trap - so constants and variables,
+	and comparisons and logical ops over them. Arithmetic can overflow
+	(add/sub/mulo/neg trap) and div can divide by 0.
+*/
+static int can_always_evaluate(ast_node *exprNode) {
+	switch (exprNode->symbol->token) {
+		case NUM:
+			return 1;
+		case ID: //Variables only - not array indexes (could be out of bounds) or calls
+			return exprNode->num_children == 0;
+		case EQ: case NEQ: case LESS: case LEQ: case GREAT: case GEQ:
+		case AND: case OR: case NEG:
+			break;
+		default:
+			return 0;
+	}
+	for (int i=0; i < exprNode->num_children; i++) {
+		if (!can_always_evaluate(exprNode->childlist[i])) {
+			return 0;
+		}
+	}
+	return 1;
 }
 
 // ==
-int handle_equal(ast_node *eqNode) {
-	tempRegister left = handle_expr(eqNode->childlist[0]);
-	tempRegister right = handle_expr(eqNode->childlist[1]);
-	add_instr_for_eq(left, left, right);
-	freeTempRegister(right);
-	return left;
+IrOperand handle_equal(ast_node *eqNode) {
+	return handle_binary_op(eqNode, IR_SEQ);
 }
 
 // !=
-int handle_not_equal(ast_node *neqNode) {
-	tempRegister left = handle_expr(neqNode->childlist[0]);
-	tempRegister right = handle_expr(neqNode->childlist[1]);
-	add_instr_for_neq(left, left, right);
-	freeTempRegister(right);
-	return left;
+IrOperand handle_not_equal(ast_node *neqNode) {
+	return handle_binary_op(neqNode, IR_SNE);
 }
 
 // <
-int handle_less(ast_node *lessNode) {
-	tempRegister left = handle_expr(lessNode->childlist[0]);
-	tempRegister right = handle_expr(lessNode->childlist[1]);
-	add_instr_for_less(left, left, right);
-	freeTempRegister(right);
-	return left;
+IrOperand handle_less(ast_node *lessNode) {
+	return handle_binary_op(lessNode, IR_SLT);
 }
 
 // <=
-int handle_less_or_equal(ast_node *leqNode) {
-	tempRegister left = handle_expr(leqNode->childlist[0]);
-	tempRegister right = handle_expr(leqNode->childlist[1]);
-	add_instr_for_leq(left, left, right);
-	freeTempRegister(right);
-	return left;
+IrOperand handle_less_or_equal(ast_node *leqNode) {
+	return handle_binary_op(leqNode, IR_SLE);
 }
 
 // >
-int handle_greater(ast_node *greaterNode) {
-	tempRegister left = handle_expr(greaterNode->childlist[0]);
-	tempRegister right = handle_expr(greaterNode->childlist[1]);
-	add_instr_for_great(left, left, right);
-	freeTempRegister(right);
-	return left;
+IrOperand handle_greater(ast_node *greaterNode) {
+	return handle_binary_op(greaterNode, IR_SGT);
 }
 
 // >=
-int handle_greater_or_equal(ast_node *geqNode) {
-	tempRegister left = handle_expr(geqNode->childlist[0]);
-	tempRegister right = handle_expr(geqNode->childlist[1]);
-	add_instr_for_geq(left, left, right);
-	freeTempRegister(right);
-	return left;
+IrOperand handle_greater_or_equal(ast_node *geqNode) {
+	return handle_binary_op(geqNode, IR_SGE);
 }
 
 // +
-int handle_add(ast_node *addNode) {
-	tempRegister left = handle_expr(addNode->childlist[0]);
-	tempRegister right = handle_expr(addNode->childlist[1]);
-	add_instr_for_addition(left, left, right);
-	freeTempRegister(right);
-	return left;
+IrOperand handle_add(ast_node *addNode) {
+	return handle_binary_op(addNode, IR_ADD);
 }
 
 // - (either binary or unary!)
-int handle_subtraction(ast_node *subNode) {
-	tempRegister left = handle_expr(subNode->childlist[0]);
-
+IrOperand handle_subtraction(ast_node *subNode) {
 	//If only one child, is unary operator
 	if (subNode->num_children == 1) {
-		add_instr_for_unarysub(left, left);
-		return left;
+		IrOperand left = handle_expr(subNode->childlist[0]);
+		return ir_vreg(ir_emit_unary(currBlock, IR_NEG, left));
 	}
-
-	tempRegister right = handle_expr(subNode->childlist[1]);
-	add_instr_for_sub(left, left, right);
-	freeTempRegister(right);
-	return left;
+	return handle_binary_op(subNode, IR_SUB);
 }
 
 // *
-int handle_multiplication(ast_node *multNode) {
-	tempRegister left = handle_expr(multNode->childlist[0]);
-	tempRegister right = handle_expr(multNode->childlist[1]);
-	add_instr_for_mult(left, left, right);
-	freeTempRegister(right);
-	return left;
-} 
+IrOperand handle_multiplication(ast_node *multNode) {
+	return handle_binary_op(multNode, IR_MUL);
+}
 
 // /
-int handle_division(ast_node *divNode) {
-	tempRegister left = handle_expr(divNode->childlist[0]);
-	tempRegister right = handle_expr(divNode->childlist[1]);
-	add_instr_for_div(left, left, right);
-	freeTempRegister(right);
-	return left;
+IrOperand handle_division(ast_node *divNode) {
+	return handle_binary_op(divNode, IR_DIV);
 }
 
 // ! (unary operator)
-int handle_negation(ast_node *negNode) {
-	tempRegister left = handle_expr(negNode->childlist[0]);
-	add_instr_for_neg(left, left);
-	return left;
+IrOperand handle_negation(ast_node *negNode) {
+	IrOperand left = handle_expr(negNode->childlist[0]);
+	return ir_vreg(ir_emit_unary(currBlock, IR_NOT, left));
 }
 
-//Base Case of Num: Loads a number into a register (which is returned)
-int handle_num(ast_node *numNode) {
-	tempRegister numReg = findAvailableTempRegister();
-	load_val_in_register(numReg, numNode->symbol->value);
-	return numReg;
+//Base Case of Num: just a constant
+IrOperand handle_num(ast_node *numNode) {
+	return ir_imm(numNode->symbol->value);
 }
 
-//Base case of ID: loads value/address into a register (which is returned)
-int handle_id(ast_node *idNode) {
+//Base case of ID: a variable's value, an array index/address, or a call's result
+IrOperand handle_id(ast_node *idNode) {
 	SymTabEntry *idInfo = symtab_lookup(idNode->symbol->lexeme);
-	tempRegister varValue = findAvailableTempRegister();
 
 	if (idInfo->isFunction == 1) {
-		//For function call, return a register containing the return value
-		return handle_function_call(idNode->childlist[0], idInfo->numParams, 
-			idInfo->name);
-	}
-
-	//Global scope
-	if (idInfo->scope == 0) {
-		if (idInfo->dimension == -1) { //Normal variable
-			load_global(varValue, idInfo->type, idInfo->offset, idInfo->isInit);
-		} else if (idNode->num_children > 0) { //Array index e.g. a1[6]
-			return load_array_index(idNode, idInfo, GP);
-		} else { //Just the name of an array e.g. a1
-			return load_array_base(idInfo, GP);
-		}	
-	} 
-	//Local scope
-	else  {
-		if (idInfo->dimension == -1) { //Normal variable
-			load_local(varValue, idInfo->type, idInfo->offset, idInfo->isInit);
-		} else if (idNode->num_children > 0) { //Array index e.g. a1[6]
-			return load_array_index(idNode, idInfo, FP);
-		} else { //Just the name of an array e.g. a1
-			return load_array_base(idInfo, FP);
+		if (idNode->num_children == 0) {
+			codegen_error("Functions have to be called e.g. f()", inFile, outFile);
 		}
+		//For function call, return the vreg holding the return value
+		return handle_function_call(idNode->childlist[0], idInfo);
+	}
+
+	if (idInfo->dimension == -1) { //Normal variable
+		if (idNode->num_children > 0) {
+			codegen_error("Can't index into something that isn't an array!", inFile, outFile);
+		}
+		//A dash of error-checking
+		if (idInfo->isInit == 0) {
+			codegen_error(idInfo->scope == 0 ? "Trying to use undeclared global!" :
+				"Trying to use undeclared local!", inFile, outFile);
+		}
+		return ir_vreg(ir_emit_ldvar(currBlock, idInfo->var));
+	} else if (idNode->num_children > 0) { //Array index e.g. a1[6]
+		return load_array_index(idNode, idInfo);
+	} else { //Just the name of an array e.g. a1
+		return load_array_base(idInfo);
 	}
-	return varValue;
 }
 
-//For arguments in a function call!
-void handle_expression_list(ast_node *elNode, int numParams) {
+//For arguments in a function call! Fills in args, in order
+void handle_expression_list(ast_node *elNode, int numParams, IrOperand *args) {
 	//Some error-checking
 	if (numParams != elNode->num_children) {
 		codegen_error("Wrong number of arguments to function!", inFile, outFile);
 	}
-	if (numParams > 4) {
+	if (numParams > IR_MAX_ARGS) {
 		codegen_error("Compiler only supports 4 or fewer arguments/parameters", inFile, outFile);
 	}
 
-	//for each parameter, move into an A_i register
 	for (int i=0; i < numParams; i++) {
-		int reg = handle_expr(elNode->childlist[i]);
-		int param = getParamRegister(i);
-		move_registers(param, reg);
-		freeTempRegister(reg);
+		args[i] = handle_expr(elNode->childlist[i]);
 	}
 }
-
@@ -0,0 +1,410 @@
+/*
+	constprop: constant folding and propagation (sparse conditional
+	constant propagation, more or less).
+
+	Every vreg and every scalar variable gets a lattice value: TOP
+	(nothing known yet), CONST (always this value) or VARYING. Blocks
+	are walked in layout order, over and over, until nothing changes.
+	Variables flow along CFG edges through LDVAR/STVAR; vregs that are
+	only written once keep their value everywhere. A cbr whose outcome
+	is known only marks the edge it takes as executable, so code in a
+	dead if/while arm never gets to spoil what comes after it.
+
+	Then the results are written back: constant vregs become
+	immediates, the instructions computing them (and loads of constant
+	variables) go, decided cbrs become jumps and blocks that were
+	never reached are removed.
+
+	Folding never hides a run-time error: division by 0, and anything
+	that would overflow (add/sub/mulo/neg trap on overflow in MIPS) is
+	left for run time.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "passmanager.h"
+
+typedef enum {
+	LAT_TOP, LAT_CONST, LAT_VARYING
+} LatticeKind;
+
+typedef struct {
+	LatticeKind kind;
+	int val; //LAT_CONST only
+} LatticeVal;
+
+//The function being worked on
+static IrFunction *func;
+static int numSlots; //One per param/local, then one per global
+static LatticeVal *vregVals;
+static char *multiDef; //vregs written more than once are always VARYING
+static LatticeVal *blockOut; //numSlots values per block id
+static char *blockExec;
+static char *edgeExec; //2 per block id: whether target[0]/target[1] can be taken
+
+//For -stats
+static int numFolded;
+static int numLoadsReplaced;
+static int numBranchesFolded;
+static int numBlocksRemoved;
+
+static int propagate_function();
+static int visit_block(IrBlock *block, LatticeVal *state);
+static void rewrite_function();
+static void setup_function(IrFunction *f);
+static void teardown_function();
+
+static LatticeVal lat_const(int val);
+static LatticeVal lat_varying();
+static LatticeVal meet(LatticeVal a, LatticeVal b);
+static int lat_equal(LatticeVal a, LatticeVal b);
+static LatticeVal eval_operand(IrOperand opnd);
+static LatticeVal eval_instr(IrInstr *instr, LatticeVal *state);
+static int fold_binary(IrOpcode op, int a, int b, int *result);
+static int var_slot(IrVar *var);
+static int edge_taken(IrBlock *pred, IrBlock *succ);
+
+void constant_propagation(IrProgram *prog) {
+	numFolded = numLoadsReplaced = numBranchesFolded = numBlocksRemoved = 0;
+
+	for (IrFunction *f = prog->functions; f != NULL; f = f->next) {
+		setup_function(f);
+		while (propagate_function()) {
+		}
+		rewrite_function();
+		teardown_function();
+	}
+
+	if (printStats) {
+		fprintf(stderr, "constprop: %d instructions folded, %d variable loads replaced, "
+			"%d branches folded, %d blocks removed\n", numFolded, numLoadsReplaced,
+			numBranchesFolded, numBlocksRemoved);
+	}
+}
+
+/** Working out the values **/
+
+//One sweep over the function. @return 1 if anything changed (so sweep again)
+static int propagate_function() {
+	int changed = 0;
+	LatticeVal *state = malloc(numSlots * sizeof(LatticeVal) + 1);
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		if (!blockExec[block->id]) {
+			continue;
+		}
+
+		//Nothing is known about anything coming into the function
+		for (int s=0; s < numSlots; s++) {
+			state[s] = block == func->entry ? lat_varying() : (LatticeVal){ LAT_TOP, 0 };
+		}
+		for (int i=0; i < block->numPreds; i++) {
+			IrBlock *pred = block->preds[i];
+			if (!edge_taken(pred, block)) {
+				continue;
+			}
+			LatticeVal *predOut = &blockOut[pred->id * numSlots];
+			for (int s=0; s < numSlots; s++) {
+				state[s] = meet(state[s], predOut[s]);
+			}
+		}
+
+		changed |= visit_block(block, state);
+
+		LatticeVal *out = &blockOut[block->id * numSlots];
+		for (int s=0; s < numSlots; s++) {
+			if (!lat_equal(out[s], state[s])) {
+				out[s] = state[s];
+				changed = 1;
+			}
+		}
+	}
+
+	free(state);
+	return changed;
+}
+
+//Runs block's instructions over state (its values on the way in, and out)
+static int visit_block(IrBlock *block, LatticeVal *state) {
+	int changed = 0;
+
+	for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+		LatticeVal val = eval_instr(instr, state);
+
+		if (instr->op == IR_STVAR) {
+			state[var_slot(instr->var)] = val;
+		} else if (instr->op == IR_CALL) {
+			//The callee can change any global
+			for (int s = func->numVars; s < numSlots; s++) {
+				state[s] = lat_varying();
+			}
+		}
+
+		if (instr->dest != -1) {
+			LatticeVal old = vregVals[instr->dest];
+			vregVals[instr->dest] = multiDef[instr->dest] ? lat_varying() : meet(old, val);
+			changed |= !lat_equal(old, vregVals[instr->dest]);
+		}
+	}
+
+	//Which ways out can actually be taken
+	IrInstr *term = block->last;
+	int takes[2] = { 0, 0 };
+	if (term->op == IR_JUMP) {
+		takes[0] = 1;
+	} else if (term->op == IR_CBR) {
+		LatticeVal cond = eval_instr(term, state);
+		takes[0] = cond.kind != LAT_CONST || cond.val != 0;
+		takes[1] = cond.kind != LAT_CONST || cond.val == 0;
+	}
+
+	for (int k=0; k < 2; k++) {
+		if (takes[k] && !edgeExec[block->id*2 + k]) {
+			edgeExec[block->id*2 + k] = 1;
+			blockExec[term->target[k]->id] = 1;
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
+/*
+	What instr produces (for a cbr: whether the condition holds, for a
+	stvar: what the variable ends up holding). Unknown operands count
+	as VARYING for a cbr, so a branch on one never gets folded the wrong way.
+*/
+static LatticeVal eval_instr(IrInstr *instr, LatticeVal *state) {
+	LatticeVal a = eval_operand(instr->src1);
+	LatticeVal b = eval_operand(instr->src2);
+	int result;
+
+	switch (instr->op) {
+		case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV:
+		case IR_SEQ: case IR_SNE: case IR_SLT: case IR_SLE: case IR_SGT: case IR_SGE:
+		case IR_LAND: case IR_LOR:
+		case IR_CBR:
+			//Both sides are evaluated already, so one of them can decide && and ||
+			if ((instr->op == IR_LAND && ((a.kind == LAT_CONST && a.val == 0)
+				|| (b.kind == LAT_CONST && b.val == 0)))) {
+				return lat_const(0);
+			}
+			if ((instr->op == IR_LOR && ((a.kind == LAT_CONST && a.val != 0)
+				|| (b.kind == LAT_CONST && b.val != 0)))) {
+				return lat_const(1);
+			}
+			if (a.kind == LAT_VARYING || b.kind == LAT_VARYING) {
+				return lat_varying();
+			}
+			if (a.kind == LAT_TOP || b.kind == LAT_TOP) {
+				return instr->op == IR_CBR ? lat_varying() : a.kind == LAT_TOP ? a : b;
+			}
+			if (fold_binary(instr->op == IR_CBR ? instr->cond : instr->op, a.val, b.val, &result)) {
+				return lat_const(result);
+			}
+			return lat_varying();
+
+		case IR_NEG:
+			if (a.kind == LAT_CONST) {
+				return a.val == INT_MIN ? lat_varying() : lat_const(-a.val);
+			}
+			return a;
+		case IR_NOT:
+			return a.kind == LAT_CONST ? lat_const(a.val == 0) : a;
+		case IR_MOV:
+			return a;
+
+		case IR_LDVAR:
+			return state[var_slot(instr->var)];
+		case IR_STVAR:
+			//A char variable only keeps the (sign-extended) low byte
+			if (a.kind == LAT_CONST && ir_var_width(instr->var) == 1) {
+				return lat_const((signed char)a.val);
+			}
+			return a;
+
+		default:
+			return lat_varying();
+	}
+}
+
+//@return 0 if folding op would hide a run-time error (so don't)
+static int fold_binary(IrOpcode op, int a, int b, int *result) {
+	long long wide;
+
+	switch (op) {
+		case IR_ADD: wide = (long long)a + b; break;
+		case IR_SUB: wide = (long long)a - b; break;
+		case IR_MUL: wide = (long long)a * b; break;
+		case IR_DIV:
+			if (b == 0 || (a == INT_MIN && b == -1)) {
+				return 0;
+			}
+			wide = a / b;
+			break;
+		case IR_SEQ: wide = a == b; break;
+		case IR_SNE: wide = a != b; break;
+		case IR_SLT: wide = a < b; break;
+		case IR_SLE: wide = a <= b; break;
+		case IR_SGT: wide = a > b; break;
+		case IR_SGE: wide = a >= b; break;
+		case IR_LAND: wide = a != 0 && b != 0; break;
+		case IR_LOR: wide = a != 0 || b != 0; break;
+		default:
+			return 0;
+	}
+
+	if (wide < INT_MIN || wide > INT_MAX) {
+		return 0;
+	}
+	*result = (int)wide;
+	return 1;
+}
+
+/** Writing the results back **/
+
+static void rewrite_function() {
+	int foldedBranch = 0;
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		if (!blockExec[block->id]) {
+			continue;
+		}
+
+		IrInstr *instr = block->first;
+		while (instr != NULL) {
+			IrInstr *next = instr->next;
+
+			IrOperand *uses[IR_MAX_USES];
+			int numUses = ir_get_uses(instr, uses);
+			for (int i=0; i < numUses; i++) {
+				if (uses[i]->kind == IRO_VREG && vregVals[uses[i]->val].kind == LAT_CONST) {
+					*uses[i] = ir_imm(vregVals[uses[i]->val].val);
+				}
+			}
+
+			if (instr->dest != -1 && vregVals[instr->dest].kind == LAT_CONST
+				&& !ir_has_side_effects(instr)) {
+				if (instr->op == IR_LDVAR) {
+					numLoadsReplaced++;
+				} else if (instr->op != IR_MOV) {
+					numFolded++;
+				}
+				ir_remove(instr);
+			} else if (instr->op == IR_CBR && edgeExec[block->id*2] != edgeExec[block->id*2 + 1]) {
+				IrBlock *taken = edgeExec[block->id*2] ? instr->target[0] : instr->target[1];
+				instr->op = IR_JUMP;
+				instr->src1 = ir_none();
+				instr->src2 = ir_none();
+				instr->target[0] = taken;
+				instr->target[1] = NULL;
+				numBranchesFolded++;
+				foldedBranch = 1;
+			}
+			instr = next;
+		}
+	}
+
+	//Whatever was never reached can only be reached from other such blocks
+	IrBlock *block = func->entry;
+	while (block != NULL) {
+		IrBlock *next = block->next;
+		if (!blockExec[block->id]) {
+			ir_remove_block(block);
+			numBlocksRemoved++;
+		}
+		block = next;
+	}
+	ir_rebuild_cfg(func);
+
+	//Folded branches leave jumps to straight-line code behind
+	if (foldedBranch && pass_enabled("simplifycfg")) {
+		simplify_cfg(func);
+	}
+}
+
+/** Helpers **/
+
+static void setup_function(IrFunction *f) {
+	func = f;
+	numSlots = func->numVars + func->prog->numGlobals;
+	ir_rebuild_cfg(func);
+
+	vregVals = malloc((func->numVregs + 1) * sizeof(LatticeVal));
+	multiDef = calloc(func->numVregs + 1, 1);
+	char *defined = calloc(func->numVregs + 1, 1);
+	for (int v=0; v < func->numVregs; v++) {
+		vregVals[v] = (LatticeVal){ LAT_TOP, 0 };
+	}
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			if (instr->dest != -1) {
+				multiDef[instr->dest] |= defined[instr->dest];
+				defined[instr->dest] = 1;
+			}
+		}
+	}
+	free(defined);
+
+	blockOut = malloc((func->numBlocks * numSlots + 1) * sizeof(LatticeVal));
+	for (int i=0; i < func->numBlocks * numSlots; i++) {
+		blockOut[i] = (LatticeVal){ LAT_TOP, 0 };
+	}
+	blockExec = calloc(func->numBlocks + 1, 1);
+	edgeExec = calloc(func->numBlocks*2 + 1, 1);
+	blockExec[func->entry->id] = 1;
+}
+
+static void teardown_function() {
+	free(vregVals);
+	free(multiDef);
+	free(blockOut);
+	free(blockExec);
+	free(edgeExec);
+}
+
+static LatticeVal lat_const(int val) {
+	return (LatticeVal){ LAT_CONST, val };
+}
+
+static LatticeVal lat_varying() {
+	return (LatticeVal){ LAT_VARYING, 0 };
+}
+
+static LatticeVal meet(LatticeVal a, LatticeVal b) {
+	if (a.kind == LAT_TOP) {
+		return b;
+	}
+	if (b.kind == LAT_TOP || lat_equal(a, b)) {
+		return a;
+	}
+	return lat_varying();
+}
+
+static int lat_equal(LatticeVal a, LatticeVal b) {
+	return a.kind == b.kind && (a.kind != LAT_CONST || a.val == b.val);
+}
+
+static LatticeVal eval_operand(IrOperand opnd) {
+	if (opnd.kind == IRO_IMM) {
+		return lat_const(opnd.val);
+	}
+	if (opnd.kind == IRO_VREG) {
+		return vregVals[opnd.val];
+	}
+	return lat_varying();
+}
+
+static int var_slot(IrVar *var) {
+	return var->kind == VAR_GLOBAL ? func->numVars + var->id : var->id;
+}
+
+//Whether pred can go on to succ (along either of its edges)
+static int edge_taken(IrBlock *pred, IrBlock *succ) {
+	IrInstr *term = pred->last;
+	return (term->target[0] == succ && edgeExec[pred->id*2])
+		|| (term->target[1] == succ && edgeExec[pred->id*2 + 1]);
+}
@@ -0,0 +1,473 @@
+/*
+	cse: common subexpression elimination by value numbering.
+
+	Blocks are visited down the dominator tree, with a table of the
+	expressions worked out so far (op + the value numbers of what it
+	reads). An instruction that's already in the table is deleted and
+	its dest replaced by the earlier one's.
+	- within a block anything pure is shared: arithmetic, compares,
+	  addr, ldvars (until the var is stored - and a stvar of an int
+	  makes the next ldvar just the value stored) and loads (until a
+	  store that could hit the same bytes, or a call that might write
+	  memory, and a store of a word makes the next load of it just
+	  the value stored)
+	- across blocks only what's dear to work out again (mul/div of
+	  two non-constants, and calls) is shared: a vreg used in another block
+	  would live in a frame slot, so the value goes through a new
+	  local instead, like licm.c does, for regalloc to keep in a
+	  register
+	Entries made in a block are popped when the walk leaves it, so
+	what's looked up always comes from a block dominating this one.
+
+	A call is an expression like any other when all the callee's
+	result depends on is its args (see effects.h), if there are at
+	most 2 of them. Any call kills the ldvars of the globals the
+	callee (or anything it calls) might write.
+
+	An ldvar of a param/local that's never stored gets the same
+	value number in every block, which is what lets a[n]*b[n] in one
+	block match the one in a block it dominates.
+
+	Two addresses can only be told apart if they're off the same
+	base, or based on different arrays - where a param array might
+	be any global array, but none of this function's locals.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "passmanager.h"
+#include "loops.h"
+#include "effects.h"
+#include "lexer.h"
+
+#define NUM_BUCKETS 1024
+
+typedef struct {
+	IrOpcode op;
+	IrOperand src1, src2; //Value numbers (or immediates)
+	IrVar *var;
+	int width, offset; //Calls: how many args, and where the callee is in the function list
+	int value; //vreg holding it, or -1 if it's been killed
+	IrVar *root; //Loads: the array the address is in, if known
+	IrBlock *block; //Where it was worked out
+	int bucket;
+	int nextInBucket;
+} CseEntry;
+
+static EffectsInfo *effects;
+
+//The function being worked on
+static IrFunction *func;
+static LoopInfo *info;
+static IrBlock **firstChild, **nextSibling; //Dominator tree, by block id
+static int numVregs; //When the pass started (newer vregs are never looked up)
+static int *leader; //By vreg: the vreg it's been replaced by (itself if it hasn't)
+static int *valueNumber; //By vreg
+static IrInstr **defOf; //By vreg
+static IrVar **rootOf; //By vreg: the array an address is based on, if known
+static IrVar **sharedVar; //By vreg: the local it's kept in for other blocks, once it is
+static char *storedVar; //By param/local id: is there a stvar of it anywhere?
+
+static CseEntry *entries;
+static int numEntries, entriesCapacity;
+static int buckets[NUM_BUCKETS];
+
+//For -stats
+static int numRemoved;
+static int numLoads;
+static int numShared;
+
+static void cse_function();
+static void visit(IrBlock *block);
+static void number_instr(IrInstr *instr);
+static void number_pure(IrInstr *instr);
+static void number_ldvar(IrInstr *instr);
+static void number_load(IrInstr *instr);
+static void number_call(IrInstr *instr);
+static void kill_memory(IrInstr *store);
+static void share_across_blocks(IrInstr *instr, int value);
+static void replace(IrInstr *instr, int value);
+
+static CseEntry *lookup(IrOpcode op, IrOperand src1, IrOperand src2, IrVar *var,
+	int width, int offset);
+static CseEntry *insert(IrOpcode op, IrOperand src1, IrOperand src2, IrVar *var,
+	int width, int offset, int value, IrBlock *block);
+static IrOperand number_of(IrOperand opnd);
+static int is_commutative(IrOpcode op);
+static int is_address(IrOperand opnd);
+static IrVar *root_of(IrOperand opnd);
+static int may_alias(IrInstr *store, CseEntry *load);
+
+void eliminate_common_subexpressions(IrProgram *prog) {
+	numRemoved = numLoads = numShared = 0;
+	effects = find_effects(prog);
+
+	for (func = prog->functions; func != NULL; func = func->next) {
+		cse_function();
+	}
+	free_effects(effects);
+
+	if (printStats) {
+		fprintf(stderr, "cse: %d instructions removed (%d of them loads), "
+			"%d values shared across blocks\n", numRemoved, numLoads, numShared);
+	}
+}
+
+static void cse_function() {
+	ir_rebuild_cfg(func);
+	info = find_dominators(func);
+	firstChild = calloc(func->numBlocks, sizeof(IrBlock *));
+	nextSibling = calloc(func->numBlocks, sizeof(IrBlock *));
+	for (IrBlock *block = func->lastBlock; block != NULL; block = block->prev) {
+		int idom = info->idom[block->id];
+		if (idom != -1 && idom != block->id) {
+			nextSibling[block->id] = firstChild[idom];
+			firstChild[idom] = block;
+		}
+	}
+
+	numVregs = func->numVregs;
+	int n = numVregs > 0 ? numVregs : 1;
+	leader = malloc(n * sizeof(int));
+	valueNumber = malloc(n * sizeof(int));
+	defOf = calloc(n, sizeof(IrInstr *));
+	rootOf = calloc(n, sizeof(IrVar *));
+	sharedVar = calloc(n, sizeof(IrVar *));
+	for (int v=0; v < numVregs; v++) {
+		leader[v] = valueNumber[v] = v;
+	}
+
+	storedVar = calloc(func->numVars + 1, 1);
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			if (instr->op == IR_STVAR && instr->var->kind != VAR_GLOBAL) {
+				storedVar[instr->var->id] = 1;
+			}
+		}
+	}
+
+	entries = NULL;
+	numEntries = entriesCapacity = 0;
+	memset(buckets, -1, sizeof(buckets));
+	visit(func->entry);
+
+	//Everything that read a deleted instruction's dest reads its replacement instead
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			IrOperand *uses[IR_MAX_USES];
+			int numUses = ir_get_uses(instr, uses);
+			for (int i=0; i < numUses; i++) {
+				if (uses[i]->kind == IRO_VREG && uses[i]->val < numVregs) {
+					uses[i]->val = leader[uses[i]->val];
+				}
+			}
+		}
+	}
+
+	free(entries);
+	free(leader);
+	free(valueNumber);
+	free(defOf);
+	free(rootOf);
+	free(sharedVar);
+	free(storedVar);
+	free(firstChild);
+	free(nextSibling);
+	free_loop_info(info);
+}
+
+static void visit(IrBlock *block) {
+	int mark = numEntries;
+
+	IrInstr *next;
+	for (IrInstr *instr = block->first; instr != NULL; instr = next) {
+		next = instr->next;
+		number_instr(instr);
+	}
+	for (IrBlock *child = firstChild[block->id]; child != NULL; child = nextSibling[child->id]) {
+		visit(child);
+	}
+
+	//Newest first, so each bucket goes back to how it was
+	while (numEntries > mark) {
+		CseEntry *entry = &entries[--numEntries];
+		buckets[entry->bucket] = entry->nextInBucket;
+	}
+}
+
+static void number_instr(IrInstr *instr) {
+	if (instr->dest != -1 && instr->dest < numVregs) {
+		defOf[instr->dest] = instr;
+	}
+
+	switch (instr->op) {
+		case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV:
+		case IR_SEQ: case IR_SNE: case IR_SLT: case IR_SLE: case IR_SGT: case IR_SGE:
+		case IR_LAND: case IR_LOR: case IR_NEG: case IR_NOT: case IR_MOV: case IR_ADDR:
+			number_pure(instr);
+			break;
+
+		case IR_LDVAR:
+			number_ldvar(instr);
+			break;
+
+		case IR_STVAR: {
+			//The next ldvar is what was stored (a char store truncates, so not for those)
+			IrOperand stored = instr->src1;
+			int value = stored.kind == IRO_VREG && stored.val < numVregs
+				&& ir_var_width(instr->var) != 1 ? leader[stored.val] : -1;
+			insert(IR_LDVAR, ir_none(), ir_none(), instr->var, 0, 0, value, instr->block);
+			break;
+		}
+
+		case IR_LOAD:
+			number_load(instr);
+			break;
+
+		case IR_STORE:
+			kill_memory(instr);
+			if (instr->width != 1 && instr->src2.kind == IRO_VREG
+				&& instr->src2.val < numVregs) {
+				CseEntry *entry = insert(IR_LOAD, number_of(instr->src1), ir_none(), NULL,
+					instr->width, instr->offset, leader[instr->src2.val], instr->block);
+				entry->root = root_of(instr->src1);
+			}
+			break;
+
+		case IR_CALL:
+			kill_memory(instr);
+			if (instr->dest != -1 && instr->numArgs <= 2
+				&& is_const(effects, effects_of(effects, instr->callee))) {
+				number_call(instr);
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+static void number_pure(IrInstr *instr) {
+	IrOperand src1 = number_of(instr->src1);
+	IrOperand src2 = number_of(instr->src2);
+	//a+b and b+a are the same thing
+	if (is_commutative(instr->op) && (src1.kind > src2.kind
+		|| (src1.kind == src2.kind && src1.val > src2.val))) {
+		IrOperand tmp = src1;
+		src1 = src2;
+		src2 = tmp;
+	}
+
+	//Addresses keep track of what array they're in
+	int dest = instr->dest;
+	if (instr->op == IR_ADDR) {
+		rootOf[dest] = instr->var;
+	} else if (func->vregTypes[dest] == VT_ADDR) {
+		IrOperand base = is_address(instr->src1) ? instr->src1 : instr->src2;
+		rootOf[dest] = root_of(base);
+	}
+
+	CseEntry *entry = lookup(instr->op, src1, src2, instr->var, 0, 0);
+	if (entry != NULL && entry->block == instr->block) {
+		replace(instr, entry->value);
+		return;
+	}
+	if (entry != NULL && (instr->op == IR_MUL || instr->op == IR_DIV)
+		&& src1.kind == IRO_VREG && src2.kind == IRO_VREG) {
+		//(entered for this block too, so a repeat here is just deleted)
+		insert(instr->op, src1, src2, NULL, 0, 0, dest, instr->block);
+		share_across_blocks(instr, entry->value);
+		return;
+	}
+	insert(instr->op, src1, src2, instr->var, 0, 0, dest, instr->block);
+}
+
+static void number_ldvar(IrInstr *instr) {
+	IrVar *var = instr->var;
+	CseEntry *entry = lookup(IR_LDVAR, ir_none(), ir_none(), var, 0, 0);
+	if (entry != NULL && entry->block == instr->block && entry->value != -1) {
+		replace(instr, entry->value);
+		return;
+	}
+
+	//Never stored: it holds the same thing everywhere
+	if (var->kind != VAR_GLOBAL && !storedVar[var->id]) {
+		valueNumber[instr->dest] = numVregs + var->id;
+	}
+	insert(IR_LDVAR, ir_none(), ir_none(), var, 0, 0, instr->dest, instr->block);
+}
+
+static void number_load(IrInstr *instr) {
+	IrOperand addr = number_of(instr->src1);
+	CseEntry *entry = lookup(IR_LOAD, addr, ir_none(), NULL, instr->width, instr->offset);
+	if (entry != NULL && entry->block == instr->block && entry->value != -1) {
+		replace(instr, entry->value);
+		numLoads++;
+		return;
+	}
+	entry = insert(IR_LOAD, addr, ir_none(), NULL, instr->width, instr->offset, instr->dest,
+		instr->block);
+	entry->root = root_of(instr->src1);
+}
+
+static void number_call(IrInstr *instr) {
+	int calleeIndex = 0;
+	for (IrFunction *f = func->prog->functions; f != instr->callee; f = f->next) {
+		calleeIndex++;
+	}
+	IrOperand src1 = instr->numArgs > 0 ? number_of(instr->args[0]) : ir_none();
+	IrOperand src2 = instr->numArgs > 1 ? number_of(instr->args[1]) : ir_none();
+
+	CseEntry *entry = lookup(IR_CALL, src1, src2, NULL, instr->numArgs, calleeIndex);
+	if (entry != NULL && entry->block == instr->block) {
+		replace(instr, entry->value);
+		return;
+	}
+	insert(IR_CALL, src1, src2, NULL, instr->numArgs, calleeIndex, instr->dest, instr->block);
+	if (entry != NULL) {
+		share_across_blocks(instr, entry->value);
+	}
+}
+
+//Loads (and, for calls, ldvars of globals) in this block that instr might change
+static void kill_memory(IrInstr *instr) {
+	FuncEffects *callee = instr->op == IR_CALL ? effects_of(effects, instr->callee) : NULL;
+	for (int i = numEntries-1; i >= 0 && entries[i].block == instr->block; i--) {
+		CseEntry *entry = &entries[i];
+		if (entry->op == IR_LOAD && (callee != NULL ? callee->writesMemory : may_alias(instr, entry))) {
+			entry->value = -1;
+		} else if (entry->op == IR_LDVAR && callee != NULL && entry->var->kind == VAR_GLOBAL
+			&& callee->writesGlobal[entry->var->id]) {
+			entry->value = -1;
+		}
+	}
+}
+
+//instr becomes an ldvar of a new local that value (from a dominating block) is kept in
+static void share_across_blocks(IrInstr *instr, int value) {
+	if (sharedVar[value] == NULL) {
+		char *name = arena_alloc(&func->prog->arena, 16);
+		sprintf(name, "cse.%d", value);
+		sharedVar[value] = ir_add_local(func, name, INTTOK, -1);
+
+		IrInstr *store = ir_new_instr(func, IR_STVAR);
+		store->var = sharedVar[value];
+		store->src1 = ir_vreg(value);
+		ir_insert_before(defOf[value]->next, store);
+	}
+
+	valueNumber[instr->dest] = valueNumber[value];
+	instr->op = IR_LDVAR;
+	instr->var = sharedVar[value];
+	instr->src1 = instr->src2 = ir_none();
+	instr->callee = NULL;
+	instr->numArgs = 0;
+	instr->isTailCall = 0;
+	numShared++;
+}
+
+//instr works out what value already holds
+static void replace(IrInstr *instr, int value) {
+	leader[instr->dest] = leader[value];
+	valueNumber[instr->dest] = valueNumber[value];
+	rootOf[instr->dest] = rootOf[value];
+	ir_remove(instr);
+	numRemoved++;
+}
+
+/** The table **/
+
+static unsigned hash_key(IrOpcode op, IrOperand src1, IrOperand src2, IrVar *var, int offset) {
+	unsigned h = op;
+	h = h*31 + src1.kind*7 + (unsigned)src1.val;
+	h = h*31 + src2.kind*7 + (unsigned)src2.val;
+	h = h*31 + (unsigned)(size_t)var / sizeof(IrVar);
+	h = h*31 + (unsigned)offset;
+	return h % NUM_BUCKETS;
+}
+
+static int same_operand(IrOperand a, IrOperand b) {
+	return a.kind == b.kind && (a.kind == IRO_NONE || a.val == b.val);
+}
+
+//The newest entry for this expression (killed ones included), or NULL
+static CseEntry *lookup(IrOpcode op, IrOperand src1, IrOperand src2, IrVar *var,
+	int width, int offset) {
+	int bucket = hash_key(op, src1, src2, var, offset);
+	for (int i = buckets[bucket]; i != -1; i = entries[i].nextInBucket) {
+		CseEntry *entry = &entries[i];
+		if (entry->op == op && same_operand(entry->src1, src1) && same_operand(entry->src2, src2)
+			&& entry->var == var && entry->width == width && entry->offset == offset) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+static CseEntry *insert(IrOpcode op, IrOperand src1, IrOperand src2, IrVar *var,
+	int width, int offset, int value, IrBlock *block) {
+	if (numEntries == entriesCapacity) {
+		entriesCapacity = entriesCapacity == 0 ? 256 : entriesCapacity*2;
+		entries = realloc(entries, entriesCapacity * sizeof(CseEntry));
+	}
+	CseEntry *entry = &entries[numEntries];
+	entry->op = op;
+	entry->src1 = src1;
+	entry->src2 = src2;
+	entry->var = var;
+	entry->width = width;
+	entry->offset = offset;
+	entry->value = value;
+	entry->block = block;
+	entry->root = NULL;
+	entry->bucket = hash_key(op, src1, src2, var, offset);
+	entry->nextInBucket = buckets[entry->bucket];
+	buckets[entry->bucket] = numEntries++;
+	return entry;
+}
+
+/** Helpers **/
+
+static IrOperand number_of(IrOperand opnd) {
+	if (opnd.kind == IRO_VREG && opnd.val < numVregs) {
+		opnd.val = valueNumber[opnd.val];
+	}
+	return opnd;
+}
+
+static int is_commutative(IrOpcode op) {
+	return op == IR_ADD || op == IR_MUL || op == IR_SEQ || op == IR_SNE
+		|| op == IR_LAND || op == IR_LOR;
+}
+
+static int is_address(IrOperand opnd) {
+	return opnd.kind == IRO_VREG && func->vregTypes[opnd.val] == VT_ADDR;
+}
+
+//The array an address is in, or NULL if it isn't known
+static IrVar *root_of(IrOperand opnd) {
+	return is_address(opnd) && opnd.val < numVregs ? rootOf[leader[opnd.val]] : NULL;
+}
+
+//Could store write any of the bytes load read?
+static int may_alias(IrInstr *store, CseEntry *load) {
+	if (same_operand(number_of(store->src1), load->src1)) {
+		return store->offset < load->offset + load->width
+			&& load->offset < store->offset + store->width;
+	}
+
+	IrVar *a = root_of(store->src1);
+	IrVar *b = load->root;
+	if (a == NULL || b == NULL || a == b) {
+		return 1;
+	}
+	//A param array is one of the caller's - a global one, or one this function can't see
+	if (a->kind == VAR_PARAM || b->kind == VAR_PARAM) {
+		IrVar *other = a->kind == VAR_PARAM ? b : a;
+		return other->kind != VAR_LOCAL;
+	}
+	return 0;
+}
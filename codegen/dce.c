@@ -0,0 +1,262 @@
+/*
+	dce: deletes code whose result nothing needs.
+	- an instruction with no side effects whose dest is never read
+	  (this takes whole chains, e.g. the address arithmetic or loads
+	  feeding something deleted, and ldvars left behind by other
+	  passes). A call counts if the callee (and everything it calls)
+	  writes nothing outside itself, does no I/O and always returns
+	  (see effects.h) - its result needn't even be kept
+	- a store to a scalar param/local that's never read afterwards
+	  (liveness over the CFG, the same way regalloc.c works it out),
+	  like an index variable reset after the loop that used it
+	- locals nothing reads or writes any more, so they don't take up
+	  room in the frame
+
+	Stores to globals and into arrays are left alone: other functions
+	(or later reads through an address) can see them. A deleted div
+	or load can no longer trap, which only matters to programs that
+	would have died there anyway.
+
+	Code after a return is already gone - simplifycfg.c removes the
+	blocks nothing reaches.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "passmanager.h"
+#include "effects.h"
+
+static EffectsInfo *effects;
+
+//The function being worked on
+static IrFunction *func;
+static int words; //unsigned ints per bitset
+static int *useCount; //By vreg
+static unsigned *useSet, *defSet, *liveIn, *liveOut; //words per block id
+
+//For -stats
+static int numRemoved;
+static int numDeadStores;
+static int numLocalsDropped;
+
+static void eliminate_in_function();
+static int sweep();
+static void count_uses();
+static void compute_liveness();
+static void remove_instr(IrInstr *instr);
+static void drop_unused_locals();
+
+static int has_side_effects(IrInstr *instr);
+static int is_tracked(IrVar *var);
+static int bit_test(unsigned *set, int bit);
+static void bit_set(unsigned *set, int bit);
+static void bit_clear(unsigned *set, int bit);
+
+void eliminate_dead_code(IrProgram *prog) {
+	numRemoved = numDeadStores = numLocalsDropped = 0;
+	effects = find_effects(prog);
+
+	for (func = prog->functions; func != NULL; func = func->next) {
+		eliminate_in_function();
+	}
+	free_effects(effects);
+
+	if (printStats) {
+		fprintf(stderr, "dce: %d instructions removed (%d of them dead stores), "
+			"%d unused locals dropped\n", numRemoved, numDeadStores, numLocalsDropped);
+	}
+}
+
+static void eliminate_in_function() {
+	ir_rebuild_cfg(func);
+	words = (func->numVars + 31) / 32;
+	size_t setsSize = (size_t)func->numBlocks * words * sizeof(unsigned);
+	useSet = malloc(setsSize + 1);
+	defSet = malloc(setsSize + 1);
+	liveIn = malloc(setsSize + 1);
+	liveOut = malloc(setsSize + 1);
+	useCount = malloc((func->numVregs + 1) * sizeof(int));
+
+	//Deleting an ldvar can make a store in another block dead, so go round until that stops
+	while (sweep())
+		;
+	drop_unused_locals();
+
+	free(useSet);
+	free(defSet);
+	free(liveIn);
+	free(liveOut);
+	free(useCount);
+}
+
+/*
+	One backwards walk over every block, with the vars live at its
+	end to start with.
+	@return 1 if anything was deleted
+*/
+static int sweep() {
+	count_uses();
+	compute_liveness();
+	unsigned *live = malloc(words * sizeof(unsigned) + 1);
+	int changed = 0;
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		memcpy(live, &liveOut[block->id * words], words * sizeof(unsigned));
+
+		IrInstr *prev;
+		for (IrInstr *instr = block->last; instr != NULL; instr = prev) {
+			prev = instr->prev;
+			if (!has_side_effects(instr) && (instr->dest == -1 || useCount[instr->dest] == 0)) {
+				remove_instr(instr);
+				changed = 1;
+				continue;
+			}
+			if ((instr->op != IR_LDVAR && instr->op != IR_STVAR) || !is_tracked(instr->var)) {
+				continue;
+			}
+
+			int v = instr->var->id;
+			if (instr->op == IR_LDVAR) {
+				bit_set(live, v);
+			} else if (!bit_test(live, v)) {
+				remove_instr(instr);
+				numDeadStores++;
+				changed = 1;
+			} else {
+				bit_clear(live, v);
+			}
+		}
+	}
+	free(live);
+	return changed;
+}
+
+static void count_uses() {
+	memset(useCount, 0, (func->numVregs + 1) * sizeof(int));
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			IrOperand *uses[IR_MAX_USES];
+			int numUses = ir_get_uses(instr, uses);
+			for (int i=0; i < numUses; i++) {
+				if (uses[i]->kind == IRO_VREG) {
+					useCount[uses[i]->val]++;
+				}
+			}
+		}
+	}
+}
+
+//Which tracked vars each block reads before writing / writes, then live in/out to a fixpoint
+static void compute_liveness() {
+	size_t setsSize = (size_t)func->numBlocks * words * sizeof(unsigned);
+	memset(useSet, 0, setsSize);
+	memset(defSet, 0, setsSize);
+	memset(liveIn, 0, setsSize);
+	memset(liveOut, 0, setsSize);
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		unsigned *use = &useSet[block->id * words];
+		unsigned *def = &defSet[block->id * words];
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			if ((instr->op != IR_LDVAR && instr->op != IR_STVAR) || !is_tracked(instr->var)) {
+				continue;
+			}
+			int v = instr->var->id;
+			if (instr->op == IR_STVAR) {
+				bit_set(def, v);
+			} else if (!bit_test(def, v)) {
+				bit_set(use, v);
+			}
+		}
+	}
+
+	int changed = 1;
+	while (changed) {
+		changed = 0;
+		for (IrBlock *block = func->lastBlock; block != NULL; block = block->prev) {
+			unsigned *in = &liveIn[block->id * words];
+			unsigned *out = &liveOut[block->id * words];
+			unsigned *use = &useSet[block->id * words];
+			unsigned *def = &defSet[block->id * words];
+
+			for (int w=0; w < words; w++) {
+				unsigned newOut = 0;
+				for (int i=0; i < block->numSuccs; i++) {
+					newOut |= liveIn[block->succs[i]->id * words + w];
+				}
+				unsigned newIn = use[w] | (newOut & ~def[w]);
+				if (newIn != in[w] || newOut != out[w]) {
+					in[w] = newIn;
+					out[w] = newOut;
+					changed = 1;
+				}
+			}
+		}
+	}
+}
+
+//Deletes instr, and counts its operands as read once less
+static void remove_instr(IrInstr *instr) {
+	IrOperand *uses[IR_MAX_USES];
+	int numUses = ir_get_uses(instr, uses);
+	for (int i=0; i < numUses; i++) {
+		if (uses[i]->kind == IRO_VREG) {
+			useCount[uses[i]->val]--;
+		}
+	}
+	ir_remove(instr);
+	numRemoved++;
+}
+
+//Locals no instruction mentions come off the list (so layout_frame() never sees them)
+static void drop_unused_locals() {
+	char *mentioned = calloc(func->numVars + 1, 1);
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			if (instr->var != NULL && instr->var->kind != VAR_GLOBAL) {
+				mentioned[instr->var->id] = 1;
+			}
+		}
+	}
+
+	IrVar **link = &func->locals;
+	while (*link != NULL) {
+		if (!mentioned[(*link)->id]) {
+			*link = (*link)->next;
+			numLocalsDropped++;
+		} else {
+			link = &(*link)->next;
+		}
+	}
+	free(mentioned);
+}
+
+/** Helpers **/
+
+static int has_side_effects(IrInstr *instr) {
+	if (instr->op == IR_CALL) {
+		FuncEffects *callee = effects_of(effects, instr->callee);
+		return !is_pure(effects, callee) || !callee->alwaysReturns;
+	}
+	return ir_has_side_effects(instr);
+}
+
+//Scalar params/locals - nothing outside the function can read them
+static int is_tracked(IrVar *var) {
+	return var->kind != VAR_GLOBAL && var->dimension == -1;
+}
+
+static int bit_test(unsigned *set, int bit) {
+	return (set[bit / 32] >> (bit % 32)) & 1;
+}
+
+static void bit_set(unsigned *set, int bit) {
+	set[bit / 32] |= 1u << (bit % 32);
+}
+
+static void bit_clear(unsigned *set, int bit) {
+	set[bit / 32] &= ~(1u << (bit % 32));
+}
@@ -0,0 +1,69 @@
+/*
+	deadfuncs: drops functions that can't be called from main, so
+	they're never lowered or written out. Once the inliner has copied
+	a helper into every caller, or constprop has folded away the only
+	branch calling it, this is what gets rid of the original.
+
+	Reachability is just a walk of the call graph from main (calls
+	are all direct in C--). A program without a main is left alone.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "passmanager.h"
+
+//For -stats
+static int numRemoved;
+static int numFunctions;
+
+static void mark_reachable(IrFunction *f);
+
+void remove_unreachable_functions(IrProgram *prog) {
+	numRemoved = numFunctions = 0;
+
+	IrFunction *main = NULL;
+	for (IrFunction *f = prog->functions; f != NULL; f = f->next) {
+		f->mark = 0;
+		numFunctions++;
+		if (strcmp(f->name, "main") == 0) {
+			main = f;
+		}
+	}
+	if (main != NULL) {
+		mark_reachable(main);
+
+		IrFunction **link = &prog->functions;
+		prog->lastFunction = NULL;
+		while (*link != NULL) {
+			if (!(*link)->mark) {
+				free((*link)->vregTypes); //(the rest is in the arena)
+				*link = (*link)->next;
+				numRemoved++;
+			} else {
+				prog->lastFunction = *link;
+				link = &(*link)->next;
+			}
+		}
+	}
+
+	if (printStats) {
+		fprintf(stderr, "deadfuncs: %d of %d functions removed\n", numRemoved, numFunctions);
+	}
+}
+
+static void mark_reachable(IrFunction *f) {
+	if (f->mark) {
+		return;
+	}
+	f->mark = 1;
+	for (IrBlock *block = f->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			if (instr->op == IR_CALL) {
+				mark_reachable(instr->callee);
+			}
+		}
+	}
+}
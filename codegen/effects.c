@@ -0,0 +1,256 @@
+/*
+	Side effects of each function, for the passes that need to see
+	through calls (see effects.h).
+
+	A function's own ldvars/stvars of globals, loads/stores and I/O
+	come first, then whatever the functions it calls do, until that
+	stops growing (recursion goes round more than once). Loads and
+	stores whose address is worked out from one of its own local
+	arrays don't count: nothing outside can see those. Anything else
+	(a global array, an array param, a pointer kept in a local) might
+	be anyone's.
+
+	A function always returns if it has no loops (no cycle in its
+	CFG) and only calls functions that always return - which a call
+	back into a function still being looked at never does.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "effects.h"
+
+static EffectsInfo *info;
+
+static void find_local_effects(int i);
+static int is_own_array(IrFunction *f, IrOperand addr, IrInstr *use);
+static int has_loop(IrBlock *block);
+static int check_returns(int i);
+static int function_index(IrFunction *f);
+
+EffectsInfo *find_effects(IrProgram *prog) {
+	info = malloc(sizeof(EffectsInfo));
+	info->numFunctions = 0;
+	for (IrFunction *f = prog->functions; f != NULL; f = f->next) {
+		info->numFunctions++;
+	}
+	info->numGlobals = prog->numGlobals;
+	int n = info->numFunctions > 0 ? info->numFunctions : 1;
+	info->functions = malloc(n * sizeof(IrFunction *));
+	info->effects = calloc(n, sizeof(FuncEffects));
+
+	int i = 0;
+	for (IrFunction *f = prog->functions; f != NULL; f = f->next) {
+		info->functions[i] = f;
+		find_local_effects(i++);
+	}
+
+	int changed = 1;
+	while (changed) {
+		changed = 0;
+		for (i=0; i < info->numFunctions; i++) {
+			FuncEffects *effects = &info->effects[i];
+			for (IrBlock *block = info->functions[i]->entry; block != NULL; block = block->next) {
+				for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+					if (instr->op != IR_CALL) {
+						continue;
+					}
+					FuncEffects *callee = &info->effects[function_index(instr->callee)];
+					int before = effects->readsMemory + effects->writesMemory + effects->doesIo;
+					effects->readsMemory |= callee->readsMemory;
+					effects->writesMemory |= callee->writesMemory;
+					effects->doesIo |= callee->doesIo;
+					changed |= effects->readsMemory + effects->writesMemory + effects->doesIo != before;
+					for (int g=0; g < info->numGlobals; g++) {
+						if ((callee->readsGlobal[g] && !effects->readsGlobal[g])
+							|| (callee->writesGlobal[g] && !effects->writesGlobal[g])) {
+							effects->readsGlobal[g] |= callee->readsGlobal[g];
+							effects->writesGlobal[g] |= callee->writesGlobal[g];
+							changed = 1;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	//alwaysReturns: 0 not yet known, 1 being checked, 2 returns, 3 might not
+	for (i=0; i < info->numFunctions; i++) {
+		check_returns(i);
+	}
+	for (i=0; i < info->numFunctions; i++) {
+		info->effects[i].alwaysReturns = info->effects[i].alwaysReturns == 2;
+	}
+	return info;
+}
+
+void free_effects(EffectsInfo *effectsInfo) {
+	for (int i=0; i < effectsInfo->numFunctions; i++) {
+		free(effectsInfo->effects[i].readsGlobal);
+		free(effectsInfo->effects[i].writesGlobal);
+	}
+	free(effectsInfo->functions);
+	free(effectsInfo->effects);
+	free(effectsInfo);
+}
+
+FuncEffects *effects_of(EffectsInfo *effectsInfo, IrFunction *f) {
+	for (int i=0; i < effectsInfo->numFunctions; i++) {
+		if (effectsInfo->functions[i] == f) {
+			return &effectsInfo->effects[i];
+		}
+	}
+	return NULL;
+}
+
+int is_pure(EffectsInfo *effectsInfo, FuncEffects *effects) {
+	if (effects->writesMemory || effects->doesIo) {
+		return 0;
+	}
+	for (int g=0; g < effectsInfo->numGlobals; g++) {
+		if (effects->writesGlobal[g]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int is_const(EffectsInfo *effectsInfo, FuncEffects *effects) {
+	if (!is_pure(effectsInfo, effects) || effects->readsMemory) {
+		return 0;
+	}
+	for (int g=0; g < effectsInfo->numGlobals; g++) {
+		if (effects->readsGlobal[g]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+//What the function's own instructions do
+static void find_local_effects(int i) {
+	IrFunction *f = info->functions[i];
+	FuncEffects *effects = &info->effects[i];
+	int size = info->numGlobals > 0 ? info->numGlobals : 1;
+	effects->readsGlobal = calloc(size, 1);
+	effects->writesGlobal = calloc(size, 1);
+
+	for (IrBlock *block = f->entry; block != NULL; block = block->next) {
+		block->mark = 0;
+	}
+	effects->alwaysReturns = has_loop(f->entry) ? 3 : 0;
+	for (IrBlock *block = f->entry; block != NULL; block = block->next) {
+		block->mark = 0;
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			switch (instr->op) {
+				case IR_LDVAR:
+					if (instr->var->kind == VAR_GLOBAL) {
+						effects->readsGlobal[instr->var->id] = 1;
+					}
+					break;
+				case IR_STVAR:
+					if (instr->var->kind == VAR_GLOBAL) {
+						effects->writesGlobal[instr->var->id] = 1;
+					}
+					break;
+				case IR_LOAD:
+					effects->readsMemory |= !is_own_array(f, instr->src1, instr);
+					break;
+				case IR_STORE:
+					effects->writesMemory |= !is_own_array(f, instr->src1, instr);
+					break;
+				case IR_READ: case IR_WRITE: case IR_WRITELN:
+					effects->doesIo = 1;
+					break;
+				default:
+					break;
+			}
+		}
+	}
+}
+
+/*
+	Is addr (read by use) one of f's local arrays, plus or minus
+	something? Followed back through the block's adds/subs/movs to an
+	addr - anything else (an ldvar of a pointer, a vreg from another
+	block) might point anywhere.
+*/
+static int is_own_array(IrFunction *f, IrOperand addr, IrInstr *use) {
+	for (IrInstr *instr = use->prev; instr != NULL && addr.kind == IRO_VREG; instr = instr->prev) {
+		if (instr->dest != addr.val) {
+			continue;
+		}
+		switch (instr->op) {
+			case IR_ADDR:
+				return instr->var->kind == VAR_LOCAL;
+			case IR_MOV:
+				addr = instr->src1;
+				break;
+			case IR_ADD: case IR_SUB:
+				//The address is whichever side is one
+				if (instr->src1.kind == IRO_VREG && f->vregTypes[instr->src1.val] == VT_ADDR) {
+					addr = instr->src1;
+				} else if (instr->op == IR_ADD && instr->src2.kind == IRO_VREG
+					&& f->vregTypes[instr->src2.val] == VT_ADDR) {
+					addr = instr->src2;
+				} else {
+					return 0;
+				}
+				break;
+			default:
+				return 0;
+		}
+	}
+	return 0;
+}
+
+//Is there a cycle among the blocks reachable from block? (mark 1: on the way, 2: done)
+static int has_loop(IrBlock *block) {
+	if (block->mark == 1) {
+		return 1;
+	}
+	if (block->mark == 2) {
+		return 0;
+	}
+	block->mark = 1;
+	IrInstr *term = block->last;
+	int found = 0;
+	if (term != NULL && (term->op == IR_JUMP || term->op == IR_CBR)) {
+		found = has_loop(term->target[0]);
+		if (!found && term->op == IR_CBR) {
+			found = has_loop(term->target[1]);
+		}
+	}
+	block->mark = 2;
+	return found;
+}
+
+//Depth first down the call graph (see alwaysReturns above)
+static int check_returns(int i) {
+	FuncEffects *effects = &info->effects[i];
+	if (effects->alwaysReturns != 0) {
+		return effects->alwaysReturns == 2;
+	}
+	effects->alwaysReturns = 1;
+	int returns = 1;
+	for (IrBlock *block = info->functions[i]->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			if (instr->op == IR_CALL && !check_returns(function_index(instr->callee))) {
+				returns = 0;
+			}
+		}
+	}
+	effects->alwaysReturns = returns ? 2 : 3;
+	return returns;
+}
+
+static int function_index(IrFunction *f) {
+	for (int i=0; i < info->numFunctions; i++) {
+		if (info->functions[i] == f) {
+			return i;
+		}
+	}
+	return -1;
+}
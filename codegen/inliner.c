@@ -0,0 +1,324 @@
+/*
+	inline: replaces calls with a copy of the function being called,
+	which saves the whole call protocol (saving live $t registers,
+	moving args into $a registers, jal, the callee's prologue and
+	epilogue) and lets the other passes see both sides at once.
+
+	A call is inlined if the callee isn't recursive (it can't reach
+	itself through the call graph) and either it's small, or this is
+	the only place it's called from and it isn't huge - and the
+	caller doesn't grow past a limit. Functions are done in the order
+	they're declared, which (since C-- needs them declared before
+	use) means a callee has had its own calls inlined by the time
+	it's copied anywhere.
+
+	For the copy:
+	- the call's block is split: what came after the call moves to a
+	  new block that the copy's returns jump to
+	- every param and local of the callee becomes a new local of the
+	  caller, and the args are stored into the param copies. Array
+	  params become pointer locals holding the address that was
+	  passed (isPointer), so addr x turns into ldvar x
+	- the value returned goes through another local, which the call's
+	  dest vreg is then loaded from (if anything reads it)
+
+	The new locals are live across the whole caller as far as the
+	frame layout knows (scope ids only mean anything inside one
+	function). The callee itself is left alone, even if nothing
+	calls it any more.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "passmanager.h"
+#include "lexer.h"
+
+//Always worth inlining (about what the call protocol costs)
+#define SMALL_FUNCTION_SIZE 12
+//Only called from one place: inlined unless bigger than this
+#define SINGLE_CALL_FUNCTION_SIZE 150
+//Callers stop taking more inlined code past this size
+#define MAX_CALLER_SIZE 2000
+
+static IrProgram *prog;
+static IrFunction **functions; //In declaration order
+static int numFunctions;
+static int *numCallSites; //By function
+static char *isRecursive; //By function
+
+//For -stats
+static int numInlined;
+
+static void find_call_sites();
+static int reaches(int from, int target, char *visited);
+static int function_index(IrFunction *f);
+static int function_size(IrFunction *f);
+static int vreg_is_read(IrFunction *f, int vreg);
+static int should_inline(IrFunction *caller, IrInstr *call);
+static void inline_call(IrFunction *caller, IrInstr *call);
+static IrVar *copy_var(IrFunction *caller, IrFunction *callee, char *name, int type, int dimension);
+
+void inline_functions(IrProgram *p) {
+	prog = p;
+	numInlined = 0;
+	find_call_sites();
+
+	for (int i=0; i < numFunctions; i++) {
+		IrFunction *caller = functions[i];
+		int inlinedAny = 0;
+
+		//Inlined code isn't looked at again (so a call it copied in stays a call)
+		for (IrBlock *block = caller->entry; block != NULL; block = block->next) {
+			IrInstr *next;
+			for (IrInstr *instr = block->first; instr != NULL; instr = next) {
+				next = instr->next;
+				if (instr->op == IR_CALL && should_inline(caller, instr)) {
+					//The rest of block moves after the copy - carry on from there
+					inline_call(caller, instr);
+					block = next->block;
+					inlinedAny = 1;
+				}
+			}
+		}
+		if (inlinedAny) {
+			ir_rebuild_cfg(caller);
+		}
+	}
+
+	free(functions);
+	free(numCallSites);
+	free(isRecursive);
+	if (printStats) {
+		fprintf(stderr, "inline: %d calls inlined\n", numInlined);
+	}
+}
+
+//Counts every function's call sites, and works out which can end up calling themselves
+static void find_call_sites() {
+	numFunctions = 0;
+	for (IrFunction *f = prog->functions; f != NULL; f = f->next) {
+		numFunctions++;
+	}
+	functions = malloc((numFunctions > 0 ? numFunctions : 1) * sizeof(IrFunction *));
+	numCallSites = calloc(numFunctions > 0 ? numFunctions : 1, sizeof(int));
+	isRecursive = calloc(numFunctions > 0 ? numFunctions : 1, 1);
+
+	int i = 0;
+	for (IrFunction *f = prog->functions; f != NULL; f = f->next) {
+		functions[i++] = f;
+	}
+	for (i=0; i < numFunctions; i++) {
+		for (IrBlock *block = functions[i]->entry; block != NULL; block = block->next) {
+			for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+				if (instr->op == IR_CALL) {
+					numCallSites[function_index(instr->callee)]++;
+				}
+			}
+		}
+	}
+
+	char *visited = malloc(numFunctions > 0 ? numFunctions : 1);
+	for (i=0; i < numFunctions; i++) {
+		memset(visited, 0, numFunctions);
+		isRecursive[i] = reaches(i, i, visited);
+	}
+	free(visited);
+}
+
+//Can functions[from] get to functions[target] through calls (one or more)?
+static int reaches(int from, int target, char *visited) {
+	for (IrBlock *block = functions[from]->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			if (instr->op != IR_CALL) {
+				continue;
+			}
+			int callee = function_index(instr->callee);
+			if (callee == target) {
+				return 1;
+			}
+			if (!visited[callee]) {
+				visited[callee] = 1;
+				if (reaches(callee, target, visited)) {
+					return 1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+static int function_index(IrFunction *f) {
+	for (int i=0; i < numFunctions; i++) {
+		if (functions[i] == f) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+//Number of instructions in f
+static int function_size(IrFunction *f) {
+	int size = 0;
+	for (IrBlock *block = f->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			size++;
+		}
+	}
+	return size;
+}
+
+static int should_inline(IrFunction *caller, IrInstr *call) {
+	int callee = function_index(call->callee);
+	if (call->callee == caller || isRecursive[callee]) {
+		return 0;
+	}
+
+	int size = function_size(call->callee);
+	if (function_size(caller) + size > MAX_CALLER_SIZE) {
+		return 0;
+	}
+	return size <= SMALL_FUNCTION_SIZE
+		|| (numCallSites[callee] == 1 && size <= SINGLE_CALL_FUNCTION_SIZE);
+}
+
+static void inline_call(IrFunction *caller, IrInstr *call) {
+	IrFunction *callee = call->callee;
+	IrBlock *block = call->block;
+
+	//What came after the call goes in a block of its own, for the copy to return to
+	IrBlock *after = ir_new_block(caller);
+	ir_move_block_after(after, block);
+	while (call->next != NULL) {
+		IrInstr *instr = call->next;
+		ir_remove(instr);
+		ir_append(after, instr);
+	}
+	ir_remove(call);
+
+	//Callee's params/locals -> new locals of the caller
+	IrVar **varMap = calloc(callee->numVars > 0 ? callee->numVars : 1, sizeof(IrVar *));
+	for (IrVar *param = callee->params; param != NULL; param = param->next) {
+		//An array param is just the address it was passed
+		varMap[param->id] = copy_var(caller, callee, param->name, param->dimension == 0 ?
+			INTTOK : param->type, -1);
+		varMap[param->id]->isPointer = param->dimension == 0;
+	}
+	for (IrVar *local = callee->locals; local != NULL; local = local->next) {
+		varMap[local->id] = copy_var(caller, callee, local->name, local->type, local->dimension);
+		varMap[local->id]->isPointer = local->isPointer;
+	}
+	IrVar *result = NULL;
+	if (call->dest != -1 && vreg_is_read(caller, call->dest)) {
+		result = copy_var(caller, callee, "return", INTTOK, -1);
+		result->isPointer = caller->vregTypes[call->dest] == VT_ADDR;
+	}
+
+	//Bind the args
+	int i = 0;
+	for (IrVar *param = callee->params; param != NULL; param = param->next) {
+		ir_emit_stvar(block, varMap[param->id], call->args[i++]);
+	}
+
+	//Empty copies of the callee's blocks, in its layout order, between block and after
+	IrBlock **blockMap = calloc(callee->numBlocks, sizeof(IrBlock *));
+	IrBlock *pos = block;
+	for (IrBlock *calleeBlock = callee->entry; calleeBlock != NULL; calleeBlock = calleeBlock->next) {
+		blockMap[calleeBlock->id] = ir_new_block(caller);
+		ir_move_block_after(blockMap[calleeBlock->id], pos);
+		pos = blockMap[calleeBlock->id];
+	}
+	ir_emit_jump(block, blockMap[callee->entry->id]);
+
+	int *vregMap = malloc((callee->numVregs > 0 ? callee->numVregs : 1) * sizeof(int));
+	for (int v=0; v < callee->numVregs; v++) {
+		vregMap[v] = ir_new_vreg(caller, callee->vregTypes[v]);
+	}
+
+	for (IrBlock *calleeBlock = callee->entry; calleeBlock != NULL; calleeBlock = calleeBlock->next) {
+		IrBlock *copyBlock = blockMap[calleeBlock->id];
+		for (IrInstr *instr = calleeBlock->first; instr != NULL; instr = instr->next) {
+			if (instr->op == IR_RET) {
+				IrOperand value = instr->src1;
+				if (result != NULL && value.kind != IRO_NONE) {
+					ir_emit_stvar(copyBlock, result, value.kind == IRO_VREG ?
+						ir_vreg(vregMap[value.val]) : value);
+				}
+				ir_emit_jump(copyBlock, after);
+				continue;
+			}
+
+			IrInstr *copy = ir_new_instr(caller, instr->op);
+			*copy = *instr;
+			copy->mark = 0;
+			copy->block = NULL;
+			copy->prev = copy->next = NULL;
+			if (instr->dest != -1) {
+				copy->dest = vregMap[instr->dest];
+			}
+			if (instr->var != NULL && instr->var->kind != VAR_GLOBAL) {
+				copy->var = varMap[instr->var->id];
+				//The array's address is now just what the pointer holds
+				if (instr->op == IR_ADDR && instr->var->kind == VAR_PARAM) {
+					copy->op = IR_LDVAR;
+				}
+			}
+			if (instr->op == IR_CALL) {
+				copy->args = arena_alloc(&prog->arena, IR_MAX_ARGS*sizeof(IrOperand));
+				memcpy(copy->args, instr->args, instr->numArgs*sizeof(IrOperand));
+			}
+			for (int j=0; j < 2; j++) {
+				if (instr->target[j] != NULL) {
+					copy->target[j] = blockMap[instr->target[j]->id];
+				}
+			}
+
+			IrOperand *uses[IR_MAX_USES];
+			int numUses = ir_get_uses(copy, uses);
+			for (int j=0; j < numUses; j++) {
+				if (uses[j]->kind == IRO_VREG) {
+					uses[j]->val = vregMap[uses[j]->val];
+				}
+			}
+			ir_append(copyBlock, copy);
+		}
+	}
+
+	//The call becomes a load of what was returned
+	if (result != NULL) {
+		IrInstr *load = ir_new_instr(caller, IR_LDVAR);
+		load->dest = call->dest;
+		load->var = result;
+		ir_insert_before(after->first, load);
+	}
+
+	free(varMap);
+	free(blockMap);
+	free(vregMap);
+	numInlined++;
+}
+
+//A new local of caller standing in for callee's var name (e.g. "f.x")
+static IrVar *copy_var(IrFunction *caller, IrFunction *callee, char *name, int type, int dimension) {
+	char *copyName = arena_alloc(&prog->arena, strlen(callee->name) + strlen(name) + 2);
+	sprintf(copyName, "%s.%s", callee->name, name);
+	return ir_add_local(caller, copyName, type, dimension);
+}
+
+//Does anything in f read vreg?
+static int vreg_is_read(IrFunction *f, int vreg) {
+	for (IrBlock *block = f->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			IrOperand *uses[IR_MAX_USES];
+			int numUses = ir_get_uses(instr, uses);
+			for (int i=0; i < numUses; i++) {
+				if (uses[i]->kind == IRO_VREG && uses[i]->val == vreg) {
+					return 1;
+				}
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,513 @@
+/*
+	Building and editing the IR: programs, functions, blocks,
+	vregs and instructions, plus the CFG bookkeeping that passes
+	rely on. Everything is allocated in the program's arena, so
+	the whole IR goes away in one destroy_ir_program() call.
+
+	@author Noor Aftab
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include "ir.h"
+#include "lexer.h"
+#include "traversaltotable.h"
+
+//Starting size of a function's vreg type array
+#define INITIAL_VREG_CAPACITY 64
+
+static void *ir_alloc(IrProgram *prog, size_t size);
+static IrVar *new_var(IrProgram *prog, char *name, IrVarKind kind, int type, int dimension);
+static void add_pred(IrBlock *block, IrBlock *pred);
+
+/** Programs, functions, variables **/
+
+IrProgram *create_ir_program() {
+	IrProgram *prog = malloc(sizeof(IrProgram));
+	memset(prog, 0, sizeof(IrProgram));
+	init_arena(&prog->arena);
+	return prog;
+}
+
+void destroy_ir_program(IrProgram *prog) {
+	if (prog == NULL) {
+		return;
+	}
+
+	//vreg types are the only thing not in the arena (they get realloc-ed)
+	for (IrFunction *func = prog->functions; func != NULL; func = func->next) {
+		free(func->vregTypes);
+	}
+	release_arena(&prog->arena);
+	free(prog);
+}
+
+IrVar *ir_add_global(IrProgram *prog, char *name, int type, int dimension, int offset) {
+	IrVar *var = new_var(prog, name, VAR_GLOBAL, type, dimension);
+	var->offset = offset;
+	var->id = prog->numGlobals++;
+
+	IrVar **tail = &prog->globals;
+	while (*tail != NULL) {
+		tail = &(*tail)->next;
+	}
+	*tail = var;
+	return var;
+}
+
+IrFunction *ir_add_function(IrProgram *prog, char *name, int returnType) {
+	IrFunction *func = ir_alloc(prog, sizeof(IrFunction));
+	func->name = name;
+	func->returnType = returnType;
+	func->prog = prog;
+	func->vregCapacity = INITIAL_VREG_CAPACITY;
+	func->vregTypes = malloc(func->vregCapacity*sizeof(VregType));
+	func->clobberedRegs = -1;
+
+	if (prog->lastFunction == NULL) {
+		prog->functions = func;
+	} else {
+		prog->lastFunction->next = func;
+	}
+	prog->lastFunction = func;
+	return func;
+}
+
+//Params are kept in order, so the i-th one arrives in $a_i
+IrVar *ir_add_param(IrFunction *func, char *name, int type, int dimension) {
+	IrVar *var = new_var(func->prog, name, VAR_PARAM, type, dimension);
+	var->paramIndex = func->numParams++;
+	var->id = func->numVars++;
+
+	IrVar **tail = &func->params;
+	while (*tail != NULL) {
+		tail = &(*tail)->next;
+	}
+	*tail = var;
+	return var;
+}
+
+IrVar *ir_add_local(IrFunction *func, char *name, int type, int dimension) {
+	IrVar *var = new_var(func->prog, name, VAR_LOCAL, type, dimension);
+	var->id = func->numVars++;
+
+	IrVar **tail = &func->locals;
+	while (*tail != NULL) {
+		tail = &(*tail)->next;
+	}
+	*tail = var;
+	return var;
+}
+
+static IrVar *new_var(IrProgram *prog, char *name, IrVarKind kind, int type, int dimension) {
+	IrVar *var = ir_alloc(prog, sizeof(IrVar));
+	var->name = name;
+	var->kind = kind;
+	var->type = type;
+	var->dimension = dimension;
+	var->reg = -1; //Lives in memory unless regalloc says otherwise
+	var->scope = 0; //Until told otherwise, it's live across the whole function
+	var->scopeEnd = INT_MAX;
+	var->slotGroup = -1; //Shares a frame slot with nothing (see stackslots.c)
+
+	int eltSize = type == CHARTOK ? CHAR_SIZE : INT_SIZE;
+	if (dimension == -1) {
+		var->size = eltSize;
+	} else if (dimension == 0) { //Array param - just an address
+		var->size = INT_SIZE;
+	} else {
+		var->size = eltSize*dimension;
+	}
+	return var;
+}
+
+//Bytes an LDVAR/STVAR of var moves (array params hold a 4-byte address)
+int ir_var_width(IrVar *var) {
+	return (var->type == CHARTOK && var->dimension == -1) ? CHAR_SIZE : INT_SIZE;
+}
+
+/** Blocks and vregs **/
+
+IrBlock *ir_new_block(IrFunction *func) {
+	IrBlock *block = ir_alloc(func->prog, sizeof(IrBlock));
+	block->id = func->numBlocks++;
+	block->func = func;
+
+	block->prev = func->lastBlock;
+	if (func->lastBlock == NULL) {
+		func->entry = block;
+	} else {
+		func->lastBlock->next = block;
+	}
+	func->lastBlock = block;
+	return block;
+}
+
+int ir_new_vreg(IrFunction *func, VregType type) {
+	if (func->numVregs == func->vregCapacity) {
+		func->vregCapacity *= 2;
+		func->vregTypes = realloc(func->vregTypes, func->vregCapacity*sizeof(VregType));
+	}
+	func->vregTypes[func->numVregs] = type;
+	return func->numVregs++;
+}
+
+void ir_remove_block(IrBlock *block) {
+	IrFunction *func = block->func;
+
+	if (block->prev != NULL) {
+		block->prev->next = block->next;
+	} else {
+		func->entry = block->next;
+	}
+	if (block->next != NULL) {
+		block->next->prev = block->prev;
+	} else {
+		func->lastBlock = block->prev;
+	}
+	block->prev = block->next = NULL;
+}
+
+void ir_move_block_after(IrBlock *block, IrBlock *pos) {
+	if (block == pos || pos->next == block) {
+		return;
+	}
+	ir_remove_block(block);
+
+	block->prev = pos;
+	block->next = pos->next;
+	if (pos->next != NULL) {
+		pos->next->prev = block;
+	} else {
+		block->func->lastBlock = block;
+	}
+	pos->next = block;
+}
+
+/** Operands **/
+
+IrOperand ir_vreg(int vreg) {
+	IrOperand opnd = { IRO_VREG, vreg };
+	return opnd;
+}
+
+IrOperand ir_imm(int immed) {
+	IrOperand opnd = { IRO_IMM, immed };
+	return opnd;
+}
+
+IrOperand ir_none() {
+	IrOperand opnd = { IRO_NONE, 0 };
+	return opnd;
+}
+
+/** Instructions **/
+
+IrInstr *ir_new_instr(IrFunction *func, IrOpcode op) {
+	IrInstr *instr = ir_alloc(func->prog, sizeof(IrInstr));
+	instr->op = op;
+	instr->dest = -1;
+	return instr;
+}
+
+void ir_append(IrBlock *block, IrInstr *instr) {
+	instr->block = block;
+	instr->prev = block->last;
+	instr->next = NULL;
+
+	if (block->last == NULL) {
+		block->first = instr;
+	} else {
+		block->last->next = instr;
+	}
+	block->last = instr;
+}
+
+void ir_insert_before(IrInstr *pos, IrInstr *instr) {
+	IrBlock *block = pos->block;
+	instr->block = block;
+	instr->next = pos;
+	instr->prev = pos->prev;
+
+	if (pos->prev == NULL) {
+		block->first = instr;
+	} else {
+		pos->prev->next = instr;
+	}
+	pos->prev = instr;
+}
+
+void ir_remove(IrInstr *instr) {
+	IrBlock *block = instr->block;
+
+	if (instr->prev == NULL) {
+		block->first = instr->next;
+	} else {
+		instr->prev->next = instr->next;
+	}
+	if (instr->next == NULL) {
+		block->last = instr->prev;
+	} else {
+		instr->next->prev = instr->prev;
+	}
+	instr->prev = instr->next = NULL;
+	instr->block = NULL;
+}
+
+/** Emitters **/
+
+int ir_emit_binary(IrBlock *block, IrOpcode op, IrOperand src1, IrOperand src2) {
+	IrFunction *func = block->func;
+	IrInstr *instr = ir_new_instr(func, op);
+
+	//Adding an int to an address (or the other way around) gives an address
+	VregType type = VT_INT;
+	if ((op == IR_ADD || op == IR_SUB) && ((src1.kind == IRO_VREG
+		&& func->vregTypes[src1.val] == VT_ADDR) || (src2.kind == IRO_VREG
+		&& func->vregTypes[src2.val] == VT_ADDR))) {
+		type = VT_ADDR;
+	}
+
+	instr->dest = ir_new_vreg(func, type);
+	instr->src1 = src1;
+	instr->src2 = src2;
+	ir_append(block, instr);
+	return instr->dest;
+}
+
+int ir_emit_unary(IrBlock *block, IrOpcode op, IrOperand src1) {
+	IrFunction *func = block->func;
+	IrInstr *instr = ir_new_instr(func, op);
+
+	VregType type = VT_INT;
+	if (op == IR_MOV && src1.kind == IRO_VREG) {
+		type = func->vregTypes[src1.val];
+	}
+
+	instr->dest = ir_new_vreg(func, type);
+	instr->src1 = src1;
+	ir_append(block, instr);
+	return instr->dest;
+}
+
+int ir_emit_ldvar(IrBlock *block, IrVar *var) {
+	IrInstr *instr = ir_new_instr(block->func, IR_LDVAR);
+	instr->dest = ir_new_vreg(block->func, var->isPointer ? VT_ADDR : VT_INT);
+	instr->var = var;
+	ir_append(block, instr);
+	return instr->dest;
+}
+
+void ir_emit_stvar(IrBlock *block, IrVar *var, IrOperand src1) {
+	IrInstr *instr = ir_new_instr(block->func, IR_STVAR);
+	instr->var = var;
+	instr->src1 = src1;
+	ir_append(block, instr);
+}
+
+int ir_emit_addr(IrBlock *block, IrVar *var) {
+	IrInstr *instr = ir_new_instr(block->func, IR_ADDR);
+	instr->dest = ir_new_vreg(block->func, VT_ADDR);
+	instr->var = var;
+	ir_append(block, instr);
+	return instr->dest;
+}
+
+int ir_emit_load(IrBlock *block, int width, IrOperand addr, int offset) {
+	IrInstr *instr = ir_new_instr(block->func, IR_LOAD);
+	instr->dest = ir_new_vreg(block->func, VT_INT);
+	instr->width = width;
+	instr->src1 = addr;
+	instr->offset = offset;
+	ir_append(block, instr);
+	return instr->dest;
+}
+
+void ir_emit_store(IrBlock *block, int width, IrOperand addr, int offset, IrOperand src) {
+	IrInstr *instr = ir_new_instr(block->func, IR_STORE);
+	instr->width = width;
+	instr->src1 = addr;
+	instr->offset = offset;
+	instr->src2 = src;
+	ir_append(block, instr);
+}
+
+int ir_emit_call(IrBlock *block, IrFunction *callee, IrOperand *args, int numArgs) {
+	IrFunction *func = block->func;
+	IrInstr *instr = ir_new_instr(func, IR_CALL);
+	instr->dest = ir_new_vreg(func, VT_INT);
+	instr->callee = callee;
+	instr->numArgs = numArgs;
+	instr->args = ir_alloc(func->prog, (numArgs > 0 ? numArgs : 1)*sizeof(IrOperand));
+	memcpy(instr->args, args, numArgs*sizeof(IrOperand));
+	ir_append(block, instr);
+	return instr->dest;
+}
+
+int ir_emit_read(IrBlock *block) {
+	IrInstr *instr = ir_new_instr(block->func, IR_READ);
+	instr->dest = ir_new_vreg(block->func, VT_INT);
+	ir_append(block, instr);
+	return instr->dest;
+}
+
+void ir_emit_write(IrBlock *block, IrOperand src1) {
+	IrInstr *instr = ir_new_instr(block->func, IR_WRITE);
+	instr->src1 = src1;
+	ir_append(block, instr);
+}
+
+void ir_emit_writeln(IrBlock *block) {
+	ir_append(block, ir_new_instr(block->func, IR_WRITELN));
+}
+
+void ir_emit_jump(IrBlock *block, IrBlock *target) {
+	IrInstr *instr = ir_new_instr(block->func, IR_JUMP);
+	instr->target[0] = target;
+	ir_append(block, instr);
+}
+
+void ir_emit_cbr(IrBlock *block, IrOpcode cond, IrOperand src1, IrOperand src2,
+	IrBlock *ifTrue, IrBlock *ifFalse) {
+	IrInstr *instr = ir_new_instr(block->func, IR_CBR);
+	instr->cond = cond;
+	instr->src1 = src1;
+	instr->src2 = src2;
+	instr->target[0] = ifTrue;
+	instr->target[1] = ifFalse;
+	ir_append(block, instr);
+}
+
+void ir_emit_ret(IrBlock *block, IrOperand src1) {
+	IrInstr *instr = ir_new_instr(block->func, IR_RET);
+	instr->src1 = src1;
+	ir_append(block, instr);
+}
+
+/** CFG **/
+
+void ir_rebuild_cfg(IrFunction *func) {
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		block->numPreds = 0;
+	}
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		IrInstr *term = block->last;
+		block->numSuccs = 0;
+
+		if (term == NULL) {
+			continue;
+		}
+		if (term->op == IR_JUMP) {
+			block->succs[block->numSuccs++] = term->target[0];
+		} else if (term->op == IR_CBR) {
+			block->succs[block->numSuccs++] = term->target[0];
+			//Both ways to the same place is still just one edge
+			if (term->target[1] != term->target[0]) {
+				block->succs[block->numSuccs++] = term->target[1];
+			}
+		}
+
+		for (int i=0; i < block->numSuccs; i++) {
+			add_pred(block->succs[i], block);
+		}
+	}
+}
+
+static void add_pred(IrBlock *block, IrBlock *pred) {
+	//Out of room: double it (the old array just stays in the arena)
+	if (block->numPreds == block->predCapacity) {
+		int newCapacity = block->predCapacity == 0 ? 2 : 2*block->predCapacity;
+		IrBlock **newPreds = ir_alloc(block->func->prog, newCapacity*sizeof(IrBlock *));
+		if (block->numPreds > 0) {
+			memcpy(newPreds, block->preds, block->numPreds*sizeof(IrBlock *));
+		}
+		block->preds = newPreds;
+		block->predCapacity = newCapacity;
+	}
+	block->preds[block->numPreds++] = pred;
+}
+
+/** Questions about instructions **/
+
+int ir_is_terminator(IrOpcode op) {
+	return op == IR_JUMP || op == IR_CBR || op == IR_RET;
+}
+
+int ir_has_dest(IrOpcode op) {
+	switch (op) {
+		case IR_STVAR: case IR_STORE: case IR_WRITE: case IR_WRITELN:
+		case IR_JUMP: case IR_CBR: case IR_RET:
+			return 0;
+		default:
+			return 1;
+	}
+}
+
+//If it does anything besides writing its dest (so can't just be deleted)
+int ir_has_side_effects(IrInstr *instr) {
+	switch (instr->op) {
+		case IR_STVAR: case IR_STORE: case IR_CALL:
+		case IR_READ: case IR_WRITE: case IR_WRITELN:
+		case IR_JUMP: case IR_CBR: case IR_RET:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/*
+	Collects pointers to every operand instr reads, so passes can
+	look at (or rewrite) them without caring which opcode it is.
+	@return number of operands put in uses
+*/
+int ir_get_uses(IrInstr *instr, IrOperand **uses) {
+	int numUses = 0;
+
+	if (instr->src1.kind != IRO_NONE) {
+		uses[numUses++] = &instr->src1;
+	}
+	if (instr->src2.kind != IRO_NONE) {
+		uses[numUses++] = &instr->src2;
+	}
+	if (instr->op == IR_CALL) {
+		for (int i=0; i < instr->numArgs; i++) {
+			uses[numUses++] = &instr->args[i];
+		}
+	}
+	return numUses;
+}
+
+IrOpcode ir_invert_cond(IrOpcode cond) {
+	switch (cond) {
+		case IR_SEQ: return IR_SNE;
+		case IR_SNE: return IR_SEQ;
+		case IR_SLT: return IR_SGE;
+		case IR_SLE: return IR_SGT;
+		case IR_SGT: return IR_SLE;
+		case IR_SGE: return IR_SLT;
+		default:
+			codegen_error("Not a comparison!", inFile, outFile);
+			return cond;
+	}
+}
+
+IrOpcode ir_swap_cond(IrOpcode cond) {
+	switch (cond) {
+		case IR_SLT: return IR_SGT;
+		case IR_SLE: return IR_SGE;
+		case IR_SGT: return IR_SLT;
+		case IR_SGE: return IR_SLE;
+		default: //== and != don't care about order
+			return cond;
+	}
+}
+
+//Zeroed memory from the program's arena
+static void *ir_alloc(IrProgram *prog, size_t size) {
+	void *mem = arena_alloc(&prog->arena, size);
+	memset(mem, 0, size);
+	return mem;
+}
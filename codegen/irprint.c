@@ -0,0 +1,184 @@
+/*
+	Prints the IR in a readable form (mycc -print-ir). Looks like:
+
+	function max(int a, int b)
+	  locals: int m
+	bb0:
+	  %v0 = ldvar a
+	  %v1 = ldvar b
+	  cbr sgt %v0, %v1 -> bb1, bb2
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include "ir.h"
+#include "lexer.h"
+#include "tablemechanics.h"
+
+static const char *opcodeNames[NUM_IR_OPCODES] = {
+	"add", "sub", "mul", "div",
+	"seq", "sne", "slt", "sle", "sgt", "sge",
+	"land", "lor",
+	"neg", "not", "mov",
+	"ldvar", "stvar", "addr", "load", "store", "call",
+	"read", "write", "writeln",
+	"jump", "cbr", "ret"
+};
+
+static void print_operand(FILE *out, IrOperand opnd);
+static void print_var_decl(FILE *out, IrVar *var);
+
+const char *ir_opcode_name(IrOpcode op) {
+	if (op < 0 || op >= NUM_IR_OPCODES) {
+		return "???";
+	}
+	return opcodeNames[op];
+}
+
+void print_ir_instr(FILE *out, IrInstr *instr) {
+	fprintf(out, "  ");
+	if (instr->dest != -1) {
+		fprintf(out, "%%v%d", instr->dest);
+		IrFunction *func = instr->block != NULL ? instr->block->func : NULL;
+		if (func != NULL && instr->dest < func->numVregs
+			&& func->vregTypes[instr->dest] == VT_ADDR) {
+			fprintf(out, ":addr");
+		}
+		fprintf(out, " = ");
+	}
+
+	switch (instr->op) {
+		case IR_LDVAR: case IR_ADDR:
+			fprintf(out, "%s %s", ir_opcode_name(instr->op), instr->var->name);
+			break;
+		case IR_STVAR:
+			fprintf(out, "stvar %s, ", instr->var->name);
+			print_operand(out, instr->src1);
+			break;
+		case IR_LOAD:
+			fprintf(out, "load.%d [", instr->width);
+			print_operand(out, instr->src1);
+			fprintf(out, "%+d]", instr->offset);
+			break;
+		case IR_STORE:
+			fprintf(out, "store.%d [", instr->width);
+			print_operand(out, instr->src1);
+			fprintf(out, "%+d], ", instr->offset);
+			print_operand(out, instr->src2);
+			break;
+		case IR_CALL:
+			fprintf(out, "%s %s(", instr->isTailCall ? "tailcall" : "call", instr->callee->name);
+			for (int i=0; i < instr->numArgs; i++) {
+				if (i > 0) {
+					fprintf(out, ", ");
+				}
+				print_operand(out, instr->args[i]);
+			}
+			fprintf(out, ")");
+			break;
+		case IR_JUMP:
+			fprintf(out, "jump bb%d", instr->target[0]->id);
+			break;
+		case IR_CBR:
+			fprintf(out, "cbr %s ", ir_opcode_name(instr->cond));
+			print_operand(out, instr->src1);
+			fprintf(out, ", ");
+			print_operand(out, instr->src2);
+			fprintf(out, " -> bb%d, bb%d", instr->target[0]->id, instr->target[1]->id);
+			break;
+		default:
+			fprintf(out, "%s", ir_opcode_name(instr->op));
+			if (instr->src1.kind != IRO_NONE) {
+				fprintf(out, " ");
+				print_operand(out, instr->src1);
+			}
+			if (instr->src2.kind != IRO_NONE) {
+				fprintf(out, ", ");
+				print_operand(out, instr->src2);
+			}
+	}
+	fprintf(out, "\n");
+}
+
+void print_ir_function(FILE *out, IrFunction *func) {
+	fprintf(out, "function %s(", func->name);
+	for (IrVar *param = func->params; param != NULL; param = param->next) {
+		print_var_decl(out, param);
+		if (param->next != NULL) {
+			fprintf(out, ", ");
+		}
+	}
+	fprintf(out, ")\n");
+
+	if (func->locals != NULL) {
+		fprintf(out, "  locals:");
+		for (IrVar *local = func->locals; local != NULL; local = local->next) {
+			fprintf(out, " ");
+			print_var_decl(out, local);
+			if (local->next != NULL) {
+				fprintf(out, ",");
+			}
+		}
+		fprintf(out, "\n");
+	}
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		fprintf(out, "bb%d:", block->id);
+		if (block->numPreds > 0) {
+			fprintf(out, "  ; preds:");
+			for (int i=0; i < block->numPreds; i++) {
+				fprintf(out, " bb%d", block->preds[i]->id);
+			}
+		}
+		fprintf(out, "\n");
+
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			print_ir_instr(out, instr);
+		}
+	}
+	fprintf(out, "\n");
+}
+
+void print_ir_program(FILE *out, IrProgram *prog) {
+	for (IrVar *global = prog->globals; global != NULL; global = global->next) {
+		fprintf(out, "global ");
+		print_var_decl(out, global);
+		fprintf(out, "  ; %d($gp)\n", global->offset);
+	}
+	if (prog->globals != NULL) {
+		fprintf(out, "\n");
+	}
+
+	for (IrFunction *func = prog->functions; func != NULL; func = func->next) {
+		print_ir_function(out, func);
+	}
+}
+
+static void print_operand(FILE *out, IrOperand opnd) {
+	switch (opnd.kind) {
+		case IRO_VREG:
+			fprintf(out, "%%v%d", opnd.val);
+			break;
+		case IRO_IMM:
+			fprintf(out, "%d", opnd.val);
+			break;
+		case IRO_NONE:
+			fprintf(out, "_");
+			break;
+	}
+}
+
+//e.g. "int x", "char buf[10]", "int arr[]", "addr &arr[i]"
+static void print_var_decl(FILE *out, IrVar *var) {
+	fprintf(out, "%s %s", var->isPointer ? "addr" : var->type == CHARTOK ? "char" : "int",
+		var->name);
+	if (var->dimension > 0) {
+		fprintf(out, "[%d]", var->dimension);
+	} else if (var->dimension == 0) {
+		fprintf(out, "[]");
+	}
+	if (var->reg != -1) {
+		fprintf(out, " (in %s)", getRegStr(var->reg));
+	}
+}
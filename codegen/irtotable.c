@@ -0,0 +1,1082 @@
+/*
+	Lowers the IR into MIPS, filling in the code table through the
+	helpers in traversaltotable.c. This is the only place that knows
+	about the stack frame and which real register a vreg ends up in.
+
+	Every function gets one fixed-size frame: $sp moves once in the
+	prologue and once in the epilogue, and nowhere in between, so
+	there's no frame pointer. Laid out from the top (offsets from $sp
+	on entry):
+		-4: saved $ra
+		then the $s registers the function uses, then params/locals
+		that aren't kept in registers, then spill slots
+	and at the very bottom, from 0($sp) up, room for the $t registers
+	saved around calls. Locals of blocks that can't be live at the same
+	time (siblings, like the two arms of an if) share slots, and so do
+	the ones stackslots.c finds are never live together. With that pass
+	on, vars are laid out words first and chars last (so there's no
+	padding between them), and spill slots of vregs that have died are
+	handed out again.
+
+	While a function is lowered, frame slots are addressed off $fp as a
+	stand-in for "$sp on entry"; once the frame size is known they're
+	all rewritten to be off $sp (see address_off_sp()).
+
+	Leaf functions (no calls) don't save $ra, and if nothing of theirs
+	ends up in memory (no frame slots, no saved $s registers) they
+	don't move $sp either - the $sp adjustments are taken back out once
+	the frame size is known (see drop_sp_moves()). Anything below $sp
+	is fair game for whatever runs next, so a leaf that does keep
+	something in its frame moves $sp like everyone else.
+	Tail calls (see tailcall.c) don't count as calls for this: they
+	take the frame down like the epilogue does and jump to the callee,
+	which returns straight to our caller with our $ra.
+
+	Registers: params/locals that regalloc.c gave an $s register live
+	there for the whole function. vregs that live inside a single block
+	are given a $t0-$t7 register from their definition to their last
+	use (spilling the one used furthest away when they run out) - or
+	just use the $s register of the variable they were loaded from, if
+	that isn't written in the meantime. vregs used across blocks live
+	in a frame slot. $t8/$t9 are scratch for immediates and reloads.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "irtotable.h"
+#include "passmanager.h"
+#include "traversaltotable.h"
+#include "tablemechanics.h"
+#include "lexer.h"
+
+//$t0-$t7 are handed out to vregs
+#define NUM_VREG_REGISTERS 8
+#define SCRATCH1 T8
+#define SCRATCH2 T9
+
+//vregHome value for a vreg that shows up in more than one block
+#define MULTI_BLOCK -2
+
+//Bytes at the top of the frame for the saved $ra
+#define SAVED_REGS_SIZE REGISTER_SIZE
+//$s0-$s7 can hold variables
+#define NUM_VAR_REGISTERS 8
+
+/** Per-function state **/
+static int frameSize; //Bytes used below $sp-on-entry so far (not counting the call save area)
+static int callSaveSize; //Bytes at the bottom of the frame for saving $t registers around calls
+static int *vregReg; //Register holding each vreg, or -1
+static int *vregSlot; //Each vreg's spill slot offset (from $sp on entry), or 0 if it has none
+static int *vregHome; //Block id each vreg is used in (or MULTI_BLOCK)
+static int *lastUse; //Index (in its block) of each vreg's last use, or -1
+static int regVreg[NUM_VREG_REGISTERS]; //vreg held by $t_i, or -1
+static Instruction **blockLabels; //By block id, NULL if nothing branches there
+static Instruction *epilogueLabel;
+static int isLeaf;
+static int *popIndices; //Where $sp is put back (the epilogue and each tail call)...
+static int numPops; //...which gets the frame size filled in at the end
+static int savedRegSlot[NUM_VAR_REGISTERS]; //Where $s_i is saved, or 0 if the function doesn't use it
+static int knownClobbers; //The callconv pass is on: calls only save what the callee writes
+static int callClobbers; //$t registers the functions this one calls write (see IrFunction.clobberedRegs)
+static int sharingSlots; //The stackslots pass is on: vars are sorted, and spill slots handed back
+static int strengthReduce; //The strength pass is on: * and / by constants use adds/magic numbers (see add_binary_immed_instr())
+static int *freeSpillSlots; //Spill slots of vregs that have died
+static int numFreeSpillSlots;
+
+//For -stats
+static int numCalls;
+static int numSavedAtCalls; //Registers saved (and restored) around them
+static int callsSaving[NUM_VREG_REGISTERS+1]; //How many calls save 0, 1, ... registers
+
+static void lower_function(IrFunction *func);
+static void layout_frame(IrFunction *func, int isLeaf);
+static int is_leaf(IrFunction *func);
+static void take_down_frame();
+static int slots_overlap(IrVar *a, IrVar *b);
+static int in_same_group(IrVar *a, IrVar *b);
+static void sort_by_alignment(IrVar **vars, int n);
+static int alignment_class(IrVar *var);
+static void free_dead_spill_slots(IrInstr *instr, int index);
+static int regs_written(int first);
+static void address_off_sp(int first, int delta);
+static void drop_sp_moves(int funcStart);
+static void find_vreg_homes(IrFunction *func);
+static void make_block_labels(IrFunction *func);
+static void lower_block(IrBlock *block);
+static void compute_last_uses(IrBlock *block);
+static void lower_instr(IrInstr *instr, int index);
+static void lower_call(IrInstr *instr, int index);
+static void load_args(IrInstr *instr, int *argRegs);
+static void lower_cbr(IrInstr *instr, int index);
+static int can_use_var_reg(IrInstr *load, int index);
+static void branch_on(IrOpcode cond, int src1, Operand src2, IrBlock *target);
+
+static int use_reg(IrOperand opnd, int scratch);
+static void release_dying(IrInstr *instr, int index);
+static int def_reg(IrInstr *instr, int index);
+static void finish_def(IrInstr *instr, int reg);
+static int spill_slot(int vreg);
+static void add_binary_instr(IrOpcode op, int dest_reg, int src_reg1, int src_reg2);
+static int add_binary_immed_instr(IrOpcode op, int dest_reg, int src_reg1, int k);
+
+void lower_ir_to_table(IrProgram *prog) {
+	setup_mips_code();
+
+	for (IrFunction *func = prog->functions; func != NULL; func = func->next) {
+		lower_function(func);
+	}
+
+	if (printStats) {
+		fprintf(stderr, "calls: %d call sites, %d registers saved/restored around them "
+			"(%.2f per call)\n", numCalls, numSavedAtCalls,
+			numCalls > 0 ? (double)numSavedAtCalls / numCalls : 0.0);
+		for (int i=0; i <= NUM_VREG_REGISTERS; i++) {
+			if (callsSaving[i] > 0) {
+				fprintf(stderr, "  %d calls save %d register%s\n", callsSaving[i], i,
+					i == 1 ? "" : "s");
+			}
+		}
+	}
+}
+
+static void lower_function(IrFunction *func) {
+	int numVregs = func->numVregs > 0 ? func->numVregs : 1;
+	vregReg = malloc(numVregs*sizeof(int));
+	vregSlot = calloc(numVregs, sizeof(int));
+	vregHome = malloc(numVregs*sizeof(int));
+	lastUse = malloc(numVregs*sizeof(int));
+	blockLabels = calloc(func->numBlocks, sizeof(Instruction *));
+	memset(vregReg, -1, numVregs*sizeof(int));
+
+	int numTailCalls = 0;
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			numTailCalls += instr->op == IR_CALL && instr->isTailCall;
+		}
+	}
+	popIndices = malloc((numTailCalls+1) * sizeof(int));
+	numPops = 0;
+
+	freeSpillSlots = malloc(numVregs*sizeof(int));
+	numFreeSpillSlots = 0;
+	sharingSlots = pass_enabled("stackslots");
+	knownClobbers = pass_enabled("callconv");
+	strengthReduce = pass_enabled("strength");
+	callClobbers = 0;
+
+	isLeaf = is_leaf(func);
+	layout_frame(func, isLeaf);
+	callSaveSize = 0;
+	find_vreg_homes(func);
+	make_block_labels(func);
+	epilogueLabel = generate_unique_label();
+
+	/** Prologue - $sp's adjustment is filled in once we know the frame size **/
+	generate_function_label(func->name);
+	int funcStart = codeTable->numInstructions;
+	add_immed_instr(SP, SP, 0);
+	if (!isLeaf) {
+		store_word_instr(RA, -REGISTER_SIZE, FP);
+	}
+	for (int i=0; i < NUM_VAR_REGISTERS; i++) {
+		if (savedRegSlot[i] != 0) {
+			store_word_instr(S0+i, savedRegSlot[i], FP);
+		}
+	}
+
+	//Params arrive in $a_i, and go to their register or frame slot
+	for (IrVar *param = func->params; param != NULL; param = param->next) {
+		if (param->reg != -1 && ir_var_width(param) == CHAR_SIZE) {
+			sign_extend_byte(param->reg, A0+param->paramIndex);
+		} else if (param->reg != -1) {
+			move_registers(param->reg, A0+param->paramIndex);
+		} else if (ir_var_width(param) == CHAR_SIZE) {
+			store_byte_instr(A0+param->paramIndex, param->offset, FP);
+		} else {
+			store_word_instr(A0+param->paramIndex, param->offset, FP);
+		}
+	}
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		lower_block(block);
+	}
+
+	/** Epilogue **/
+	add_instr_to_code_table(epilogueLabel);
+	take_down_frame();
+	jump_to_register(RA);
+
+	//Spill slots and call save space have all been handed out by now
+	frameSize += callSaveSize;
+	if (frameSize%ALIGN != 0) {
+		frameSize += ALIGN - frameSize%ALIGN;
+	}
+	if (isLeaf && frameSize == 0) {
+		drop_sp_moves(funcStart);
+	} else {
+		codeTable->instrSet[funcStart].op3.val.immed = -frameSize;
+		for (int i=0; i < numPops; i++) {
+			codeTable->instrSet[popIndices[i]].op3.val.immed = frameSize;
+		}
+		address_off_sp(funcStart, frameSize);
+	}
+	func->clobberedRegs = callClobbers | regs_written(funcStart);
+
+	free(vregReg);
+	free(vregSlot);
+	free(vregHome);
+	free(lastUse);
+	free(blockLabels);
+	free(popIndices);
+	free(freeSpillSlots);
+}
+
+//Puts back the $s registers, $ra and $sp, ready to leave
+static void take_down_frame() {
+	for (int i=0; i < NUM_VAR_REGISTERS; i++) {
+		if (savedRegSlot[i] != 0) {
+			load_word_instr(S0+i, savedRegSlot[i], FP);
+		}
+	}
+	if (!isLeaf) {
+		load_word_instr(RA, -REGISTER_SIZE, FP);
+	}
+	popIndices[numPops++] = codeTable->numInstructions;
+	add_immed_instr(SP, SP, 0);
+}
+
+//Gives every $s register in use, and every param/local in memory, its offset from $sp on entry
+static void layout_frame(IrFunction *func, int isLeaf) {
+	frameSize = isLeaf ? 0 : SAVED_REGS_SIZE;
+
+	//The callee saves $s registers - but only the ones it uses
+	memset(savedRegSlot, 0, sizeof(savedRegSlot));
+	for (int pass=0; pass < 2; pass++) {
+		IrVar *var = pass == 0 ? func->params : func->locals;
+		for (; var != NULL; var = var->next) {
+			if (var->reg != -1 && savedRegSlot[var->reg-S0] == 0) {
+				frameSize += REGISTER_SIZE;
+				savedRegSlot[var->reg-S0] = -frameSize;
+			}
+		}
+	}
+
+	IrVar **memVars = malloc((func->numVars + 1) * sizeof(IrVar *));
+	int numMemVars = 0;
+	for (int pass=0; pass < 2; pass++) {
+		IrVar *var = pass == 0 ? func->params : func->locals;
+		for (; var != NULL; var = var->next) {
+			if (var->reg == -1) {
+				memVars[numMemVars++] = var;
+			}
+		}
+	}
+	if (sharingSlots) {
+		sort_by_alignment(memVars, numMemVars);
+	}
+
+	//A var (with the rest of its slot group) goes below every one already placed it can be live alongside
+	char *placed = calloc(numMemVars + 1, 1);
+	int varsStart = frameSize;
+	int varsEnd = frameSize;
+	for (int i=0; i < numMemVars; i++) {
+		if (placed[i]) {
+			continue;
+		}
+		IrVar *var = memVars[i];
+		int top = varsStart;
+		for (int j=0; j < numMemVars; j++) {
+			if (!placed[j] || -memVars[j]->offset <= top) {
+				continue;
+			}
+			for (int k=i; k < numMemVars; k++) {
+				if ((k == i || in_same_group(memVars[k], var)) && slots_overlap(memVars[j], memVars[k])) {
+					top = -memVars[j]->offset;
+					break;
+				}
+			}
+		}
+
+		//Chars can go anywhere, everything else is 4-byte aligned
+		int align = (var->type == CHARTOK && var->dimension == -1) ? CHAR_SIZE : ALIGN;
+		if (top%align != 0) {
+			top += align - top%align;
+		}
+		for (int k=i; k < numMemVars; k++) {
+			if (k == i || in_same_group(memVars[k], var)) {
+				memVars[k]->offset = -(top + var->size);
+				placed[k] = 1;
+			}
+		}
+		if (top + var->size > varsEnd) {
+			varsEnd = top + var->size;
+		}
+	}
+	free(placed);
+	free(memVars);
+	frameSize = varsEnd;
+}
+
+/*
+	Can a and b be live at the same time? Blocks are numbered in
+	order, so a block's scope and its nested ones form a range - and
+	then vars stackslots.c put in one group never are.
+*/
+static int slots_overlap(IrVar *a, IrVar *b) {
+	return a->scope <= b->scopeEnd && b->scope <= a->scopeEnd && !in_same_group(a, b);
+}
+
+static int in_same_group(IrVar *a, IrVar *b) {
+	return a->slotGroup != -1 && a->slotGroup == b->slotGroup;
+}
+
+//Whole words first, then arrays that end partway through one, then chars (a stable sort)
+static void sort_by_alignment(IrVar **vars, int n) {
+	for (int i=1; i < n; i++) {
+		IrVar *var = vars[i];
+		int j = i;
+		while (j > 0 && alignment_class(vars[j-1]) > alignment_class(var)) {
+			vars[j] = vars[j-1];
+			j--;
+		}
+		vars[j] = var;
+	}
+}
+
+static int alignment_class(IrVar *var) {
+	if (var->type == CHARTOK && var->dimension == -1) {
+		return 2;
+	}
+	return var->size%ALIGN != 0;
+}
+
+//Turns every $fp-relative frame address from first on into one off $sp
+static void address_off_sp(int first, int delta) {
+	for (int i=first; i < codeTable->numInstructions; i++) {
+		Operand *opnds[3] = { &codeTable->instrSet[i].op1, &codeTable->instrSet[i].op2,
+			&codeTable->instrSet[i].op3 };
+		for (int j=0; j < 3; j++) {
+			if (opnds[j]->kind == OPND_MEM && opnds[j]->reg == FP) {
+				opnds[j]->reg = SP;
+				opnds[j]->val.immed += delta;
+			}
+		}
+	}
+}
+
+//Takes out the prologue's and each pop's $sp adjustment, for a leaf with no frame
+static void drop_sp_moves(int funcStart) {
+	codeTable->instrSet[funcStart].command = NULL;
+	for (int i=0; i < numPops; i++) {
+		codeTable->instrSet[popIndices[i]].command = NULL;
+	}
+	int kept = funcStart;
+	for (int i=funcStart; i < codeTable->numInstructions; i++) {
+		if (codeTable->instrSet[i].command != NULL) {
+			codeTable->instrSet[kept++] = codeTable->instrSet[i];
+		}
+	}
+	codeTable->numInstructions = kept;
+}
+
+/*
+	$t0-$t7 written by the code from first on (as a mask, bit i for
+	$t_i). Calls are left to callClobbers, and SPIM's pseudo-
+	instructions only ever use $at on top of what they're given.
+*/
+static int regs_written(int first) {
+	static char *readOnly[] = { "sw", "sb", "jr", "jal", "j", "syscall", "mult", "nop" };
+	int mask = 0;
+	for (int i=first; i < codeTable->numInstructions; i++) {
+		Instruction *instr = &codeTable->instrSet[i];
+		char *command = instr->command;
+		size_t len = strlen(command);
+		int writes = instr->op1.kind == OPND_REG && command[0] != 'b' && command[0] != '.'
+			&& (len == 0 || command[len-1] != ':')
+			&& !(strcmp(command, "div") == 0 && instr->op3.kind == OPND_NONE);
+		for (int j=0; j < (int)(sizeof(readOnly)/sizeof(readOnly[0])) && writes; j++) {
+			writes = strcmp(command, readOnly[j]) != 0;
+		}
+		if (writes && instr->op1.reg >= T0 && instr->op1.reg < T0+NUM_VREG_REGISTERS) {
+			mask |= 1 << (instr->op1.reg - T0);
+		}
+	}
+	return mask;
+}
+
+//Calls (that come back) are the only thing that needs $ra saved (and $sp moved)
+static int is_leaf(IrFunction *func) {
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			if (instr->op == IR_CALL && !instr->isTailCall) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+//vregs used in more than one block get a frame slot for good
+static void find_vreg_homes(IrFunction *func) {
+	memset(vregHome, -1, func->numVregs*sizeof(int));
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			IrOperand *uses[IR_MAX_USES];
+			int numUses = ir_get_uses(instr, uses);
+			int vregs[IR_MAX_USES+1];
+			int numVregs = 0;
+
+			for (int i=0; i < numUses; i++) {
+				if (uses[i]->kind == IRO_VREG) {
+					vregs[numVregs++] = uses[i]->val;
+				}
+			}
+			if (instr->dest != -1) {
+				vregs[numVregs++] = instr->dest;
+			}
+
+			for (int i=0; i < numVregs; i++) {
+				int v = vregs[i];
+				if (vregHome[v] == -1) {
+					vregHome[v] = block->id;
+				} else if (vregHome[v] != block->id && vregHome[v] != MULTI_BLOCK) {
+					vregHome[v] = MULTI_BLOCK;
+					spill_slot(v);
+				}
+			}
+		}
+	}
+}
+
+//Only blocks that something branches to (rather than falls into) need a label
+static void make_block_labels(IrFunction *func) {
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		IrInstr *term = block->last;
+		IrBlock *targets[2] = { NULL, NULL };
+
+		if (term->op == IR_JUMP || (term->op == IR_CBR && term->target[0] == term->target[1])) {
+			if (term->target[0] != block->next) {
+				targets[0] = term->target[0];
+			}
+		} else if (term->op == IR_CBR) {
+			if (term->target[1] != block->next) {
+				targets[0] = term->target[1];
+			}
+			if (term->target[0] != block->next) {
+				targets[1] = term->target[0];
+			}
+		}
+
+		for (int i=0; i < 2; i++) {
+			if (targets[i] != NULL && blockLabels[targets[i]->id] == NULL) {
+				blockLabels[targets[i]->id] = generate_unique_label();
+			}
+		}
+	}
+}
+
+static void lower_block(IrBlock *block) {
+	if (blockLabels[block->id] != NULL) {
+		add_instr_to_code_table(blockLabels[block->id]);
+	}
+
+	//Nothing is kept in registers between blocks
+	for (int i=0; i < NUM_VREG_REGISTERS; i++) {
+		regVreg[i] = -1;
+	}
+	compute_last_uses(block);
+
+	int index = 0;
+	for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+		lower_instr(instr, index);
+		free_dead_spill_slots(instr, index++);
+	}
+}
+
+static void compute_last_uses(IrBlock *block) {
+	int index = 0;
+	for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+		IrOperand *uses[IR_MAX_USES];
+		int numUses = ir_get_uses(instr, uses);
+
+		for (int i=0; i < numUses; i++) {
+			if (uses[i]->kind == IRO_VREG) {
+				lastUse[uses[i]->val] = index;
+			}
+		}
+		//Written but never read afterwards (yet)
+		if (instr->dest != -1) {
+			lastUse[instr->dest] = -1;
+		}
+		index++;
+	}
+}
+
+static void lower_instr(IrInstr *instr, int index) {
+	int src1, src2, dest;
+	IrVar *var = instr->var;
+
+	switch (instr->op) {
+		case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV:
+		case IR_SEQ: case IR_SNE: case IR_SLT: case IR_SLE: case IR_SGT: case IR_SGE:
+		case IR_LAND: case IR_LOR: {
+			IrOpcode op = instr->op;
+			IrOperand left = instr->src1;
+			IrOperand right = instr->src2;
+			//A constant goes on the right, where the immediate forms take it
+			if (left.kind == IRO_IMM && right.kind != IRO_IMM && op != IR_SUB && op != IR_DIV) {
+				left = instr->src2;
+				right = instr->src1;
+				op = op >= IR_SEQ && op <= IR_SGE ? ir_swap_cond(op) : op;
+			}
+
+			src1 = use_reg(left, SCRATCH1);
+			src2 = right.kind == IRO_IMM ? -1 : use_reg(right, SCRATCH2);
+			release_dying(instr, index);
+			dest = def_reg(instr, index);
+			if (src2 != -1 || !add_binary_immed_instr(op, dest, src1, right.val)) {
+				if (src2 == -1) {
+					src2 = use_reg(right, SCRATCH2);
+				}
+				add_binary_instr(op, dest, src1, src2);
+			}
+			finish_def(instr, dest);
+			break;
+		}
+
+		case IR_NEG: case IR_NOT:
+			src1 = use_reg(instr->src1, SCRATCH1);
+			release_dying(instr, index);
+			dest = def_reg(instr, index);
+			if (instr->op == IR_NEG) {
+				add_instr_for_unarysub(dest, src1);
+			} else {
+				add_immed_op_instr("sltiu", dest, src1, 1);
+			}
+			finish_def(instr, dest);
+			break;
+
+		case IR_MOV:
+			if (instr->src1.kind == IRO_IMM) {
+				dest = def_reg(instr, index);
+				load_val_in_register(dest, instr->src1.val);
+			} else {
+				src1 = use_reg(instr->src1, SCRATCH1);
+				release_dying(instr, index);
+				dest = def_reg(instr, index);
+				if (dest != src1) {
+					move_registers(dest, src1);
+				}
+			}
+			finish_def(instr, dest);
+			break;
+
+		case IR_LDVAR:
+			if (var->reg != -1 && can_use_var_reg(instr, index)) {
+				vregReg[instr->dest] = var->reg;
+				break;
+			}
+			dest = def_reg(instr, index);
+			if (var->reg != -1) {
+				move_registers(dest, var->reg);
+			} else if (var->kind == VAR_GLOBAL) {
+				load_global(dest, var->type, var->offset, 1);
+			} else {
+				load_local(dest, var->type, var->offset, FP, 1);
+			}
+			finish_def(instr, dest);
+			break;
+
+		case IR_STVAR:
+			src1 = use_reg(instr->src1, SCRATCH1);
+			release_dying(instr, index);
+			if (var->reg != -1 && ir_var_width(var) == CHAR_SIZE) {
+				sign_extend_byte(var->reg, src1);
+			} else if (var->reg != -1) {
+				if (var->reg != src1) { //(x = y with both coalesced into one register)
+					move_registers(var->reg, src1);
+				}
+			} else if (var->kind == VAR_GLOBAL) {
+				assign_global(src1, var->type, var->offset);
+			} else {
+				assign_local(src1, var->type, var->offset, FP);
+			}
+			break;
+
+		case IR_ADDR:
+			if (var->reg != -1 && can_use_var_reg(instr, index)) {
+				vregReg[instr->dest] = var->reg;
+				break;
+			}
+			dest = def_reg(instr, index);
+			if (var->reg != -1) { //(an array param, with callconv on)
+				move_registers(dest, var->reg);
+			} else if (var->kind == VAR_GLOBAL) {
+				load_reg_address_instr(dest, var->offset, GP);
+			} else if (var->kind == VAR_PARAM) { //The param holds the address
+				load_word_instr(dest, var->offset, FP);
+			} else {
+				load_reg_address_instr(dest, var->offset, FP);
+			}
+			finish_def(instr, dest);
+			break;
+
+		case IR_LOAD:
+			src1 = use_reg(instr->src1, SCRATCH1);
+			release_dying(instr, index);
+			dest = def_reg(instr, index);
+			if (instr->width == CHAR_SIZE) {
+				load_byte_instr(dest, instr->offset, src1);
+			} else {
+				load_word_instr(dest, instr->offset, src1);
+			}
+			finish_def(instr, dest);
+			break;
+
+		case IR_STORE:
+			src1 = use_reg(instr->src1, SCRATCH1);
+			src2 = use_reg(instr->src2, SCRATCH2);
+			release_dying(instr, index);
+			if (instr->width == CHAR_SIZE) {
+				store_byte_instr(src2, instr->offset, src1);
+			} else {
+				store_word_instr(src2, instr->offset, src1);
+			}
+			break;
+
+		case IR_CALL:
+			lower_call(instr, index);
+			break;
+
+		case IR_READ:
+			dest = def_reg(instr, index);
+			add_read_instr(dest);
+			finish_def(instr, dest);
+			break;
+
+		case IR_WRITE:
+			src1 = use_reg(instr->src1, SCRATCH1);
+			release_dying(instr, index);
+			add_write_instr(src1);
+			break;
+
+		case IR_WRITELN:
+			add_newline_instr();
+			break;
+
+		case IR_JUMP:
+			if (instr->target[0] != instr->block->next) {
+				branch(blockLabels[instr->target[0]->id]);
+			}
+			break;
+
+		case IR_CBR:
+			lower_cbr(instr, index);
+			break;
+
+		case IR_RET:
+			if (instr->prev != NULL && instr->prev->op == IR_CALL && instr->prev->isTailCall) {
+				break; //Already gone - the callee returns for us
+			}
+			if (instr->src1.kind == IRO_IMM) {
+				load_val_in_register(V0, instr->src1.val);
+			} else if (instr->src1.kind == IRO_VREG) {
+				move_registers(V0, use_reg(instr->src1, SCRATCH1));
+			}
+			//The epilogue comes right after the last block
+			if (instr->block->next != NULL) {
+				branch(epilogueLabel);
+			}
+			break;
+
+		default:
+			codegen_error("Can't lower this IR instruction!", inFile, outFile);
+	}
+}
+
+/*
+	Only the $t registers holding a vreg that's still needed after the
+	call are saved around it - and with callconv on, only the ones the
+	callee is known to write. $a registers never are: params are
+	copied out of them in the prologue. ($s registers are the callee's
+	job.)
+*/
+static void lower_call(IrInstr *instr, int index) {
+	int argRegs[IR_MAX_ARGS];
+	for (int i=0; i < instr->numArgs; i++) {
+		IrOperand arg = instr->args[i];
+		argRegs[i] = arg.kind == IRO_VREG ? vregReg[arg.val] : -1;
+	}
+
+	int calleeClobbers = instr->callee->clobberedRegs;
+	if (calleeClobbers == -1) { //Not lowered yet (it's recursive)
+		calleeClobbers = (1 << NUM_VREG_REGISTERS) - 1;
+	}
+	callClobbers |= calleeClobbers;
+
+	//Nothing's live afterwards: the args go straight to the $a registers and we leave
+	if (instr->isTailCall) {
+		load_args(instr, argRegs);
+		take_down_frame();
+		jump_to_function(instr->callee->name);
+		return;
+	}
+
+	//Args are only read (below) before anything writes dest's register
+	release_dying(instr, index);
+	int dest = instr->dest != -1 ? def_reg(instr, index) : -1;
+
+	int liveRegs[NUM_VREG_REGISTERS];
+	int numLive = 0;
+	for (int i=0; i < NUM_VREG_REGISTERS; i++) {
+		if (regVreg[i] != -1 && regVreg[i] != instr->dest
+			&& (!knownClobbers || (calleeClobbers & (1 << i)))) {
+			liveRegs[numLive++] = T0+i;
+		}
+	}
+	numCalls++;
+	numSavedAtCalls += numLive;
+	callsSaving[numLive]++;
+	if (numLive*REGISTER_SIZE > callSaveSize) {
+		callSaveSize = numLive*REGISTER_SIZE;
+	}
+
+	generate_function_precall(liveRegs, numLive);
+	load_args(instr, argRegs);
+	jal_to_function(instr->callee->name);
+	generate_function_postcall(liveRegs, numLive);
+
+	if (dest != -1) {
+		move_registers(dest, V0);
+		finish_def(instr, dest);
+	}
+}
+
+//Puts the args in $a0-$a3 (argRegs: where each vreg arg was before the call freed anything)
+static void load_args(IrInstr *instr, int *argRegs) {
+	for (int i=0; i < instr->numArgs; i++) {
+		IrOperand arg = instr->args[i];
+		if (arg.kind == IRO_IMM) {
+			load_val_in_register(A0+i, arg.val);
+		} else if (argRegs[i] != -1) {
+			move_registers(A0+i, argRegs[i]);
+		} else {
+			load_word_instr(A0+i, vregSlot[arg.val], FP);
+		}
+	}
+}
+
+/*
+	The comparison is the branch itself (beq, blt, bgtz...), so no 0/1
+	value gets made. The exception is ordering against a constant:
+	SPIM can't do blt with an immediate in less than 3 instructions,
+	but slt (slti) and a beqz/bnez is 2.
+*/
+static void lower_cbr(IrInstr *instr, int index) {
+	IrBlock *next = instr->block->next;
+	IrBlock *ifTrue = instr->target[0];
+	IrBlock *ifFalse = instr->target[1];
+	IrOpcode cond = instr->cond;
+	IrOperand left = instr->src1;
+	IrOperand right = instr->src2;
+
+	//Branches can take an immediate as their 2nd operand only
+	if (left.kind == IRO_IMM && right.kind != IRO_IMM) {
+		left = instr->src2;
+		right = instr->src1;
+		cond = ir_swap_cond(cond);
+	}
+	int src1 = use_reg(left, SCRATCH1);
+	Operand src2;
+	int isOrdering = cond != IR_SEQ && cond != IR_SNE;
+	if (isOrdering && right.kind == IRO_IMM && right.val != 0
+		&& right.val > -32768 && right.val < 32767) {
+		//a <= K is a < K+1, and a > K / a >= K are the opposites
+		int bound = (cond == IR_SLE || cond == IR_SGT) ? right.val + 1 : right.val;
+		add_immed_op_instr("slti", SCRATCH1, src1, bound);
+		src1 = SCRATCH1;
+		src2 = reg_operand(ZERO);
+		cond = (cond == IR_SLT || cond == IR_SLE) ? IR_SNE : IR_SEQ;
+	} else if (right.kind == IRO_IMM && right.val != 0 && right.val >= -32768 && right.val <= 32767) {
+		src2 = immed_operand(right.val);
+	} else {
+		src2 = reg_operand(use_reg(right, SCRATCH2));
+	}
+	release_dying(instr, index);
+
+	if (ifTrue == ifFalse) {
+		if (ifTrue != next) {
+			branch(blockLabels[ifTrue->id]);
+		}
+	} else if (ifFalse == next) {
+		branch_on(cond, src1, src2, ifTrue);
+	} else if (ifTrue == next) {
+		branch_on(ir_invert_cond(cond), src1, src2, ifFalse);
+	} else {
+		branch_on(cond, src1, src2, ifTrue);
+		branch(blockLabels[ifFalse->id]);
+	}
+}
+
+/*
+	A vreg loaded from a variable kept in $s_i can just be $s_i,
+	as long as nothing writes $s_i before the vreg's last use (and
+	it doesn't have to outlive the block).
+*/
+static int can_use_var_reg(IrInstr *load, int index) {
+	int v = load->dest;
+	if (vregHome[v] == MULTI_BLOCK || lastUse[v] <= index) {
+		return 0;
+	}
+
+	IrInstr *instr = load->next;
+	for (int i = index+1; i < lastUse[v]; i++, instr = instr->next) {
+		if (instr->op == IR_STVAR && instr->var->reg == load->var->reg) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+//Branches to target if src1 cond src2 holds - comparing with $zero gets the one-register forms
+static void branch_on(IrOpcode cond, int src1, Operand src2, IrBlock *target) {
+	static char *compareBranches[] = { "beq", "bne", "blt", "ble", "bgt", "bge" };
+	static char *zeroBranches[] = { "beqz", "bnez", "bltz", "blez", "bgtz", "bgez" };
+	Instruction *label = blockLabels[target->id];
+
+	if (src2.kind == OPND_REG && src2.reg == ZERO) {
+		zero_branch_instr(zeroBranches[cond-IR_SEQ], src1, label);
+	} else {
+		compare_branch_instr(compareBranches[cond-IR_SEQ], src1, src2, label);
+	}
+}
+
+/** Register handling **/
+
+//Register holding opnd's value - scratch gets used for immediates/spilled vregs
+static int use_reg(IrOperand opnd, int scratch) {
+	if (opnd.kind == IRO_IMM) {
+		if (opnd.val == 0) {
+			return ZERO;
+		}
+		load_val_in_register(scratch, opnd.val);
+		return scratch;
+	}
+
+	int v = opnd.val;
+	if (vregReg[v] != -1) {
+		return vregReg[v];
+	}
+	load_word_instr(scratch, vregSlot[v], FP);
+	return scratch;
+}
+
+//Frees registers of vregs that instr reads for the last time
+static void release_dying(IrInstr *instr, int index) {
+	IrOperand *uses[IR_MAX_USES];
+	int numUses = ir_get_uses(instr, uses);
+
+	for (int i=0; i < numUses; i++) {
+		int v = uses[i]->val;
+		if (uses[i]->kind == IRO_VREG && lastUse[v] == index && vregReg[v] >= T0
+			&& vregReg[v] < T0+NUM_VREG_REGISTERS) {
+			regVreg[vregReg[v]-T0] = -1;
+			vregReg[v] = -1;
+		}
+	}
+}
+
+/*
+	Spill slots of (single block) vregs instr read for the last time
+	can be used again - but only once instr is all done, since a call
+	reads its args out of their slots after picking dest's register.
+*/
+static void free_dead_spill_slots(IrInstr *instr, int index) {
+	if (!sharingSlots) {
+		return;
+	}
+	IrOperand *uses[IR_MAX_USES];
+	int numUses = ir_get_uses(instr, uses);
+	for (int i=0; i < numUses; i++) {
+		int v = uses[i]->val;
+		if (uses[i]->kind == IRO_VREG && lastUse[v] == index && vregHome[v] != MULTI_BLOCK
+			&& vregSlot[v] != 0) {
+			freeSpillSlots[numFreeSpillSlots++] = vregSlot[v];
+			vregSlot[v] = 0;
+		}
+	}
+}
+
+//Picks the register instr's result goes in (spilling something if need be)
+static int def_reg(IrInstr *instr, int index) {
+	int v = instr->dest;
+
+	//Results that live in memory, or are never read, go through scratch
+	if (vregHome[v] == MULTI_BLOCK || lastUse[v] <= index) {
+		return SCRATCH1;
+	}
+
+	//Only read by the stvar right after it: compute it straight into the variable's register
+	IrInstr *store = instr->next;
+	if (store != NULL && store->op == IR_STVAR && store->var->reg != -1
+		&& ir_var_width(store->var) != CHAR_SIZE && lastUse[v] == index+1) {
+		vregReg[v] = store->var->reg;
+		return store->var->reg;
+	}
+
+	for (int i=0; i < NUM_VREG_REGISTERS; i++) {
+		if (regVreg[i] == -1) {
+			regVreg[i] = v;
+			vregReg[v] = T0+i;
+			return T0+i;
+		}
+	}
+
+	//All taken: spill whichever is needed furthest away (but not one instr reads)
+	IrOperand *uses[IR_MAX_USES];
+	int numUses = ir_get_uses(instr, uses);
+	int victim = -1;
+	for (int i=0; i < NUM_VREG_REGISTERS; i++) {
+		int isUsed = 0;
+		for (int j=0; j < numUses; j++) {
+			isUsed |= uses[j]->kind == IRO_VREG && uses[j]->val == regVreg[i];
+		}
+		if (!isUsed && (victim == -1 || lastUse[regVreg[i]] > lastUse[regVreg[victim]])) {
+			victim = i;
+		}
+	}
+
+	store_word_instr(T0+victim, spill_slot(regVreg[victim]), FP);
+	vregReg[regVreg[victim]] = -1;
+	regVreg[victim] = v;
+	vregReg[v] = T0+victim;
+	return T0+victim;
+}
+
+//Results of vregs living in memory get written back
+static void finish_def(IrInstr *instr, int reg) {
+	if (vregHome[instr->dest] == MULTI_BLOCK) {
+		store_word_instr(reg, vregSlot[instr->dest], FP);
+	}
+}
+
+static int spill_slot(int vreg) {
+	if (vregSlot[vreg] == 0 && vregHome[vreg] != MULTI_BLOCK && numFreeSpillSlots > 0) {
+		vregSlot[vreg] = freeSpillSlots[--numFreeSpillSlots];
+	} else if (vregSlot[vreg] == 0) {
+		if (frameSize%ALIGN != 0) {
+			frameSize += ALIGN - frameSize%ALIGN;
+		}
+		frameSize += REGISTER_SIZE;
+		vregSlot[vreg] = -frameSize;
+	}
+	return vregSlot[vreg];
+}
+
+/*
+	dest_reg = src_reg1 op k, using the immediate forms of the
+	instructions (and shifts for * and /), which SPIM doesn't need to
+	expand into several. Comparisons are built from slti/sltiu:
+	a <= k is a < k+1, a >= k is !(a < k), and a == k is (a^k) < 1
+	unsigned. SCRATCH2 is free to use - k would have gone there.
+	Adds for * and magic numbers for / are the strength pass's, so at
+	-O0 (or -fno-strength) they're left as mulo/div.
+	@return 0 if there's no such form for op and k (nothing is emitted then)
+*/
+static int add_binary_immed_instr(IrOpcode op, int dest_reg, int src_reg1, int k) {
+	int fits = k >= -32768 && k <= 32767;
+	int nextFits = k >= -32768 && k < 32767;
+
+	switch (op) {
+		//Like add/sub, these still trap on overflow
+		case IR_ADD:
+			if (!fits) return 0;
+			add_immed_op_instr("addi", dest_reg, src_reg1, k);
+			return 1;
+		case IR_SUB:
+			if (k == INT_MIN || !(-k >= -32768 && -k <= 32767)) return 0;
+			add_immed_op_instr("addi", dest_reg, src_reg1, -k);
+			return 1;
+
+		case IR_MUL:
+			if (k == -1) { //(neg traps on overflow too)
+				add_instr_for_unarysub(dest_reg, src_reg1);
+				return 1;
+			}
+			if (!strengthReduce) return 0;
+			return add_instr_for_mult_by_const(dest_reg, src_reg1, k, SCRATCH2);
+		case IR_DIV:
+			if (!strengthReduce) return 0;
+			if (k == -1) {
+				add_instr_for_unarysub(dest_reg, src_reg1);
+				return 1;
+			}
+			return add_instr_for_div_by_const(dest_reg, src_reg1, k, SCRATCH2);
+
+		case IR_SLT:
+		case IR_SGE:
+			if (!fits) return 0;
+			add_immed_op_instr("slti", dest_reg, src_reg1, k);
+			if (op == IR_SGE) {
+				add_immed_op_instr("xori", dest_reg, dest_reg, 1);
+			}
+			return 1;
+		case IR_SLE:
+		case IR_SGT:
+			if (!nextFits) return 0;
+			add_immed_op_instr("slti", dest_reg, src_reg1, k+1);
+			if (op == IR_SGT) {
+				add_immed_op_instr("xori", dest_reg, dest_reg, 1);
+			}
+			return 1;
+
+		case IR_SEQ:
+		case IR_SNE: {
+			//Get something that's 0 exactly when src_reg1 == k
+			int diff = src_reg1;
+			if (k > 0 && k <= 65535) {
+				add_immed_op_instr("xori", dest_reg, src_reg1, k);
+				diff = dest_reg;
+			} else if (k != 0) {
+				if (k == INT_MIN || -k < -32768 || -k > 32767) return 0;
+				add_immed_op_instr("addiu", dest_reg, src_reg1, -k);
+				diff = dest_reg;
+			}
+			if (op == IR_SEQ) {
+				add_immed_op_instr("sltiu", dest_reg, diff, 1);
+			} else {
+				Instruction sltuInstr = setup_3op_instr("sltu", reg_operand(dest_reg),
+					reg_operand(ZERO), reg_operand(diff));
+				add_instr_to_code_table(&sltuInstr);
+			}
+			return 1;
+		}
+
+		default:
+			return 0;
+	}
+}
+
+static void add_binary_instr(IrOpcode op, int dest_reg, int src_reg1, int src_reg2) {
+	switch (op) {
+		case IR_ADD: add_instr_for_addition(dest_reg, src_reg1, src_reg2); break;
+		case IR_SUB: add_instr_for_sub(dest_reg, src_reg1, src_reg2); break;
+		case IR_MUL: add_instr_for_mult(dest_reg, src_reg1, src_reg2); break;
+		case IR_DIV: add_instr_for_div(dest_reg, src_reg1, src_reg2); break;
+		case IR_SEQ: add_instr_for_eq(dest_reg, src_reg1, src_reg2); break;
+		case IR_SNE: add_instr_for_neq(dest_reg, src_reg1, src_reg2); break;
+		case IR_SLT: add_instr_for_less(dest_reg, src_reg1, src_reg2); break;
+		case IR_SLE: add_instr_for_leq(dest_reg, src_reg1, src_reg2); break;
+		case IR_SGT: add_instr_for_great(dest_reg, src_reg1, src_reg2); break;
+		case IR_SGE: add_instr_for_geq(dest_reg, src_reg1, src_reg2); break;
+		case IR_LAND: add_instr_for_and(dest_reg, src_reg1, src_reg2); break;
+		case IR_LOR: add_instr_for_or(dest_reg, src_reg1, src_reg2); break;
+		default:
+			codegen_error("Not a binary IR instruction!", inFile, outFile);
+	}
+}
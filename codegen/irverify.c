@@ -0,0 +1,216 @@
+/*
+	Checks the IR is well-formed: every block ends in exactly one
+	terminator, the CFG edges match the terminators, operands are
+	the right kind, and every vreg that's read is written somewhere.
+	Passes that break any of this get caught right after they run
+	(see -verify-ir) instead of as weird MIPS output.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+#include "traversaltotable.h"
+
+static void check(int ok, IrFunction *func, IrInstr *instr, const char *when, const char *msg);
+static void check_operand(IrFunction *func, IrInstr *instr, IrOperand opnd, const char *when);
+static void check_instr(IrFunction *func, IrInstr *instr, const char *when);
+static int count_edges(IrBlock *from, IrBlock *to);
+
+void verify_ir_program(IrProgram *prog, const char *when) {
+	for (IrFunction *func = prog->functions; func != NULL; func = func->next) {
+		verify_ir_function(func, when);
+	}
+}
+
+void verify_ir_function(IrFunction *func, const char *when) {
+	check(func->entry != NULL && func->entry->prev == NULL, func, NULL, when,
+		"entry block must come first");
+
+	//Mark which blocks are really in the function, so targets can be checked
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		check(block->func == func, func, NULL, when, "block belongs to another function");
+		check(block->next != NULL || block == func->lastBlock, func, NULL, when,
+			"lastBlock is out of date");
+		check(block->next == NULL || block->next->prev == block, func, NULL, when,
+			"block list links are broken");
+		block->mark = 1;
+	}
+
+	char *defined = calloc(func->numVregs > 0 ? func->numVregs : 1, 1);
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		check(block->last != NULL, func, NULL, when, "empty block");
+		check(ir_is_terminator(block->last->op), func, block->last, when,
+			"block doesn't end with a terminator");
+
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			check(instr->block == block, func, instr, when, "instruction's block is wrong");
+			check(instr->next != NULL || instr == block->last, func, instr, when,
+				"block's last instruction is out of date");
+			check(instr->next == NULL || instr->next->prev == instr, func, instr, when,
+				"instruction list links are broken");
+			check(instr == block->last || !ir_is_terminator(instr->op), func, instr, when,
+				"terminator in the middle of a block");
+
+			check_instr(func, instr, when);
+			if (instr->dest != -1) {
+				defined[instr->dest] = 1;
+			}
+		}
+
+		//succs must be exactly what the terminator says
+		IrInstr *term = block->last;
+		int expectedSuccs = term->op == IR_JUMP ? 1 : term->op == IR_CBR ?
+			(term->target[0] == term->target[1] ? 1 : 2) : 0;
+		check(block->numSuccs == expectedSuccs, func, term, when,
+			"succs don't match the terminator (forgot ir_rebuild_cfg?)");
+		for (int i=0; i < block->numSuccs; i++) {
+			check(block->succs[i] == term->target[0] || block->succs[i] == term->target[1],
+				func, term, when, "succs don't match the terminator (forgot ir_rebuild_cfg?)");
+		}
+
+		//...and every edge must show up exactly once in the other end's preds
+		for (int i=0; i < block->numPreds; i++) {
+			IrBlock *pred = block->preds[i];
+			check(pred->mark == 1, func, NULL, when, "pred isn't in the function");
+			int seen = 0;
+			for (int j=0; j < block->numPreds; j++) {
+				seen += block->preds[j] == pred;
+			}
+			check(seen == count_edges(pred, block), func, NULL, when,
+				"preds don't match succs (forgot ir_rebuild_cfg?)");
+		}
+		for (int i=0; i < block->numSuccs; i++) {
+			IrBlock *succ = block->succs[i];
+			int found = 0;
+			for (int j=0; j < succ->numPreds; j++) {
+				found |= succ->preds[j] == block;
+			}
+			check(found, func, term, when, "edge missing from preds (forgot ir_rebuild_cfg?)");
+		}
+	}
+
+	//Every vreg that gets read must be written somewhere
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			IrOperand *uses[IR_MAX_USES];
+			int numUses = ir_get_uses(instr, uses);
+			for (int i=0; i < numUses; i++) {
+				check(uses[i]->kind != IRO_VREG || defined[uses[i]->val], func, instr,
+					when, "vreg is read but never written");
+			}
+		}
+	}
+	free(defined);
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		block->mark = 0;
+	}
+}
+
+static void check_instr(IrFunction *func, IrInstr *instr, const char *when) {
+	IrOpcode op = instr->op;
+	int hasSrc1 = instr->src1.kind != IRO_NONE;
+	int hasSrc2 = instr->src2.kind != IRO_NONE;
+
+	check(op >= 0 && op < NUM_IR_OPCODES, func, instr, when, "unknown opcode");
+	check(instr->dest >= -1 && instr->dest < func->numVregs, func, instr, when,
+		"dest vreg out of range");
+	//A call's result is allowed to be dropped
+	check(ir_has_dest(op) ? (instr->dest != -1 || op == IR_CALL) : instr->dest == -1,
+		func, instr, when, "dest doesn't fit the opcode");
+	check_operand(func, instr, instr->src1, when);
+	check_operand(func, instr, instr->src2, when);
+
+	switch (op) {
+		case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV:
+		case IR_SEQ: case IR_SNE: case IR_SLT: case IR_SLE: case IR_SGT: case IR_SGE:
+		case IR_LAND: case IR_LOR:
+			check(hasSrc1 && hasSrc2, func, instr, when, "binary op needs two operands");
+			break;
+		case IR_NEG: case IR_NOT: case IR_MOV: case IR_WRITE:
+			check(hasSrc1 && !hasSrc2, func, instr, when, "unary op needs one operand");
+			break;
+		case IR_LDVAR: case IR_STVAR:
+			check(instr->var != NULL && instr->var->dimension == -1, func, instr, when,
+				"ldvar/stvar needs a scalar variable");
+			check(op == IR_LDVAR ? !hasSrc1 : hasSrc1, func, instr, when,
+				"wrong operands for ldvar/stvar");
+			break;
+		case IR_ADDR:
+			check(instr->var != NULL && instr->var->dimension != -1, func, instr, when,
+				"addr needs an array");
+			break;
+		case IR_LOAD: case IR_STORE:
+			check(instr->width == 1 || instr->width == 4, func, instr, when, "bad width");
+			check(instr->src1.kind == IRO_VREG && func->vregTypes[instr->src1.val] == VT_ADDR,
+				func, instr, when, "load/store needs an address vreg");
+			check(op == IR_LOAD ? !hasSrc2 : hasSrc2, func, instr, when,
+				"wrong operands for load/store");
+			break;
+		case IR_CALL:
+			check(instr->callee != NULL, func, instr, when, "call without a callee");
+			check(instr->numArgs == instr->callee->numParams && instr->numArgs <= IR_MAX_ARGS,
+				func, instr, when, "wrong number of args");
+			for (int i=0; i < instr->numArgs; i++) {
+				check(instr->args[i].kind != IRO_NONE, func, instr, when, "missing arg");
+				check_operand(func, instr, instr->args[i], when);
+			}
+			check(!instr->isTailCall || (instr->next != NULL && instr->next->op == IR_RET
+				&& (instr->next->src1.kind == IRO_NONE || (instr->next->src1.kind == IRO_VREG
+					&& instr->next->src1.val == instr->dest))), func, instr, when,
+				"tail call isn't followed by a ret of its result");
+			break;
+		case IR_CBR:
+			check(instr->cond >= IR_SEQ && instr->cond <= IR_SGE, func, instr, when,
+				"cbr needs a comparison");
+			check(hasSrc1 && hasSrc2, func, instr, when, "cbr needs two operands");
+			check(instr->target[1] != NULL && instr->target[1]->mark == 1, func, instr,
+				when, "branch to a block that isn't in the function");
+			//Fall through to check target[0] too
+		case IR_JUMP:
+			check(instr->target[0] != NULL && instr->target[0]->mark == 1, func, instr,
+				when, "branch to a block that isn't in the function");
+			break;
+		case IR_RET:
+			check(!hasSrc2, func, instr, when, "ret has one operand at most");
+			break;
+		default:
+			break;
+	}
+}
+
+static void check_operand(IrFunction *func, IrInstr *instr, IrOperand opnd, const char *when) {
+	check(opnd.kind != IRO_VREG || (opnd.val >= 0 && opnd.val < func->numVregs),
+		func, instr, when, "vreg out of range");
+}
+
+//How many times from's terminator branches to to (as one CFG edge each)
+static int count_edges(IrBlock *from, IrBlock *to) {
+	int edges = 0;
+	for (int i=0; i < from->numSuccs; i++) {
+		edges += from->succs[i] == to;
+	}
+	return edges;
+}
+
+//On failure: show the offending function, then bail
+static void check(int ok, IrFunction *func, IrInstr *instr, const char *when, const char *msg) {
+	if (ok) {
+		return;
+	}
+
+	print_ir_function(stdout, func);
+	if (instr != NULL) {
+		printf("offending instruction:\n");
+		print_ir_instr(stdout, instr);
+	}
+
+	char errMessage[256];
+	snprintf(errMessage, sizeof(errMessage), "Broken IR in %s (%s): %s",
+		func->name, when, msg);
+	codegen_error(errMessage, inFile, outFile);
+}
@@ -0,0 +1,564 @@
+/*
+	ivreduce: walks arrays in loops with a pointer, instead of working
+	out base + i*size from scratch on every iteration.
+
+	- a basic induction variable is a scalar int param/local that the
+	  loop only ever changes with i = i + c
+	- an array address worked out from one, addr a + (i + d)*size,
+	  gets a pointer variable for (a, i, size). That's set to
+	  addr a + i*size in the loop's preheader and moved on by c*size
+	  right after every i = i + c, so it always keeps up with i. The
+	  address then just reads the pointer (d*size goes into the
+	  load/store offsets), and the ldvar/mul/addr/add are deleted
+	- if the loop test compares i with a constant, or with a variable
+	  the loop doesn't change, and i isn't needed after the loop, the
+	  test compares the pointer with addr a + n*size instead and the
+	  i = i + c's go
+
+	Loops are done innermost first. The pointers are just locals with
+	isPointer set, so regalloc keeps them in registers like any other.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "passmanager.h"
+#include "loops.h"
+#include "lexer.h"
+
+//One pointer variable, always equal to addr array + iv*scale
+typedef struct IvPointer {
+	IrVar *array;
+	IrVar *iv;
+	int scale;
+	IrVar *var;
+	struct IvPointer *next;
+} IvPointer;
+
+typedef enum {
+	IV_UNCHANGED, IV_INDUCTION, IV_OTHER
+} IvState;
+
+//The function being worked on
+static IrFunction *func;
+static int numTracked; //vregs defOf/useCount cover (newer ones are never deleted)
+static IrInstr **defOf; //By vreg, NULL if it has no (or more than one) def
+static int *useCount;
+static IvState *ivState; //By var id
+static IvPointer *pointers; //For the loop being worked on
+
+//For -stats
+static int numPointers;
+static int numAddresses;
+static int numTests;
+
+static void reduce_loop(IrLoop *loop);
+static void scan_function();
+static void classify_stores(IrLoop *loop);
+static int is_increment(IrInstr *store, int *step);
+static int is_induction(IrVar *var);
+static int match_address(IrInstr *instr, IrVar **array, IrVar **iv, int *scale, int *disp);
+static IvPointer *pointer_for(IrLoop *loop, IrVar *array, IrVar *iv, int scale);
+static void rewrite_address(IrInstr *instr, IvPointer *ptr, int disp);
+static void add_pointer_steps(IrLoop *loop);
+static void rewrite_exit_test(IrLoop *loop);
+static int only_increments_read(IrLoop *loop, IrVar *iv, IrInstr *testLoad);
+static int live_after_loop(IrLoop *loop, IrVar *var);
+static void remove_dead(IrLoop *loop);
+
+static IrInstr *vreg_def(IrOperand opnd);
+static int no_store_between(IrInstr *from, IrInstr *to, IrVar *var);
+static IrVar *new_pointer_var(IrVar *array, char *index);
+static int insert_instr(IrInstr *pos, IrOpcode op, IrOperand src1, IrOperand src2, IrVar *var);
+static void drop_uses(IrInstr *instr);
+
+void reduce_induction_variables(IrProgram *prog) {
+	numPointers = numAddresses = numTests = 0;
+
+	for (func = prog->functions; func != NULL; func = func->next) {
+		LoopInfo *info = find_loops(func);
+		for (IrLoop *loop = info->loops; loop != NULL; loop = loop->next) {
+			reduce_loop(loop);
+		}
+		free_loop_info(info);
+	}
+
+	if (printStats) {
+		fprintf(stderr, "ivreduce: %d pointers made, %d array addresses replaced, "
+			"%d loop tests rewritten\n", numPointers, numAddresses, numTests);
+	}
+}
+
+static void reduce_loop(IrLoop *loop) {
+	scan_function();
+	classify_stores(loop);
+	pointers = NULL;
+
+	for (int i=0; i < loop->numBlocks; i++) {
+		for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = instr->next) {
+			IrVar *array, *iv;
+			int scale, disp;
+			if (match_address(instr, &array, &iv, &scale, &disp)) {
+				rewrite_address(instr, pointer_for(loop, array, iv, scale), disp);
+			}
+		}
+	}
+
+	if (pointers != NULL) {
+		add_pointer_steps(loop);
+		remove_dead(loop);
+		rewrite_exit_test(loop);
+	}
+
+	while (pointers != NULL) {
+		IvPointer *next = pointers->next;
+		free(pointers);
+		pointers = next;
+	}
+	free(defOf);
+	free(useCount);
+	free(ivState);
+}
+
+static void scan_function() {
+	numTracked = func->numVregs;
+	defOf = calloc(numTracked > 0 ? numTracked : 1, sizeof(IrInstr *));
+	useCount = calloc(numTracked > 0 ? numTracked : 1, sizeof(int));
+	char *seen = calloc(numTracked > 0 ? numTracked : 1, 1);
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			if (instr->dest != -1) {
+				defOf[instr->dest] = seen[instr->dest] ? NULL : instr;
+				seen[instr->dest] = 1;
+			}
+			IrOperand *uses[IR_MAX_USES];
+			int numUses = ir_get_uses(instr, uses);
+			for (int i=0; i < numUses; i++) {
+				if (uses[i]->kind == IRO_VREG) {
+					useCount[uses[i]->val]++;
+				}
+			}
+		}
+	}
+	free(seen);
+}
+
+//Which vars the loop changes, and whether it's only ever by i = i + c
+static void classify_stores(IrLoop *loop) {
+	ivState = calloc(func->numVars > 0 ? func->numVars : 1, sizeof(IvState));
+
+	for (int i=0; i < loop->numBlocks; i++) {
+		for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = instr->next) {
+			if (instr->op != IR_STVAR || instr->var->kind == VAR_GLOBAL) {
+				continue;
+			}
+			IrVar *var = instr->var;
+			int step;
+			//chars wrap around at 127, which a pointer wouldn't
+			if (var->type == INTTOK && !var->isPointer && is_increment(instr, &step)) {
+				if (ivState[var->id] == IV_UNCHANGED) {
+					ivState[var->id] = IV_INDUCTION;
+				}
+			} else {
+				ivState[var->id] = IV_OTHER;
+			}
+		}
+	}
+}
+
+//ivState only has the function's own vars: a global's id counts among the globals
+static int is_induction(IrVar *var) {
+	return var->kind != VAR_GLOBAL && ivState[var->id] == IV_INDUCTION;
+}
+
+//Is store "var = var + c" (read and written in the same block)? Sets step to c
+static int is_increment(IrInstr *store, int *step) {
+	IrInstr *add = vreg_def(store->src1);
+	if (add == NULL || add->block != store->block
+		|| (add->op != IR_ADD && add->op != IR_SUB)) {
+		return 0;
+	}
+
+	IrOperand var = add->src1, amount = add->src2;
+	if (add->op == IR_ADD && amount.kind != IRO_IMM) {
+		var = add->src2;
+		amount = add->src1;
+	}
+	IrInstr *load = vreg_def(var);
+	if (amount.kind != IRO_IMM || load == NULL || load->op != IR_LDVAR
+		|| load->var != store->var || load->block != store->block
+		|| !no_store_between(load, store, store->var)) {
+		return 0;
+	}
+	*step = add->op == IR_ADD ? amount.val : -amount.val;
+	return 1;
+}
+
+/*
+	Is instr "addr array + (iv + disp)*scale", with iv an induction
+	variable that nothing writes between its ldvar and instr?
+*/
+static int match_address(IrInstr *instr, IrVar **array, IrVar **iv, int *scale, int *disp) {
+	if (instr->op != IR_ADD || func->vregTypes[instr->dest] != VT_ADDR) {
+		return 0;
+	}
+
+	IrInstr *base = vreg_def(instr->src1);
+	IrOperand index = instr->src2;
+	if (base == NULL || base->op != IR_ADDR) {
+		base = vreg_def(instr->src2);
+		index = instr->src1;
+	}
+	if (base == NULL || base->op != IR_ADDR) {
+		return 0;
+	}
+
+	*scale = 1;
+	IrInstr *def = vreg_def(index);
+	if (def != NULL && def->op == IR_MUL && def->block == instr->block
+		&& (def->src1.kind == IRO_IMM || def->src2.kind == IRO_IMM)) {
+		*scale = def->src2.kind == IRO_IMM ? def->src2.val : def->src1.val;
+		def = vreg_def(def->src2.kind == IRO_IMM ? def->src1 : def->src2);
+	}
+
+	*disp = 0;
+	if (def != NULL && def->op == IR_ADD && def->block == instr->block
+		&& (def->src1.kind == IRO_IMM || def->src2.kind == IRO_IMM)) {
+		*disp = def->src2.kind == IRO_IMM ? def->src2.val : def->src1.val;
+		def = vreg_def(def->src2.kind == IRO_IMM ? def->src1 : def->src2);
+	} else if (def != NULL && def->op == IR_SUB && def->block == instr->block
+		&& def->src2.kind == IRO_IMM) {
+		*disp = -def->src2.val;
+		def = vreg_def(def->src1);
+	}
+
+	if (def == NULL || def->op != IR_LDVAR || def->block != instr->block
+		|| def->var->isPointer || !is_induction(def->var) || *scale == 0
+		|| !no_store_between(def, instr, def->var)) {
+		return 0;
+	}
+	*array = base->var;
+	*iv = def->var;
+	return 1;
+}
+
+//The loop's pointer for (array, iv, scale), made (and set up in the preheader) if need be
+static IvPointer *pointer_for(IrLoop *loop, IrVar *array, IrVar *iv, int scale) {
+	for (IvPointer *ptr = pointers; ptr != NULL; ptr = ptr->next) {
+		if (ptr->array == array && ptr->iv == iv && ptr->scale == scale) {
+			return ptr;
+		}
+	}
+
+	IvPointer *ptr = malloc(sizeof(IvPointer));
+	ptr->array = array;
+	ptr->iv = iv;
+	ptr->scale = scale;
+	ptr->var = new_pointer_var(array, iv->name);
+	ptr->next = pointers;
+	pointers = ptr;
+	numPointers++;
+
+	//ptr = addr array + iv*scale, just before the loop starts
+	IrInstr *term = loop->preheader->last;
+	int index = insert_instr(term, IR_LDVAR, ir_none(), ir_none(), iv);
+	if (scale != 1) {
+		index = insert_instr(term, IR_MUL, ir_vreg(index), ir_imm(scale), NULL);
+	}
+	int base = insert_instr(term, IR_ADDR, ir_none(), ir_none(), array);
+	int start = insert_instr(term, IR_ADD, ir_vreg(base), ir_vreg(index), NULL);
+	insert_instr(term, IR_STVAR, ir_vreg(start), ir_none(), ptr->var);
+	return ptr;
+}
+
+/*
+	instr becomes a read of the pointer. disp*scale gets added on by
+	the loads/stores using it, or, if something else needs the
+	address too, by instr itself.
+*/
+static void rewrite_address(IrInstr *instr, IvPointer *ptr, int disp) {
+	int offset = disp*ptr->scale;
+	int onlyMemoryUses = 1;
+	for (IrBlock *block = func->entry; block != NULL && offset != 0; block = block->next) {
+		for (IrInstr *user = block->first; user != NULL; user = user->next) {
+			IrOperand *uses[IR_MAX_USES];
+			int numUses = ir_get_uses(user, uses);
+			for (int i=0; i < numUses; i++) {
+				if (uses[i]->kind == IRO_VREG && uses[i]->val == instr->dest
+					&& !((user->op == IR_LOAD || user->op == IR_STORE) && uses[i] == &user->src1)) {
+					onlyMemoryUses = 0;
+				}
+			}
+		}
+	}
+
+	drop_uses(instr);
+	numAddresses++;
+	if (offset != 0 && !onlyMemoryUses) {
+		int pointer = insert_instr(instr, IR_LDVAR, ir_none(), ir_none(), ptr->var);
+		instr->src1 = ir_vreg(pointer);
+		instr->src2 = ir_imm(offset);
+		return;
+	}
+
+	for (IrBlock *block = func->entry; block != NULL && offset != 0; block = block->next) {
+		for (IrInstr *user = block->first; user != NULL; user = user->next) {
+			if ((user->op == IR_LOAD || user->op == IR_STORE)
+				&& user->src1.kind == IRO_VREG && user->src1.val == instr->dest) {
+				user->offset += offset;
+			}
+		}
+	}
+	instr->op = IR_LDVAR;
+	instr->var = ptr->var;
+	instr->src1 = instr->src2 = ir_none();
+}
+
+//Right after every iv = iv + c, its pointers move on by c*scale
+static void add_pointer_steps(IrLoop *loop) {
+	for (int i=0; i < loop->numBlocks; i++) {
+		IrInstr *next;
+		for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = next) {
+			next = instr->next;
+			int step;
+			if (instr->op != IR_STVAR || instr->var->isPointer
+				|| !is_induction(instr->var) || !is_increment(instr, &step)) {
+				continue;
+			}
+			for (IvPointer *ptr = pointers; ptr != NULL; ptr = ptr->next) {
+				if (ptr->iv != instr->var) {
+					continue;
+				}
+				int old = insert_instr(next, IR_LDVAR, ir_none(), ir_none(), ptr->var);
+				int moved = insert_instr(next, IR_ADD, ir_vreg(old), ir_imm(step*ptr->scale), NULL);
+				insert_instr(next, IR_STVAR, ir_vreg(moved), ir_none(), ptr->var);
+			}
+		}
+	}
+}
+
+/*
+	"iv < n" -> "pointer < addr array + n*scale", for the loop test
+	in the header. Only done when that leaves iv with nothing to do:
+	the loop doesn't read it otherwise and it's dead after the loop.
+*/
+static void rewrite_exit_test(IrLoop *loop) {
+	IrInstr *test = loop->header->last;
+	if (test->op != IR_CBR
+		|| loop->contains[test->target[0]->id] == loop->contains[test->target[1]->id]) {
+		return;
+	}
+
+	IrOpcode cond = test->cond;
+	IrOperand bound = test->src2;
+	IrInstr *load = vreg_def(test->src1);
+	if (load == NULL || load->op != IR_LDVAR || !is_induction(load->var)) {
+		cond = ir_swap_cond(cond);
+		bound = test->src1;
+		load = vreg_def(test->src2);
+	}
+	if (load == NULL || load->op != IR_LDVAR || !is_induction(load->var)
+		|| load->block != test->block || !no_store_between(load, test, load->var)) {
+		return;
+	}
+	IrVar *iv = load->var;
+
+	//The bound has to stay put for the whole loop
+	IrInstr *boundLoad = vreg_def(bound);
+	if (bound.kind == IRO_VREG && (boundLoad == NULL || boundLoad->op != IR_LDVAR
+		|| boundLoad->var->kind == VAR_GLOBAL || boundLoad->var->isPointer
+		|| ivState[boundLoad->var->id] != IV_UNCHANGED)) {
+		return;
+	}
+
+	//Ordering is only kept by a positive scale
+	IvPointer *ptr = pointers;
+	while (ptr != NULL && (ptr->iv != iv || ptr->scale <= 0)) {
+		ptr = ptr->next;
+	}
+	if (ptr == NULL || (bound.kind == IRO_IMM
+		&& (bound.val > (1 << 28)/ptr->scale || bound.val < -(1 << 28)/ptr->scale))) {
+		return;
+	}
+	if (!only_increments_read(loop, iv, load) || live_after_loop(loop, iv)) {
+		return;
+	}
+
+	//limit = addr array + bound*scale, before the loop
+	IrVar *limit = new_pointer_var(ptr->array, bound.kind == IRO_IMM ? NULL : boundLoad->var->name);
+	IrInstr *term = loop->preheader->last;
+	IrOperand offset = ir_imm(bound.kind == IRO_IMM ? bound.val*ptr->scale : 0);
+	if (bound.kind == IRO_VREG) {
+		offset = ir_vreg(insert_instr(term, IR_LDVAR, ir_none(), ir_none(), boundLoad->var));
+		if (ptr->scale != 1) {
+			offset = ir_vreg(insert_instr(term, IR_MUL, offset, ir_imm(ptr->scale), NULL));
+		}
+	}
+	int base = insert_instr(term, IR_ADDR, ir_none(), ir_none(), ptr->array);
+	int end = insert_instr(term, IR_ADD, ir_vreg(base), offset, NULL);
+	insert_instr(term, IR_STVAR, ir_vreg(end), ir_none(), limit);
+
+	drop_uses(test);
+	test->cond = cond;
+	test->src1 = ir_vreg(insert_instr(test, IR_LDVAR, ir_none(), ir_none(), ptr->var));
+	test->src2 = ir_vreg(insert_instr(test, IR_LDVAR, ir_none(), ir_none(), limit));
+
+	//Now nothing reads iv, so stop keeping it up to date
+	for (int i=0; i < loop->numBlocks; i++) {
+		IrInstr *next;
+		for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = next) {
+			next = instr->next;
+			if (instr->op == IR_STVAR && instr->var == iv) {
+				drop_uses(instr);
+				ir_remove(instr);
+			}
+		}
+	}
+	remove_dead(loop);
+	numTests++;
+}
+
+//Is every read of iv in the loop either testLoad or part of an iv = iv + c?
+static int only_increments_read(IrLoop *loop, IrVar *iv, IrInstr *testLoad) {
+	int numLoads = 0, numIncrements = 0;
+	for (int i=0; i < loop->numBlocks; i++) {
+		for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = instr->next) {
+			if (instr->op == IR_LDVAR && instr->var == iv) {
+				numLoads++;
+			} else if (instr->op == IR_STVAR && instr->var == iv) {
+				IrInstr *add = vreg_def(instr->src1);
+				IrInstr *load = vreg_def(add->src1.kind == IRO_VREG ? add->src1 : add->src2);
+				if (useCount[add->dest] != 1 || useCount[load->dest] != 1) {
+					return 0;
+				}
+				numIncrements++;
+			}
+		}
+	}
+	return useCount[testLoad->dest] == 1 && numLoads == numIncrements + 1;
+}
+
+//Could var be read, after leaving the loop, before being written?
+static int live_after_loop(IrLoop *loop, IrVar *var) {
+	char *liveIn = calloc(func->numBlocks, 1);
+	char *gen = calloc(func->numBlocks, 1);
+	char *kill = calloc(func->numBlocks, 1);
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL && !kill[block->id]; instr = instr->next) {
+			gen[block->id] |= instr->op == IR_LDVAR && instr->var == var;
+			kill[block->id] |= instr->op == IR_STVAR && instr->var == var;
+		}
+	}
+
+	int changed = 1;
+	while (changed) {
+		changed = 0;
+		for (IrBlock *block = func->lastBlock; block != NULL; block = block->prev) {
+			int live = gen[block->id];
+			for (int i=0; i < block->numSuccs && !kill[block->id]; i++) {
+				live |= liveIn[block->succs[i]->id];
+			}
+			if (live != liveIn[block->id]) {
+				liveIn[block->id] = live;
+				changed = 1;
+			}
+		}
+	}
+
+	int live = 0;
+	for (int i=0; i < loop->numBlocks; i++) {
+		IrBlock *block = loop->blocks[i];
+		for (int j=0; j < block->numSuccs; j++) {
+			live |= !loop->contains[block->succs[j]->id] && liveIn[block->succs[j]->id];
+		}
+	}
+	free(liveIn);
+	free(gen);
+	free(kill);
+	return live;
+}
+
+//Deletes the address arithmetic (and ldvars) in the loop that nothing reads any more
+static void remove_dead(IrLoop *loop) {
+	int changed = 1;
+	while (changed) {
+		changed = 0;
+		for (int i=0; i < loop->numBlocks; i++) {
+			IrInstr *next;
+			for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = next) {
+				next = instr->next;
+				int removable = instr->op == IR_LDVAR || instr->op == IR_ADDR
+					|| instr->op == IR_ADD || instr->op == IR_SUB || instr->op == IR_MUL;
+				if (removable && instr->dest < numTracked && useCount[instr->dest] == 0) {
+					drop_uses(instr);
+					ir_remove(instr);
+					changed = 1;
+				}
+			}
+		}
+	}
+}
+
+/** Helpers **/
+
+//The instruction that wrote opnd, if it's a vreg with exactly one
+static IrInstr *vreg_def(IrOperand opnd) {
+	if (opnd.kind != IRO_VREG || opnd.val >= numTracked) {
+		return NULL;
+	}
+	return defOf[opnd.val];
+}
+
+//from and to are in the same block, from first
+static int no_store_between(IrInstr *from, IrInstr *to, IrVar *var) {
+	for (IrInstr *instr = from->next; instr != to; instr = instr->next) {
+		if (instr == NULL || (instr->op == IR_STVAR && instr->var == var)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+//e.g. "&a[i]", or "&a[]" when index is NULL (a limit with a constant index)
+static IrVar *new_pointer_var(IrVar *array, char *index) {
+	char *name = arena_alloc(&func->prog->arena, strlen(array->name)
+		+ (index != NULL ? strlen(index) : 0) + 4);
+	sprintf(name, "&%s[%s]", array->name, index != NULL ? index : "");
+
+	IrVar *var = ir_add_local(func, name, INTTOK, -1);
+	var->isPointer = 1;
+	return var;
+}
+
+/*
+	Puts a new instruction just before pos.
+	@return its dest vreg (-1 if it doesn't write one)
+*/
+static int insert_instr(IrInstr *pos, IrOpcode op, IrOperand src1, IrOperand src2, IrVar *var) {
+	IrInstr *instr = ir_new_instr(func, op);
+	instr->src1 = src1;
+	instr->src2 = src2;
+	instr->var = var;
+	if (ir_has_dest(op)) {
+		int isAddr = op == IR_ADDR || (op == IR_LDVAR && var->isPointer)
+			|| (op == IR_ADD && src1.kind == IRO_VREG && func->vregTypes[src1.val] == VT_ADDR);
+		instr->dest = ir_new_vreg(func, isAddr ? VT_ADDR : VT_INT);
+	}
+	ir_insert_before(pos, instr);
+	return instr->dest;
+}
+
+//instr is about to go (or stop reading its operands)
+static void drop_uses(IrInstr *instr) {
+	IrOperand *uses[IR_MAX_USES];
+	int numUses = ir_get_uses(instr, uses);
+	for (int i=0; i < numUses; i++) {
+		if (uses[i]->kind == IRO_VREG && uses[i]->val < numTracked) {
+			useCount[uses[i]->val]--;
+		}
+	}
+}
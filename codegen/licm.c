@@ -0,0 +1,524 @@
+/*
+	licm: loop-invariant code motion. Whatever a loop works out the
+	same way on every iteration is moved into its preheader and done
+	once, and the result kept in a new local that the loop reads (so
+	regalloc can keep it in a register - a vreg used across blocks
+	would only get a frame slot).
+
+	An instruction is invariant if everything it reads comes from
+	outside the loop or from other invariant instructions, and:
+	- ldvar: the loop never writes the variable. For a global, it
+	  also mustn't call anything that might (worked out for the whole
+	  program first, following calls of calls)
+	- load: the loop has no stores, and calls nothing that stores
+	- addr: always (nothing can move an array)
+	- call: the callee (and everything it calls) has no effects but
+	  its result, always returns, and reads no global the loop writes
+	  (nor arrays, if the loop has stores) - see effects.h
+
+	Moving code out of the loop runs it even when the loop doesn't
+	run at all, so anything that can trap (overflow in add/sub/neg/
+	mul, div by 0, loading from a bad address, anything in a call)
+	only moves if the loop would run it anyway: its block dominates
+	every way out of the loop and every way back to the header. If
+	the loop test is known to pass the first time round (like i = 0;
+	while (i < 10)) the header's way out doesn't count, so the first
+	iteration is enough. It also mustn't trap before something the
+	first iteration would have shown first: no I/O, call (to anything
+	but a pure function sure to return) or store to a global or array
+	can come before it on the way from the header.
+
+	Only chains that are worth it move: a lone ldvar of a param/local
+	already is just a register read.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "passmanager.h"
+#include "loops.h"
+#include "effects.h"
+#include "lexer.h"
+
+//instr->mark while a loop is worked on
+#define INVARIANT 1
+#define HOISTING 2
+
+//Whole-program summary of what calls might do
+static EffectsInfo *effects;
+static int numGlobals;
+
+//The function and loop being worked on
+static IrFunction *func;
+static LoopInfo *info;
+static IrLoop *loop;
+static IrInstr **defOf; //By vreg, NULL if it has no (or more than one) def
+static char *isRoot; //By vreg: invariant, but read by something in the loop that isn't
+static char *storedVar; //By param/local id: written in the loop
+static char *storedGlobal; //By global id: written in the loop, or by something it calls
+static int hasStores; //Stores into an array, or calls something that might
+static int runsOnce; //The loop test is known to pass on the way in
+
+//For -stats
+static int numHoisted;
+static int numLoops;
+
+static void hoist_from_loop();
+static void collect_loop_writes();
+static int is_invariant(IrInstr *instr);
+static int is_invariant_call(IrInstr *call);
+static int can_trap(IrInstr *instr);
+static int runs_every_iteration(IrBlock *block);
+static int effects_before(IrInstr *instr);
+static int shows_effect(IrInstr *instr);
+static int known_to_run();
+static int value_on_entry(IrInstr *test, IrOperand opnd, int *val);
+static int worth_hoisting(IrInstr *instr);
+static void mark_for_hoisting(IrInstr *instr);
+static int move_to_preheader();
+static void read_through_var(IrInstr *root);
+
+static IrInstr *vreg_def(IrOperand opnd);
+static int writes_global(IrInstr *instr, IrVar *var);
+static int in_loop(IrOperand opnd);
+static int compare(IrOpcode cond, int a, int b);
+
+void loop_invariant_code_motion(IrProgram *prog) {
+	numHoisted = numLoops = 0;
+	effects = find_effects(prog);
+	numGlobals = prog->numGlobals;
+
+	for (func = prog->functions; func != NULL; func = func->next) {
+		info = find_loops(func);
+		for (loop = info->loops; loop != NULL; loop = loop->next) {
+			hoist_from_loop();
+		}
+		free_loop_info(info);
+	}
+
+	free_effects(effects);
+	if (printStats) {
+		fprintf(stderr, "licm: %d instructions hoisted out of %d loops\n",
+			numHoisted, numLoops);
+	}
+}
+
+static void hoist_from_loop() {
+	int numVregs = func->numVregs > 0 ? func->numVregs : 1;
+	defOf = calloc(numVregs, sizeof(IrInstr *));
+	isRoot = calloc(numVregs, 1);
+	char *seen = calloc(numVregs, 1);
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			instr->mark = 0;
+			if (instr->dest != -1) {
+				defOf[instr->dest] = seen[instr->dest] ? NULL : instr;
+				seen[instr->dest] = 1;
+			}
+		}
+	}
+	free(seen);
+
+	collect_loop_writes();
+	runsOnce = known_to_run();
+
+	int changed = 1;
+	while (changed) {
+		changed = 0;
+		for (int i=0; i < loop->numBlocks; i++) {
+			for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = instr->next) {
+				if (instr->mark == 0 && is_invariant(instr)) {
+					instr->mark = INVARIANT;
+					changed = 1;
+				}
+			}
+		}
+	}
+
+	//Roots: invariant values that the rest of the loop reads
+	for (int i=0; i < loop->numBlocks; i++) {
+		for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = instr->next) {
+			IrOperand *uses[IR_MAX_USES];
+			int numUses = ir_get_uses(instr, uses);
+			for (int j=0; j < numUses && instr->mark != INVARIANT; j++) {
+				IrInstr *def = vreg_def(*uses[j]);
+				if (def != NULL && def->mark == INVARIANT && in_loop(*uses[j])) {
+					isRoot[def->dest] = 1;
+				}
+			}
+		}
+	}
+	for (int i=0; i < loop->numBlocks; i++) {
+		for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = instr->next) {
+			if (instr->mark == INVARIANT && isRoot[instr->dest] && worth_hoisting(instr)) {
+				mark_for_hoisting(instr);
+			}
+		}
+	}
+
+	//(Roots that weren't worth it alone may have come along with another one)
+	int numRoots = 0;
+	for (int i=0; i < loop->numBlocks; i++) {
+		for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = instr->next) {
+			numRoots += instr->mark == HOISTING && isRoot[instr->dest];
+		}
+	}
+
+	if (numRoots > 0) {
+		IrInstr **roots = malloc(numRoots * sizeof(IrInstr *));
+		int r = 0;
+		for (int i=0; i < loop->numBlocks; i++) {
+			for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = instr->next) {
+				if (instr->mark == HOISTING && isRoot[instr->dest]) {
+					roots[r++] = instr;
+				}
+			}
+		}
+		while (move_to_preheader()) {
+		}
+		for (r=0; r < numRoots; r++) {
+			read_through_var(roots[r]);
+		}
+		free(roots);
+		numLoops++;
+	}
+
+	for (IrInstr *instr = loop->preheader->first; instr != NULL; instr = instr->next) {
+		instr->mark = 0;
+	}
+	for (int i=0; i < loop->numBlocks; i++) {
+		for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = instr->next) {
+			instr->mark = 0;
+		}
+	}
+	free(defOf);
+	free(isRoot);
+	free(storedVar);
+	free(storedGlobal);
+}
+
+static void collect_loop_writes() {
+	storedVar = calloc(func->numVars > 0 ? func->numVars : 1, 1);
+	storedGlobal = calloc(numGlobals > 0 ? numGlobals : 1, 1);
+	hasStores = 0;
+
+	for (int i=0; i < loop->numBlocks; i++) {
+		for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = instr->next) {
+			if (instr->op == IR_STVAR && instr->var->kind == VAR_GLOBAL) {
+				storedGlobal[instr->var->id] = 1;
+			} else if (instr->op == IR_STVAR) {
+				storedVar[instr->var->id] = 1;
+			} else if (instr->op == IR_STORE) {
+				hasStores = 1;
+			} else if (instr->op == IR_CALL) {
+				FuncEffects *callee = effects_of(effects, instr->callee);
+				hasStores |= callee->writesMemory;
+				for (int g=0; g < numGlobals; g++) {
+					storedGlobal[g] |= callee->writesGlobal[g];
+				}
+			}
+		}
+	}
+}
+
+static int is_invariant(IrInstr *instr) {
+	switch (instr->op) {
+		case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV:
+		case IR_SEQ: case IR_SNE: case IR_SLT: case IR_SLE: case IR_SGT: case IR_SGE:
+		case IR_LAND: case IR_LOR: case IR_NEG: case IR_NOT: case IR_MOV:
+		case IR_ADDR:
+			break;
+		case IR_LDVAR:
+			if (instr->var->kind == VAR_GLOBAL ? storedGlobal[instr->var->id]
+				: storedVar[instr->var->id]) {
+				return 0;
+			}
+			break;
+		case IR_LOAD:
+			if (hasStores) {
+				return 0;
+			}
+			break;
+		case IR_CALL:
+			if (!is_invariant_call(instr)) {
+				return 0;
+			}
+			break;
+		default:
+			return 0;
+	}
+
+	IrOperand *uses[IR_MAX_USES];
+	int numUses = ir_get_uses(instr, uses);
+	for (int i=0; i < numUses; i++) {
+		IrInstr *def = vreg_def(*uses[i]);
+		if (uses[i]->kind == IRO_VREG && (def == NULL
+			|| (loop->contains[def->block->id] && def->mark != INVARIANT))) {
+			return 0;
+		}
+	}
+	return !can_trap(instr) || (runs_every_iteration(instr->block) && !effects_before(instr));
+}
+
+//(Given its args are)
+static int is_invariant_call(IrInstr *call) {
+	FuncEffects *callee = effects_of(effects, call->callee);
+	if (call->dest == -1 || !is_pure(effects, callee) || !callee->alwaysReturns
+		|| (callee->readsMemory && hasStores)) {
+		return 0;
+	}
+	for (int g=0; g < numGlobals; g++) {
+		if (callee->readsGlobal[g] && storedGlobal[g]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int can_trap(IrInstr *instr) {
+	switch (instr->op) {
+		case IR_ADD: case IR_SUB: case IR_NEG: case IR_MUL: case IR_LOAD: case IR_CALL:
+			return 1;
+		case IR_DIV: //Dividing by a constant is done with shifts and a multiply
+			return instr->src2.kind != IRO_IMM || instr->src2.val == 0 || instr->src2.val == -1;
+		default:
+			return 0;
+	}
+}
+
+//Does block run before the loop is left (branching out or returning) or goes round again?
+static int runs_every_iteration(IrBlock *block) {
+	for (int i=0; i < loop->numBlocks; i++) {
+		IrBlock *other = loop->blocks[i];
+		int leaves = other->last->op == IR_RET;
+		for (int j=0; j < other->numSuccs; j++) {
+			IrBlock *succ = other->succs[j];
+			//The header's test won't leave the first time, if runsOnce
+			leaves |= succ == loop->header
+				|| (!loop->contains[succ->id] && !(runsOnce && other == loop->header));
+		}
+		if (leaves && !block_dominates(info, block, other)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+//Does the first iteration do anything that shows (see shows_effect()) before it gets to instr?
+static int effects_before(IrInstr *instr) {
+	char *visited = calloc(func->numBlocks + 1, 1);
+	IrBlock **stack = malloc(loop->numBlocks * sizeof(IrBlock *));
+	int numStacked = 0;
+	stack[numStacked++] = instr->block;
+	visited[instr->block->id] = 1;
+
+	//Back from instr's block to the header, not round the loop again
+	int found = 0;
+	while (numStacked > 0 && !found) {
+		IrBlock *block = stack[--numStacked];
+		IrInstr *end = block == instr->block ? instr : NULL;
+		for (IrInstr *other = block->first; other != end && !found; other = other->next) {
+			found = shows_effect(other);
+		}
+		if (block == loop->header) {
+			continue;
+		}
+		for (int i=0; i < block->numPreds; i++) {
+			IrBlock *pred = block->preds[i];
+			if (loop->contains[pred->id] && !visited[pred->id]) {
+				visited[pred->id] = 1;
+				stack[numStacked++] = pred;
+			}
+		}
+	}
+	free(visited);
+	free(stack);
+	return found;
+}
+
+//Would a trap before instr hide it? (Stores to params/locals can't be seen once it has)
+static int shows_effect(IrInstr *instr) {
+	switch (instr->op) {
+		case IR_READ: case IR_WRITE: case IR_WRITELN: case IR_STORE:
+			return 1;
+		case IR_STVAR:
+			return instr->var->kind == VAR_GLOBAL;
+		case IR_CALL: {
+			FuncEffects *callee = effects_of(effects, instr->callee);
+			return !is_pure(effects, callee) || !callee->alwaysReturns;
+		}
+		default:
+			return 0;
+	}
+}
+
+//Is the header's test sure to stay in the loop the first time it's run?
+static int known_to_run() {
+	IrInstr *test = loop->header->last;
+	int a, b;
+	if (test->op != IR_CBR || !value_on_entry(test, test->src1, &a)
+		|| !value_on_entry(test, test->src2, &b)) {
+		return 0;
+	}
+	IrBlock *taken = compare(test->cond, a, b) ? test->target[0] : test->target[1];
+	return loop->contains[taken->id];
+}
+
+/*
+	What opnd (read by the header's test) is when the loop is
+	entered: a constant, or an ldvar of a variable last set to one on
+	the straight-line way into the preheader.
+*/
+static int value_on_entry(IrInstr *test, IrOperand opnd, int *val) {
+	if (opnd.kind == IRO_IMM) {
+		*val = opnd.val;
+		return 1;
+	}
+	IrInstr *load = vreg_def(opnd);
+	if (load == NULL || load->op != IR_LDVAR || load->block != loop->header) {
+		return 0;
+	}
+	IrVar *var = load->var;
+	for (IrInstr *instr = loop->header->first; instr != load; instr = instr->next) {
+		if ((instr->op == IR_STVAR && instr->var == var) || writes_global(instr, var)) {
+			return 0;
+		}
+	}
+
+	IrBlock *block = loop->preheader;
+	for (int steps=0; steps < func->numBlocks; steps++) {
+		for (IrInstr *instr = block->last; instr != NULL; instr = instr->prev) {
+			if (instr->op == IR_STVAR && instr->var == var) {
+				*val = instr->src1.val;
+				return instr->src1.kind == IRO_IMM;
+			}
+			if (writes_global(instr, var)) {
+				return 0;
+			}
+		}
+		if (block->numPreds != 1) {
+			return 0;
+		}
+		block = block->preds[0];
+	}
+	return 0;
+}
+
+//Does moving instr's chain save anything, or is it just ldvars of params/locals?
+static int worth_hoisting(IrInstr *instr) {
+	return instr->op != IR_LDVAR || instr->var->kind == VAR_GLOBAL;
+}
+
+//instr, and the invariant instructions in the loop it reads
+static void mark_for_hoisting(IrInstr *instr) {
+	if (instr->mark == HOISTING) {
+		return;
+	}
+	instr->mark = HOISTING;
+
+	IrOperand *uses[IR_MAX_USES];
+	int numUses = ir_get_uses(instr, uses);
+	for (int i=0; i < numUses; i++) {
+		IrInstr *def = vreg_def(*uses[i]);
+		if (def != NULL && def->mark != 0 && in_loop(*uses[i])) {
+			mark_for_hoisting(def);
+		}
+	}
+}
+
+/*
+	Moves every instruction marked for hoisting whose operands are
+	already outside the loop to the end of the preheader.
+	@return 1 if any moved (so the ones reading them may be able to now)
+*/
+static int move_to_preheader() {
+	int moved = 0;
+	for (int i=0; i < loop->numBlocks; i++) {
+		IrInstr *next;
+		for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = next) {
+			next = instr->next;
+			if (instr->mark != HOISTING) {
+				continue;
+			}
+
+			IrOperand *uses[IR_MAX_USES];
+			int numUses = ir_get_uses(instr, uses);
+			int ready = 1;
+			for (int j=0; j < numUses; j++) {
+				ready &= !in_loop(*uses[j]);
+			}
+			if (ready) {
+				ir_remove(instr);
+				ir_insert_before(loop->preheader->last, instr);
+				numHoisted++;
+				moved = 1;
+			}
+		}
+	}
+	return moved;
+}
+
+//Keeps root's result in a new local, which the loop reads instead of the vreg
+static void read_through_var(IrInstr *root) {
+	char *name = arena_alloc(&func->prog->arena, 16);
+	sprintf(name, "inv.%d", root->dest);
+	IrVar *var = ir_add_local(func, name, INTTOK, -1);
+	var->isPointer = func->vregTypes[root->dest] == VT_ADDR;
+
+	IrInstr *store = ir_new_instr(func, IR_STVAR);
+	store->var = var;
+	store->src1 = ir_vreg(root->dest);
+	ir_insert_before(loop->preheader->last, store);
+
+	for (int i=0; i < loop->numBlocks; i++) {
+		for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = instr->next) {
+			IrOperand *uses[IR_MAX_USES];
+			int numUses = ir_get_uses(instr, uses);
+			for (int j=0; j < numUses; j++) {
+				if (uses[j]->kind != IRO_VREG || uses[j]->val != root->dest) {
+					continue;
+				}
+				IrInstr *load = ir_new_instr(func, IR_LDVAR);
+				load->var = var;
+				load->dest = ir_new_vreg(func, func->vregTypes[root->dest]);
+				ir_insert_before(instr, load);
+				*uses[j] = ir_vreg(load->dest);
+			}
+		}
+	}
+}
+
+/** Helpers **/
+
+//The instruction that wrote opnd, if it's a vreg with exactly one
+static IrInstr *vreg_def(IrOperand opnd) {
+	if (opnd.kind != IRO_VREG) {
+		return NULL;
+	}
+	return defOf[opnd.val];
+}
+
+//Is instr a call that might change var (a global)?
+static int writes_global(IrInstr *instr, IrVar *var) {
+	return instr->op == IR_CALL && var->kind == VAR_GLOBAL
+		&& effects_of(effects, instr->callee)->writesGlobal[var->id];
+}
+
+//Is opnd worked out inside the loop?
+static int in_loop(IrOperand opnd) {
+	IrInstr *def = vreg_def(opnd);
+	return def != NULL && loop->contains[def->block->id];
+}
+
+static int compare(IrOpcode cond, int a, int b) {
+	switch (cond) {
+		case IR_SEQ: return a == b;
+		case IR_SNE: return a != b;
+		case IR_SLT: return a < b;
+		case IR_SLE: return a <= b;
+		case IR_SGT: return a > b;
+		default: return a >= b;
+	}
+}
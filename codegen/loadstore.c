@@ -0,0 +1,297 @@
+/*
+	loadstore: gets rid of memory traffic the other passes leave.
+	- a global an int loop writes (and calls nothing that reads or
+	  writes it) is kept in a new local while the loop runs: loaded
+	  once in the
+	  preheader, stored back on every way out. regalloc can then give
+	  it a register, where the loop would otherwise lw/sw it off $gp
+	  every time round. (A global the loop only reads is licm.c's.)
+	- a store to a global, or into an array, that's overwritten later
+	  in the same block with nothing in between that could read it
+	  (a load that might overlap, a call that might read it, a
+	  return) is deleted
+
+	A store and its later load in one block are already cse.c's
+	(the load becomes the value stored), and dead stores to
+	params/locals are dce.c's. What a call might read and write
+	comes from effects.h.
+
+	Char globals are left alone - a store into one cuts the value
+	down to a byte, which an int local wouldn't.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "passmanager.h"
+#include "loops.h"
+#include "effects.h"
+#include "lexer.h"
+
+//Stores into arrays a block goes on to overwrite (see remove_dead_stores())
+typedef struct {
+	IrOperand addr;
+	int offset;
+	int width;
+} LaterStore;
+
+static EffectsInfo *effects;
+
+//The function being worked on
+static IrFunction *func;
+static int numGlobals;
+static IrVar **promoted; //By global id: the local standing in for it in the current loop
+
+//For -stats
+static int numPromoted;
+static int numLoops;
+static int numDeadStores;
+
+static int promote_in_loop(IrLoop *loop);
+static void store_back(IrBlock *block, IrInstr *pos);
+static void remove_dead_stores(IrBlock *block);
+
+void eliminate_redundant_loads_stores(IrProgram *prog) {
+	numPromoted = numLoops = numDeadStores = 0;
+	numGlobals = prog->numGlobals;
+	promoted = calloc(numGlobals + 1, sizeof(IrVar *));
+	effects = find_effects(prog);
+
+	for (func = prog->functions; func != NULL; func = func->next) {
+		//Each promotion changes the CFG, so the loops are found again after it
+		int changed = 1;
+		while (changed) {
+			changed = 0;
+			LoopInfo *info = find_loops(func);
+			for (IrLoop *loop = info->loops; loop != NULL && !changed; loop = loop->next) {
+				changed = promote_in_loop(loop);
+			}
+			free_loop_info(info);
+		}
+
+		for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+			remove_dead_stores(block);
+		}
+	}
+	free(promoted);
+	free_effects(effects);
+
+	if (printStats) {
+		fprintf(stderr, "loadstore: %d globals kept in locals across %d loops, "
+			"%d dead stores removed\n", numPromoted, numLoops, numDeadStores);
+	}
+}
+
+/*
+	Promotes every int global loop writes, unless something it calls
+	uses that global too.
+	@return 1 if anything was promoted
+*/
+static int promote_in_loop(IrLoop *loop) {
+	char *stored = calloc(numGlobals + 1, 1);
+	char *calleesUse = calloc(numGlobals + 1, 1);
+	for (int i=0; i < loop->numBlocks; i++) {
+		for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = instr->next) {
+			if (instr->op == IR_CALL) {
+				FuncEffects *callee = effects_of(effects, instr->callee);
+				for (int g=0; g < numGlobals; g++) {
+					calleesUse[g] |= callee->readsGlobal[g] | callee->writesGlobal[g];
+				}
+			} else if (instr->op == IR_STVAR && instr->var->kind == VAR_GLOBAL && instr->var->type == INTTOK) {
+				stored[instr->var->id] = 1;
+			}
+		}
+	}
+
+	int numToPromote = 0;
+	for (IrVar *global = func->prog->globals; global != NULL; global = global->next) {
+		promoted[global->id] = NULL;
+		if (!stored[global->id] || calleesUse[global->id]) {
+			continue;
+		}
+		char *name = arena_alloc(&func->prog->arena, strlen(global->name) + 8);
+		sprintf(name, "%s.local", global->name);
+		IrVar *var = ir_add_local(func, name, INTTOK, -1);
+		promoted[global->id] = var;
+		numToPromote++;
+
+		IrInstr *load = ir_new_instr(func, IR_LDVAR);
+		load->var = global;
+		load->dest = ir_new_vreg(func, VT_INT);
+		ir_insert_before(loop->preheader->last, load);
+		IrInstr *store = ir_new_instr(func, IR_STVAR);
+		store->var = var;
+		store->src1 = ir_vreg(load->dest);
+		ir_insert_before(loop->preheader->last, store);
+	}
+	free(stored);
+	free(calleesUse);
+	if (numToPromote == 0) {
+		return 0;
+	}
+
+	for (int i=0; i < loop->numBlocks; i++) {
+		for (IrInstr *instr = loop->blocks[i]->first; instr != NULL; instr = instr->next) {
+			if ((instr->op == IR_LDVAR || instr->op == IR_STVAR) && instr->var->kind == VAR_GLOBAL
+				&& promoted[instr->var->id] != NULL) {
+				instr->var = promoted[instr->var->id];
+			}
+		}
+	}
+
+	//Stores back: at the top of a block only the loop reaches, or else on a new block on the edge
+	for (int i=0; i < loop->numBlocks; i++) {
+		IrBlock *block = loop->blocks[i];
+		for (int k=0; k < block->numSuccs; k++) {
+			IrBlock *exit = block->succs[k];
+			if (loop->contains[exit->id] || exit->mark) {
+				continue;
+			}
+			int onlyFromLoop = 1;
+			for (int p=0; p < exit->numPreds; p++) {
+				onlyFromLoop &= loop->contains[exit->preds[p]->id];
+			}
+			if (onlyFromLoop) {
+				store_back(exit, exit->first);
+				exit->mark = 1;
+				continue;
+			}
+
+			IrInstr *term = block->last;
+			if (term->target[0] != exit && term->target[1] != exit) {
+				continue; //(both edges go here, and the first one's already been split)
+			}
+			IrBlock *edge = ir_new_block(func);
+			ir_emit_jump(edge, exit);
+			store_back(edge, edge->last);
+			for (int t=0; t < 2; t++) {
+				if (term->target[t] == exit) {
+					term->target[t] = edge;
+				}
+			}
+		}
+	}
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		block->mark = 0;
+	}
+	ir_rebuild_cfg(func);
+
+	numPromoted += numToPromote;
+	numLoops++;
+	return 1;
+}
+
+//Copies every promoted local back to its global, before pos
+static void store_back(IrBlock *block, IrInstr *pos) {
+	for (IrVar *global = func->prog->globals; global != NULL; global = global->next) {
+		IrVar *var = promoted[global->id];
+		if (var == NULL) {
+			continue;
+		}
+		IrInstr *load = ir_new_instr(func, IR_LDVAR);
+		load->var = var;
+		load->dest = ir_new_vreg(func, VT_INT);
+		ir_insert_before(pos, load);
+		IrInstr *store = ir_new_instr(func, IR_STVAR);
+		store->var = global;
+		store->src1 = ir_vreg(load->dest);
+		ir_insert_before(pos, store);
+	}
+}
+
+/*
+	Walks block backwards, remembering which globals and which bytes
+	of arrays are stored to further down with nothing reading them
+	first - a store to one of those is dead. Nothing is known at the
+	end of the block (whatever comes next might read anything).
+*/
+static void remove_dead_stores(IrBlock *block) {
+	char *globalStored = calloc(numGlobals + 1, 1);
+	LaterStore *later = NULL;
+	int numLater = 0, laterCapacity = 0;
+
+	IrInstr *prev;
+	for (IrInstr *instr = block->last; instr != NULL; instr = prev) {
+		prev = instr->prev;
+		switch (instr->op) {
+		case IR_CALL: {
+			FuncEffects *callee = effects_of(effects, instr->callee);
+			for (int g=0; g < numGlobals; g++) {
+				globalStored[g] &= !callee->readsGlobal[g];
+			}
+			if (callee->readsMemory) {
+				numLater = 0;
+			}
+			break;
+		}
+
+		case IR_RET:
+			memset(globalStored, 0, numGlobals + 1);
+			numLater = 0;
+			break;
+
+		case IR_LDVAR:
+			if (instr->var->kind == VAR_GLOBAL) {
+				globalStored[instr->var->id] = 0;
+			}
+			break;
+
+		case IR_STVAR:
+			if (instr->var->kind != VAR_GLOBAL) {
+				break;
+			}
+			if (globalStored[instr->var->id]) {
+				ir_remove(instr);
+				numDeadStores++;
+			}
+			globalStored[instr->var->id] = 1;
+			break;
+
+		case IR_LOAD: {
+			//Only stores off the same address to bytes this doesn't read survive
+			int kept = 0;
+			for (int i=0; i < numLater; i++) {
+				LaterStore *store = &later[i];
+				if (store->addr.kind == instr->src1.kind && store->addr.val == instr->src1.val
+					&& (store->offset >= instr->offset + instr->width
+					|| instr->offset >= store->offset + store->width)) {
+					later[kept++] = *store;
+				}
+			}
+			numLater = kept;
+			break;
+		}
+
+		case IR_STORE: {
+			int isDead = 0;
+			for (int i=0; i < numLater; i++) {
+				LaterStore *store = &later[i];
+				isDead |= store->addr.kind == instr->src1.kind && store->addr.val == instr->src1.val
+					&& store->offset <= instr->offset
+					&& instr->offset + instr->width <= store->offset + store->width;
+			}
+			if (isDead) {
+				ir_remove(instr);
+				numDeadStores++;
+				break;
+			}
+			if (numLater == laterCapacity) {
+				laterCapacity = laterCapacity * 2 + 8;
+				later = realloc(later, laterCapacity * sizeof(LaterStore));
+			}
+			later[numLater].addr = instr->src1;
+			later[numLater].offset = instr->offset;
+			later[numLater].width = instr->width;
+			numLater++;
+			break;
+		}
+
+		default:
+			break;
+		}
+	}
+	free(globalStored);
+	free(later);
+}
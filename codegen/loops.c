@@ -0,0 +1,336 @@
+/*
+	Loop finding (see loops.h), shared by the passes that move code
+	into or around loops.
+
+	Dominators are worked out with the Cooper/Harvey/Kennedy
+	algorithm: walk the blocks in reverse postorder, setting each
+	one's immediate dominator to the nearest common dominator of the
+	preds seen so far, until nothing changes. For the CFGs C-- gives
+	that takes two or three rounds.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "loops.h"
+
+static void compute_dominators(LoopInfo *info);
+static void collect_loops(LoopInfo *info);
+static IrLoop *loop_with_header(LoopInfo *info, IrBlock *header);
+static void add_to_loop(LoopInfo *info, IrLoop *loop, IrBlock *latch);
+static void finish_loop(LoopInfo *info, IrLoop *loop);
+static void link_nesting(LoopInfo *info);
+static int add_preheaders(LoopInfo *info);
+static void free_loops(LoopInfo *info);
+static int intersect(int *idom, int *rpoIndex, int a, int b);
+
+LoopInfo *find_loops(IrFunction *func) {
+	LoopInfo *info = calloc(1, sizeof(LoopInfo));
+	info->func = func;
+	compute_dominators(info);
+	collect_loops(info);
+
+	//The new blocks change the dominators (and loop bodies), so start over
+	if (add_preheaders(info)) {
+		ir_rebuild_cfg(func);
+		free_loops(info);
+		compute_dominators(info);
+		collect_loops(info);
+	}
+	return info;
+}
+
+LoopInfo *find_dominators(IrFunction *func) {
+	LoopInfo *info = calloc(1, sizeof(LoopInfo));
+	info->func = func;
+	compute_dominators(info);
+	return info;
+}
+
+void free_loop_info(LoopInfo *info) {
+	free_loops(info);
+	free(info);
+}
+
+//Does every path from the entry to b go through a? (a dominates itself)
+int block_dominates(LoopInfo *info, IrBlock *a, IrBlock *b) {
+	int id = b->id;
+	if (info->idom[id] == -1 || info->idom[a->id] == -1) {
+		return 0;
+	}
+	while (id != a->id) {
+		if (info->idom[id] == id) { //Got up to the entry
+			return 0;
+		}
+		id = info->idom[id];
+	}
+	return 1;
+}
+
+static void compute_dominators(LoopInfo *info) {
+	IrFunction *func = info->func;
+	int n = func->numBlocks;
+	int *idom = malloc(n * sizeof(int));
+	int *rpoIndex = malloc(n * sizeof(int));
+	IrBlock **order = malloc(n * sizeof(IrBlock *));
+	IrBlock **stack = malloc(n * sizeof(IrBlock *));
+	int *nextSucc = calloc(n, sizeof(int));
+	for (int i=0; i < n; i++) {
+		idom[i] = rpoIndex[i] = -1;
+	}
+
+	//Postorder by an explicit depth-first walk (rpoIndex doubles as "seen")
+	int numOrdered = 0, depth = 0;
+	stack[depth++] = func->entry;
+	rpoIndex[func->entry->id] = 0;
+	while (depth > 0) {
+		IrBlock *block = stack[depth-1];
+		if (nextSucc[block->id] < block->numSuccs) {
+			IrBlock *succ = block->succs[nextSucc[block->id]++];
+			if (rpoIndex[succ->id] == -1) {
+				rpoIndex[succ->id] = 0;
+				stack[depth++] = succ;
+			}
+		} else {
+			order[numOrdered++] = block;
+			depth--;
+		}
+	}
+	//Flip it round into reverse postorder
+	for (int i=0; i < numOrdered/2; i++) {
+		IrBlock *tmp = order[i];
+		order[i] = order[numOrdered-1-i];
+		order[numOrdered-1-i] = tmp;
+	}
+	for (int i=0; i < numOrdered; i++) {
+		rpoIndex[order[i]->id] = i;
+	}
+
+	idom[func->entry->id] = func->entry->id;
+	int changed = 1;
+	while (changed) {
+		changed = 0;
+		for (int i=1; i < numOrdered; i++) {
+			IrBlock *block = order[i];
+			int newIdom = -1;
+			for (int j=0; j < block->numPreds; j++) {
+				int pred = block->preds[j]->id;
+				if (idom[pred] == -1) { //Not reachable, or not got to yet
+					continue;
+				}
+				newIdom = newIdom == -1 ? pred : intersect(idom, rpoIndex, pred, newIdom);
+			}
+			if (idom[block->id] != newIdom) {
+				idom[block->id] = newIdom;
+				changed = 1;
+			}
+		}
+	}
+
+	info->idom = idom;
+	free(rpoIndex);
+	free(order);
+	free(stack);
+	free(nextSucc);
+}
+
+//Nearest block dominating both a and b
+static int intersect(int *idom, int *rpoIndex, int a, int b) {
+	while (a != b) {
+		while (rpoIndex[a] > rpoIndex[b]) {
+			a = idom[a];
+		}
+		while (rpoIndex[b] > rpoIndex[a]) {
+			b = idom[b];
+		}
+	}
+	return a;
+}
+
+static void collect_loops(LoopInfo *info) {
+	info->loops = NULL;
+	info->numLoops = 0;
+
+	for (IrBlock *block = info->func->entry; block != NULL; block = block->next) {
+		if (info->idom[block->id] == -1) {
+			continue;
+		}
+		for (int i=0; i < block->numSuccs; i++) {
+			IrBlock *header = block->succs[i];
+			if (block_dominates(info, header, block)) {
+				add_to_loop(info, loop_with_header(info, header), block);
+			}
+		}
+	}
+
+	for (IrLoop *loop = info->loops; loop != NULL; loop = loop->next) {
+		finish_loop(info, loop);
+	}
+	link_nesting(info);
+}
+
+//Back edges to the same header all make one loop
+static IrLoop *loop_with_header(LoopInfo *info, IrBlock *header) {
+	for (IrLoop *loop = info->loops; loop != NULL; loop = loop->next) {
+		if (loop->header == header) {
+			return loop;
+		}
+	}
+
+	IrLoop *loop = calloc(1, sizeof(IrLoop));
+	loop->header = header;
+	loop->contains = calloc(info->func->numBlocks, 1);
+	loop->contains[header->id] = 1;
+	loop->next = info->loops;
+	info->loops = loop;
+	info->numLoops++;
+	return loop;
+}
+
+//Everything that reaches latch without going through the header is in the loop
+static void add_to_loop(LoopInfo *info, IrLoop *loop, IrBlock *latch) {
+	if (loop->contains[latch->id]) {
+		return;
+	}
+
+	int n = latch->func->numBlocks;
+	IrBlock **worklist = malloc(n * sizeof(IrBlock *));
+	int numWork = 0;
+	loop->contains[latch->id] = 1;
+	worklist[numWork++] = latch;
+	while (numWork > 0) {
+		IrBlock *block = worklist[--numWork];
+		for (int i=0; i < block->numPreds; i++) {
+			IrBlock *pred = block->preds[i];
+			if (!loop->contains[pred->id] && info->idom[pred->id] != -1) {
+				loop->contains[pred->id] = 1;
+				worklist[numWork++] = pred;
+			}
+		}
+	}
+	free(worklist);
+}
+
+//Fills in the block list and spots the preheader, if there already is one
+static void finish_loop(LoopInfo *info, IrLoop *loop) {
+	loop->numBlocks = 0;
+	for (IrBlock *block = info->func->entry; block != NULL; block = block->next) {
+		loop->numBlocks += loop->contains[block->id];
+	}
+	loop->blocks = malloc(loop->numBlocks * sizeof(IrBlock *));
+	int i = 0;
+	for (IrBlock *block = info->func->entry; block != NULL; block = block->next) {
+		if (loop->contains[block->id]) {
+			loop->blocks[i++] = block;
+		}
+	}
+
+	IrBlock *outsidePred = NULL;
+	int numOutside = 0;
+	for (int j=0; j < loop->header->numPreds; j++) {
+		if (!loop->contains[loop->header->preds[j]->id]) {
+			outsidePred = loop->header->preds[j];
+			numOutside++;
+		}
+	}
+	loop->preheader = NULL;
+	if (numOutside == 1 && outsidePred->numSuccs == 1) {
+		loop->preheader = outsidePred;
+	}
+}
+
+/*
+	A loop's parent is the smallest other loop holding its header.
+	The list is then sorted smallest first, which puts every loop
+	ahead of the ones it's inside.
+*/
+static void link_nesting(LoopInfo *info) {
+	for (IrLoop *loop = info->loops; loop != NULL; loop = loop->next) {
+		loop->parent = NULL;
+		for (IrLoop *other = info->loops; other != NULL; other = other->next) {
+			if (other != loop && other->contains[loop->header->id]
+				&& other->numBlocks > loop->numBlocks
+				&& (loop->parent == NULL || other->numBlocks < loop->parent->numBlocks)) {
+				loop->parent = other;
+			}
+		}
+	}
+
+	IrLoop *sorted = NULL;
+	while (info->loops != NULL) {
+		IrLoop *loop = info->loops;
+		info->loops = loop->next;
+
+		IrLoop **pos = &sorted;
+		while (*pos != NULL && (*pos)->numBlocks <= loop->numBlocks) {
+			pos = &(*pos)->next;
+		}
+		loop->next = *pos;
+		*pos = loop;
+	}
+	info->loops = sorted;
+
+	for (IrLoop *loop = info->loops; loop != NULL; loop = loop->next) {
+		loop->depth = 0;
+		for (IrLoop *outer = loop; outer != NULL; outer = outer->parent) {
+			loop->depth++;
+		}
+	}
+}
+
+/*
+	Gives every loop without one a new block, laid out just before
+	the header, that the ways in from outside the loop now go to.
+	@return how many were added (the CFG then needs rebuilding)
+*/
+static int add_preheaders(LoopInfo *info) {
+	IrFunction *func = info->func;
+	int numAdded = 0;
+
+	for (IrLoop *loop = info->loops; loop != NULL; loop = loop->next) {
+		if (loop->preheader != NULL) {
+			continue;
+		}
+		IrBlock *header = loop->header;
+		IrBlock *preheader = ir_new_block(func);
+		ir_emit_jump(preheader, header);
+
+		for (int i=0; i < header->numPreds; i++) {
+			IrInstr *term = header->preds[i]->last;
+			if (loop->contains[header->preds[i]->id]) {
+				continue;
+			}
+			for (int j=0; j < 2; j++) {
+				if (term->target[j] == header) {
+					term->target[j] = preheader;
+				}
+			}
+		}
+
+		//Whatever fell through into the header now falls into this instead
+		if (header->prev != NULL) {
+			ir_move_block_after(preheader, header->prev);
+		} else { //The header was the entry, so this takes over
+			ir_remove_block(preheader);
+			preheader->next = func->entry;
+			func->entry->prev = preheader;
+			func->entry = preheader;
+		}
+		numAdded++;
+	}
+	return numAdded;
+}
+
+static void free_loops(LoopInfo *info) {
+	while (info->loops != NULL) {
+		IrLoop *loop = info->loops;
+		info->loops = loop->next;
+		free(loop->contains);
+		free(loop->blocks);
+		free(loop);
+	}
+	free(info->idom);
+	info->idom = NULL;
+}
@@ -3,26 +3,72 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
+#include <time.h>
 #include "traversaltotable.h"
 #include "codetraversal.h"
 #include "parser.h"
 #include "symtab.h"
 #include "ast.h"
+#include "tablemechanics.h"
+#include "passmanager.h"
+#include "irtotable.h"
+
+FILE *inFile;
+FILE *outFile;
+
+static void usage() {
+  printf("usage: mycc  [-time]  [-emitbench N]  [-O0]  [-f<pass>]  filename.c--  filename.s\n");
+  printf("  -time          print how long each compiler phase took (to stderr)\n");
+  printf("  -emitbench N   also write the assembly N more times to /dev/null and\n");
+  printf("                 report the emit phase's throughput (to stderr)\n");
+  print_pass_options();
+  exit(1);
+}
+
+//Seconds elapsed since *start, and resets *start to now
+static double lap(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double secs = (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec)/1e9;
+  *start = now;
+  return secs;
+}
 
 int main(int argc, char *argv[]) {
 
   FILE *in = 0, *out = 0;
+  char *inName = NULL, *outName = NULL;
+  int timePhases = 0;
+  int emitReps = 0;
+  struct timespec clock;
 
-  if(argc != 3) { 
-    printf("usage: mycc  filename.c--  filename.s\n");
-    exit(1);
+  for (int i=1; i < argc; i++) {
+    if (strcmp(argv[i], "-time") == 0) {
+      timePhases = 1;
+    } else if (strcmp(argv[i], "-emitbench") == 0 && i+1 < argc) {
+      emitReps = atoi(argv[++i]);
+    } else if (handle_pass_option(argv[i])) {
+      continue;
+    } else if (argv[i][0] == '-') {
+      usage();
+    } else if (inName == NULL) {
+      inName = argv[i];
+    } else if (outName == NULL) {
+      outName = argv[i];
+    } else {
+      usage();
+    }
   }
-  if(!(in = fopen(argv[1], "rw")) ) {
+  if (outName == NULL) { 
+    usage();
+  }
+  if(!(in = fopen(inName, "rw")) ) {
     perror("no such file\n");
     exit(1);
   }
-  if(!(out = fopen(argv[2], "w")) ) {
+  if(!(out = fopen(outName, "w")) ) {
     perror("opening output file faild\n");
     exit(1);
   }
@@ -30,13 +76,56 @@ int main(int argc, char *argv[]) {
   inFile = in;
   outFile = out;
 
+  clock_gettime(CLOCK_MONOTONIC, &clock);
   parse(in);   
+  double parseTime = lap(&clock);
+
   init_symtab_stack(); 
-  traverse_and_generate_code(); 
-  output_code_table_to_file(out);                              
+  IrProgram *prog = traverse_and_generate_ir(); 
+  double irgenTime = lap(&clock);
+
+  run_ir_passes(prog);
+  double optTime = lap(&clock);
+
+  lower_ir_to_table(prog);
+  run_code_passes(codeTable);
+  double codegenTime = lap(&clock);
+
+  size_t bytesOut = output_code_table_to_file(out);                              
+  fflush(out);
+  double emitTime = lap(&clock);
+
+  if (timePhases) {
+    fprintf(stderr, "parse:   %8.3f s\n", parseTime);
+    fprintf(stderr, "irgen:   %8.3f s\n", irgenTime);
+    fprintf(stderr, "passes:  %8.3f s\n", optTime);
+    fprintf(stderr, "codegen: %8.3f s  (%d instructions)\n", codegenTime, 
+      codeTable->numInstructions);
+    fprintf(stderr, "emit:    %8.3f s  (%zu bytes)\n", emitTime, bytesOut);
+  }
+
+  //Emit-only benchmark: the table is already built, so just keep writing it
+  if (emitReps > 0) {
+    FILE *devNull = fopen("/dev/null", "w");
+    if (devNull == NULL) {
+      perror("opening /dev/null failed\n");
+      exit(1);
+    }
+    lap(&clock);
+    for (int i=0; i < emitReps; i++) {
+      output_code_table_to_file(devNull);
+    }
+    fflush(devNull);
+    double repTime = lap(&clock)/emitReps;
+    fprintf(stderr, "emitbench: %d runs, %8.4f s/run, %8.1f MB/s\n", emitReps, 
+      repTime, bytesOut/repTime/1e6);
+    fclose(devNull);
+  }
   
   //Free up heap memory we used for our data structures
   destroy_code_table();
+  destroy_ir_program(prog);
+  irProgram = NULL;
   destroy_ast(&ast_tree);
   destroy_symtab_stack();
 
@@ -0,0 +1,185 @@
+/*
+	Runs the optimisation passes over the IR, in the order they're
+	listed in the passes table below. New passes go in that table
+	(and in passmanager.h), nowhere else.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "passmanager.h"
+
+int optLevel = 1;
+int printStats = 0;
+int unrollCount = 4;
+int unrollMaxSize = 64;
+int unrollFullMax = 16;
+int noReorder = 0;
+
+//Debugging aids
+static int printIr = 0; //Print the IR just before lowering it
+static int printIrAll = 0; //...and after every pass
+static int verifyEachPass = 0;
+
+static IrPass passes[] = {
+	{ "inline", "copy small (or only-called-once) functions into their callers",
+		NULL, inline_functions, NULL, -1 },
+	{ "simplifycfg", "remove unreachable blocks and merge straight-line ones",
+		simplify_cfg, NULL, NULL, -1 },
+	{ "tailcall", "make self-recursive tail calls into loops, and other tail calls into jumps",
+		NULL, eliminate_tail_calls, NULL, -1 },
+	{ "unroll", "copy the bodies of counted loops (see -unroll-count and friends)",
+		NULL, unroll_loops, NULL, -1 },
+	{ "ivreduce", "walk arrays in loops with a pointer instead of working out base + i*size",
+		NULL, reduce_induction_variables, NULL, -1 },
+	{ "constprop", "fold constants and propagate them through variables and branches",
+		NULL, constant_propagation, NULL, -1 },
+	{ "cse", "share values worked out more than once (value numbering down the dominator tree)",
+		NULL, eliminate_common_subexpressions, NULL, -1 },
+	{ "licm", "move what loops work out the same every time into their preheaders",
+		NULL, loop_invariant_code_motion, NULL, -1 },
+	{ "loadstore", "keep globals loops write in locals, and delete stores overwritten before they're read",
+		NULL, eliminate_redundant_loads_stores, NULL, -1 },
+	{ "dce", "delete instructions nothing reads, stores to dead variables and unused locals",
+		NULL, eliminate_dead_code, NULL, -1 },
+	{ "deadfuncs", "drop functions main can't reach",
+		NULL, remove_unreachable_functions, NULL, -1 },
+	{ "callconv", "lower callees first, so calls only save the registers they clobber, and keep "
+		"array params in registers", NULL, choose_calling_conventions, NULL, -1 },
+	{ "regalloc", "keep scalar params/locals in $s0-$s7 (graph colouring)",
+		NULL, allocate_registers, NULL, -1 },
+	{ "stackslots", "let params/locals in memory that are never live together share frame slots",
+		NULL, share_stack_slots, NULL, -1 },
+	{ "strength", "lower * by small constants to adds and / by constants to magic-number "
+		"multiplies", NULL, NULL, NULL, -1 },
+	{ "peephole", "clean up redundant MIPS instructions (after lowering)",
+		NULL, NULL, peephole_optimize, -1 },
+	{ "schedule", "reorder the MIPS in each block around load/multiply/divide latencies, "
+		"and fill delay slots with -noreorder", NULL, NULL, schedule_code, -1 },
+};
+
+#define NUM_PASSES ((int)(sizeof(passes)/sizeof(passes[0])))
+
+static IrPass *find_pass(char *name);
+static int should_run(IrPass *pass);
+
+int handle_pass_option(char *arg) {
+	if (strcmp(arg, "-O0") == 0) {
+		optLevel = 0;
+	} else if (strcmp(arg, "-O1") == 0 || strcmp(arg, "-O") == 0) {
+		optLevel = 1;
+	} else if (strcmp(arg, "-print-ir") == 0) {
+		printIr = 1;
+	} else if (strcmp(arg, "-print-ir-all") == 0) {
+		printIr = printIrAll = 1;
+	} else if (strcmp(arg, "-verify-ir") == 0) {
+		verifyEachPass = 1;
+	} else if (strcmp(arg, "-stats") == 0) {
+		printStats = 1;
+	} else if (strncmp(arg, "-unroll-count=", 14) == 0) {
+		unrollCount = atoi(arg+14);
+	} else if (strncmp(arg, "-unroll-max-size=", 17) == 0) {
+		unrollMaxSize = atoi(arg+17);
+	} else if (strncmp(arg, "-unroll-full-max=", 17) == 0) {
+		unrollFullMax = atoi(arg+17);
+	} else if (strcmp(arg, "-noreorder") == 0) {
+		noReorder = 1;
+	} else if (strncmp(arg, "-fno-", 5) == 0 && find_pass(arg+5) != NULL) {
+		find_pass(arg+5)->setting = 0;
+	} else if (strncmp(arg, "-f", 2) == 0 && find_pass(arg+2) != NULL) {
+		find_pass(arg+2)->setting = 1;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+void print_pass_options() {
+	printf("  -O0            don't optimise (-O1, the default, runs every pass)\n");
+	printf("  -f<pass>       run <pass> even at -O0; -fno-<pass> never runs it\n");
+	printf("  -print-ir      print the IR before it's lowered to MIPS\n");
+	printf("  -print-ir-all  ...and after each pass too\n");
+	printf("  -verify-ir     check the IR is well-formed after every pass\n");
+	printf("  -stats         print what each pass did (to stderr)\n");
+	printf("  -unroll-count=N     copies of a loop body unroll makes (default %d)\n", unrollCount);
+	printf("  -unroll-max-size=N  ...as long as they come to at most N IR instructions (%d)\n",
+		unrollMaxSize);
+	printf("  -unroll-full-max=N  loops of up to N trips are unrolled completely (%d)\n",
+		unrollFullMax);
+	printf("  -noreorder     write .set noreorder code, with the delay slots and load delays filled in\n");
+	printf("  passes, in the order they run:\n");
+	for (int i=0; i < NUM_PASSES; i++) {
+		printf("    %-14s %s\n", passes[i].name, passes[i].description);
+	}
+}
+
+int pass_enabled(char *name) {
+	IrPass *pass = find_pass(name);
+	return pass != NULL && should_run(pass);
+}
+
+void run_ir_passes(IrProgram *prog) {
+	verify_ir_program(prog, "after building the IR");
+	if (printIrAll) {
+		printf("*** IR as built ***\n");
+		print_ir_program(stdout, prog);
+	}
+
+	for (int i=0; i < NUM_PASSES; i++) {
+		IrPass *pass = &passes[i];
+		if ((pass->runOnFunction == NULL && pass->runOnProgram == NULL) || !should_run(pass)) {
+			continue;
+		}
+
+		if (pass->runOnProgram != NULL) {
+			pass->runOnProgram(prog);
+		} else {
+			for (IrFunction *func = prog->functions; func != NULL; func = func->next) {
+				pass->runOnFunction(func);
+			}
+		}
+
+		if (verifyEachPass) {
+			verify_ir_program(prog, pass->name);
+		}
+		if (printIrAll) {
+			printf("*** IR after %s ***\n", pass->name);
+			print_ir_program(stdout, prog);
+		}
+	}
+
+	//Lowering trusts the IR, so always check it once more
+	if (!verifyEachPass) {
+		verify_ir_program(prog, "before lowering");
+	}
+	if (printIr && !printIrAll) {
+		print_ir_program(stdout, prog);
+	}
+}
+
+void run_code_passes(CodeTable *table) {
+	for (int i=0; i < NUM_PASSES; i++) {
+		if (passes[i].runOnCode != NULL && should_run(&passes[i])) {
+			passes[i].runOnCode(table);
+		}
+	}
+	//Without the scheduler the delay slots still need something in them
+	if (noReorder && !pass_enabled("schedule")) {
+		pad_delay_slots(table);
+	}
+}
+
+static IrPass *find_pass(char *name) {
+	for (int i=0; i < NUM_PASSES; i++) {
+		if (strcmp(passes[i].name, name) == 0) {
+			return &passes[i];
+		}
+	}
+	return NULL;
+}
+
+static int should_run(IrPass *pass) {
+	return pass->setting == 1 || (pass->setting == -1 && optLevel > 0);
+}
@@ -0,0 +1,506 @@
+/*
+	Peephole optimiser over the finished code table. Each rule
+	looks at the instruction at some position (and the next one
+	or two) and rewrites/deletes them if they match. Rules are
+	listed in the rules table below and are re-run until none of
+	them fire any more.
+
+	Liveness is worked out by scanning forward from an instruction
+	until the register is read (live) or overwritten (dead). The
+	scan gives up at branches, except for $t8/$t9/$v1: irtotable.c
+	only uses those as scratch within one IR instruction, so they
+	never hold anything across a branch.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "passmanager.h"
+#include "traversaltotable.h"
+
+typedef struct {
+	char *name;
+	char *description;
+	char *triggers[14]; //Commands the rule can start at (NULL-terminated)
+	int (*apply)(int i); //Tries the rule at instruction i, returns 1 if it changed anything
+	int hits;
+} PeepholeRule;
+
+static int remove_self_move(int i);
+static int remove_addiu_zero(int i);
+static int remove_branch_to_next(int i);
+static int invert_branch_over_branch(int i);
+static int remove_unreachable(int i);
+static int forward_stored_value(int i);
+static int la_to_move(int i);
+static int fold_immediate(int i);
+static int forward_move(int i);
+
+static PeepholeRule rules[] = {
+	{ "self-move", "move $r, $r", { "move" }, remove_self_move, 0 },
+	{ "addiu-zero", "addiu $r, $r, 0", { "addiu" }, remove_addiu_zero, 0 },
+	{ "branch-to-next", "branch to the label right after it", { "b", "j", "beqz", "bnez",
+		"bltz", "bgez", "blez", "bgtz", "beq", "bne", "blt", "bge", "ble", "bgt" },
+		remove_branch_to_next, 0 },
+	{ "branch-over-branch", "beqz $r, L1; b L2; L1: -> bnez $r, L2", { "beqz", "bnez",
+		"bltz", "bgez", "blez", "bgtz", "beq", "bne", "blt", "bge", "ble", "bgt" },
+		invert_branch_over_branch, 0 },
+	{ "unreachable", "code between a jump and the next label", { "b", "j", "jr" },
+		remove_unreachable, 0 },
+	{ "store-load", "sw $a, X; lw $b, X -> sw $a, X; move $b, $a", { "sw" },
+		forward_stored_value, 0 },
+	{ "la-as-move", "la $d, 0($s) -> move $d, $s", { "la" }, la_to_move, 0 },
+	{ "fold-immediate", "li $t, K; add $d, $s, $t -> add $d, $s, K", { "li" },
+		fold_immediate, 0 },
+	//Any writer of op1 can start this one
+	{ "forward-move", "lw $t, X; move $d, $t -> lw $d, X", { NULL }, forward_move, 0 },
+};
+
+#define NUM_RULES ((int)(sizeof(rules)/sizeof(rules[0])))
+
+static CodeTable *table; //The one being optimised
+
+//Shorthand for the i-th instruction
+#define INSTR(i) (&table->instrSet[i])
+
+/*
+	What kind of instruction each one is, worked out up front
+	(the liveness scans look at the same instructions over and over,
+	so they shouldn't have to strcmp their way through them)
+*/
+#define PF_LABEL 0x01
+#define PF_DIRECTIVE 0x02
+#define PF_JUMP 0x04 //b, j, jr
+#define PF_COND_BRANCH 0x08 //beqz, blt... (the label is the last operand)
+#define PF_JR 0x10
+#define PF_JAL 0x20
+#define PF_SYSCALL 0x40
+#define PF_WRITES_OP1 0x80 //op1 is a register it writes (and nothing else)
+
+static const struct {
+	char *command;
+	unsigned char flags;
+} commandFlags[] = {
+	{ "add", PF_WRITES_OP1 }, { "addiu", PF_WRITES_OP1 }, { "sub", PF_WRITES_OP1 },
+	{ "mulo", PF_WRITES_OP1 }, { "div", PF_WRITES_OP1 }, { "seq", PF_WRITES_OP1 },
+	{ "sne", PF_WRITES_OP1 }, { "slt", PF_WRITES_OP1 }, { "sle", PF_WRITES_OP1 },
+	{ "sgt", PF_WRITES_OP1 }, { "sge", PF_WRITES_OP1 }, { "neg", PF_WRITES_OP1 },
+	{ "li", PF_WRITES_OP1 }, { "la", PF_WRITES_OP1 }, { "lw", PF_WRITES_OP1 },
+	{ "lb", PF_WRITES_OP1 }, { "move", PF_WRITES_OP1 }, { "sll", PF_WRITES_OP1 },
+	{ "sra", PF_WRITES_OP1 }, { "srl", PF_WRITES_OP1 }, { "addi", PF_WRITES_OP1 },
+	{ "addu", PF_WRITES_OP1 }, { "subu", PF_WRITES_OP1 }, { "slti", PF_WRITES_OP1 },
+	{ "sltiu", PF_WRITES_OP1 }, { "sltu", PF_WRITES_OP1 }, { "xori", PF_WRITES_OP1 },
+	{ "mfhi", PF_WRITES_OP1 }, { "mult", 0 },
+	{ "b", PF_JUMP }, { "j", PF_JUMP }, { "jr", PF_JUMP | PF_JR },
+	{ "beqz", PF_COND_BRANCH }, { "bnez", PF_COND_BRANCH }, { "bltz", PF_COND_BRANCH },
+	{ "bgez", PF_COND_BRANCH }, { "blez", PF_COND_BRANCH }, { "bgtz", PF_COND_BRANCH },
+	{ "beq", PF_COND_BRANCH }, { "bne", PF_COND_BRANCH }, { "blt", PF_COND_BRANCH },
+	{ "bge", PF_COND_BRANCH }, { "ble", PF_COND_BRANCH }, { "bgt", PF_COND_BRANCH },
+	{ "jal", PF_JAL }, { "syscall", PF_SYSCALL }, { "sw", 0 },
+};
+
+#define NUM_COMMANDS ((int)(sizeof(commandFlags)/sizeof(commandFlags[0])))
+
+static unsigned char *flags; //flags[i] for INSTR(i)
+static unsigned short *ruleMasks; //Bit r set if rules[r] can start at INSTR(i)
+
+//Which rules each command in commandFlags triggers, and which any command does
+static unsigned short commandRules[NUM_COMMANDS];
+static unsigned short anyCommandRules;
+
+static int next_instr(int i);
+static int is_deleted(int i);
+static void delete_instr(int i);
+static void compact_table();
+static void setup_command_rules();
+static void classify(int i);
+
+static int has_flag(int i, unsigned char flag);
+static int label_follows(int i, const char *target);
+static int writes_op1(int i);
+static int reads_reg(int i, int reg);
+static int reg_dead_after(int i, int reg);
+static int is_command(Instruction *instr, char *command);
+static Operand *branch_label(Instruction *instr);
+
+void peephole_optimize(CodeTable *codeTable) {
+	table = codeTable;
+	int before = table->numInstructions;
+
+	setup_command_rules();
+
+	int size = table->numInstructions > 0 ? table->numInstructions : 1;
+	flags = malloc(size * sizeof(flags[0]));
+	ruleMasks = malloc(size * sizeof(ruleMasks[0]));
+	for (int i=0; i < table->numInstructions; i++) {
+		classify(i);
+	}
+
+	int changed = 1;
+	while (changed) {
+		changed = 0;
+		for (int i=0; i < table->numInstructions; i = next_instr(i)) {
+			for (int r=0; r < NUM_RULES && !is_deleted(i); r++) {
+				if ((ruleMasks[i] & (1 << r)) && rules[r].apply(i)) {
+					rules[r].hits++;
+					changed = 1;
+				}
+			}
+		}
+		compact_table();
+	}
+	free(flags);
+	free(ruleMasks);
+	flags = NULL;
+	ruleMasks = NULL;
+
+	if (printStats) {
+		fprintf(stderr, "peephole: %d -> %d instructions\n", before, table->numInstructions);
+		for (int r=0; r < NUM_RULES; r++) {
+			fprintf(stderr, "  %-20s %8d  (%s)\n", rules[r].name, rules[r].hits,
+				rules[r].description);
+		}
+	}
+}
+
+/** The rules **/
+
+static int remove_self_move(int i) {
+	Instruction *instr = INSTR(i);
+	if (instr->op1.reg == instr->op2.reg) {
+		delete_instr(i);
+		return 1;
+	}
+	return 0;
+}
+
+static int remove_addiu_zero(int i) {
+	Instruction *instr = INSTR(i);
+	if (instr->op1.reg == instr->op2.reg
+		&& instr->op3.kind == OPND_IMM && instr->op3.val.immed == 0) {
+		delete_instr(i);
+		return 1;
+	}
+	return 0;
+}
+
+//b L / beqz $r, L with L: coming straight after
+static int remove_branch_to_next(int i) {
+	Instruction *instr = INSTR(i);
+	const char *target = NULL;
+
+	if (has_flag(i, PF_JUMP) && !has_flag(i, PF_JR)) {
+		target = instr->op1.val.sym;
+	} else if (has_flag(i, PF_COND_BRANCH)) {
+		target = branch_label(instr)->val.sym;
+	}
+
+	if (target != NULL && label_follows(i, target)) {
+		delete_instr(i);
+		return 1;
+	}
+	return 0;
+}
+
+//beqz $r, L1; b L2; L1: -> bnez $r, L2; L1: (and the same for the other conditional branches)
+static int invert_branch_over_branch(int i) {
+	static char *opposites[][2] = { { "beqz", "bnez" }, { "bltz", "bgez" }, { "blez", "bgtz" },
+		{ "beq", "bne" }, { "blt", "bge" }, { "ble", "bgt" } };
+	Instruction *cond = INSTR(i);
+	int j = next_instr(i);
+	if (j >= table->numInstructions) {
+		return 0;
+	}
+
+	Instruction *jump = INSTR(j);
+	if (!is_command(jump, "b") || !label_follows(j, branch_label(cond)->val.sym)) {
+		return 0;
+	}
+
+	for (int k=0; k < (int)(sizeof(opposites)/sizeof(opposites[0])); k++) {
+		for (int side=0; side < 2; side++) {
+			if (is_command(cond, opposites[k][side])) {
+				cond->command = opposites[k][!side];
+				*branch_label(cond) = jump->op1;
+				delete_instr(j);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+//Nothing can reach code after a jump until there's a label to jump to
+static int remove_unreachable(int i) {
+	int removed = 0;
+	for (int j = next_instr(i); j < table->numInstructions; j = next_instr(j)) {
+		if (has_flag(j, PF_LABEL | PF_DIRECTIVE)) {
+			break;
+		}
+		delete_instr(j);
+		removed = 1;
+	}
+	return removed;
+}
+
+//A word that was just stored can be copied instead of loaded back
+static int forward_stored_value(int i) {
+	Instruction *store = INSTR(i);
+	int j = next_instr(i);
+	if (j >= table->numInstructions) {
+		return 0;
+	}
+
+	Instruction *load = INSTR(j);
+	if (!is_command(load, "lw") || load->op2.reg != store->op2.reg
+		|| load->op2.val.immed != store->op2.val.immed) {
+		return 0;
+	}
+
+	if (load->op1.reg == store->op1.reg) {
+		delete_instr(j);
+	} else {
+		*load = setup_2op_instr("move", load->op1, store->op1);
+	}
+	return 1;
+}
+
+//la with a 0 offset from a register is just a copy (so forward-move can use it)
+static int la_to_move(int i) {
+	Instruction *instr = INSTR(i);
+	if (instr->op2.kind == OPND_MEM && instr->op2.val.immed == 0) {
+		*instr = setup_2op_instr("move", instr->op1, reg_operand(instr->op2.reg));
+		return 1;
+	}
+	return 0;
+}
+
+/*
+	li $t, K followed by an op reading $t: use K as the op's
+	immediate instead (SPIM turns these into the i-type forms).
+	Only for 16-bit K, so nothing gets longer.
+*/
+static int fold_immediate(int i) {
+	static char *foldable[] = { "add", "sub", "mulo", "div", "slt", "sle", "sgt", "sge",
+		"seq", "sne" };
+	Instruction *li = INSTR(i);
+	int j = next_instr(i);
+	if (j >= table->numInstructions) {
+		return 0;
+	}
+
+	Instruction *op = INSTR(j);
+	int K = li->op2.val.immed;
+	int t = li->op1.reg;
+	int isFoldable = 0;
+	for (int k=0; k < (int)(sizeof(foldable)/sizeof(foldable[0])); k++) {
+		isFoldable |= is_command(op, foldable[k]);
+	}
+	if (!isFoldable || op->op3.kind != OPND_REG || K < -32767 || K > 32767
+		|| (K == 0 && is_command(op, "div"))) {
+		return 0;
+	}
+	//$t has to be exactly one of the sources, and not needed afterwards
+	if ((op->op2.reg == t) == (op->op3.reg == t)
+		|| (op->op1.reg != t && !reg_dead_after(j, t))) {
+		return 0;
+	}
+
+	//The immediate has to be the 2nd source - flip the op around if $t is the 1st
+	if (op->op2.reg == t) {
+		if (is_command(op, "slt")) op->command = "sgt";
+		else if (is_command(op, "sgt")) op->command = "slt";
+		else if (is_command(op, "sle")) op->command = "sge";
+		else if (is_command(op, "sge")) op->command = "sle";
+		else if (!is_command(op, "add") && !is_command(op, "mulo")
+			&& !is_command(op, "seq") && !is_command(op, "sne")) {
+			return 0;
+		}
+		op->op2 = op->op3;
+	}
+
+	op->op3 = immed_operand(K);
+	delete_instr(i);
+	return 1;
+}
+
+//Something writes $t only to copy it elsewhere: write it there directly
+static int forward_move(int i) {
+	Instruction *def = INSTR(i);
+	int j = next_instr(i);
+	if (!writes_op1(i) || j >= table->numInstructions) {
+		return 0;
+	}
+
+	Instruction *move = INSTR(j);
+	int t = def->op1.reg;
+	if (!is_command(move, "move") || move->op2.reg != t || !reg_dead_after(j, t)) {
+		return 0;
+	}
+
+	def->op1 = move->op1;
+	delete_instr(j);
+	return 1;
+}
+
+/** Helpers **/
+
+//Index of the next instruction that hasn't been deleted (numInstructions if none)
+static int next_instr(int i) {
+	do {
+		i++;
+	} while (i < table->numInstructions && is_deleted(i));
+	return i;
+}
+
+static int is_deleted(int i) {
+	return INSTR(i)->command == NULL;
+}
+
+//Deleted instructions are only marked, and squeezed out by compact_table()
+static void delete_instr(int i) {
+	INSTR(i)->command = NULL;
+}
+
+static void compact_table() {
+	int kept = 0;
+	for (int i=0; i < table->numInstructions; i++) {
+		if (!is_deleted(i)) {
+			flags[kept] = flags[i];
+			ruleMasks[kept] = ruleMasks[i];
+			table->instrSet[kept++] = table->instrSet[i];
+		}
+	}
+	table->numInstructions = kept;
+}
+
+static void setup_command_rules() {
+	anyCommandRules = 0;
+	for (int k=0; k < NUM_COMMANDS; k++) {
+		commandRules[k] = 0;
+	}
+
+	for (int r=0; r < NUM_RULES; r++) {
+		if (rules[r].triggers[0] == NULL) {
+			anyCommandRules |= 1 << r;
+		}
+		for (int t=0; rules[r].triggers[t] != NULL; t++) {
+			for (int k=0; k < NUM_COMMANDS; k++) {
+				if (strcmp(commandFlags[k].command, rules[r].triggers[t]) == 0) {
+					commandRules[k] |= 1 << r;
+				}
+			}
+		}
+	}
+}
+
+/*
+	Fills in flags[i] and ruleMasks[i]. Labels and directives never
+	start a rule. The rules only ever turn an instruction into one
+	with the same flags (lw/la -> move, beqz <-> bnez, slt <-> sgt...),
+	so this is done once, not every round.
+*/
+static void classify(int i) {
+	Instruction *instr = INSTR(i);
+	size_t len = strlen(instr->command);
+	flags[i] = 0;
+	ruleMasks[i] = 0;
+
+	if (len > 0 && instr->command[len-1] == ':') {
+		flags[i] = PF_LABEL;
+		return;
+	}
+	if (instr->command[0] == '.') {
+		flags[i] = PF_DIRECTIVE;
+		return;
+	}
+
+	ruleMasks[i] = anyCommandRules;
+	for (int k=0; k < NUM_COMMANDS; k++) {
+		if (instr->command[0] == commandFlags[k].command[0]
+			&& strcmp(instr->command, commandFlags[k].command) == 0) {
+			flags[i] = commandFlags[k].flags;
+			if ((flags[i] & PF_WRITES_OP1) && instr->op1.kind != OPND_REG) {
+				flags[i] = 0;
+			}
+			ruleMasks[i] |= commandRules[k];
+			return;
+		}
+	}
+}
+
+//Where a conditional branch keeps its label: after the one or two registers it tests
+static Operand *branch_label(Instruction *instr) {
+	return instr->op3.kind == OPND_SYM ? &instr->op3 : &instr->op2;
+}
+
+//(Checking the first letter first skips most of the strcmp calls)
+static int is_command(Instruction *instr, char *command) {
+	return instr->command != NULL && instr->command[0] == command[0]
+		&& strcmp(instr->command, command) == 0;
+}
+
+//Whether instruction i has any of the given flags
+static int has_flag(int i, unsigned char flag) {
+	return (flags[i] & flag) != 0;
+}
+
+//Whether label target: is among the labels right after instruction i
+static int label_follows(int i, const char *target) {
+	size_t len = strlen(target);
+	for (int j = next_instr(i); j < table->numInstructions && has_flag(j, PF_LABEL); j = next_instr(j)) {
+		char *label = INSTR(j)->command;
+		if (strncmp(label, target, len) == 0 && label[len] == ':') {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int writes_op1(int i) {
+	return has_flag(i, PF_WRITES_OP1);
+}
+
+static int reads_reg(int i, int reg) {
+	Instruction *instr = INSTR(i);
+	Operand *ops[3] = { &instr->op1, &instr->op2, &instr->op3 };
+	for (int k = writes_op1(i) ? 1 : 0; k < 3; k++) {
+		if ((ops[k]->kind == OPND_REG || ops[k]->kind == OPND_MEM) && ops[k]->reg == reg) {
+			return 1;
+		}
+	}
+	if (has_flag(i, PF_SYSCALL)) {
+		return reg == V0 || reg == A0;
+	}
+	if (has_flag(i, PF_JAL)) {
+		return reg >= A0 && reg <= A3;
+	}
+	return 0;
+}
+
+//Whether the value reg holds after instruction i is never read
+static int reg_dead_after(int i, int reg) {
+	int isScratch = reg == T8 || reg == T9 || reg == V1;
+
+	for (int j = next_instr(i); j < table->numInstructions; j = next_instr(j)) {
+		if (has_flag(j, PF_LABEL | PF_DIRECTIVE)) {
+			continue; //Falls straight into it
+		}
+		if (reads_reg(j, reg)) {
+			return 0;
+		}
+		if (writes_op1(j) && INSTR(j)->op1.reg == reg) {
+			return 1;
+		}
+		//Returning: only $v0 and what the callee has to preserve are still wanted
+		if (has_flag(j, PF_JR)) {
+			return !(reg == V0 || (reg >= S0 && reg <= S7) || reg >= SP);
+		}
+		if (has_flag(j, PF_JUMP | PF_COND_BRANCH | PF_JAL)) {
+			return isScratch;
+		}
+	}
+	return 1;
+}
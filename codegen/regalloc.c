@@ -0,0 +1,505 @@
+/*
+	regalloc: keeps scalar params and locals in $s0-$s7 for the whole
+	function, by graph colouring (Chaitin/Briggs).
+
+	- liveness of every scalar variable is worked out over the CFG
+	  (ldvar reads it, stvar writes it)
+	- two variables interfere if one is written while the other is
+	  live, except when the write copies the other one (x = y), since
+	  then they hold the same value anyway
+	- variables joined by such a copy are coalesced into one node
+	  when that can't make the graph harder to colour (Briggs' test),
+	  so the copy becomes a self-move that the peephole pass drops
+	- the graph is coloured with 8 colours. When every node left has
+	  8+ neighbours, the one that's cheapest to leave in memory (uses
+	  weighted by loop depth, over its degree) is picked; it still
+	  gets a colour if one happens to be free at the end
+	- whatever doesn't get a colour stays in its frame slot, and so
+	  do the variables of a colour that's used too little to pay for
+	  saving/restoring its register
+
+	Nothing can take a scalar's address in C--, so every param/local
+	is a candidate. Globals aren't: any call might change them. With
+	callconv.c on, so are array params: they just hold the address
+	they were passed, which the function only ever reads (with an
+	addr).
+	This only decides var->reg - irtotable.c does the rest (and saves
+	whichever $s registers get used in the prologue).
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "passmanager.h"
+#include "lexer.h"
+#include "traversaltotable.h"
+
+//$s0-$s7
+#define NUM_COLOURS 8
+//Loops nested deeper than this are weighted as if they weren't
+#define MAX_LOOP_WEIGHT_DEPTH 5
+
+//The function being worked on
+static IrFunction *func;
+static int numVars;
+static int words; //unsigned ints per bitset
+static IrVar **vars; //By id
+static unsigned *useSet, *defSet, *liveIn, *liveOut; //words per block id
+static unsigned char *adj; //numVars x numVars interference matrix
+static int *degree;
+static int *alias; //Coalesced vars point at the node they were merged into
+static long long *cost; //Loop-weighted number of ldvar/stvars
+static int *colour;
+static int (*moves)[2]; //x = y copies: { x, y }
+static int numMoves;
+
+static int arrayParamsInRegs; //callconv is on
+
+//For -stats
+static int numCandidates;
+static int numPromoted;
+static int numCoalesced;
+
+static void allocate_function(IrFunction *f);
+static void compute_loop_weights(int *weight);
+static void collect_uses_and_copies(int *weight);
+static void compute_liveness();
+static void build_interference();
+static void coalesce();
+static void colour_graph();
+
+static int is_candidate(IrVar *var);
+static int reads_var(IrInstr *instr);
+static int find_alias(int v);
+static void add_edge(int a, int b);
+static void remove_edge(int a, int b);
+static int copied_var(IrInstr *store);
+static int bit_test(unsigned *set, int bit);
+static void bit_set(unsigned *set, int bit);
+static void bit_clear(unsigned *set, int bit);
+
+void allocate_registers(IrProgram *prog) {
+	numCandidates = numPromoted = numCoalesced = 0;
+	arrayParamsInRegs = pass_enabled("callconv");
+
+	for (IrFunction *f = prog->functions; f != NULL; f = f->next) {
+		allocate_function(f);
+	}
+
+	if (printStats) {
+		fprintf(stderr, "regalloc: %d of %d scalar params/locals kept in $s registers, "
+			"%d copies coalesced\n", numPromoted, numCandidates, numCoalesced);
+	}
+}
+
+static void allocate_function(IrFunction *f) {
+	func = f;
+	numVars = func->numVars;
+	if (numVars == 0) {
+		return;
+	}
+	words = (numVars + 31) / 32;
+
+	vars = calloc(numVars, sizeof(IrVar *));
+	for (IrVar *var = func->params; var != NULL; var = var->next) {
+		vars[var->id] = var;
+	}
+	for (IrVar *var = func->locals; var != NULL; var = var->next) {
+		vars[var->id] = var;
+	}
+
+	size_t setsSize = (size_t)func->numBlocks * words * sizeof(unsigned);
+	useSet = calloc(1, setsSize + 1);
+	defSet = calloc(1, setsSize + 1);
+	liveIn = calloc(1, setsSize + 1);
+	liveOut = calloc(1, setsSize + 1);
+	adj = calloc((size_t)numVars * numVars, 1);
+	degree = calloc(numVars, sizeof(int));
+	alias = malloc(numVars * sizeof(int));
+	cost = calloc(numVars, sizeof(long long));
+	colour = malloc(numVars * sizeof(int));
+	moves = NULL;
+	numMoves = 0;
+	for (int v=0; v < numVars; v++) {
+		alias[v] = v;
+		colour[v] = -1;
+	}
+
+	int *weight = malloc((func->numBlocks + 1) * sizeof(int));
+	ir_rebuild_cfg(func);
+	compute_loop_weights(weight);
+	collect_uses_and_copies(weight);
+	compute_liveness();
+	build_interference();
+	coalesce();
+	colour_graph();
+
+	//Using an $s register costs a save and a restore, which has to be won back
+	long long benefit[NUM_COLOURS] = { 0 };
+	for (int v=0; v < numVars; v++) {
+		if (alias[v] == v && colour[v] != -1) {
+			benefit[colour[v]] += cost[v];
+		}
+	}
+	for (int v=0; v < numVars; v++) {
+		if (alias[v] == v && colour[v] != -1 && benefit[colour[v]] <= 2) {
+			colour[v] = -1;
+		}
+	}
+
+	for (int v=0; v < numVars; v++) {
+		if (vars[v] == NULL) {
+			continue;
+		}
+		vars[v]->reg = -1;
+		if (!is_candidate(vars[v]) || cost[find_alias(v)] == 0) {
+			continue;
+		}
+		numCandidates++;
+		if (colour[find_alias(v)] != -1) {
+			vars[v]->reg = S0 + colour[find_alias(v)];
+			numPromoted++;
+		}
+	}
+
+	free(weight);
+	free(vars);
+	free(useSet);
+	free(defSet);
+	free(liveIn);
+	free(liveOut);
+	free(adj);
+	free(degree);
+	free(alias);
+	free(cost);
+	free(colour);
+	free(moves);
+}
+
+/*
+	How often each block roughly runs: x10 for every loop it's in.
+	codetraversal.c lays a while loop out as header, body, exit, so
+	a branch back to an earlier block closes a loop over everything
+	between the two.
+*/
+static void compute_loop_weights(int *weight) {
+	int *depth = calloc(func->numBlocks + 1, sizeof(int));
+	int *position = malloc((func->numBlocks + 1) * sizeof(int));
+	IrBlock **layout = malloc((func->numBlocks + 1) * sizeof(IrBlock *));
+
+	int numLaidOut = 0;
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		position[block->id] = numLaidOut;
+		layout[numLaidOut++] = block;
+	}
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (int i=0; i < block->numSuccs; i++) {
+			int header = position[block->succs[i]->id];
+			if (header > position[block->id]) {
+				continue; //Forward edge
+			}
+			for (int p = header; p <= position[block->id]; p++) {
+				depth[layout[p]->id]++;
+			}
+		}
+	}
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		weight[block->id] = 1;
+		for (int d=0; d < depth[block->id] && d < MAX_LOOP_WEIGHT_DEPTH; d++) {
+			weight[block->id] *= 10;
+		}
+	}
+
+	free(depth);
+	free(position);
+	free(layout);
+}
+
+//Fills in each block's use/def sets, the var costs and the x = y copies
+static void collect_uses_and_copies(int *weight) {
+	int movesCapacity = 0;
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		unsigned *use = &useSet[block->id * words];
+		unsigned *def = &defSet[block->id * words];
+
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			instr->mark = 0;
+			if ((!reads_var(instr) && instr->op != IR_STVAR) || !is_candidate(instr->var)) {
+				continue;
+			}
+
+			//A char store takes 2 instructions in a register (see sign_extend_byte), so it gains nothing
+			int v = instr->var->id;
+			if (reads_var(instr) || ir_var_width(instr->var) != CHAR_SIZE) {
+				cost[v] += weight[block->id];
+			}
+			if (reads_var(instr)) {
+				if (!bit_test(def, v)) {
+					bit_set(use, v);
+				}
+				continue;
+			}
+
+			bit_set(def, v);
+			//Storing into a char truncates, so that's only a copy of another char
+			int copied = copied_var(instr);
+			if (copied != -1 && instr->var->type == CHARTOK && vars[copied]->type != CHARTOK) {
+				copied = -1;
+			}
+			if (copied != -1 && copied != v) {
+				instr->mark = copied + 1;
+				if (numMoves == movesCapacity) {
+					movesCapacity = movesCapacity == 0 ? 16 : movesCapacity*2;
+					moves = realloc(moves, movesCapacity * sizeof(moves[0]));
+				}
+				moves[numMoves][0] = v;
+				moves[numMoves][1] = copied;
+				numMoves++;
+			}
+		}
+	}
+}
+
+static void compute_liveness() {
+	int changed = 1;
+	while (changed) {
+		changed = 0;
+		for (IrBlock *block = func->lastBlock; block != NULL; block = block->prev) {
+			unsigned *in = &liveIn[block->id * words];
+			unsigned *out = &liveOut[block->id * words];
+			unsigned *use = &useSet[block->id * words];
+			unsigned *def = &defSet[block->id * words];
+
+			for (int w=0; w < words; w++) {
+				unsigned newOut = 0;
+				for (int i=0; i < block->numSuccs; i++) {
+					newOut |= liveIn[block->succs[i]->id * words + w];
+				}
+				unsigned newIn = use[w] | (newOut & ~def[w]);
+				if (newIn != in[w] || newOut != out[w]) {
+					in[w] = newIn;
+					out[w] = newOut;
+					changed = 1;
+				}
+			}
+		}
+	}
+}
+
+static void build_interference() {
+	unsigned *live = malloc(words * sizeof(unsigned));
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		memcpy(live, &liveOut[block->id * words], words * sizeof(unsigned));
+
+		for (IrInstr *instr = block->last; instr != NULL; instr = instr->prev) {
+			if ((!reads_var(instr) && instr->op != IR_STVAR) || !is_candidate(instr->var)) {
+				continue;
+			}
+
+			int v = instr->var->id;
+			if (reads_var(instr)) {
+				bit_set(live, v);
+				continue;
+			}
+
+			int copied = instr->mark - 1;
+			for (int u=0; u < numVars; u++) {
+				if (u != v && u != copied && bit_test(live, u)) {
+					add_edge(u, v);
+				}
+			}
+			bit_clear(live, v);
+		}
+	}
+
+	//Params are all written on the way in, while whatever's live there is live
+	for (int u=0; u < numVars; u++) {
+		for (int v=u+1; v < numVars; v++) {
+			if (!is_candidate(vars[u]) || !is_candidate(vars[v])) {
+				continue;
+			}
+			int uLive = bit_test(&liveIn[func->entry->id * words], u)
+				|| vars[u]->kind == VAR_PARAM;
+			int vLive = bit_test(&liveIn[func->entry->id * words], v)
+				|| vars[v]->kind == VAR_PARAM;
+			if (uLive && vLive) {
+				add_edge(u, v);
+			}
+		}
+	}
+
+	free(live);
+}
+
+//Briggs: merge x and y if the result has fewer than NUM_COLOURS neighbours of significant degree
+static void coalesce() {
+	for (int m=0; m < numMoves; m++) {
+		int x = find_alias(moves[m][0]);
+		int y = find_alias(moves[m][1]);
+		if (x == y || adj[x*numVars + y]) {
+			continue;
+		}
+
+		int significant = 0;
+		for (int n=0; n < numVars; n++) {
+			if ((adj[x*numVars + n] || adj[y*numVars + n]) && degree[n] >= NUM_COLOURS) {
+				significant++;
+			}
+		}
+		if (significant >= NUM_COLOURS) {
+			continue;
+		}
+
+		//Fold y into x
+		for (int n=0; n < numVars; n++) {
+			if (adj[y*numVars + n]) {
+				remove_edge(y, n);
+				add_edge(x, n);
+			}
+		}
+		alias[y] = x;
+		cost[x] += cost[y];
+		cost[y] = 0;
+		numCoalesced++;
+	}
+}
+
+static void colour_graph() {
+	int *stack = malloc(numVars * sizeof(int));
+	int *curDegree = malloc(numVars * sizeof(int));
+	char *removed = calloc(numVars, 1);
+	int top = 0;
+	int numNodes = 0;
+
+	for (int v=0; v < numVars; v++) {
+		curDegree[v] = degree[v];
+		if (is_candidate(vars[v]) && alias[v] == v && cost[v] > 0) {
+			numNodes++;
+		} else {
+			removed[v] = 1;
+		}
+	}
+
+	//Simplify: take out nodes that are sure to get a colour, else the cheapest to spill
+	while (top < numNodes) {
+		int pick = -1;
+		for (int v=0; v < numVars && pick == -1; v++) {
+			if (!removed[v] && curDegree[v] < NUM_COLOURS) {
+				pick = v;
+			}
+		}
+		if (pick == -1) {
+			for (int v=0; v < numVars; v++) {
+				if (!removed[v] && (pick == -1
+					|| cost[v] * curDegree[pick] < cost[pick] * curDegree[v])) {
+					pick = v;
+				}
+			}
+		}
+
+		removed[pick] = 1;
+		stack[top++] = pick;
+		for (int n=0; n < numVars; n++) {
+			if (adj[pick*numVars + n]) {
+				curDegree[n]--;
+			}
+		}
+	}
+
+	//Select: hand out colours in reverse order
+	while (top > 0) {
+		int v = stack[--top];
+		int taken = 0;
+		for (int n=0; n < numVars; n++) {
+			if (adj[v*numVars + n] && colour[n] != -1) {
+				taken |= 1 << colour[n];
+			}
+		}
+		for (int c=0; c < NUM_COLOURS; c++) {
+			if (!(taken & (1 << c))) {
+				colour[v] = c;
+				break;
+			}
+		}
+	}
+
+	free(stack);
+	free(curDegree);
+	free(removed);
+}
+
+/** Helpers **/
+
+//(var is NULL for an id whose local was dropped - see dce.c)
+static int is_candidate(IrVar *var) {
+	return var != NULL && var->kind != VAR_GLOBAL
+		&& (var->dimension == -1 || (var->dimension == 0 && arrayParamsInRegs));
+}
+
+//ldvar, or the addr of an array param (which reads the address it holds)
+static int reads_var(IrInstr *instr) {
+	return instr->op == IR_LDVAR || (instr->op == IR_ADDR && instr->var->kind == VAR_PARAM);
+}
+
+static int find_alias(int v) {
+	while (alias[v] != v) {
+		v = alias[v];
+	}
+	return v;
+}
+
+static void add_edge(int a, int b) {
+	if (!adj[a*numVars + b]) {
+		adj[a*numVars + b] = adj[b*numVars + a] = 1;
+		degree[a]++;
+		degree[b]++;
+	}
+}
+
+static void remove_edge(int a, int b) {
+	if (adj[a*numVars + b]) {
+		adj[a*numVars + b] = adj[b*numVars + a] = 0;
+		degree[a]--;
+		degree[b]--;
+	}
+}
+
+/*
+	If store's value was loaded from another variable earlier in the
+	block (with nothing writing that variable in between), that
+	variable's id. Otherwise -1.
+*/
+static int copied_var(IrInstr *store) {
+	if (store->src1.kind != IRO_VREG) {
+		return -1;
+	}
+
+	for (IrInstr *instr = store->prev; instr != NULL; instr = instr->prev) {
+		if (instr->dest == store->src1.val) {
+			return instr->op == IR_LDVAR && is_candidate(instr->var) ? instr->var->id : -1;
+		}
+		if (instr->op == IR_STVAR) {
+			//Also rules out the loaded variable being changed before the copy
+			return -1;
+		}
+	}
+	return -1;
+}
+
+static int bit_test(unsigned *set, int bit) {
+	return (set[bit/32] >> (bit%32)) & 1;
+}
+
+static void bit_set(unsigned *set, int bit) {
+	set[bit/32] |= 1u << (bit%32);
+}
+
+static void bit_clear(unsigned *set, int bit) {
+	set[bit/32] &= ~(1u << (bit%32));
+}
@@ -0,0 +1,522 @@
+/*
+	schedule: reorders the MIPS in each basic block for a pipelined
+	core, and (with -noreorder) takes over the delay slots SPIM would
+	otherwise hide, writing the output under .set noreorder.
+
+	A block here is what's between labels and branches/jumps/jal/jr.
+	Its instructions are put in a dependence graph (registers, with
+	HI/LO as two more, and memory - two accesses are only kept apart
+	when they're off the same unchanged base register and don't
+	overlap, or one's off $gp and the other off $sp/$fp), and then
+	list scheduled: at every step, out of what's ready, whatever has
+	the longest chain of latencies still hanging off it goes next.
+	Latencies are roughly an R3000's: 2 for a load, 12 for a
+	multiply, 35 for a divide, 1 for anything else. Instructions that
+	can trap stay on the same side of every syscall, so output before
+	a trap still comes out.
+
+	With -noreorder:
+	- a load's result can't be read by the very next instruction, so
+	  something independent is put between them - or a nop, if
+	  nothing fits
+	- the instruction after a branch/jump/jal/jr (its delay slot) runs
+	  whether or not the branch is taken, before the target. It gets
+	  an instruction from the block that nothing after it depends on
+	  (the branch itself included - for jal that's only $ra, the args
+	  aren't read until the callee runs). Pseudo-instructions that
+	  SPIM turns into more than one instruction, loads and syscalls
+	  never go in a slot. If nothing fits, it's a nop
+
+	With the pass turned off, -noreorder still gets a nop in every
+	delay slot (pad_delay_slots()).
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "passmanager.h"
+#include "traversaltotable.h"
+
+//Blocks longer than this are scheduled a piece at a time
+#define MAX_REGION 128
+
+//Register bits: the 29 named registers (S0...ZERO), then HI and LO
+#define REG_BIT(reg) (1u << ((reg) - S0))
+#define HI_BIT (1u << 29)
+#define LO_BIT (1u << 30)
+
+#define SF_WRITES_OP1 0x01
+#define SF_LOAD 0x02
+#define SF_STORE 0x04
+#define SF_BRANCH 0x08 //b, j, jr and the conditional branches
+#define SF_CALL 0x10 //jal
+#define SF_SYSCALL 0x20
+#define SF_TRAPS 0x40 //Overflow or divide by 0
+#define SF_MULTI 0x80 //Always more than one machine instruction
+#define SF_READS_HI 0x100
+#define SF_READS_LO 0x200
+#define SF_WRITES_HILO 0x400
+#define SF_UNKNOWN 0x800 //Not in the table below: nothing moves past it
+
+static const struct {
+	char *command;
+	int flags;
+	int latency;
+} commandInfo[] = {
+	{ "add", SF_WRITES_OP1 | SF_TRAPS, 1 }, { "addi", SF_WRITES_OP1 | SF_TRAPS, 1 },
+	{ "sub", SF_WRITES_OP1 | SF_TRAPS, 1 }, { "neg", SF_WRITES_OP1 | SF_TRAPS, 1 },
+	{ "addu", SF_WRITES_OP1, 1 }, { "addiu", SF_WRITES_OP1, 1 }, { "subu", SF_WRITES_OP1, 1 },
+	{ "negu", SF_WRITES_OP1, 1 }, { "and", SF_WRITES_OP1, 1 }, { "andi", SF_WRITES_OP1, 1 },
+	{ "or", SF_WRITES_OP1, 1 }, { "ori", SF_WRITES_OP1, 1 }, { "xor", SF_WRITES_OP1, 1 },
+	{ "xori", SF_WRITES_OP1, 1 }, { "nor", SF_WRITES_OP1, 1 }, { "not", SF_WRITES_OP1, 1 },
+	{ "sll", SF_WRITES_OP1, 1 }, { "sra", SF_WRITES_OP1, 1 }, { "srl", SF_WRITES_OP1, 1 },
+	{ "slt", SF_WRITES_OP1, 1 }, { "slti", SF_WRITES_OP1, 1 }, { "sltu", SF_WRITES_OP1, 1 },
+	{ "sltiu", SF_WRITES_OP1, 1 }, { "move", SF_WRITES_OP1, 1 }, { "li", SF_WRITES_OP1, 1 },
+	{ "la", SF_WRITES_OP1, 1 }, { "lui", SF_WRITES_OP1, 1 },
+	{ "seq", SF_WRITES_OP1 | SF_MULTI, 1 }, { "sne", SF_WRITES_OP1 | SF_MULTI, 1 },
+	{ "sle", SF_WRITES_OP1 | SF_MULTI, 1 }, { "sge", SF_WRITES_OP1 | SF_MULTI, 1 },
+	{ "sgt", SF_WRITES_OP1 | SF_MULTI, 1 },
+	{ "mfhi", SF_WRITES_OP1 | SF_READS_HI, 1 }, { "mflo", SF_WRITES_OP1 | SF_READS_LO, 1 },
+	{ "mult", SF_WRITES_HILO, 12 },
+	{ "mulo", SF_WRITES_OP1 | SF_TRAPS | SF_MULTI, 12 },
+	{ "div", SF_WRITES_OP1 | SF_TRAPS | SF_MULTI, 35 }, //(the 2 operand one is sorted out below)
+	{ "lw", SF_WRITES_OP1 | SF_LOAD, 2 }, { "lb", SF_WRITES_OP1 | SF_LOAD, 2 },
+	{ "sw", SF_STORE, 1 }, { "sb", SF_STORE, 1 },
+	{ "b", SF_BRANCH, 1 }, { "j", SF_BRANCH, 1 }, { "jr", SF_BRANCH, 1 },
+	{ "beqz", SF_BRANCH, 1 }, { "bnez", SF_BRANCH, 1 }, { "bltz", SF_BRANCH, 1 },
+	{ "bgez", SF_BRANCH, 1 }, { "blez", SF_BRANCH, 1 }, { "bgtz", SF_BRANCH, 1 },
+	{ "beq", SF_BRANCH, 1 }, { "bne", SF_BRANCH, 1 }, { "blt", SF_BRANCH, 1 },
+	{ "bge", SF_BRANCH, 1 }, { "ble", SF_BRANCH, 1 }, { "bgt", SF_BRANCH, 1 },
+	{ "jal", SF_CALL, 1 }, { "syscall", SF_SYSCALL, 1 }, { "nop", 0, 1 },
+};
+
+#define NUM_COMMANDS ((int)(sizeof(commandInfo)/sizeof(commandInfo[0])))
+
+//One instruction of the block being scheduled
+typedef struct {
+	Instruction instr;
+	int flags;
+	int latency;
+	unsigned reads, writes; //Register bits (a branch's are what it reads when it branches)
+	int priority; //Longest chain of latencies from here to the end of the block
+	int readyAt; //Cycle its operands are there by
+	int numPredsLeft;
+	int scheduled;
+} SchedNode;
+
+static CodeTable *table;
+static Instruction *out; //The new instruction list
+static int numOut, outCapacity;
+static int reorder; //0: everything stays where it is (pad_delay_slots)
+
+static SchedNode nodes[MAX_REGION];
+static char dep[MAX_REGION][MAX_REGION]; //dep[i][j]: j has to come after i
+static int numNodes;
+
+//For -stats
+static int numSlots;
+static int numSlotsFilled;
+static int numLoadNops;
+
+static void rewrite_table();
+static void schedule_region(int start, int end, int hasTerminator);
+static void build_graph();
+static int conflicts(int i, int j);
+static int edge_latency(int i, int j);
+static void list_schedule(int *order, int term);
+static int pick_delay_slot(int *order, int count);
+static void fix_load_hazards();
+
+static void emit(Instruction *instr);
+static int classify(Instruction *instr, int *latency);
+static void find_reads_writes(SchedNode *node);
+static unsigned reg_bit(Operand *opnd);
+static int is_label_or_directive(Instruction *instr);
+static int fits_one_instr(Instruction *instr);
+static int fits_16_bits(int immed);
+static int hazard(SchedNode *load, SchedNode *next);
+
+void schedule_code(CodeTable *codeTable) {
+	table = codeTable;
+	numSlots = numSlotsFilled = numLoadNops = 0;
+	reorder = 1;
+	rewrite_table();
+
+	if (printStats) {
+		fprintf(stderr, "schedule: %d of %d delay slots filled, %d nops after loads\n",
+			numSlotsFilled, numSlots, numLoadNops);
+	}
+}
+
+void pad_delay_slots(CodeTable *codeTable) {
+	table = codeTable;
+	reorder = 0;
+	rewrite_table();
+}
+
+//Goes through the table a block at a time, building the new one in out
+static void rewrite_table() {
+	outCapacity = table->numInstructions * 2 + 16;
+	out = malloc(outCapacity * sizeof(Instruction));
+	numOut = 0;
+
+	int i = 0;
+	while (i < table->numInstructions) {
+		Instruction *instr = &table->instrSet[i];
+		if (is_label_or_directive(instr)) {
+			emit(instr);
+			if (noReorder && strcmp(instr->command, ".text") == 0) {
+				Instruction setNoReorder = { ".set noreorder" };
+				emit(&setNoReorder);
+			}
+			i++;
+			continue;
+		}
+
+		//Up to (and including) the next branch, or up to the next label
+		int end = i;
+		int hasTerminator = 0;
+		while (end < table->numInstructions && end - i < MAX_REGION && !hasTerminator
+			&& !is_label_or_directive(&table->instrSet[end])) {
+			int latency;
+			hasTerminator = (classify(&table->instrSet[end], &latency) & (SF_BRANCH | SF_CALL)) != 0;
+			end++;
+		}
+		schedule_region(i, end, hasTerminator);
+		i = end;
+	}
+
+	if (noReorder) {
+		fix_load_hazards();
+	}
+	free(table->instrSet);
+	table->instrSet = out;
+	table->numInstructions = numOut;
+	table->capacity = outCapacity;
+}
+
+static void schedule_region(int start, int end, int hasTerminator) {
+	numNodes = end - start;
+	int order[MAX_REGION];
+	for (int i=0; i < numNodes; i++) {
+		SchedNode *node = &nodes[i];
+		node->instr = table->instrSet[start + i];
+		node->flags = classify(&node->instr, &node->latency);
+		find_reads_writes(node);
+		order[i] = i;
+	}
+	if (reorder) {
+		build_graph();
+		list_schedule(order, hasTerminator ? numNodes-1 : -1);
+	}
+
+	int count = numNodes;
+	int slot = -1;
+	if (noReorder && hasTerminator) {
+		numSlots++;
+		int k = reorder ? pick_delay_slot(order, count) : -1;
+		if (k != -1) {
+			slot = order[k];
+			memmove(&order[k], &order[k+1], (count-k-1) * sizeof(int));
+			count--;
+			numSlotsFilled++;
+		}
+	}
+
+	for (int k=0; k < count; k++) {
+		emit(&nodes[order[k]].instr);
+	}
+	if (noReorder && hasTerminator) {
+		Instruction nop = { "nop" };
+		emit(slot != -1 ? &nodes[slot].instr : &nop);
+	}
+}
+
+/** The dependence graph **/
+
+static void build_graph() {
+	for (int j=0; j < numNodes; j++) {
+		for (int i=0; i < j; i++) {
+			dep[i][j] = conflicts(i, j);
+		}
+	}
+
+	//Priorities from the bottom up (the original order is a topological one)
+	for (int i = numNodes-1; i >= 0; i--) {
+		SchedNode *node = &nodes[i];
+		node->priority = node->latency;
+		node->numPredsLeft = 0;
+		node->readyAt = 0;
+		node->scheduled = 0;
+		for (int j = i+1; j < numNodes; j++) {
+			if (dep[i][j] && edge_latency(i, j) + nodes[j].priority > node->priority) {
+				node->priority = edge_latency(i, j) + nodes[j].priority;
+			}
+		}
+		for (int k=0; k < i; k++) {
+			node->numPredsLeft += dep[k][i];
+		}
+	}
+}
+
+//Does nodes[j] have to stay after nodes[i] (i < j)?
+static int conflicts(int i, int j) {
+	SchedNode *a = &nodes[i], *b = &nodes[j];
+	if ((a->flags | b->flags) & SF_UNKNOWN) {
+		return 1;
+	}
+	if ((a->writes & (b->reads | b->writes)) || (a->reads & b->writes)) {
+		return 1;
+	}
+	//Output before a trap has to get out
+	if (((a->flags & SF_SYSCALL) && (b->flags & SF_TRAPS))
+		|| ((a->flags & SF_TRAPS) && (b->flags & SF_SYSCALL))) {
+		return 1;
+	}
+
+	if (!((a->flags | b->flags) & SF_STORE) || !(a->flags & (SF_LOAD | SF_STORE))
+		|| !(b->flags & (SF_LOAD | SF_STORE))) {
+		return 0;
+	}
+	Operand *x = &a->instr.op2, *y = &b->instr.op2;
+	//The stack and the globals never overlap
+	if ((x->reg == GP && (y->reg == SP || y->reg == FP))
+		|| (y->reg == GP && (x->reg == SP || x->reg == FP))) {
+		return 0;
+	}
+	if (x->reg != y->reg) {
+		return 1;
+	}
+	for (int k=i; k < j; k++) {
+		if (nodes[k].writes & REG_BIT(x->reg)) {
+			return 1;
+		}
+	}
+	int widthA = a->instr.command[1] == 'b' ? 1 : 4;
+	int widthB = b->instr.command[1] == 'b' ? 1 : 4;
+	return x->val.immed < y->val.immed + widthB && y->val.immed < x->val.immed + widthA;
+}
+
+//Cycles nodes[j] waits for nodes[i] (only reading its result waits on its latency)
+static int edge_latency(int i, int j) {
+	return (nodes[i].writes & nodes[j].reads) ? nodes[i].latency : 0;
+}
+
+/*
+	Fills in order, one instruction per cycle. Out of what has all
+	its predecessors done, the first of these wins:
+	- doesn't read what a load right before it loaded
+	- has its operands there by now
+	- highest priority
+	- came first originally
+	The terminator (if there is one, nodes[term]) always goes last.
+*/
+static void list_schedule(int *order, int term) {
+	int cycle = 0;
+	int last = -1;
+	for (int step=0; step < numNodes; step++) {
+		int best = -1, bestKey[3] = { 0 };
+		for (int c=0; c < numNodes; c++) {
+			SchedNode *node = &nodes[c];
+			if (node->scheduled || node->numPredsLeft > 0 || (c == term && step < numNodes-1)) {
+				continue;
+			}
+			int key[3] = { last == -1 || !hazard(&nodes[last], node), node->readyAt <= cycle,
+				node->priority };
+			if (best == -1 || key[0] > bestKey[0] || (key[0] == bestKey[0] && (key[1] > bestKey[1]
+				|| (key[1] == bestKey[1] && key[2] > bestKey[2])))) {
+				best = c;
+				memcpy(bestKey, key, sizeof(key));
+			}
+		}
+
+		SchedNode *node = &nodes[best];
+		int issued = node->readyAt > cycle ? node->readyAt : cycle;
+		node->scheduled = 1;
+		order[step] = best;
+		for (int j = best+1; j < numNodes; j++) {
+			if (dep[best][j]) {
+				nodes[j].numPredsLeft--;
+				if (issued + edge_latency(best, j) > nodes[j].readyAt) {
+					nodes[j].readyAt = issued + edge_latency(best, j);
+				}
+			}
+		}
+		cycle = issued + 1;
+		last = best;
+	}
+}
+
+/*
+	Something for the branch at the end of order (count long) to run
+	in its delay slot: the latest instruction nothing after it depends
+	on, that's one real instruction, and that can be taken out without
+	putting a load right before something reading what it loaded.
+	@return its position in order, or -1
+*/
+static int pick_delay_slot(int *order, int count) {
+	for (int k = count-2; k >= 0; k--) {
+		int x = order[k];
+		SchedNode *node = &nodes[x];
+		if ((node->flags & (SF_LOAD | SF_SYSCALL | SF_UNKNOWN)) || !fits_one_instr(&node->instr)) {
+			continue;
+		}
+		int isNeeded = 0;
+		for (int j = x+1; j < numNodes; j++) {
+			isNeeded |= dep[x][j];
+		}
+		if (isNeeded || (k > 0 && hazard(&nodes[order[k-1]], &nodes[order[k+1]]))) {
+			continue;
+		}
+		return k;
+	}
+	return -1;
+}
+
+//A nop after any load whose next instruction (going by the layout) reads what it loaded
+static void fix_load_hazards() {
+	Instruction *fixed = malloc((numOut * 2 + 1) * sizeof(Instruction));
+	int numFixed = 0;
+	for (int i=0; i < numOut; i++) {
+		fixed[numFixed++] = out[i];
+
+		SchedNode load, next;
+		load.instr = out[i];
+		load.flags = classify(&load.instr, &load.latency);
+		if (!(load.flags & SF_LOAD)) {
+			continue;
+		}
+		find_reads_writes(&load);
+		int j = i+1;
+		while (j < numOut && is_label_or_directive(&out[j])) {
+			j++;
+		}
+		if (j == numOut) {
+			continue;
+		}
+		next.instr = out[j];
+		next.flags = classify(&next.instr, &next.latency);
+		find_reads_writes(&next);
+		if (hazard(&load, &next)) {
+			Instruction nop = { "nop" };
+			fixed[numFixed++] = nop;
+			numLoadNops++;
+		}
+	}
+	free(out);
+	out = fixed;
+	numOut = numFixed;
+	outCapacity = numOut * 2 + 1;
+}
+
+/** Helpers **/
+
+static void emit(Instruction *instr) {
+	if (numOut == outCapacity) {
+		outCapacity *= 2;
+		out = realloc(out, outCapacity * sizeof(Instruction));
+	}
+	out[numOut++] = *instr;
+}
+
+//SF_ flags for instr (and how many cycles its result takes)
+static int classify(Instruction *instr, int *latency) {
+	for (int k=0; k < NUM_COMMANDS; k++) {
+		if (instr->command[0] == commandInfo[k].command[0]
+			&& strcmp(instr->command, commandInfo[k].command) == 0) {
+			*latency = commandInfo[k].latency;
+			//div $s, $t just sets HI/LO (and doesn't check for 0)
+			if (strcmp(instr->command, "div") == 0 && instr->op3.kind == OPND_NONE) {
+				return SF_WRITES_HILO;
+			}
+			return commandInfo[k].flags;
+		}
+	}
+	*latency = 1;
+	return SF_UNKNOWN;
+}
+
+static void find_reads_writes(SchedNode *node) {
+	Instruction *instr = &node->instr;
+	Operand *ops[3] = { &instr->op1, &instr->op2, &instr->op3 };
+	node->reads = node->writes = 0;
+
+	if (node->flags & SF_UNKNOWN) {
+		node->reads = node->writes = ~0u;
+	} else if (node->flags & SF_SYSCALL) {
+		node->reads = REG_BIT(V0) | REG_BIT(A0);
+		node->writes = REG_BIT(V0);
+	} else if (node->flags & SF_CALL) {
+		node->writes = REG_BIT(RA); //(the args are read once the callee's running)
+	} else {
+		int first = 0;
+		if (node->flags & SF_WRITES_OP1) {
+			node->writes = reg_bit(ops[0]);
+			first = 1;
+		}
+		for (int k = first; k < 3; k++) {
+			node->reads |= reg_bit(ops[k]);
+		}
+	}
+
+	if (node->flags & SF_READS_HI) {
+		node->reads |= HI_BIT;
+	}
+	if (node->flags & SF_READS_LO) {
+		node->reads |= LO_BIT;
+	}
+	if (node->flags & SF_WRITES_HILO) {
+		node->writes |= HI_BIT | LO_BIT;
+	}
+}
+
+static unsigned reg_bit(Operand *opnd) {
+	if ((opnd->kind != OPND_REG && opnd->kind != OPND_MEM) || opnd->reg < S0 || opnd->reg > ZERO) {
+		return 0;
+	}
+	return REG_BIT(opnd->reg);
+}
+
+static int is_label_or_directive(Instruction *instr) {
+	size_t len = strlen(instr->command);
+	return instr->command[0] == '.' || (len > 0 && instr->command[len-1] == ':');
+}
+
+//Will SPIM assemble instr to just the one machine instruction?
+static int fits_one_instr(Instruction *instr) {
+	static char *immForms[] = { "add", "addu", "addi", "addiu", "slt", "sltu", "slti", "sltiu",
+		"and", "andi", "or", "ori", "xor", "xori", "sll", "sra", "srl" };
+	int latency;
+	if (classify(instr, &latency) & SF_MULTI) {
+		return 0;
+	}
+	if (strcmp(instr->command, "li") == 0) {
+		return instr->op2.val.immed >= -32768 && instr->op2.val.immed <= 65535;
+	}
+	if (strcmp(instr->command, "la") == 0) {
+		return instr->op2.kind == OPND_MEM && fits_16_bits(instr->op2.val.immed);
+	}
+	if (instr->op2.kind == OPND_MEM) {
+		return fits_16_bits(instr->op2.val.immed);
+	}
+	if (instr->op3.kind == OPND_IMM) {
+		for (int k=0; k < (int)(sizeof(immForms)/sizeof(immForms[0])); k++) {
+			if (strcmp(instr->command, immForms[k]) == 0) {
+				return fits_16_bits(instr->op3.val.immed);
+			}
+		}
+		return 0;
+	}
+	return 1;
+}
+
+static int fits_16_bits(int immed) {
+	return immed >= -32768 && immed <= 32767;
+}
+
+//Would next (straight after load) read what load loaded?
+static int hazard(SchedNode *load, SchedNode *next) {
+	return (load->flags & SF_LOAD) && (load->writes & next->reads & ~REG_BIT(ZERO));
+}
@@ -0,0 +1,151 @@
+/*
+	simplifycfg: tidies up the CFG that codetraversal.c builds.
+	- a cbr whose targets are the same block becomes a jump
+	- blocks nothing can reach (e.g. code after a return/break) go
+	- jumps to a block that only jumps on are sent straight there
+	- a block is merged into its predecessor when that predecessor
+	  always jumps to it and nothing else does
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "passmanager.h"
+
+static int fold_same_target_branches(IrFunction *func);
+static int remove_unreachable_blocks(IrFunction *func);
+static int thread_empty_blocks(IrFunction *func);
+static int merge_straight_line_blocks(IrFunction *func);
+static void mark_reachable(IrBlock *block);
+
+void simplify_cfg(IrFunction *func) {
+	ir_rebuild_cfg(func);
+
+	int changed = 1;
+	while (changed) {
+		changed = fold_same_target_branches(func);
+		changed |= remove_unreachable_blocks(func);
+		changed |= thread_empty_blocks(func);
+		changed |= merge_straight_line_blocks(func);
+	}
+}
+
+static int fold_same_target_branches(IrFunction *func) {
+	int changed = 0;
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		IrInstr *term = block->last;
+		if (term->op == IR_CBR && term->target[0] == term->target[1]) {
+			term->op = IR_JUMP;
+			term->src1 = ir_none();
+			term->src2 = ir_none();
+			term->target[1] = NULL;
+			changed = 1;
+		}
+	}
+
+	if (changed) {
+		ir_rebuild_cfg(func);
+	}
+	return changed;
+}
+
+static int remove_unreachable_blocks(IrFunction *func) {
+	int changed = 0;
+	mark_reachable(func->entry);
+
+	IrBlock *block = func->entry;
+	while (block != NULL) {
+		IrBlock *next = block->next;
+		if (block->mark == 0) {
+			ir_remove_block(block);
+			changed = 1;
+		}
+		block->mark = 0;
+		block = next;
+	}
+
+	if (changed) {
+		ir_rebuild_cfg(func);
+	}
+	return changed;
+}
+
+//Iterative DFS (a recursive one could blow the stack on huge functions)
+static void mark_reachable(IrBlock *entry) {
+	int capacity = entry->func->numBlocks;
+	IrBlock **stack = malloc(capacity*sizeof(IrBlock *));
+	int top = 0;
+
+	entry->mark = 1;
+	stack[top++] = entry;
+	while (top > 0) {
+		IrBlock *block = stack[--top];
+		for (int i=0; i < block->numSuccs; i++) {
+			if (block->succs[i]->mark == 0) {
+				block->succs[i]->mark = 1;
+				stack[top++] = block->succs[i];
+			}
+		}
+	}
+	free(stack);
+}
+
+//Anything branching to a block that's just "jump X" may as well go to X
+static int thread_empty_blocks(IrFunction *func) {
+	int changed = 0;
+
+	for (IrBlock *block = func->entry->next; block != NULL; block = block->next) {
+		IrInstr *term = block->last;
+		if (block->first != term || term->op != IR_JUMP || term->target[0] == block) {
+			continue;
+		}
+
+		IrBlock *dest = term->target[0];
+		for (int i=0; i < block->numPreds; i++) {
+			IrInstr *predTerm = block->preds[i]->last;
+			for (int j=0; j < 2; j++) {
+				if (predTerm->target[j] == block) {
+					predTerm->target[j] = dest;
+					changed = 1;
+				}
+			}
+		}
+		//Keep preds/succs right for the blocks still to come in this loop
+		ir_rebuild_cfg(func);
+	}
+	return changed;
+}
+
+static int merge_straight_line_blocks(IrFunction *func) {
+	int changed = 0;
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		while (block->last->op == IR_JUMP) {
+			IrBlock *succ = block->last->target[0];
+			if (succ == block || succ == func->entry || succ->numPreds != 1) {
+				break;
+			}
+
+			//Splice succ's instructions in place of the jump
+			ir_remove(block->last);
+			for (IrInstr *instr = succ->first; instr != NULL; instr = instr->next) {
+				instr->block = block;
+			}
+			if (block->last == NULL) {
+				block->first = succ->first;
+			} else {
+				block->last->next = succ->first;
+				succ->first->prev = block->last;
+			}
+			block->last = succ->last;
+			succ->first = succ->last = NULL;
+
+			ir_remove_block(succ);
+			ir_rebuild_cfg(func);
+			changed = 1;
+		}
+	}
+	return changed;
+}
@@ -0,0 +1,241 @@
+/*
+	stackslots: lets scalar params/locals left in memory share frame
+	slots when they're never live at the same time, so functions
+	(recursive ones especially) take less stack.
+
+	Liveness of the params/locals regalloc didn't give a register is
+	worked out over the CFG the same way regalloc.c does it, and two
+	of them interfere if one is written while the other is live (the
+	params all count as written on entry, where the prologue stores
+	them). They're then coloured greedily: each one goes in the first
+	slot group none of its neighbours are in, and whose vars are the
+	same width. A local that can be read before it's written (it's
+	live on entry) isn't put in any group.
+
+	layout_frame() (irtotable.c) does the rest: vars of one group get
+	the same offset, and the frame is laid out biggest alignment
+	first, so chars don't leave padding between ints. It also hands
+	spill slots of vregs that have died back out.
+
+	This only decides var->slotGroup.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "passmanager.h"
+
+//The function being worked on
+static IrFunction *func;
+static int numVars;
+static int words; //unsigned ints per bitset
+static IrVar **vars; //By id
+static unsigned *useSet, *defSet, *liveIn, *liveOut; //words per block id
+static unsigned char *adj; //numVars x numVars interference matrix
+
+//For -stats
+static int numInMemory;
+static int numGroups;
+
+static void share_slots_in_function();
+static void compute_liveness();
+static void build_interference();
+static void colour_groups();
+
+static int is_tracked(IrVar *var);
+static int bit_test(unsigned *set, int bit);
+static void bit_set(unsigned *set, int bit);
+static void bit_clear(unsigned *set, int bit);
+
+void share_stack_slots(IrProgram *prog) {
+	numInMemory = numGroups = 0;
+
+	for (func = prog->functions; func != NULL; func = func->next) {
+		share_slots_in_function();
+	}
+
+	if (printStats) {
+		fprintf(stderr, "stackslots: %d scalar params/locals in memory share %d slots\n",
+			numInMemory, numGroups);
+	}
+}
+
+static void share_slots_in_function() {
+	numVars = func->numVars;
+	if (numVars == 0) {
+		return;
+	}
+	words = (numVars + 31) / 32;
+
+	vars = calloc(numVars, sizeof(IrVar *));
+	for (IrVar *var = func->params; var != NULL; var = var->next) {
+		vars[var->id] = var;
+	}
+	for (IrVar *var = func->locals; var != NULL; var = var->next) {
+		vars[var->id] = var;
+	}
+
+	size_t setsSize = (size_t)func->numBlocks * words * sizeof(unsigned);
+	useSet = calloc(1, setsSize + 1);
+	defSet = calloc(1, setsSize + 1);
+	liveIn = calloc(1, setsSize + 1);
+	liveOut = calloc(1, setsSize + 1);
+	adj = calloc((size_t)numVars * numVars, 1);
+
+	ir_rebuild_cfg(func);
+	compute_liveness();
+	build_interference();
+	colour_groups();
+
+	free(vars);
+	free(useSet);
+	free(defSet);
+	free(liveIn);
+	free(liveOut);
+	free(adj);
+}
+
+//Which tracked vars each block reads before writing / writes, then live in/out to a fixpoint
+static void compute_liveness() {
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		unsigned *use = &useSet[block->id * words];
+		unsigned *def = &defSet[block->id * words];
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			if ((instr->op != IR_LDVAR && instr->op != IR_STVAR) || !is_tracked(instr->var)) {
+				continue;
+			}
+			int v = instr->var->id;
+			if (instr->op == IR_STVAR) {
+				bit_set(def, v);
+			} else if (!bit_test(def, v)) {
+				bit_set(use, v);
+			}
+		}
+	}
+
+	int changed = 1;
+	while (changed) {
+		changed = 0;
+		for (IrBlock *block = func->lastBlock; block != NULL; block = block->prev) {
+			unsigned *in = &liveIn[block->id * words];
+			unsigned *out = &liveOut[block->id * words];
+			unsigned *use = &useSet[block->id * words];
+			unsigned *def = &defSet[block->id * words];
+
+			for (int w=0; w < words; w++) {
+				unsigned newOut = 0;
+				for (int i=0; i < block->numSuccs; i++) {
+					newOut |= liveIn[block->succs[i]->id * words + w];
+				}
+				unsigned newIn = use[w] | (newOut & ~def[w]);
+				if (newIn != in[w] || newOut != out[w]) {
+					in[w] = newIn;
+					out[w] = newOut;
+					changed = 1;
+				}
+			}
+		}
+	}
+}
+
+//Every store interferes with whatever's live across it
+static void build_interference() {
+	unsigned *live = malloc(words * sizeof(unsigned) + 1);
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		memcpy(live, &liveOut[block->id * words], words * sizeof(unsigned));
+		for (IrInstr *instr = block->last; instr != NULL; instr = instr->prev) {
+			if ((instr->op != IR_LDVAR && instr->op != IR_STVAR) || !is_tracked(instr->var)) {
+				continue;
+			}
+			int x = instr->var->id;
+			if (instr->op == IR_LDVAR) {
+				bit_set(live, x);
+				continue;
+			}
+			for (int v=0; v < numVars; v++) {
+				if (v != x && bit_test(live, v)) {
+					adj[x*numVars + v] = adj[v*numVars + x] = 1;
+				}
+			}
+			bit_clear(live, x);
+		}
+	}
+
+	//The prologue writes every param, while the others (and anything live on entry) are live
+	unsigned *entryLive = &liveIn[func->entry->id * words];
+	for (IrVar *param = func->params; param != NULL; param = param->next) {
+		if (!is_tracked(param)) {
+			continue;
+		}
+		for (int v=0; v < numVars; v++) {
+			if (v != param->id && (bit_test(entryLive, v)
+				|| (vars[v] != NULL && vars[v]->kind == VAR_PARAM))) {
+				adj[param->id*numVars + v] = adj[v*numVars + param->id] = 1;
+			}
+		}
+	}
+	free(live);
+}
+
+static void colour_groups() {
+	int *group = malloc(numVars * sizeof(int));
+	int *groupWidth = malloc(numVars * sizeof(int));
+	char *taken = malloc(numVars + 1);
+	int numFunctionGroups = 0;
+	unsigned *entryLive = &liveIn[func->entry->id * words];
+
+	for (int v=0; v < numVars; v++) {
+		group[v] = -1;
+		if (vars[v] == NULL) {
+			continue;
+		}
+		vars[v]->slotGroup = -1;
+		if (!is_tracked(vars[v]) || (vars[v]->kind == VAR_LOCAL && bit_test(entryLive, v))) {
+			continue;
+		}
+		numInMemory++;
+
+		memset(taken, 0, numVars + 1);
+		for (int u=0; u < v; u++) {
+			if (group[u] != -1 && adj[v*numVars + u]) {
+				taken[group[u]] = 1;
+			}
+		}
+		int g = 0;
+		while (g < numFunctionGroups && (taken[g] || groupWidth[g] != ir_var_width(vars[v]))) {
+			g++;
+		}
+		if (g == numFunctionGroups) {
+			groupWidth[numFunctionGroups++] = ir_var_width(vars[v]);
+		}
+		group[v] = g;
+		vars[v]->slotGroup = g;
+	}
+	numGroups += numFunctionGroups;
+
+	free(group);
+	free(groupWidth);
+	free(taken);
+}
+
+/** Helpers **/
+
+//Scalar params/locals that stay in memory
+static int is_tracked(IrVar *var) {
+	return var->kind != VAR_GLOBAL && var->dimension == -1 && var->reg == -1;
+}
+
+static int bit_test(unsigned *set, int bit) {
+	return (set[bit / 32] >> (bit % 32)) & 1;
+}
+
+static void bit_set(unsigned *set, int bit) {
+	set[bit / 32] |= 1u << (bit % 32);
+}
+
+static void bit_clear(unsigned *set, int bit) {
+	set[bit / 32] &= ~(1u << (bit % 32));
+}
@@ -0,0 +1,412 @@
+/*
+	tailcall: gets rid of calls whose result is returned straight
+	away (ret of the call's dest, right after it).
+
+	A function calling itself like that becomes a loop: the args are
+	stored into the params and it jumps back to the start, so deep
+	recursion runs in one frame. Array args have to be the array
+	param that's already there (its slot isn't a var we can store
+	into). Locals don't need resetting - C-- doesn't initialise them.
+
+	Simple linear recursions that do one more thing with the result,
+	like return n * fact(n-1), are made into that shape first with an
+	accumulator: a new local starting at 0 (for +) or 1 (for *) that
+	the other operand is folded into before going round again, and
+	that every other return folds its value into. The other operand
+	has to be worked out before the call (or be an ldvar of a param/
+	local, which the call can't change). The products/sums are built
+	in the opposite order to the recursion's, so this is only done
+	where that can't change whether (or, as far as anyone can see,
+	when) the program traps - see accumulating_is_safe(). Otherwise
+	the call stays a call.
+
+	Every other call in tail position (including to other functions)
+	is marked isTailCall, and irtotable.c lowers it as: args into the
+	$a registers, take the frame down, and jump - the callee then
+	returns straight to our caller. That's only done if the function
+	has no local arrays, since an address passed along could point
+	into the frame being given up.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "passmanager.h"
+#include "lexer.h"
+
+static IrFunction *func;
+static IrBlock *loopStart; //Where the recursive calls jump back to
+static IrVar *acc; //The accumulator, or NULL if there isn't one
+static IrOpcode accOp;
+
+//For -stats
+static int numLooped;
+static int numAccumulated;
+static int numMarked;
+
+static void eliminate_in_function();
+static IrInstr *self_tail_call(IrInstr *ret, IrOpcode *op, IrOperand *other);
+static int args_fit_params(IrInstr *call);
+static int only_reads_vars_after(IrInstr *call, IrInstr *until);
+static int count_uses(int vreg);
+static int all_returns_have_values();
+static int accumulating_is_safe();
+static long lower_bound(IrBlock *block, IrOperand opnd);
+static IrInstr *def_in_block(IrBlock *block, IrOperand opnd);
+static int is_stored(IrVar *var);
+static void make_loop_start();
+static void loop_back(IrInstr *call, IrOperand other);
+static void fold_into_return(IrInstr *ret);
+static int has_local_arrays();
+
+void eliminate_tail_calls(IrProgram *prog) {
+	numLooped = numAccumulated = numMarked = 0;
+
+	for (func = prog->functions; func != NULL; func = func->next) {
+		eliminate_in_function();
+	}
+
+	if (printStats) {
+		fprintf(stderr, "tailcall: %d recursive calls made into loops (%d with an accumulator), "
+			"%d other tail calls\n", numLooped, numAccumulated, numMarked);
+	}
+}
+
+static void eliminate_in_function() {
+	loopStart = NULL;
+	acc = NULL;
+	ir_rebuild_cfg(func);
+
+	//The accumulator's op comes from the first call that needs one
+	int haveOp = 0;
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		IrOpcode op;
+		IrOperand other;
+		IrInstr *call = self_tail_call(block->last, &op, &other);
+		if (call != NULL && other.kind != IRO_NONE && !haveOp) {
+			accOp = op;
+			haveOp = 1;
+		}
+	}
+	if (haveOp && all_returns_have_values() && accumulating_is_safe()) {
+		acc = ir_add_local(func, accOp == IR_MUL ? "acc.mul" : "acc.add", INTTOK, -1);
+	}
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		IrInstr *ret = block->last;
+		if (ret->op != IR_RET) {
+			continue;
+		}
+		IrOpcode op;
+		IrOperand other;
+		IrInstr *call = self_tail_call(ret, &op, &other);
+		if (call != NULL && (other.kind == IRO_NONE || (acc != NULL && op == accOp))) {
+			if (loopStart == NULL) {
+				make_loop_start();
+			}
+			loop_back(call, other);
+			numLooped++;
+			numAccumulated += other.kind != IRO_NONE;
+		} else if (acc != NULL) {
+			fold_into_return(ret);
+		}
+	}
+
+	//What's left in tail position (a ret of the call right before it) can reuse the frame
+	int reuseFrame = !has_local_arrays();
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		IrInstr *ret = block->last;
+		IrInstr *call = ret->prev;
+		if (ret->op == IR_RET && call != NULL && call->op == IR_CALL && reuseFrame
+			&& (ret->src1.kind == IRO_NONE
+				|| (ret->src1.kind == IRO_VREG && ret->src1.val == call->dest))) {
+			call->isTailCall = 1;
+			numMarked++;
+		}
+	}
+
+	if (loopStart != NULL) {
+		ir_rebuild_cfg(func);
+	}
+}
+
+/*
+	Is ret returning what a call to this function just gave back -
+	either as it is, or after one + or * with something else?
+	@return the call (and the op and other operand, which is none if
+	it's returned as it is), or NULL
+*/
+static IrInstr *self_tail_call(IrInstr *ret, IrOpcode *op, IrOperand *other) {
+	*other = ir_none();
+	if (ret->op != IR_RET || ret->src1.kind != IRO_VREG) {
+		return NULL;
+	}
+
+	IrInstr *call = ret->prev;
+	if (call != NULL && call->op == IR_CALL) {
+		return call->callee == func && call->dest == ret->src1.val && args_fit_params(call) ?
+			call : NULL;
+	}
+
+	IrInstr *combine = ret->prev;
+	if (combine == NULL || (combine->op != IR_ADD && combine->op != IR_MUL)
+		|| combine->dest != ret->src1.val || count_uses(combine->dest) != 1) {
+		return NULL;
+	}
+	for (call = combine->prev; call != NULL && call->op != IR_CALL; call = call->prev)
+		;
+	if (call == NULL || call->callee != func || !args_fit_params(call)
+		|| count_uses(call->dest) != 1 || !only_reads_vars_after(call, combine)) {
+		return NULL;
+	}
+
+	//The call's result on one side (its only use), so the other side can't depend on it
+	if (combine->src1.kind == IRO_VREG && combine->src1.val == call->dest) {
+		*other = combine->src2;
+	} else if (combine->src2.kind == IRO_VREG && combine->src2.val == call->dest) {
+		*other = combine->src1;
+	} else {
+		return NULL;
+	}
+	*op = combine->op;
+	return call;
+}
+
+//Array params can only be passed themselves (nothing else can be stored in their slot)
+static int args_fit_params(IrInstr *call) {
+	int i = 0;
+	for (IrVar *param = func->params; param != NULL; param = param->next, i++) {
+		if (param->dimension == -1) {
+			continue;
+		}
+		IrInstr *def = NULL;
+		if (call->args[i].kind == IRO_VREG) {
+			for (def = call->prev; def != NULL && def->dest != call->args[i].val; def = def->prev)
+				;
+		}
+		if (def == NULL || def->op != IR_ADDR || def->var != param) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+//Only ldvars of params/locals between call and until (the call can't change those)
+static int only_reads_vars_after(IrInstr *call, IrInstr *until) {
+	for (IrInstr *instr = call->next; instr != until; instr = instr->next) {
+		if (instr->op != IR_LDVAR || instr->var->kind == VAR_GLOBAL) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int count_uses(int vreg) {
+	int count = 0;
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			IrOperand *uses[IR_MAX_USES];
+			int numUses = ir_get_uses(instr, uses);
+			for (int i=0; i < numUses; i++) {
+				count += uses[i]->kind == IRO_VREG && uses[i]->val == vreg;
+			}
+		}
+	}
+	return count;
+}
+
+//The accumulator gets folded into every return, so they all need something to fold it into
+static int all_returns_have_values() {
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		if (block->last->op == IR_RET && block->last->src1.kind == IRO_NONE) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+	Building the products/sums the other way round mustn't make a
+	program trap that wouldn't have (like n * f(n-1) with f(0) = 0,
+	where every product the recursion works out is 0). It can't if
+	every term is at least 0 for + (1 for *): each partial result, in
+	either order, is then at most the whole thing, so both overflow
+	exactly when that does. The terms are the other operands - a
+	constant, or a param the branch into the call's block keeps above
+	something (like n in if (n <= 1) ... else return n * fact(n-1)) -
+	and the constants every other return gives. Where it traps can
+	only be seen if the function does I/O or calls something else.
+*/
+static int accumulating_is_safe() {
+	int least = accOp == IR_MUL ? 1 : 0;
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			if (instr->op == IR_READ || instr->op == IR_WRITE || instr->op == IR_WRITELN
+				|| (instr->op == IR_CALL && instr->callee != func)) {
+				return 0;
+			}
+		}
+
+		IrInstr *ret = block->last;
+		if (ret->op != IR_RET) {
+			continue;
+		}
+		IrOpcode op;
+		IrOperand other;
+		IrInstr *call = self_tail_call(ret, &op, &other);
+		if (call == NULL) {
+			if (ret->src1.kind != IRO_IMM || ret->src1.val < least) {
+				return 0;
+			}
+		} else if (other.kind != IRO_NONE && (op != accOp || lower_bound(block, other) < least)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+	The least opnd can be in block: a constant, or a param (never
+	stored) that the branch leading to block compares with one.
+	@return LONG_MIN if nothing's known
+*/
+static long lower_bound(IrBlock *block, IrOperand opnd) {
+	if (opnd.kind == IRO_IMM) {
+		return opnd.val;
+	}
+	IrInstr *load = def_in_block(block, opnd);
+	if (load == NULL || load->op != IR_LDVAR || load->var->kind != VAR_PARAM
+		|| is_stored(load->var)) {
+		return LONG_MIN;
+	}
+
+	//Back up through blocks that were only jumped to
+	for (int steps=0; block->numPreds == 1 && block->preds[0]->last->op == IR_JUMP
+		&& steps < func->numBlocks; steps++) {
+		block = block->preds[0];
+	}
+	if (block->numPreds != 1) {
+		return LONG_MIN;
+	}
+	IrInstr *test = block->preds[0]->last;
+	if (test->op != IR_CBR || test->target[0] == test->target[1]) {
+		return LONG_MIN;
+	}
+	IrOpcode cond = test->target[0] == block ? test->cond : ir_invert_cond(test->cond);
+	IrOperand var = test->src1;
+	IrOperand bound = test->src2;
+	if (bound.kind != IRO_IMM) {
+		cond = ir_swap_cond(cond);
+		var = test->src2;
+		bound = test->src1;
+	}
+	IrInstr *testLoad = def_in_block(test->block, var);
+	if (bound.kind != IRO_IMM || testLoad == NULL || testLoad->op != IR_LDVAR
+		|| testLoad->var != load->var) {
+		return LONG_MIN;
+	}
+	switch (cond) {
+		case IR_SGT: return (long)bound.val + 1;
+		case IR_SGE: case IR_SEQ: return bound.val;
+		default: return LONG_MIN;
+	}
+}
+
+//The instruction in block that wrote opnd, if it's a vreg
+static IrInstr *def_in_block(IrBlock *block, IrOperand opnd) {
+	if (opnd.kind != IRO_VREG) {
+		return NULL;
+	}
+	for (IrInstr *instr = block->last; instr != NULL; instr = instr->prev) {
+		if (instr->dest == opnd.val) {
+			return instr;
+		}
+	}
+	return NULL;
+}
+
+static int is_stored(IrVar *var) {
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			if (instr->op == IR_STVAR && instr->var == var) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+//A new entry block (setting up the accumulator) that falls into the old one
+static void make_loop_start() {
+	loopStart = func->entry;
+	IrBlock *entry = ir_new_block(func);
+	ir_remove_block(entry);
+	entry->next = func->entry;
+	func->entry->prev = entry;
+	func->entry = entry;
+
+	if (acc != NULL) {
+		ir_emit_stvar(entry, acc, ir_imm(accOp == IR_MUL ? 1 : 0));
+	}
+	ir_emit_jump(entry, loopStart);
+}
+
+/*
+	call (and whatever was done with its result) becomes: fold other
+	into the accumulator, store the args into the params, go round
+	again. The ldvars between the call and the combine stay, since
+	other may be one of them.
+*/
+static void loop_back(IrInstr *call, IrOperand other) {
+	IrBlock *block = call->block;
+	IrInstr *ret = block->last;
+	if (other.kind != IRO_NONE) {
+		ir_remove(ret->prev); //The combine
+	}
+	ir_remove(ret);
+	ir_remove(call);
+
+	if (other.kind != IRO_NONE) {
+		int soFar = ir_emit_ldvar(block, acc);
+		int folded = ir_emit_binary(block, accOp, ir_vreg(soFar), other);
+		ir_emit_stvar(block, acc, ir_vreg(folded));
+	}
+
+	int i = 0;
+	for (IrVar *param = func->params; param != NULL; param = param->next, i++) {
+		if (param->dimension == -1) {
+			ir_emit_stvar(block, param, call->args[i]);
+		}
+	}
+	ir_emit_jump(block, loopStart);
+}
+
+//ret v -> ret acc op v
+static void fold_into_return(IrInstr *ret) {
+	IrInstr *load = ir_new_instr(func, IR_LDVAR);
+	load->dest = ir_new_vreg(func, VT_INT);
+	load->var = acc;
+	ir_insert_before(ret, load);
+	if (ret->src1.kind == IRO_IMM && ret->src1.val == (accOp == IR_MUL ? 1 : 0)) {
+		ret->src1 = ir_vreg(load->dest); //(like fact's return 1)
+		return;
+	}
+
+	IrInstr *combine = ir_new_instr(func, accOp);
+	combine->dest = ir_new_vreg(func, VT_INT);
+	combine->src1 = ir_vreg(load->dest);
+	combine->src2 = ret->src1;
+	ir_insert_before(ret, combine);
+	ret->src1 = ir_vreg(combine->dest);
+}
+
+static int has_local_arrays() {
+	for (IrVar *local = func->locals; local != NULL; local = local->next) {
+		if (local->dimension != -1) {
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -10,240 +10,81 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
 #include "traversaltotable.h"
 #include "tablemechanics.h"
+#include "asmwriter.h"
 #include "lexer.h"
 
-static Instruction *functionEpilogueLabelHolder = NULL;
-
 /*
 	Called at the beginning of every traversal - sets up .s file.
 	Hardcoded!
 */
 void setup_mips_code() {
-	init_table_and_loop_stack();
+	init_code_table();
 
 	//.data
-	Instruction *dataDir = init_Instruction_struct();
-	dataDir->command = strdup(".data");
-	add_instr_to_code_table(dataDir);
+	Instruction dataDir = { ".data" };
+	add_instr_to_code_table(&dataDir);
 
 	//_newline_:
-	Instruction *newlineLabel = init_Instruction_struct();
-	newlineLabel->command = strdup("_newline_:");
-	add_instr_to_code_table(newlineLabel);
+	Instruction newlineLabel = { "_newline_:" };
+	add_instr_to_code_table(&newlineLabel);
 
 	//.asciiz \n
-	Instruction *newline = init_Instruction_struct();
-	newline->command = strdup(".asciiz \"\\n\"");
-	add_instr_to_code_table(newline);
+	Instruction newline = { ".asciiz \"\\n\"" };
+	add_instr_to_code_table(&newline);
 
 	//.text
-	Instruction *textDir = init_Instruction_struct();
-	textDir->command = strdup(".text");
-	add_instr_to_code_table(textDir);
+	Instruction textDir = { ".text" };
+	add_instr_to_code_table(&textDir);
 
 	//.globl main
-	Instruction *mainGlobal = init_Instruction_struct();
-	mainGlobal->command = strdup(".globl main");
-	add_instr_to_code_table(mainGlobal);
+	Instruction mainGlobal = { ".globl main" };
+	add_instr_to_code_table(&mainGlobal);
 }
 
 /*
-	Called before a function call. Stores temporary registers and 
-	parameter registers, so the called function can use them.
+	Called before a function call. Stores the registers in regs (the
+	ones holding something still needed after the call), so the called
+	function can use them. They go at the bottom of the caller's frame,
+	which has room for them - $sp itself doesn't move.
 */
-
-void generate_function_precall() {
-	//Saving 12 registers, so make space for 48 bytes
-	int spaceToMake = (8+4)*REGISTER_SIZE;
-
-	//Update $sp in MIPS file and in our counter
-	add_immed_instr(SP, SP, -spaceToMake);
-	stackCurrOffset += spaceToMake;
-
-	//I use numbers here because I felt it would be more readable
-	store_word_instr(T0, 44, SP);
-	store_word_instr(T1, 40, SP);
-	store_word_instr(T2, 36, SP);
-	store_word_instr(T3, 32, SP);
-	store_word_instr(T4, 28, SP);
-	store_word_instr(T5, 24, SP);
-	store_word_instr(T6, 20, SP);
-	store_word_instr(T7, 16, SP);
-
-	store_word_instr(A0, 12, SP);
-	store_word_instr(A1, 8, SP);
-	store_word_instr(A2, 4, SP);
-	store_word_instr(A3, 0, SP);
+void generate_function_precall(int *regs, int numRegs) {
+	for (int i=0; i < numRegs; i++) {
+		store_word_instr(regs[i], i*REGISTER_SIZE, SP);
+	}
 }
 
 //Jumps to the function we're calling
 void jal_to_function(char *calledFuncName) {
-	Instruction *jalInstr = init_Instruction_struct();
-	jalInstr->command = strdup("jal");
-	jalInstr->op1 = strdup(calledFuncName);
-	add_instr_to_code_table(jalInstr);
+	Instruction jalInstr = { "jal", sym_operand(table_strdup(calledFuncName)) };
+	add_instr_to_code_table(&jalInstr);
 }
 
-/*
-	Called at beginning of a function. Sets up the new
-	functions' stack/frame pointers, as well as the return
-	address. Stores local registers too!
-*/
-void generate_function_prologue() {
-	functionEpilogueLabelHolder = generate_unique_label();
-
-	//First make space for parameters!
-	add_immed_instr(SP, SP, -paramOffset);
-	stackCurrOffset = paramOffset; 
-
-	//Update $sp
-	int spaceToMake = (2+8)*REGISTER_SIZE;
-	add_immed_instr(SP, SP, -spaceToMake);
-	stackCurrOffset += spaceToMake; 
-
-	store_word_instr(RA, 36, SP);
-	store_word_instr(FP, 32, SP);
-	store_word_instr(S0, 28, SP);
-	store_word_instr(S1, 24, SP);
-	store_word_instr(S2, 20, SP);
-	store_word_instr(S3, 16, SP);
-	store_word_instr(S4, 12, SP);
-	store_word_instr(S5, 8, SP);
-	store_word_instr(S6, 4, SP);
-	store_word_instr(S7, 0, SP);
-	add_immed_instr(FP, SP, stackCurrOffset); //Update $fp
-}
-
-/*
-	Called at the end of a function. Basically undoes
-	what happens in generate_function_prologue()
-*/
-void generate_function_epilogue() {
-	add_instr_to_code_table(functionEpilogueLabelHolder);
-
-	int spaceToReload = (8+2)*REGISTER_SIZE;
-
-	load_word_instr(S7, 0, SP);
-	load_word_instr(S6, 4, SP);
-	load_word_instr(S5, 8, SP);
-	load_word_instr(S4, 12, SP);
-	load_word_instr(S3, 16, SP);
-	load_word_instr(S2, 20, SP);
-	load_word_instr(S1, 24, SP);
-	load_word_instr(S0, 28, SP);
-	load_word_instr(FP, 32, SP);
-	load_word_instr(RA, 36, SP);
-	add_immed_instr(SP, SP, paramOffset);
-	add_immed_instr(SP, SP, spaceToReload);  //Pops stack frame
-
-	//localsOffset+paramOffset = space used by locals/params we must reload
-	stackCurrOffset -= localsOffset + paramOffset + spaceToReload;
-	jump_to_register(RA);
-
-	//Reset for the next function
-	paramOffset = 0;
-	localsOffset = 0;
+//Jumps to a function without linking - it returns to whoever called us
+void jump_to_function(char *calledFuncName) {
+	Instruction jInstr = { "j", sym_operand(table_strdup(calledFuncName)) };
+	add_instr_to_code_table(&jInstr);
 }
 
 /*
 	Called after a function call. Basically undoes what happens in
-	generate_function_precal()
+	generate_function_precall() (regs must be the same)
 */
-void generate_function_postcall() {
-	int spaceToReload = (8+4)*REGISTER_SIZE;
-
-	//Restore temporaries
-	load_word_instr(T0, 44, SP);
-	load_word_instr(T1, 40, SP);
-	load_word_instr(T2, 36, SP);
-	load_word_instr(T3, 32, SP);
-	load_word_instr(T4, 28, SP);
-	load_word_instr(T5, 24, SP);
-	load_word_instr(T6, 20, SP);
-	load_word_instr(T7, 16, SP);
-
-	//Restore arguments
-	load_word_instr(A0, 12, SP);
-	load_word_instr(A1, 8, SP);
-	load_word_instr(A2, 4, SP);
-	load_word_instr(A3, 0, SP);
-
-	//Pop stack
-	add_immed_instr(SP, SP, spaceToReload);
-	stackCurrOffset -= spaceToReload;
+void generate_function_postcall(int *regs, int numRegs) {
+	for (int i=0; i < numRegs; i++) {
+		load_word_instr(regs[i], i*REGISTER_SIZE, SP);
+	}
 }
 
 //Create a label with a function's name - need for jal-ing
 void generate_function_label(char *name) {
-	Instruction *label = init_Instruction_struct();
-
 	char tempHolder[1+strlen(name)+1+1];
 	sprintf(tempHolder, "%s:", name);
-	label->command = strdup(tempHolder);
-
-	add_instr_to_code_table(label);
-}
-
-/*
-	Signals that space must be made for parameters. Stores value
-	of a_i register into where the parameter would be stores.
-*/
-void allocate_space_for_params(int paramType, int paramReg, int offset, int dimension) {
-	//Storing an array address: just need 4-bytes!
-	if (dimension != -1) { 
-		//SP at this point is the same as FP after prologue
-		store_word_instr(paramReg, offset, SP);
-		allocate_param_to_stack(ALIGN);
-		return;
-	}
-
-	//Otherwise, if it's a normal variable
-	switch(paramType) {
-		case INTTOK: 
-			store_word_instr(paramReg, offset, SP);
-			allocate_param_to_stack(INT_SIZE);
-			break;
-		case CHARTOK:  
-			store_byte_instr(paramReg, offset, SP);
-			allocate_param_to_stack(CHAR_SIZE);
-			break;
-	}
-}
-
-//After allocating space for parameters, pad to ensure 4-byte alignement
-void pad_params() {
-	if (stackCurrOffset%ALIGN != 0) {
-		//Basically like allocating a parameter! Except you're not using it
-		allocate_param_to_stack(ALIGN-stackCurrOffset%ALIGN);
-	}
-}
-
-//Update $sp to make space on the stack for local variables
-void allocate_space_for_locals(int type, int dimension, int arrOffset) {
-	if (dimension != -1) { //An array
-		allocate_at_stack_top(arrOffset);
-		return;
-	}
 
-	//A normal variable
-	switch(type) {
-		case INTTOK: 
-			allocate_at_stack_top(INT_SIZE);	
-			break;
-		case CHARTOK:  
-			allocate_at_stack_top(CHAR_SIZE);
-			break;
-	}
-}
-
-//Similar to pad_params - allocate space on stack for alignment
-void pad_locals() {
-	if (stackCurrOffset%ALIGN != 0) {
-		//Basically the same process as allocating locals to stack
-		allocate_at_stack_top(ALIGN-stackCurrOffset%ALIGN);
-	}
+	Instruction label = { table_strdup(tempHolder) };
+	add_instr_to_code_table(&label);
 }
 
 //Stores value in src_reg1 into the given offset from $gp
@@ -258,14 +99,14 @@ void assign_global(int src_reg, int type, int offset) {
 	}
 }
 
-//Stores value in src_reg1 into the given offset from $fp
-void assign_local(int src_reg, int type, int offset) {
+//Stores value in src_reg1 into the given offset from frame_reg ($fp, or $sp if there's no frame pointer)
+void assign_local(int src_reg, int type, int offset, int frame_reg) {
 	switch(type) {
 		case INTTOK: 
-			store_word_instr(src_reg, offset, FP);
+			store_word_instr(src_reg, offset, frame_reg);
 			break;
 		case CHARTOK:  
-			store_byte_instr(src_reg, offset, FP);
+			store_byte_instr(src_reg, offset, frame_reg);
 			break;
 	}
 }
@@ -287,8 +128,8 @@ void load_global(int dest_reg, int type, int offset, int isInit) {
 	}
 }
 
-//Loads value at the passed-in offset from $fp into dest_reg
-void load_local(int dest_reg, int type, int offset, int isInit) {
+//Loads value at the passed-in offset from frame_reg ($fp, or $sp) into dest_reg
+void load_local(int dest_reg, int type, int offset, int frame_reg, int isInit) {
 	//Another dash of error-checking
 	if (isInit == 0) {
 		codegen_error("Trying to use undeclared local!", inFile, outFile);
@@ -296,34 +137,33 @@ void load_local(int dest_reg, int type, int offset, int isInit) {
 
 	switch(type) {
 		case INTTOK: 
-			load_word_instr(dest_reg, offset, FP);
+			load_word_instr(dest_reg, offset, frame_reg);
 			break;
 		case CHARTOK:  
-			load_byte_instr(dest_reg, offset, FP);
+			load_byte_instr(dest_reg, offset, frame_reg);
 			break;
 	}
 }
 
 //move R_d, R_s
 void move_registers(int dest_reg, int src_reg1) {
-	Instruction *moveInstr = setup_2op_instr(strdup("move"), 
-		getRegStr(dest_reg), getRegStr(src_reg1));
-	add_instr_to_code_table(moveInstr);
-}
-
-//@param src_reg1 register stored at top of stack
-void store_reg_on_stack(int src_reg1) {
-	allocate_at_stack_top(REGISTER_SIZE);
-	store_word_instr(src_reg1, 0, SP);
+	Instruction moveInstr = setup_2op_instr("move", 
+		reg_operand(dest_reg), reg_operand(src_reg1));
+	add_instr_to_code_table(&moveInstr);
 }
 
-//@param src_reg1 register loaded from top of stack
-void load_reg_from_stack(int src_reg1) {
-	//No helper function for this sadly - not repeated much
-	load_word_instr(src_reg1, 0, SP);
-	add_immed_instr(SP, SP, REGISTER_SIZE);
-	stackCurrOffset -= REGISTER_SIZE;
-	localsOffset -= REGISTER_SIZE;
+/*
+	Char variables kept in a register have to hold what lb would
+	give back: the low byte, sign-extended.
+	sll dest_reg, src_reg1, 24; sra dest_reg, dest_reg, 24
+*/
+void sign_extend_byte(int dest_reg, int src_reg1) {
+	Instruction sllInstr = setup_3op_instr("sll",
+		reg_operand(dest_reg), reg_operand(src_reg1), immed_operand(24));
+	add_instr_to_code_table(&sllInstr);
+	Instruction sraInstr = setup_3op_instr("sra",
+		reg_operand(dest_reg), reg_operand(dest_reg), immed_operand(24));
+	add_instr_to_code_table(&sraInstr);
 }
 
 /*
@@ -331,19 +171,26 @@ void load_reg_from_stack(int src_reg1) {
 	addiu dest_reg, src_reg1, immed
 */
  void add_immed_instr(int dest_reg, int src_reg1, int immed) {
- 	//Get length of immediate value
-	int immedLength = snprintf(NULL, 0, "%d", immed);
-	char *immedHolder = malloc(sizeof(immedLength)+1);
-	sprintf(immedHolder, "%d", immed);
+	Instruction addiuInstr = setup_3op_instr("addiu", 
+		reg_operand(dest_reg), reg_operand(src_reg1), immed_operand(immed));
+
+	add_instr_to_code_table(&addiuInstr);
+}
 
-	Instruction *addiuInstr = setup_3op_instr(strdup("addiu"), 
-		getRegStr(dest_reg), getRegStr(src_reg1), immedHolder);
+//Any i-type instruction, e.g. slti dest_reg, src_reg1, immed
+void add_immed_op_instr(char *command, int dest_reg, int src_reg1, int immed) {
+	Instruction immedInstr = setup_3op_instr(command,
+		reg_operand(dest_reg), reg_operand(src_reg1), immed_operand(immed));
 
-	add_instr_to_code_table(addiuInstr);
+	add_instr_to_code_table(&immedInstr);
 }
 
-void execute_return() {
-	branch(functionEpilogueLabelHolder);
+//Any r-type instruction, e.g. addu dest_reg, src_reg1, src_reg2
+static void add_reg_op_instr(char *command, int dest_reg, int src_reg1, int src_reg2) {
+	Instruction regInstr = setup_3op_instr(command,
+		reg_operand(dest_reg), reg_operand(src_reg1), reg_operand(src_reg2));
+
+	add_instr_to_code_table(&regInstr);
 }
 
 //Uses syscall to read in an integer from user
@@ -373,81 +220,6 @@ void add_write_instr(int src_reg1) {
 	syscall_instr();
 }
 
-//Adds instruction to break out of a while loop
-void add_break_instr() {
-	Instruction *topOfStack = whileLabelStack->doneLabelStack[whileLabelStack->numLoops-1];
-
-	if (topOfStack != NULL) {
-		//Branches to enclosing loops done label
-		branch(topOfStack);
-	} else {
-		//Moreee error-checking
-		codegen_error("'break;' can only be used within while loops!", inFile, outFile);
-	}
-}
-
-/** Functions for if-else statements **/
-
-//Inserts branching code to else 
-void add_instr_for_if(int src_reg1) {
-	Instruction *elseLabel = generate_else_label();
-	beqzInstr(src_reg1, elseLabel);
-
-	ifelseLabelHolder = elseLabel;
-}
-
-/* 
-	Inserts branching code for when conditional is done, and 
-	inserts label for else-bodys (which should follow after 
-	this function call)
-*/
-void add_instr_for_else() {
-	Instruction *condDoneLabel = generate_ifelse_done_label();
-	branch(condDoneLabel);
-
-	Instruction *elseLabel = ifelseLabelHolder;
-
-	add_instr_to_code_table(elseLabel);
-	ifelseLabelHolder = condDoneLabel;
-}
-
-//Inserts label for code after the conditional
-void add_instr_for_cond_finish() {
-	Instruction *condFinish = ifelseLabelHolder;
-	add_instr_to_code_table(condFinish);
-}
-
-/** Functions for while() loops **/
-
-//Adds while-label to code table
-void add_instr_for_while() {
-	Instruction *whileStartLabel = generate_while_label();
-	add_instr_to_code_table(whileStartLabel);
-	push_start_of_while_loop(whileStartLabel);
-
-	Instruction *whileDoneLabel = generate_while_done_label();
-	push_end_of_while_loop(whileDoneLabel);
-}
-
-/* 
-	Checks if register in-charge of branching is 0 (so 
-	conditional is false)
-*/
-void add_instr_for_while_middle(int src_reg1) {
-	beqzInstr(src_reg1, whileLabelStack->doneLabelStack[whileLabelStack->numLoops-1]);
-}
-
-//Jumps back up to while conditional
-void add_instr_for_while_end() {
-	int topOfStackIndex =  whileLabelStack->numLoops-1;
-
-	branch(whileLabelStack->startLabelStack[topOfStackIndex]);
-	add_instr_to_code_table(whileLabelStack->doneLabelStack[topOfStackIndex]);
-
-	//"Popping" the loop stack
-	whileLabelStack->numLoops--; 
-}
-
 /*
 	Puts down instructions that execute a logical OR. 
 
@@ -492,72 +264,72 @@ void add_instr_for_and(int dest_reg, int src_reg1, int src_reg2) {
 
 // ==
 void add_instr_for_eq(int dest_reg, int src_reg1, int src_reg2) {
-	Instruction *eqInstr = setup_3op_instr(strdup("seq"), 
-		getRegStr(dest_reg), getRegStr(src_reg1), getRegStr(src_reg2));
-	add_instr_to_code_table(eqInstr);
+	Instruction eqInstr = setup_3op_instr("seq", 
+		reg_operand(dest_reg), reg_operand(src_reg1), reg_operand(src_reg2));
+	add_instr_to_code_table(&eqInstr);
 }
 
 // !=
 void add_instr_for_neq(int dest_reg, int src_reg1, int src_reg2) {
-	Instruction *neqInstr = setup_3op_instr(strdup("sne"), 
-		getRegStr(dest_reg), getRegStr(src_reg1), getRegStr(src_reg2));
-	add_instr_to_code_table(neqInstr);
+	Instruction neqInstr = setup_3op_instr("sne", 
+		reg_operand(dest_reg), reg_operand(src_reg1), reg_operand(src_reg2));
+	add_instr_to_code_table(&neqInstr);
 }
 
 // dest_reg=1 if src_reg1 < src_reg2, otherwise dest_reg=0
 void add_instr_for_less(int dest_reg, int src_reg1, int src_reg2) {
-	Instruction *lessInstr = setup_3op_instr(strdup("slt"), 
-		getRegStr(dest_reg), getRegStr(src_reg1), getRegStr(src_reg2));
-	add_instr_to_code_table(lessInstr);
+	Instruction lessInstr = setup_3op_instr("slt", 
+		reg_operand(dest_reg), reg_operand(src_reg1), reg_operand(src_reg2));
+	add_instr_to_code_table(&lessInstr);
 }
 
 // dest_reg=1 if src_reg1 <= src_reg2, otherwise dest_reg=0
 void add_instr_for_leq(int dest_reg, int src_reg1, int src_reg2) {
-	Instruction *leqInstr=setup_3op_instr(strdup("sle"), 
-		getRegStr(dest_reg), getRegStr(src_reg1), getRegStr(src_reg2));
-	add_instr_to_code_table(leqInstr);
+	Instruction leqInstr = setup_3op_instr("sle", 
+		reg_operand(dest_reg), reg_operand(src_reg1), reg_operand(src_reg2));
+	add_instr_to_code_table(&leqInstr);
 }
 
 // dest_reg=1 if src_reg1 > src_reg2, otherwise dest_reg=0
 void add_instr_for_great(int dest_reg, int src_reg1, int src_reg2) {
-	Instruction *greatInstr = setup_3op_instr(strdup("sgt"), 
-		getRegStr(dest_reg), getRegStr(src_reg1), getRegStr(src_reg2));
-	add_instr_to_code_table(greatInstr);
+	Instruction greatInstr = setup_3op_instr("sgt", 
+		reg_operand(dest_reg), reg_operand(src_reg1), reg_operand(src_reg2));
+	add_instr_to_code_table(&greatInstr);
 }
 
 // dest_reg=1 if src_reg1 >= src_reg2, otherwise dest_reg=0
 void add_instr_for_geq(int dest_reg, int src_reg1, int src_reg2) {
-	Instruction *geqInstr= setup_3op_instr(strdup("sge"), 
-		getRegStr(dest_reg), getRegStr(src_reg1), getRegStr(src_reg2));
-	add_instr_to_code_table(geqInstr);
+	Instruction geqInstr = setup_3op_instr("sge", 
+		reg_operand(dest_reg), reg_operand(src_reg1), reg_operand(src_reg2));
+	add_instr_to_code_table(&geqInstr);
 }
 
 // dest_reg = src_reg1 + src_reg2
 void add_instr_for_addition(int dest_reg, int src_reg1, int src_reg2) {
-	Instruction *addInstr = setup_3op_instr(strdup("add"), 
-		getRegStr(dest_reg), getRegStr(src_reg1), getRegStr(src_reg2));
-	add_instr_to_code_table(addInstr);
+	Instruction addInstr = setup_3op_instr("add", 
+		reg_operand(dest_reg), reg_operand(src_reg1), reg_operand(src_reg2));
+	add_instr_to_code_table(&addInstr);
 }
 
 // dest_reg = src_reg1 - src_reg2
 void add_instr_for_sub(int dest_reg, int src_reg1, int src_reg2) {
-	Instruction *subInstr = setup_3op_instr(strdup("sub"), 
-		getRegStr(dest_reg), getRegStr(src_reg1), getRegStr(src_reg2));
-	add_instr_to_code_table(subInstr);
+	Instruction subInstr = setup_3op_instr("sub", 
+		reg_operand(dest_reg), reg_operand(src_reg1), reg_operand(src_reg2));
+	add_instr_to_code_table(&subInstr);
 }
 
 // dest_reg = src_reg1*src_reg2
 void add_instr_for_mult(int dest_reg, int src_reg1, int src_reg2) {
-	Instruction *multInstr = setup_3op_instr(strdup("mulo"), 
-		getRegStr(dest_reg), getRegStr(src_reg1), getRegStr(src_reg2));
-	add_instr_to_code_table(multInstr);
+	Instruction multInstr = setup_3op_instr("mulo", 
+		reg_operand(dest_reg), reg_operand(src_reg1), reg_operand(src_reg2));
+	add_instr_to_code_table(&multInstr);
 }
 
 // dest_reg = src_reg1/src_reg2
 void add_instr_for_div(int dest_reg, int src_reg1, int src_reg2) {
-	Instruction *divInstr = setup_3op_instr(strdup("div"), 
-		getRegStr(dest_reg), getRegStr(src_reg1), getRegStr(src_reg2));
-	add_instr_to_code_table(divInstr);
+	Instruction divInstr = setup_3op_instr("div", 
+		reg_operand(dest_reg), reg_operand(src_reg1), reg_operand(src_reg2));
+	add_instr_to_code_table(&divInstr);
 }
 
 // dest_reg = ~src_reg1 (I'm assuming ~ is the same operator as !)
@@ -577,79 +349,173 @@ void add_instr_for_neg(int dest_reg, int src_reg1) {
 
 }
 
-// dest_reg = -src_reg1
-void add_instr_for_unarysub(int dest_reg, int src_reg1) {
-	Instruction *unSubInstr = setup_2op_instr(strdup("neg"), 
-		getRegStr(dest_reg), getRegStr(src_reg1));
-	add_instr_to_code_table(unSubInstr);
-}
+/*
+	dest_reg = src_reg1*k with adds, if k is a power of 2 or a sum of
+	two (like 10 = 8+2 = 2*(4+1)) that takes at most 4 of them. Every
+	partial result is between 0 and the product, so the adds trap on
+	overflow just where mulo would.
+	scratch_reg gets clobbered, and can't be src_reg1.
+	@return 0 if k isn't one of those (nothing is emitted then)
+*/
+int add_instr_for_mult_by_const(int dest_reg, int src_reg1, int k, int scratch_reg) {
+	if (k < 2) {
+		return 0;
+	}
+	int hi = 30;
+	while (!(k & (1 << hi))) {
+		hi--;
+	}
+	int rest = k - (1 << hi);
+	if ((rest & (rest-1)) != 0 || hi + (rest != 0) > 4) {
+		return 0;
+	}
 
-// Loads an immediate value (param immed) into a register (param dest_reg)
-void load_val_in_register(int dest_reg, int immed) {
-	int numDigits = snprintf(NULL, 0, "%d", immed);
-	char *immedString = malloc(numDigits+1);
-	sprintf(immedString, "%d", immed);
+	//k = 2^lo * (2^(hi-lo) + 1): double up to the bigger term, add
+	//src_reg1, then double what's left
+	int lo = hi;
+	int from = src_reg1;
+	if (rest != 0) {
+		lo = 0;
+		while (!(rest & (1 << lo))) {
+			lo++;
+		}
+		for (int i=lo; i < hi; i++) {
+			add_reg_op_instr("add", scratch_reg, from, from);
+			from = scratch_reg;
+		}
+		add_reg_op_instr("add", dest_reg, scratch_reg, src_reg1);
+		from = dest_reg;
+	}
+	for (int i=0; i < lo; i++) {
+		add_reg_op_instr("add", dest_reg, from, from);
+		from = dest_reg;
+	}
+	return 1;
+}
 
-	Instruction *liInstr = setup_2op_instr(strdup("li"), 
-		getRegStr(dest_reg), immedString);
+/*
+	Magic number and shift for dividing by d (d >= 3, not a power
+	of 2): the top half of x*magic, shifted right, is about x/d.
+	From Hacker's Delight, section 10-4.
+*/
+static void div_magic(int d, int *magic, int *shift) {
+	const unsigned int two31 = 0x80000000u;
+	unsigned int ad = d;
+	unsigned int anc = two31 - 1 - two31%ad; //Absolute value of nc
+	int p = 31;
+	unsigned int q1 = two31/anc, r1 = two31 - q1*anc; //2^p/|nc| and its remainder
+	unsigned int q2 = two31/ad, r2 = two31 - q2*ad; //2^p/|d| and its remainder
+	unsigned int delta;
+
+	do {
+		p++;
+		q1 *= 2;
+		r1 *= 2;
+		if (r1 >= anc) {
+			q1++;
+			r1 -= anc;
+		}
+		q2 *= 2;
+		r2 *= 2;
+		if (r2 >= ad) {
+			q2++;
+			r2 -= ad;
+		}
+		delta = ad - r2;
+	} while (q1 < delta || (q1 == delta && r1 == 0));
 
-	add_instr_to_code_table(liInstr);
+	*magic = (int)(q2 + 1);
+	*shift = p - 32;
 }
 
-//Prints the code table to a given file (param out)
-void output_code_table_to_file(FILE *out) {
-	for (int i=0; i < codeTable->numInstructions; i++) {
-
-		if (codeTable->instrSet[i]->command != NULL) {
-			fprintf(out, "%s ", codeTable->instrSet[i]->command);
+/*
+	dest_reg = src_reg1/k without a div: shifts for powers of 2, and a
+	multiply by a magic number otherwise. Rounds towards 0, like div.
+	scratch_reg gets clobbered, and can't be src_reg1.
+	@return 0 if k is 0 or INT_MIN (nothing is emitted then)
+*/
+int add_instr_for_div_by_const(int dest_reg, int src_reg1, int k, int scratch_reg) {
+	if (k == 0 || k == INT_MIN) {
+		return 0;
+	}
+	int magnitude = k < 0 ? -k : k;
+
+	if (magnitude == 1) {
+		move_registers(dest_reg, src_reg1);
+	} else if ((magnitude & (magnitude-1)) == 0) {
+		//Negative numbers get 2^shift - 1 added first, so the shift rounds towards 0
+		int shift = 0;
+		while ((1 << shift) != magnitude) {
+			shift++;
 		}
-
-		if (codeTable->instrSet[i]->op1 != NULL) {
-			fprintf(out, "%s", codeTable->instrSet[i]->op1);
+		if (shift == 1) {
+			add_immed_op_instr("srl", scratch_reg, src_reg1, 31);
+		} else {
+			add_immed_op_instr("sra", scratch_reg, src_reg1, 31);
+			add_immed_op_instr("srl", scratch_reg, scratch_reg, 32-shift);
 		}
-
-		if (codeTable->instrSet[i]->op2 != NULL) {
-			fprintf(out, ", %s", codeTable->instrSet[i]->op2);
+		add_reg_op_instr("addu", scratch_reg, src_reg1, scratch_reg);
+		add_immed_op_instr("sra", dest_reg, scratch_reg, shift);
+	} else {
+		int magic, shift;
+		div_magic(magnitude, &magic, &shift);
+		load_val_in_register(scratch_reg, magic);
+		Instruction multInstr = setup_2op_instr("mult", reg_operand(src_reg1), reg_operand(scratch_reg));
+		add_instr_to_code_table(&multInstr);
+		Instruction mfhiInstr = { "mfhi", reg_operand(scratch_reg) };
+		add_instr_to_code_table(&mfhiInstr);
+		if (magic < 0) {
+			add_reg_op_instr("addu", scratch_reg, scratch_reg, src_reg1);
 		}
-
-		if (codeTable->instrSet[i]->op3 != NULL) {
-			fprintf(out, ", %s", codeTable->instrSet[i]->op3);
+		if (shift > 0) {
+			add_immed_op_instr("sra", scratch_reg, scratch_reg, shift);
 		}
+		//+1 for negative numbers, so it rounds towards 0 (src_reg1 is read for the last time here)
+		add_immed_op_instr("srl", dest_reg, src_reg1, 31);
+		add_reg_op_instr("addu", dest_reg, scratch_reg, dest_reg);
+	}
 
-		fprintf(out, "\n");
+	if (k < 0) {
+		add_reg_op_instr("subu", dest_reg, ZERO, dest_reg);
 	}
+	return 1;
 }
 
-//Frees up heap memory used for the code table
-void destroy_code_table() {
-	//Free space used by nested loop supports
-	free(whileLabelStack->startLabelStack);
-	free(whileLabelStack->doneLabelStack);
-	free(whileLabelStack);	
-
-	//Frees the actual code table
-	for (int i=0; i < codeTable->numInstructions; i++) {
-		if (codeTable->instrSet[i]->command != NULL) {
-			free(codeTable->instrSet[i]->command);
-		}
+// dest_reg = -src_reg1
+void add_instr_for_unarysub(int dest_reg, int src_reg1) {
+	Instruction unSubInstr = setup_2op_instr("neg", 
+		reg_operand(dest_reg), reg_operand(src_reg1));
+	add_instr_to_code_table(&unSubInstr);
+}
 
-		if (codeTable->instrSet[i]->op1 != NULL) {
-			free(codeTable->instrSet[i]->op1);
-		}
+// Loads an immediate value (param immed) into a register (param dest_reg)
+void load_val_in_register(int dest_reg, int immed) {
+	Instruction liInstr = setup_2op_instr("li", 
+		reg_operand(dest_reg), immed_operand(immed));
 
-		if (codeTable->instrSet[i]->op2 != NULL) {
-			free(codeTable->instrSet[i]->op2);
-		}
+	add_instr_to_code_table(&liInstr);
+}
 
-		if (codeTable->instrSet[i]->op3 != NULL) {
-			free(codeTable->instrSet[i]->op3);
-		}				
-		
-		free(codeTable->instrSet[i]);
+/*
+	Prints the code table to a given file (param out). The formatting
+	is done by asmwriter.c, straight into a big buffer.
+	@return number of bytes written
+*/
+size_t output_code_table_to_file(FILE *out) {
+	return write_instructions(out, codeTable->instrSet, codeTable->numInstructions);
+}
 
+//Frees up heap memory used for the code table (if it's been made yet)
+void destroy_code_table() {
+	if (codeTable == NULL) {
+		return;
 	}
+
+	//Operands all live in the arena
 	free(codeTable->instrSet);
+	release_arena(&codeTable->arena);
 	free(codeTable);
+	codeTable = NULL;
 }
 
 /* 
@@ -657,13 +523,10 @@ void destroy_code_table() {
 	lw dest_reg, addr_offset(src_reg1)
 */
 void load_word_instr(int dest_reg, int addr_offset, int src_reg1) {
-	//Set-up the register address
-	char *tempAddrStorage = generate_store_and_load_addr(addr_offset, src_reg1);
-
-	Instruction *loadInstr = setup_2op_instr(strdup("lw"), 
-		getRegStr(dest_reg), tempAddrStorage);
+	Instruction loadInstr = setup_2op_instr("lw", 
+		reg_operand(dest_reg), mem_operand(addr_offset, src_reg1));
 
-	add_instr_to_code_table(loadInstr);
+	add_instr_to_code_table(&loadInstr);
 }
 
 /*
@@ -672,12 +535,10 @@ void load_word_instr(int dest_reg, int addr_offset, int src_reg1) {
 	lb dest_reg, addr_offset(src_reg1)
 */
 void load_byte_instr(int dest_reg, int addr_offset, int src_reg1) {
-	char *tempAddrStorage = generate_store_and_load_addr(addr_offset, src_reg1);
+	Instruction loadInstr = setup_2op_instr("lb", 
+		reg_operand(dest_reg), mem_operand(addr_offset, src_reg1));
 
-	Instruction *loadInstr = setup_2op_instr(strdup("lb"), 
-		getRegStr(dest_reg), tempAddrStorage);
-
-	add_instr_to_code_table(loadInstr);
+	add_instr_to_code_table(&loadInstr);
 }
 
 /* 
@@ -686,12 +547,10 @@ void load_byte_instr(int dest_reg, int addr_offset, int src_reg1) {
 	la dest_reg, addr_offset(src_reg1)
 */
  void load_reg_address_instr(int dest_reg, int addr_offset, int src_reg1) {
-	char *tempAddrStorage = generate_store_and_load_addr(addr_offset, src_reg1);
-
-	Instruction *loadInstr = setup_2op_instr(strdup("la"), 
-		getRegStr(dest_reg), tempAddrStorage);
+	Instruction loadInstr = setup_2op_instr("la", 
+		reg_operand(dest_reg), mem_operand(addr_offset, src_reg1));
 
-	add_instr_to_code_table(loadInstr);
+	add_instr_to_code_table(&loadInstr);
 }
 
 /*
@@ -699,12 +558,10 @@ void load_byte_instr(int dest_reg, int addr_offset, int src_reg1) {
 	sw src_reg1, addr_offset(src_reg2)
 */
  void store_word_instr(int src_reg1, int addr_offset, int src_reg2) {
-	char *tempAddrStorage = generate_store_and_load_addr(addr_offset, src_reg2);
+	Instruction storeInstr = setup_2op_instr("sw",
+		reg_operand(src_reg1), mem_operand(addr_offset, src_reg2));
 
-	Instruction *storeInstr = setup_2op_instr(strdup("sw"),
-		getRegStr(src_reg1), tempAddrStorage);
-
-	add_instr_to_code_table(storeInstr);
+	add_instr_to_code_table(&storeInstr);
 }
 
 /* 
@@ -713,11 +570,9 @@ void load_byte_instr(int dest_reg, int addr_offset, int src_reg1) {
 	sb src_reg1, addr_offset(src_reg2)
 */
 void store_byte_instr(int src_reg1, int addr_offset, int src_reg2) {
-	char *tempAddrStorage = generate_store_and_load_addr(addr_offset, src_reg2);
-
-	Instruction *storeInstr = setup_2op_instr(strdup("sb"), 
-		getRegStr(src_reg1), tempAddrStorage);
+	Instruction storeInstr = setup_2op_instr("sb", 
+		reg_operand(src_reg1), mem_operand(addr_offset, src_reg2));
 
-	add_instr_to_code_table(storeInstr);
+	add_instr_to_code_table(&storeInstr);
 }
 
@@ -0,0 +1,518 @@
+/*
+	unroll: copies the body of tight counted loops, so the compare,
+	branch and jump back are paid once for several iterations.
+
+	A loop is taken on if it's just a header doing the test and one
+	block doing the rest, like while (i < n) { ...; i = i + 1; }:
+	- i is an int param/local the body changes exactly once, by i = i + c
+	- the test is i < n or i <= n (i > n or i >= n when c is negative),
+	  with n a constant or worked out from variables the loop doesn't
+	  change
+
+	If i's value going in is a constant, and so is n, the number of
+	trips is known: when it's small enough (-unroll-full-max) the loop
+	goes altogether and the body is written out that many times in a
+	row (constprop then has a constant for every i).
+
+	Otherwise the body is copied k times (-unroll-count, fewer if the
+	copies would pass -unroll-max-size instructions) into a new loop
+	that's only entered while there are k trips to go, i.e. while
+	i < n - (k-1)*c. The old loop stays behind it to do the last few.
+	Bodies with calls in aren't worth it (the call costs much more than
+	the loop around it) and are left alone.
+	n - (k-1)*c is worked out once before the loops - if n is so near
+	the end of the int range that that would overflow, the new loop
+	is skipped. When the trip count is known to be a multiple of k the
+	old loop isn't needed at all.
+
+	This runs before ivreduce, which would otherwise have turned the
+	test into a pointer compare.
+
+	@author Noor Aftab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "passmanager.h"
+#include "loops.h"
+#include "lexer.h"
+
+//What's been worked out about the loop being looked at
+typedef struct {
+	IrBlock *preheader;
+	IrBlock *header;
+	IrBlock *body;
+	IrBlock *exit;
+	IrOpcode cond; //Looping goes on while (i cond bound)
+	IrVar *iv;
+	int step;
+	IrOperand bound;
+	int size; //Instructions in the body (not counting the jump back)
+	int tripsKnown;
+	long long trips;
+} CountedLoop;
+
+//The function being worked on
+static IrFunction *func;
+static IrBlock **defBlock; //By vreg: where it's defined
+static char *badVreg; //By vreg: defined more than once, or read outside its block
+static int numScanned; //vregs the above cover
+
+//For -stats
+static int numFull;
+static int numPartial;
+
+static void unroll_in_function();
+static int unroll_next_loop();
+static int match_counted_loop(IrLoop *loop, CountedLoop *cl);
+static IrVar *iv_read_by(IrOperand opnd, CountedLoop *cl);
+static int match_increment(CountedLoop *cl);
+static int body_is_self_contained(CountedLoop *cl);
+static int is_invariant(IrOperand opnd, CountedLoop *cl);
+static void find_trip_count(CountedLoop *cl);
+static int start_value(CountedLoop *cl, int *start);
+static void unroll_fully(CountedLoop *cl);
+static int unroll_partly(CountedLoop *cl);
+static void copy_instrs(IrBlock *from, IrBlock *to, int *vregMap);
+static IrBlock *new_block_after(IrBlock *pos);
+static void scan_vregs();
+static int stored_in_body(CountedLoop *cl, IrVar *var);
+static int body_has_calls(CountedLoop *cl);
+
+void unroll_loops(IrProgram *prog) {
+	numFull = numPartial = 0;
+
+	for (func = prog->functions; func != NULL; func = func->next) {
+		unroll_in_function();
+	}
+
+	if (printStats) {
+		fprintf(stderr, "unroll: %d loops fully unrolled, %d unrolled with a remainder loop\n",
+			numFull, numPartial);
+	}
+}
+
+static void unroll_in_function() {
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		block->mark = 0;
+	}
+	//Every change adds blocks, so the loops are found again each time
+	while (unroll_next_loop())
+		;
+	//(simplifycfg.c counts on finding every mark 0)
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		block->mark = 0;
+	}
+}
+
+//@return 1 if a loop was unrolled
+static int unroll_next_loop() {
+	LoopInfo *info = find_loops(func);
+	scan_vregs();
+
+	int changed = 0;
+	for (IrLoop *loop = info->loops; loop != NULL && !changed; loop = loop->next) {
+		CountedLoop cl;
+		if (loop->header->mark || !match_counted_loop(loop, &cl)) {
+			continue;
+		}
+		loop->header->mark = 1; //(never looked at again, whatever happens)
+
+		find_trip_count(&cl);
+		if (cl.tripsKnown && cl.trips <= unrollFullMax
+			&& cl.trips * cl.size <= unrollMaxSize) {
+			unroll_fully(&cl);
+			numFull++;
+			changed = 1;
+		} else if (unroll_partly(&cl)) {
+			numPartial++;
+			changed = 1;
+		}
+	}
+
+	free(defBlock);
+	free(badVreg);
+	free_loop_info(info);
+	if (changed) {
+		ir_rebuild_cfg(func);
+	}
+	return changed;
+}
+
+/** Recognising counted loops **/
+
+static int match_counted_loop(IrLoop *loop, CountedLoop *cl) {
+	if (loop->numBlocks != 2 || loop->preheader->last->op != IR_JUMP) {
+		return 0;
+	}
+	cl->preheader = loop->preheader;
+	cl->header = loop->header;
+	cl->body = loop->blocks[0] == loop->header ? loop->blocks[1] : loop->blocks[0];
+
+	IrInstr *test = cl->header->last;
+	if (test->op != IR_CBR || cl->body->last->op != IR_JUMP
+		|| cl->body->last->target[0] != cl->header) {
+		return 0;
+	}
+	//The header only works out the test
+	for (IrInstr *instr = cl->header->first; instr != test; instr = instr->next) {
+		if (ir_has_side_effects(instr) || instr->op == IR_LOAD
+			|| (instr->dest != -1 && badVreg[instr->dest])) {
+			return 0;
+		}
+	}
+
+	//Carrying on is the true side
+	cl->cond = test->cond;
+	if (test->target[0] == cl->body && test->target[1] != cl->body) {
+		cl->exit = test->target[1];
+	} else if (test->target[1] == cl->body && test->target[0] != cl->body) {
+		cl->exit = test->target[0];
+		cl->cond = ir_invert_cond(cl->cond);
+	} else {
+		return 0;
+	}
+
+	//i on the left (swapping the compare round if it's on the right)
+	cl->bound = test->src2;
+	cl->iv = iv_read_by(test->src1, cl);
+	if (cl->iv == NULL || !match_increment(cl)) {
+		cl->cond = ir_swap_cond(cl->cond);
+		cl->bound = test->src1;
+		cl->iv = iv_read_by(test->src2, cl);
+		if (cl->iv == NULL || !match_increment(cl)) {
+			return 0;
+		}
+	}
+
+	//Counting towards the bound
+	if (cl->step > 0 ? cl->cond != IR_SLT && cl->cond != IR_SLE
+		: cl->cond != IR_SGT && cl->cond != IR_SGE) {
+		return 0;
+	}
+	return is_invariant(cl->bound, cl) && body_is_self_contained(cl);
+}
+
+//The var opnd is an ldvar of, if it could be a counter (a scalar int param/local)
+static IrVar *iv_read_by(IrOperand opnd, CountedLoop *cl) {
+	if (opnd.kind != IRO_VREG) {
+		return NULL;
+	}
+	for (IrInstr *instr = cl->header->first; instr != NULL; instr = instr->next) {
+		if (instr->dest == opnd.val) {
+			IrVar *var = instr->var;
+			return instr->op == IR_LDVAR && var->kind != VAR_GLOBAL && var->type == INTTOK
+				&& var->dimension == -1 && !var->isPointer ? var : NULL;
+		}
+	}
+	return NULL;
+}
+
+//Does the body store cl->iv just once, as iv = iv + c (setting step to c)?
+static int match_increment(CountedLoop *cl) {
+	IrInstr *store = NULL;
+	for (IrInstr *instr = cl->body->first; instr != NULL; instr = instr->next) {
+		if (instr->op == IR_STVAR && instr->var == cl->iv) {
+			if (store != NULL) {
+				return 0;
+			}
+			store = instr;
+		}
+	}
+	if (store == NULL || store->src1.kind != IRO_VREG) {
+		return 0;
+	}
+
+	IrInstr *add = NULL, *load = NULL;
+	for (IrInstr *instr = cl->body->first; instr != store; instr = instr->next) {
+		if (instr->dest == store->src1.val) {
+			add = instr;
+		}
+	}
+	if (add == NULL || (add->op != IR_ADD && add->op != IR_SUB)) {
+		return 0;
+	}
+	IrOperand var = add->src1, amount = add->src2;
+	if (add->op == IR_ADD && amount.kind != IRO_IMM) {
+		var = add->src2;
+		amount = add->src1;
+	}
+	for (IrInstr *instr = cl->body->first; instr != add && var.kind == IRO_VREG; instr = instr->next) {
+		if (instr->dest == var.val) {
+			load = instr;
+		}
+	}
+	if (amount.kind != IRO_IMM || amount.val == 0 || load == NULL || load->op != IR_LDVAR
+		|| load->var != cl->iv) {
+		return 0;
+	}
+	cl->step = add->op == IR_ADD ? amount.val : -amount.val;
+	return 1;
+}
+
+//Is everything the body works out only read in the body, after it's worked out?
+static int body_is_self_contained(CountedLoop *cl) {
+	char *defined = calloc(numScanned > 0 ? numScanned : 1, 1);
+	int ok = 1;
+	cl->size = 0;
+	for (IrInstr *instr = cl->body->first; instr != cl->body->last && ok; instr = instr->next) {
+		IrOperand *uses[IR_MAX_USES];
+		int numUses = ir_get_uses(instr, uses);
+		for (int i=0; i < numUses; i++) {
+			int v = uses[i]->val;
+			if (uses[i]->kind == IRO_VREG && defBlock[v] == cl->body && !defined[v]) {
+				ok = 0;
+			}
+		}
+		if (instr->dest != -1) {
+			ok = ok && !badVreg[instr->dest];
+			defined[instr->dest] = 1;
+		}
+		cl->size++;
+	}
+	free(defined);
+	return ok;
+}
+
+//Is opnd the same every time round (a constant, or worked out in the header from those)?
+static int is_invariant(IrOperand opnd, CountedLoop *cl) {
+	if (opnd.kind == IRO_IMM) {
+		return 1;
+	}
+	if (opnd.kind != IRO_VREG || defBlock[opnd.val] != cl->header) {
+		return 0;
+	}
+	IrInstr *def = cl->header->first;
+	while (def->dest != opnd.val) {
+		def = def->next;
+	}
+
+	switch (def->op) {
+		case IR_LDVAR:
+			//(a call could change a global)
+			return def->var != cl->iv && !stored_in_body(cl, def->var)
+				&& (def->var->kind != VAR_GLOBAL || !body_has_calls(cl));
+		case IR_ADDR:
+			return 1;
+		case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV:
+		case IR_SEQ: case IR_SNE: case IR_SLT: case IR_SLE: case IR_SGT: case IR_SGE:
+		case IR_LAND: case IR_LOR: case IR_NEG: case IR_NOT: case IR_MOV:
+			return is_invariant(def->src1, cl)
+				&& (def->src2.kind == IRO_NONE || is_invariant(def->src2, cl));
+		default:
+			return 0;
+	}
+}
+
+//Known if i starts at a constant and the bound is one
+static void find_trip_count(CountedLoop *cl) {
+	int start;
+	cl->tripsKnown = cl->bound.kind == IRO_IMM && start_value(cl, &start);
+	if (!cl->tripsKnown) {
+		return;
+	}
+
+	long long i = start, bound = cl->bound.val;
+	switch (cl->cond) {
+		case IR_SLT: cl->trips = i < bound ? (bound - i + cl->step - 1) / cl->step : 0; break;
+		case IR_SLE: cl->trips = i <= bound ? (bound - i) / cl->step + 1 : 0; break;
+		case IR_SGT: cl->trips = i > bound ? (i - bound - cl->step - 1) / -cl->step : 0; break;
+		default: cl->trips = i >= bound ? (i - bound) / -cl->step + 1 : 0; break;
+	}
+	//The last i = i + c would overflow (trap), so leave that to the loop
+	long long last = i + cl->trips * cl->step;
+	if (last > INT_MAX || last < INT_MIN) {
+		cl->tripsKnown = 0;
+	}
+}
+
+//The constant stored into i last thing before the loop, found going back up through blocks
+//with just the one way in
+static int start_value(CountedLoop *cl, int *start) {
+	IrBlock *block = cl->preheader;
+	for (int depth=0; depth < 8; depth++) {
+		for (IrInstr *instr = block->last; instr != NULL; instr = instr->prev) {
+			if (instr->op == IR_STVAR && instr->var == cl->iv) {
+				*start = instr->src1.val;
+				return instr->src1.kind == IRO_IMM;
+			}
+		}
+		if (block->numPreds != 1 || block == func->entry) {
+			return 0;
+		}
+		block = block->preds[0];
+	}
+	return 0;
+}
+
+/** Unrolling **/
+
+//The loop's replaced by trips copies of the body, one after the other
+static void unroll_fully(CountedLoop *cl) {
+	IrBlock *straight = new_block_after(cl->preheader);
+	int *vregMap = malloc((func->numVregs + 1) * sizeof(int));
+	for (long long t=0; t < cl->trips; t++) {
+		copy_instrs(cl->body, straight, vregMap);
+	}
+	free(vregMap);
+	ir_emit_jump(straight, cl->exit);
+
+	cl->preheader->last->target[0] = straight;
+	ir_remove_block(cl->header);
+	ir_remove_block(cl->body);
+}
+
+/*
+	preheader -> [guard: is bound too near the end of the range?
+	              -> limit = bound - (k-1)*c] -> main loop -> old loop
+	@return 0 if it wasn't worth it (or possible)
+*/
+static int unroll_partly(CountedLoop *cl) {
+	int k = unrollCount;
+	if (k * cl->size > unrollMaxSize) {
+		k = unrollMaxSize / (cl->size > 0 ? cl->size : 1);
+	}
+	//A call costs far more than going round the loop does
+	if (k < 2 || (cl->tripsKnown && cl->trips < k) || body_has_calls(cl)) {
+		return 0;
+	}
+	long long extra = (long long)(k-1) * cl->step;
+	if (extra > INT_MAX/2 || extra < -(INT_MAX/2) || (cl->bound.kind == IRO_IMM
+		&& (cl->bound.val - extra > INT_MAX || cl->bound.val - extra < INT_MIN))) {
+		return 0;
+	}
+	int *vregMap = malloc((func->numVregs + 1) * sizeof(int));
+
+	IrBlock *pos = cl->preheader;
+	IrBlock *mainHeader = new_block_after(cl->preheader);
+	IrOperand limit = ir_imm(cl->bound.val - extra);
+	if (cl->bound.kind == IRO_VREG) {
+		//The bound's worked out (once) the way the header does it
+		IrBlock *guard = new_block_after(cl->preheader);
+		IrBlock *setLimit = new_block_after(guard);
+		copy_instrs(cl->header, guard, vregMap);
+		int bound = vregMap[cl->bound.val];
+		if (cl->step > 0) {
+			ir_emit_cbr(guard, IR_SLT, ir_vreg(bound), ir_imm(INT_MIN + extra),
+				cl->header, setLimit);
+		} else {
+			ir_emit_cbr(guard, IR_SGT, ir_vreg(bound), ir_imm(INT_MAX + extra),
+				cl->header, setLimit);
+		}
+
+		IrVar *limitVar = ir_add_local(func, "unroll.limit", INTTOK, -1);
+		int diff = ir_emit_binary(setLimit, IR_SUB, ir_vreg(bound), ir_imm(extra));
+		ir_emit_stvar(setLimit, limitVar, ir_vreg(diff));
+		ir_emit_jump(setLimit, mainHeader);
+		limit = ir_vreg(ir_emit_ldvar(mainHeader, limitVar));
+		pos = guard;
+	}
+	cl->preheader->last->target[0] = pos == cl->preheader ? mainHeader : pos;
+
+	//A multiple of k trips leaves nothing for the old loop
+	int keepOld = !cl->tripsKnown || cl->trips % k != 0;
+	IrBlock *mainBody = new_block_after(mainHeader);
+	int i = ir_emit_ldvar(mainHeader, cl->iv);
+	ir_emit_cbr(mainHeader, cl->cond, ir_vreg(i), limit, mainBody,
+		keepOld ? cl->header : cl->exit);
+	for (int copy=0; copy < k; copy++) {
+		copy_instrs(cl->body, mainBody, vregMap);
+	}
+	ir_emit_jump(mainBody, mainHeader);
+	mainHeader->mark = 1;
+
+	if (!keepOld) {
+		ir_remove_block(cl->header);
+		ir_remove_block(cl->body);
+	}
+	free(vregMap);
+	return 1;
+}
+
+/*
+	Appends a copy of from's instructions (not its terminator) to to.
+	Vregs defined in from get new ones (vregMap says which), ones from
+	outside it are read as they are.
+*/
+static void copy_instrs(IrBlock *from, IrBlock *to, int *vregMap) {
+	for (IrInstr *instr = from->first; instr != from->last; instr = instr->next) {
+		IrInstr *copy = ir_new_instr(func, instr->op);
+		*copy = *instr;
+		copy->mark = 0;
+		copy->block = NULL;
+		copy->prev = copy->next = NULL;
+		if (instr->op == IR_CALL) {
+			copy->args = arena_alloc(&func->prog->arena, IR_MAX_ARGS*sizeof(IrOperand));
+			memcpy(copy->args, instr->args, instr->numArgs*sizeof(IrOperand));
+		}
+
+		IrOperand *uses[IR_MAX_USES];
+		int numUses = ir_get_uses(copy, uses);
+		for (int i=0; i < numUses; i++) {
+			if (uses[i]->kind == IRO_VREG && uses[i]->val < numScanned
+				&& defBlock[uses[i]->val] == from) {
+				uses[i]->val = vregMap[uses[i]->val];
+			}
+		}
+		if (instr->dest != -1) {
+			copy->dest = ir_new_vreg(func, func->vregTypes[instr->dest]);
+			vregMap[instr->dest] = copy->dest;
+		}
+		ir_append(to, copy);
+	}
+}
+
+static IrBlock *new_block_after(IrBlock *pos) {
+	IrBlock *block = ir_new_block(func);
+	ir_move_block_after(block, pos);
+	return block;
+}
+
+/** Helpers **/
+
+//Where each vreg is defined, and which ones it isn't safe to copy blocks around
+static void scan_vregs() {
+	numScanned = func->numVregs;
+	defBlock = calloc(numScanned > 0 ? numScanned : 1, sizeof(IrBlock *));
+	badVreg = calloc(numScanned > 0 ? numScanned : 1, 1);
+
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			if (instr->dest != -1) {
+				badVreg[instr->dest] |= defBlock[instr->dest] != NULL;
+				defBlock[instr->dest] = block;
+			}
+		}
+	}
+	for (IrBlock *block = func->entry; block != NULL; block = block->next) {
+		for (IrInstr *instr = block->first; instr != NULL; instr = instr->next) {
+			IrOperand *uses[IR_MAX_USES];
+			int numUses = ir_get_uses(instr, uses);
+			for (int i=0; i < numUses; i++) {
+				if (uses[i]->kind == IRO_VREG && defBlock[uses[i]->val] != block) {
+					badVreg[uses[i]->val] = 1;
+				}
+			}
+		}
+	}
+}
+
+static int stored_in_body(CountedLoop *cl, IrVar *var) {
+	for (IrInstr *instr = cl->body->first; instr != NULL; instr = instr->next) {
+		if (instr->op == IR_STVAR && instr->var == var) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int body_has_calls(CountedLoop *cl) {
+	for (IrInstr *instr = cl->body->first; instr != NULL; instr = instr->next) {
+		if (instr->op == IR_CALL) {
+			return 1;
+		}
+	}
+	return 0;
+}
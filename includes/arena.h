@@ -0,0 +1,37 @@
+/*
+	Header file for arena.c!
+
+	An arena hands out memory from big blocks instead of calling
+	malloc for every little thing, and gives all of it back in one
+	go when we're done. The code table uses one so it doesn't have
+	to malloc (and later free) every single instruction and operand.
+
+	@author Noor Aftab
+*/
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+//Size of a regular arena block, in bytes (bigger requests get their own)
+#define ARENA_BLOCK_SIZE (64*1024)
+
+typedef struct ArenaBlock {
+	struct ArenaBlock *next;
+	size_t used;
+	size_t size;
+	char data[];
+} ArenaBlock;
+
+typedef struct {
+	ArenaBlock *head; //Block we're currently handing memory out from
+} Arena;
+
+extern void init_arena(Arena *arena);
+extern void *arena_alloc(Arena *arena, size_t size);
+extern char *arena_strdup(Arena *arena, const char *str);
+//Frees every block the arena owns - everything it handed out dies with it
+extern void release_arena(Arena *arena);
+
+#endif
@@ -0,0 +1,23 @@
+/*
+	Header file for asmwriter.c!
+
+	Turns the code table's instructions into .s text. Instead of a 
+	few fprintf calls per instruction, everything is formatted by
+	hand into one big buffer that gets fwrite-d out in large chunks.
+
+	@author Noor Aftab
+*/
+
+#ifndef _ASMWRITER_H
+#define _ASMWRITER_H
+
+#include <stdio.h>
+#include "tablemechanics.h"
+
+//Size of the output buffer, in bytes
+#define ASM_BUFFER_SIZE (1 << 20)
+
+//Writes num instructions to out, returns how many bytes were written
+extern size_t write_instructions(FILE *out, Instruction *instrs, int num);
+
+#endif
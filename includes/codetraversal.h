@@ -2,23 +2,20 @@
 #ifndef _CODETRAVERSAL_H
 #define _CODETRAVERSAL_H
 
-typedef struct {
-	int numOffsets;
-	int *stack;
-} OffsetStack;
+#include "ir.h"
 
-extern OffsetStack *offsetStack;
+//The IR being built, and where we are in it
+extern IrProgram *irProgram;
+extern IrFunction *currFunc;
+extern IrBlock *currBlock;
+extern IrBlock *breakTarget; //NULL if not in a while loop
 
-//1 is break is encountered
-extern int breakOccured; 
-//1 if return is enocuntered
-extern int returnOccured;
-extern int funcOffset;   //Within a function
 extern int globalOffset; //How many globals
-extern int currScope;  
+extern int currScope;
+extern int currBlockScope; //Id of the block locals are being declared in
 
-//Kickstars traversal
-extern void traverse_and_generate_code();
+//Kickstars traversal - returns the IR for the whole program
+extern IrProgram *traverse_and_generate_ir();
 
 /*
 	Functions only codegen needs for traversing. Not in the codegen.h
@@ -45,25 +42,25 @@ void handle_else(ast_node *elseNode);
 void handle_while(ast_node *whileNode);
 
 //Functions for handling expressions, and operators in expressions
-extern int handle_expr(ast_node *exprNode);
-int handle_assign(ast_node *assignNode);
-int handle_or(ast_node *orNode);
-int handle_and(ast_node *andNode);
-int handle_equal(ast_node *eqNode);
-int handle_not_equal(ast_node *neqNode);
-int handle_less(ast_node *lessNode);
-int handle_less_or_equal(ast_node *leqNode);
-int handle_greater(ast_node *greaterNode);
-int handle_greater_or_equal(ast_node *geqNode);
-int handle_add(ast_node *addNode);
-int handle_subtraction(ast_node *subNode);
-int handle_multiplication(ast_node *multNode);
-int handle_division(ast_node *divNode);
-int handle_negation(ast_node *negNode);
-int handle_num(ast_node *numNode);
+extern IrOperand handle_expr(ast_node *exprNode);
+IrOperand handle_assign(ast_node *assignNode);
+IrOperand handle_or(ast_node *orNode);
+IrOperand handle_and(ast_node *andNode);
+IrOperand handle_equal(ast_node *eqNode);
+IrOperand handle_not_equal(ast_node *neqNode);
+IrOperand handle_less(ast_node *lessNode);
+IrOperand handle_less_or_equal(ast_node *leqNode);
+IrOperand handle_greater(ast_node *greaterNode);
+IrOperand handle_greater_or_equal(ast_node *geqNode);
+IrOperand handle_add(ast_node *addNode);
+IrOperand handle_subtraction(ast_node *subNode);
+IrOperand handle_multiplication(ast_node *multNode);
+IrOperand handle_division(ast_node *divNode);
+IrOperand handle_negation(ast_node *negNode);
+IrOperand handle_num(ast_node *numNode);
 
-int handle_id(ast_node *idNode);
-extern void handle_expression_list(ast_node *elNode, int numParams); 
+IrOperand handle_id(ast_node *idNode);
+extern void handle_expression_list(ast_node *elNode, int numParams, IrOperand *args);
 
 
 #endif
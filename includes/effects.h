@@ -0,0 +1,44 @@
+/*
+	Header file for effects.c!
+
+	Works out what calling each function can do, following calls of
+	calls through the whole program: which globals it reads and
+	writes, whether it reads or writes arrays other than its own
+	locals (global ones, or ones passed in), whether it does any
+	I/O, and whether it's sure to come back. Passes use it to keep
+	what they know across calls that can't change it, and to treat
+	calls with no effects like any other instruction.
+
+	@author Noor Aftab
+*/
+
+#ifndef _EFFECTS_H
+#define _EFFECTS_H
+
+#include "ir.h"
+
+typedef struct {
+	char *readsGlobal; //By global id
+	char *writesGlobal;
+	int readsMemory; //Loads from an array that isn't one of its own locals
+	int writesMemory; //...and stores into one
+	int doesIo; //read, write or writeln
+	int alwaysReturns; //No loops or recursion in it or anything it calls
+} FuncEffects;
+
+typedef struct {
+	IrFunction **functions;
+	FuncEffects *effects; //Same order as functions
+	int numFunctions;
+	int numGlobals;
+} EffectsInfo;
+
+extern EffectsInfo *find_effects(IrProgram *prog);
+extern void free_effects(EffectsInfo *info);
+extern FuncEffects *effects_of(EffectsInfo *info, IrFunction *f);
+//Calling it changes nothing but the result it returns
+extern int is_pure(EffectsInfo *info, FuncEffects *effects);
+//...and the result only depends on the args
+extern int is_const(EffectsInfo *info, FuncEffects *effects);
+
+#endif
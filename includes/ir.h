@@ -0,0 +1,234 @@
+/*
+	Header file for ir.c (and irprint.c/irverify.c)!
+
+	The IR sits between codetraversal.c and the code table. Each
+	function becomes a list of basic blocks holding three-address
+	instructions on virtual registers (vregs), and the blocks are
+	linked into a control-flow graph. Optimisation passes work on
+	this, and irtotable.c lowers it into MIPS at the very end.
+
+	Variables (globals, params, locals) are not vregs - they live in
+	memory and are read/written with LDVAR/STVAR, so passes can
+	still reason about them by name.
+
+	@author Noor Aftab
+*/
+
+#ifndef _IR_H
+#define _IR_H
+
+#include <stdio.h>
+#include "arena.h"
+
+//What a vreg holds - a plain integer, or an address (array base + offset)
+typedef enum {
+	VT_INT, VT_ADDR
+} VregType;
+
+typedef enum {
+	//dest = src1 op src2
+	IR_ADD, IR_SUB, IR_MUL, IR_DIV,
+	IR_SEQ, IR_SNE, IR_SLT, IR_SLE, IR_SGT, IR_SGE,
+	IR_LAND, IR_LOR, //Logical && and || (both sides already evaluated)
+
+	//dest = op src1
+	IR_NEG, IR_NOT, IR_MOV,
+
+	IR_LDVAR, //dest = var
+	IR_STVAR, //var = src1
+	IR_ADDR, //dest = address of (array) var
+	IR_LOAD, //dest = width bytes at [src1 + offset]
+	IR_STORE, //width bytes at [src1 + offset] = src2
+	IR_CALL, //dest = callee(args)
+
+	IR_READ, //dest = integer read in
+	IR_WRITE, //prints src1
+	IR_WRITELN,
+
+	//Terminators - always (and only) the last instruction of a block
+	IR_JUMP, //goto target[0]
+	IR_CBR, //if (src1 cond src2) goto target[0] else goto target[1]
+	IR_RET, //return src1 (src1 may be unused)
+
+	NUM_IR_OPCODES
+} IrOpcode;
+
+typedef enum {
+	IRO_NONE, IRO_VREG, IRO_IMM
+} IrOperandKind;
+
+//A source operand: either a vreg or an immediate
+typedef struct {
+	IrOperandKind kind;
+	int val; //vreg number or the immediate itself
+} IrOperand;
+
+typedef enum {
+	VAR_GLOBAL, VAR_PARAM, VAR_LOCAL
+} IrVarKind;
+
+typedef struct IrVar {
+	char *name;
+	IrVarKind kind;
+	int type; //INTTOK or CHARTOK (element type, for arrays)
+	int dimension; //-1 if not an array, 0 for array params
+	int size; //Bytes it takes up in memory
+	int offset; //From $gp for globals, from $sp on entry (set when lowering) otherwise
+	int paramIndex; //Which $a register a param arrives in
+	int id; //Position among its function's vars (or among globals)
+	int reg; //Register a scalar param/local is kept in (see regalloc.c), or -1
+	int scope; //Locals: id of the block declaring it...
+	int scopeEnd; //...and the last id of a block nested inside that one
+	int slotGroup; //Params/locals in the same one (if not -1) can share a frame slot
+	int isPointer; //Holds an address rather than an int (LDVAR gives a VT_ADDR vreg)
+	struct IrVar *next;
+} IrVar;
+
+struct IrBlock;
+struct IrFunction;
+
+typedef struct IrInstr {
+	IrOpcode op;
+	int dest; //vreg, or -1 if nothing is written
+	IrOperand src1;
+	IrOperand src2;
+
+	IrOpcode cond; //IR_CBR: comparison (IR_SEQ...IR_SGE) between src1 and src2
+	int width; //IR_LOAD/IR_STORE: 1 or 4 bytes
+	int offset; //IR_LOAD/IR_STORE: constant added to the address in src1
+	IrVar *var; //IR_LDVAR/IR_STVAR/IR_ADDR
+	struct IrFunction *callee; //IR_CALL
+	int numArgs; //IR_CALL
+	IrOperand *args;
+	int isTailCall; //IR_CALL: the ret right after it returns its result (see tailcall.c)
+	struct IrBlock *target[2]; //IR_JUMP (target[0]) and IR_CBR (true, false)
+
+	int mark; //Scratch space for passes
+	struct IrBlock *block;
+	struct IrInstr *prev;
+	struct IrInstr *next;
+} IrInstr;
+
+typedef struct IrBlock {
+	int id;
+	IrInstr *first;
+	IrInstr *last;
+
+	//Worked out from the terminator by ir_rebuild_cfg()
+	struct IrBlock *succs[2];
+	int numSuccs;
+	struct IrBlock **preds;
+	int numPreds;
+	int predCapacity;
+
+	int mark; //Scratch space for passes
+	struct IrFunction *func;
+	struct IrBlock *prev; //Layout order (the order blocks are written out in)
+	struct IrBlock *next;
+} IrBlock;
+
+typedef struct IrFunction {
+	char *name;
+	int returnType;
+
+	IrVar *params; //In order, so params[i] arrives in $a_i
+	int numParams;
+	IrVar *locals;
+	int numVars;
+
+	IrBlock *entry; //Always the first block in layout order
+	IrBlock *lastBlock;
+	int numBlocks; //Used to hand out block ids
+	int numScopes; //Used to hand out (source-level) block scope ids
+
+	int numVregs;
+	int vregCapacity;
+	VregType *vregTypes;
+
+	int clobberedRegs; //Once lowered: bit i set if it (or anything it calls) writes $t_i, else -1
+
+	int mark; //Scratch space for passes
+	struct IrProgram *prog;
+	struct IrFunction *next;
+} IrFunction;
+
+typedef struct IrProgram {
+	IrVar *globals;
+	int numGlobals;
+	IrFunction *functions; //In the order they were declared
+	IrFunction *lastFunction;
+	Arena arena; //Everything above (except vregTypes) is allocated here
+} IrProgram;
+
+//Most operands an instruction can read (src1, src2 and 4 call args)
+#define IR_MAX_USES 6
+//Most args a call can have (there are only 4 $a registers)
+#define IR_MAX_ARGS 4
+
+/** Building the IR (ir.c) **/
+extern IrProgram *create_ir_program();
+extern void destroy_ir_program(IrProgram *prog);
+
+extern IrVar *ir_add_global(IrProgram *prog, char *name, int type, int dimension, int offset);
+extern IrFunction *ir_add_function(IrProgram *prog, char *name, int returnType);
+extern IrVar *ir_add_param(IrFunction *func, char *name, int type, int dimension);
+extern IrVar *ir_add_local(IrFunction *func, char *name, int type, int dimension);
+extern IrBlock *ir_new_block(IrFunction *func); //Added at the end of the layout
+extern int ir_new_vreg(IrFunction *func, VregType type);
+
+extern IrOperand ir_vreg(int vreg);
+extern IrOperand ir_imm(int immed);
+extern IrOperand ir_none();
+
+//A fresh instruction that isn't in any block yet
+extern IrInstr *ir_new_instr(IrFunction *func, IrOpcode op);
+extern void ir_append(IrBlock *block, IrInstr *instr);
+extern void ir_insert_before(IrInstr *pos, IrInstr *instr);
+extern void ir_remove(IrInstr *instr); //Unlinks it (memory stays in the arena)
+
+//Handy emitters - each returns the dest vreg (or nothing)
+extern int ir_emit_binary(IrBlock *block, IrOpcode op, IrOperand src1, IrOperand src2);
+extern int ir_emit_unary(IrBlock *block, IrOpcode op, IrOperand src1);
+extern int ir_emit_ldvar(IrBlock *block, IrVar *var);
+extern void ir_emit_stvar(IrBlock *block, IrVar *var, IrOperand src1);
+extern int ir_emit_addr(IrBlock *block, IrVar *var);
+extern int ir_emit_load(IrBlock *block, int width, IrOperand addr, int offset);
+extern void ir_emit_store(IrBlock *block, int width, IrOperand addr, int offset, IrOperand src);
+extern int ir_emit_call(IrBlock *block, struct IrFunction *callee, IrOperand *args, int numArgs);
+extern int ir_emit_read(IrBlock *block);
+extern void ir_emit_write(IrBlock *block, IrOperand src1);
+extern void ir_emit_writeln(IrBlock *block);
+
+//Terminators (these don't touch the CFG edges - see ir_rebuild_cfg)
+extern void ir_emit_jump(IrBlock *block, IrBlock *target);
+extern void ir_emit_cbr(IrBlock *block, IrOpcode cond, IrOperand src1, IrOperand src2,
+	IrBlock *ifTrue, IrBlock *ifFalse);
+extern void ir_emit_ret(IrBlock *block, IrOperand src1);
+
+//Recomputes every block's succs/preds from its terminator
+extern void ir_rebuild_cfg(IrFunction *func);
+//Unlinks a block from the layout (its instructions go with it)
+extern void ir_remove_block(IrBlock *block);
+//Moves block to come right after pos in the layout
+extern void ir_move_block_after(IrBlock *block, IrBlock *pos);
+
+//Questions passes keep asking about instructions
+extern int ir_is_terminator(IrOpcode op);
+extern int ir_has_dest(IrOpcode op);
+extern int ir_has_side_effects(IrInstr *instr);
+extern int ir_get_uses(IrInstr *instr, IrOperand **uses); //Fills uses[IR_MAX_USES]
+extern int ir_var_width(IrVar *var); //Bytes moved by LDVAR/STVAR of var
+extern IrOpcode ir_invert_cond(IrOpcode cond); //e.g. IR_SLT -> IR_SGE
+extern IrOpcode ir_swap_cond(IrOpcode cond); //e.g. IR_SLT -> IR_SGT (operands swapped)
+
+/** Printing (irprint.c) **/
+extern const char *ir_opcode_name(IrOpcode op);
+extern void print_ir_instr(FILE *out, IrInstr *instr);
+extern void print_ir_function(FILE *out, IrFunction *func);
+extern void print_ir_program(FILE *out, IrProgram *prog);
+
+/** Sanity checks (irverify.c). Exits with a message if something's off **/
+extern void verify_ir_function(IrFunction *func, const char *when);
+extern void verify_ir_program(IrProgram *prog, const char *when);
+
+#endif
@@ -0,0 +1,18 @@
+/*
+	Header file for irtotable.c!
+
+	Turns the (optimised) IR into MIPS instructions in the code
+	table - this is the last step before the table is written out.
+
+	@author Noor Aftab
+*/
+
+#ifndef _IRTOTABLE_H
+#define _IRTOTABLE_H
+
+#include "ir.h"
+
+//Sets up the code table and fills it with every function in prog
+extern void lower_ir_to_table(IrProgram *prog);
+
+#endif
@@ -0,0 +1,48 @@
+/*
+	Header file for loops.c!
+
+	Finds the loops of a function for the passes that work on them.
+	Dominators are worked out over the CFG, every edge to a block
+	that dominates where it comes from is a back edge, and the
+	blocks that can reach the back edge without going through its
+	target (the header) make up the loop.
+
+	Every loop found gets a preheader: a block that jumps straight
+	to the header and that every way into the loop from outside
+	goes through, so there's one place for code that has to run
+	just before the loop starts.
+
+	@author Noor Aftab
+*/
+
+#ifndef _LOOPS_H
+#define _LOOPS_H
+
+#include "ir.h"
+
+typedef struct IrLoop {
+	IrBlock *header;
+	IrBlock *preheader;
+	char *contains; //By block id: 1 if the block is in the loop
+	IrBlock **blocks; //In layout order (header included)
+	int numBlocks;
+	int depth; //1 for a loop that isn't inside another one
+	struct IrLoop *parent; //The innermost loop this one is inside, or NULL
+	struct IrLoop *next;
+} IrLoop;
+
+typedef struct {
+	IrFunction *func;
+	int *idom; //By block id: immediate dominator's id (the entry's own), -1 if unreachable
+	IrLoop *loops; //Inner loops come before the ones they're inside
+	int numLoops;
+} LoopInfo;
+
+//Adds (and links into the CFG) whatever preheaders are missing
+extern LoopInfo *find_loops(IrFunction *func);
+//Just the dominators - no loops, and the CFG is left as it is
+extern LoopInfo *find_dominators(IrFunction *func);
+extern void free_loop_info(LoopInfo *info);
+extern int block_dominates(LoopInfo *info, IrBlock *a, IrBlock *b);
+
+#endif
@@ -0,0 +1,69 @@
+/*
+	Header file for passmanager.c!
+
+	Every optimisation pass over the IR is registered in the table
+	in passmanager.c, and run (in that order) by run_ir_passes().
+	Passes can be switched on/off one at a time from the command 
+	line with -f<pass> / -fno-<pass>, and -O0 turns them all off.
+
+	@author Noor Aftab
+*/
+
+#ifndef _PASSMANAGER_H
+#define _PASSMANAGER_H
+
+#include "ir.h"
+#include "tablemechanics.h"
+
+typedef struct {
+	char *name; //What -f<name>/-fno-<name> refer to it by
+	char *description;
+	//At most one of these is set - none for a pass that only changes how the IR is lowered
+	//(irtotable.c checks pass_enabled())
+	void (*runOnFunction)(IrFunction *func);
+	void (*runOnProgram)(IrProgram *prog);
+	void (*runOnCode)(CodeTable *table); //Runs after lowering, on the MIPS
+	int setting; //-1 = decided by -O level, 0 = off, 1 = on
+} IrPass;
+
+//0 runs no passes (unless turned on with -f<pass>), 1 (the default) runs them all
+extern int optLevel;
+//-stats: passes report what they did (to stderr)
+extern int printStats;
+//Size limits for unroll.c (-unroll-count=N, -unroll-max-size=N, -unroll-full-max=N)
+extern int unrollCount;
+extern int unrollMaxSize;
+extern int unrollFullMax;
+//-noreorder: the output fills its own delay slots (scheduler.c)
+extern int noReorder;
+
+//Handles -O0/-O1, -f<pass>, -fno-<pass>, -print-ir, -print-ir-all, -verify-ir, -stats,
+//-unroll-*, -noreorder
+//@return 1 if arg was one of these (0 means the caller should deal with it)
+extern int handle_pass_option(char *arg);
+extern void print_pass_options(); //For the usage message
+extern int pass_enabled(char *name);
+
+extern void run_ir_passes(IrProgram *prog);
+extern void run_code_passes(CodeTable *table); //The ones with runOnCode set
+
+/** The passes themselves **/
+extern void inline_functions(IrProgram *prog); //inliner.c
+extern void simplify_cfg(IrFunction *func); //simplifycfg.c
+extern void eliminate_tail_calls(IrProgram *prog); //tailcall.c
+extern void constant_propagation(IrProgram *prog); //constprop.c
+extern void unroll_loops(IrProgram *prog); //unroll.c
+extern void reduce_induction_variables(IrProgram *prog); //ivreduce.c
+extern void eliminate_common_subexpressions(IrProgram *prog); //cse.c
+extern void loop_invariant_code_motion(IrProgram *prog); //licm.c
+extern void eliminate_redundant_loads_stores(IrProgram *prog); //loadstore.c
+extern void eliminate_dead_code(IrProgram *prog); //dce.c
+extern void remove_unreachable_functions(IrProgram *prog); //deadfuncs.c
+extern void choose_calling_conventions(IrProgram *prog); //callconv.c
+extern void allocate_registers(IrProgram *prog); //regalloc.c (has to run last...)
+extern void share_stack_slots(IrProgram *prog); //stackslots.c (...but for this one)
+extern void peephole_optimize(CodeTable *table); //peephole.c
+extern void schedule_code(CodeTable *table); //scheduler.c
+extern void pad_delay_slots(CodeTable *table); //scheduler.c (-noreorder without the scheduler)
+
+#endif
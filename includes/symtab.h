@@ -3,6 +3,7 @@
 #define _SYMTAB_H
 
 #include "traversaltotable.h"
+#include "ir.h"
 
 //Structure for a single symbol table entry
 typedef struct {
@@ -11,12 +12,14 @@ typedef struct {
 
 	int scope; //Globals - 0
 	int dimension; //For arrays only
-	int offset; //From $fp
+	int offset; //From $gp (globals only)
 	int isInit;
+	IrVar *var; //Where it lives in the IR
 
 	//Only for functions
 	int isFunction;
 	int numParams;
+	IrFunction *func;
 } SymTabEntry;
 
 //Structure for a single symbol table (for a given scope)
@@ -39,7 +42,7 @@ void push_symtab(); //Entering a scope
 void pop_symtab(); //Leaving a scope
 
 //Insert a variable's info. into symbol table @ top of stack
-void insert_var_symtab_entry(char *name, int scope, int type, 
+SymTabEntry *insert_var_symtab_entry(char *name, int scope, int type, 
 	int dimension, int offset, int isInit); 
 //Insert a function's!
 SymTabEntry *insert_func_symtab_entry(char *name, int returnType);
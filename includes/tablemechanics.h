@@ -15,53 +15,84 @@
 
 //Has access to everything in codegen
 //#include "traversaltotable.h"
+#include "arena.h"
 
 //Size of a register, in bytes
 #define REGISTER_SIZE 4
 
+//Longest register name ($zero)
+#define MAX_REG_NAME_LEN 5
+
+//What an instruction operand holds
+typedef enum {
+	OPND_NONE=0, //Operand slot isn't used
+	OPND_REG, //A register, e.g. $t0
+	OPND_IMM, //An immediate, e.g. -48
+	OPND_MEM, //An offset from a register, e.g. 4($sp)
+	OPND_SYM //A label/function/data name, e.g. .L3 or _newline_
+} OperandKind;
+
+/*
+	Operands are kept typed (not as strings) so nothing has to be
+	formatted until the table is written out, and so later passes 
+	can look at registers/offsets without parsing text.
+*/
+typedef struct {
+	OperandKind kind;
+	int reg; //OPND_REG, or the base register of OPND_MEM
+	union {
+		int immed; //OPND_IMM, or the offset of OPND_MEM
+		const char *sym; //OPND_SYM
+	} val;
+} Operand;
+
 //A MIPS instruction has at most 4 "things" 
 typedef struct {
 	char *command; //Can hold command or label/address
-	char *op1; //R_D
-	char *op2;	//R_S
-	char *op3;	//R_T
+	Operand op1; //R_D
+	Operand op2; //R_S
+	Operand op3; //R_T
 } Instruction;
 
+/*
+	Instructions are stored inline (not as pointers) and the array
+	grows geometrically, so adding one is amortized O(1). Operand
+	strings and label holders live in the arena, so the whole table
+	is thrown away in one go by destroy_code_table().
+*/
 typedef struct {
 	int numInstructions;
-	Instruction **instrSet;
+	int capacity;
+	Instruction *instrSet;
+	Arena arena;
 } CodeTable;
 
+//Starting capacity of the instruction array
+#define INITIAL_TABLE_CAPACITY 1024
+
 /** Static variables/functions that only codetable.c needs to know about **/
 
 //The actual, glorious code table
 extern CodeTable *codeTable;
 
-//Keeps track of params and locals during a block
-extern int paramOffset;
-extern int localsOffset;
-
-//Helper variables to store labels for if-else statements/while loops
-extern Instruction *ifelseLabelHolder;
-extern Instruction *whileLabelHolder;
-extern Instruction *whileDoneLabelHolder;
 extern int numUniqueLabels; //Useful for generating unique labels
 
-extern void init_table_and_loop_stack();
+extern void init_code_table();
 extern Instruction *init_Instruction_struct();
-extern void allocate_param_to_stack(int size);
-extern void allocate_at_stack_top(int size);
 extern void load_addr_instr(int dest_reg, char *addr);
-extern char *generate_store_and_load_addr(int addr_offset, int src_reg2);
+
+//Operand makers
+extern Operand reg_operand(int reg);
+extern Operand immed_operand(int immed);
+extern Operand mem_operand(int addr_offset, int base_reg); //e.g. 4($sp)
+extern Operand sym_operand(const char *sym);
 
 //Label-making helper functions
-extern Instruction *generate_while_label(); 
-extern Instruction *generate_while_done_label();
-extern Instruction *generate_else_label();
-extern Instruction *generate_ifelse_done_label();
 extern Instruction *generate_unique_label();
 extern Instruction *generate_given_label(char *label);
 extern char* get_address_from_label(Instruction *label);
+//Copies a string into the code table's arena
+extern char *table_strdup(const char *str);
 
 extern void jump(Instruction *label);
 extern void jump_to_register(int reg);
@@ -69,24 +100,14 @@ extern void jump_to_register(int reg);
 extern void branch(Instruction *label); //If-else, while, logical OR/AND
 extern void bnezInstr(int src_reg1, Instruction *label); //Logical OR
 extern void beqzInstr(int src_reg1, Instruction *label); //Logical AND, if-else
+extern void zero_branch_instr(char *command, int src_reg1, Instruction *label); //bltz, bgez...
+extern void compare_branch_instr(char *command, int src_reg1, Operand src2, Instruction *label); //beq, blt...
 extern void syscall_instr(); //write, writeln, read
-//Cuts down on code repetition
-extern Instruction *setup_3op_instr(char *command, char *dest_reg, char *src_reg1, char *src_reg2);
-extern Instruction *setup_2op_instr(char *command, char *dest_reg, char *src_reg1);
+//Cuts down on code repetition (instructions are built on the stack, then copied in)
+extern Instruction setup_3op_instr(char *command, Operand dest, Operand src1, Operand src2);
+extern Instruction setup_2op_instr(char *command, Operand dest, Operand src1);
 //Converts register enums to strings for MIPS code
 extern char *getRegStr(int reg);
 extern void add_instr_to_code_table(Instruction *instr);
 
-/** Support for nested while-loops **/
-typedef struct {
-	int numLoops;
-	Instruction **startLabelStack;
-	Instruction **doneLabelStack;
-} WhileLabelStack;
-
-extern WhileLabelStack *whileLabelStack;
-extern void push_start_of_while_loop();
-extern void push_end_of_while_loop();
-
 #endif
-
@@ -1,6 +1,7 @@
 /*
 	This header file declares enums and functions called/defined 
-	in both codegen.c and codetable.c
+	in both codegen.c and codetable.c (irtotable.c lowers the IR
+	with these)
 
 	@author Noor Aftab
 	@date Friday, 24th April 2020
@@ -27,67 +28,45 @@ typedef enum {
 } parameterRegister;
 
 typedef enum {
-	T0=512, T1, T2, T3, T4, T5, T6, T7
+	T0=512, T1, T2, T3, T4, T5, T6, T7, T8, T9
 } tempRegister;
 
 typedef enum {
-	SP=520, FP, GP, RA, V0, V1
+	SP=522, FP, GP, RA, V0, V1, ZERO
 } otherImptRegisters;
 
-FILE *inFile;
-FILE *outFile;
-
-//$sp's total offset as program executes
-extern int stackCurrOffset;
+//Defined in main.c - handy for closing files on errors
+extern FILE *inFile;
+extern FILE *outFile;
 
 /** Functions codegen.c expects to have for "tracing out" MIPS code **/
 
 extern void setup_mips_code();
 
 //Functions for function entering/exiting
-extern void generate_function_precall();
+//Save/restore regs (only what's live across the call) around a jal
+extern void generate_function_precall(int *regs, int numRegs);
 extern void jal_to_function(char *name);
-extern void generate_function_prologue();
-extern void generate_function_epilogue();
-extern void generate_function_postcall();
+extern void jump_to_function(char *name); //Tail call: the callee returns to our caller
+extern void generate_function_postcall(int *regs, int numRegs);
 extern void generate_function_label(char *name);
 
-//Allocating space on stack for params
-extern void allocate_space_for_params(int paramType, int paramReg, int offset, int dimension);
-extern void pad_params(); 
-//Allocating space on stack for locals
-extern void allocate_space_for_locals(int type, int dimension, int arrOffset);
-extern void pad_locals();
-
 extern void assign_global(int src_reg, int type, int offset);
-extern void assign_local(int src_reg, int type, int offset);
+extern void assign_local(int src_reg, int type, int offset, int frame_reg);
 extern void load_global(int dest_reg, int type, int offset, int isInit);
-extern void load_local(int dest_reg, int type, int offset, int isInit);
+extern void load_local(int dest_reg, int type, int offset, int frame_reg, int isInit);
 
 extern void move_registers(int dest_reg, int src_reg1);
-
-//For saving t_i registers 
-extern void store_reg_on_stack(int src_reg1);
-extern void load_reg_from_stack(int src_reg1);
+//What a char variable holds once src_reg1 is stored in it (like sb then lb)
+extern void sign_extend_byte(int dest_reg, int src_reg1);
 
 //Helpful for changing $sp when exiting a block (and in general)
 extern void add_immed_instr(int dest_reg, int src_reg1, int immed);
+extern void add_immed_op_instr(char *command, int dest_reg, int src_reg1, int immed); //slti, sll...
 
-extern void execute_return();
 extern void add_read_instr(int src_reg1);
 extern void add_newline_instr(); //writeln
 extern void add_write_instr(int src_reg1); //write
-extern void add_break_instr();
-
-//If-else statements
-extern void add_instr_for_if(int src_reg1);
-extern void add_instr_for_else();
-extern void add_instr_for_cond_finish();
-
-//While loops
-extern void add_instr_for_while();
-extern void add_instr_for_while_middle(int src_reg1);
-extern void add_instr_for_while_end();
 
 //Expressions!
 extern void add_instr_for_or(int dest_reg, int src_reg1, int src_reg2);
@@ -102,6 +81,9 @@ extern void add_instr_for_addition(int dest_reg, int src_reg1, int src_reg2);
 extern void add_instr_for_sub(int dest_reg, int src_reg1, int src_reg2);
 extern void add_instr_for_mult(int dest_reg, int src_reg1, int src_reg2);
 extern void add_instr_for_div(int dest_reg, int src_reg1, int src_reg2);
+//Shift/add (or magic number) versions - return 0 if k isn't worth it
+extern int add_instr_for_mult_by_const(int dest_reg, int src_reg1, int k, int scratch_reg);
+extern int add_instr_for_div_by_const(int dest_reg, int src_reg1, int k, int scratch_reg);
 extern void add_instr_for_neg(int dest_reg, int src_reg1);
 extern void add_instr_for_unarysub(int dest_reg, int src_reg1);
 
@@ -115,7 +97,7 @@ extern void load_byte_instr(int dest_reg, int addr_offset, int src_reg1);
 /** End of "tracing out" functions **/
 
 //Prints code table to given .s file
-extern void output_code_table_to_file(FILE *out);
+extern size_t output_code_table_to_file(FILE *out); //Returns # of bytes written
 //Frees up heap memory used by table
 extern void destroy_code_table();
 
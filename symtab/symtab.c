@@ -50,7 +50,7 @@ SymTabEntry *symtab_lookup(char *name) {
 }
 
 //Insert a variable to the SymTab at the top of the stack
-void insert_var_symtab_entry(char *name, int scope, int type, 
+SymTabEntry *insert_var_symtab_entry(char *name, int scope, int type, 
 	int dimension, int offset, int isInit) {
 	check_duplicate_entry(name);
 	SymTabEntry *entry = malloc(sizeof(SymTabEntry));
@@ -64,6 +64,7 @@ void insert_var_symtab_entry(char *name, int scope, int type,
 	entry->isFunction = 0; 
 
 	add_symtab_entry_to_symtab(entry);
+	return entry;
 }
 
 //Insert a function to the SymTab at top of the stack
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include "traversaltotable.h"
 #include "traversalmechanics.h"
+#include "codetraversal.h"
 #include "parser.h"
 #include "symtab.h"
 #include "ast.h"
@@ -15,7 +16,7 @@ void symtab_error(char *err_message, FILE *in, FILE *out) {
   destroy_code_table();
   destroy_ast(&ast_tree);
   destroy_symtab_stack();
-  destroy_offset_stack();
+  destroy_ir_program(irProgram);
 
   fclose(in);
   fclose(out);